@@ -24,9 +24,33 @@
 #include "./nmt/Config.h"
 #include "./nmt/train/Trainer.h"
 #include "./nmt/translate/Translator.h"
+#include "./nmt/service/Metrics.h"
+#include "./nmt/service/ShmServer.h"
+#include "./nmt/service/ModelPool.h"
+#include "./nmt/service/ModelReloader.h"
 
 using namespace nmt;
 
+/*
+dump the model to a file of the mapped format, with the vocabularies if they are given
+>> config - the configuration
+>> model - the model
+*/
+static void DumpModel(NMTConfig& config, NMTModel& model)
+{
+    /* make a bundle with the vocabularies */
+    if (strcmp(config.common.srcVocabFN, "") != 0 && strcmp(config.common.tgtVocabFN, "") != 0) {
+        Vocab srcVocab;
+        Vocab tgtVocab;
+        srcVocab.Load(config.common.srcVocabFN);
+        tgtVocab.Load(config.common.tgtVocabFN);
+        model.DumpToMappedFile(config.common.dumpModelFN, &srcVocab, &tgtVocab);
+    }
+    else {
+        model.DumpToMappedFile(config.common.dumpModelFN);
+    }
+}
+
 int main(int argc, const char** argv)
 {
     std::ios_base::sync_with_stdio(false);
@@ -51,6 +75,59 @@ int main(int argc, const char** argv)
         trainer.Run();
     }
 
+    /* pruning the attention heads with the scores on a development set */
+    else if (config.common.pruneHeads > 0 && strcmp(config.common.dumpModelFN, "") != 0) {
+
+        /* disable gradient flow */
+        DISABLE_GRAD;
+
+        CheckNTErrors(strcmp(config.translation.inputFN, "") != 0,
+                      "A development set (-input) is required to prune the heads");
+
+        /* the heads are scored and saved with the original weights */
+        config.common.cpuFP16 = false;
+        config.common.int8Emb = false;
+        config.common.useFP16 = false;
+
+        /* every sentence of the development set is decoded by the model,
+           so nothing is taken from the caches */
+        config.translation.cacheSize = 0;
+        config.translation.tmFN[0] = '\0';
+        config.translation.encCacheSize = 0;
+        config.translation.prefixCacheSize = 0;
+
+        NMTModel model;
+        model.InitModel(config);
+
+        Translator translator;
+        translator.Init(config, model);
+
+        model.SetHeadScoring(true);
+        translator.Translate();
+        model.PruneHeads(config.common.pruneHeads);
+
+        DumpModel(config, model);
+    }
+
+    /* factorizing the weights with the truncated SVD */
+    else if ((config.common.factorFFN || config.common.factorOutput) && strcmp(config.common.dumpModelFN, "") != 0) {
+
+        /* disable gradient flow */
+        DISABLE_GRAD;
+
+        /* the weights are factorized and saved in FP32 */
+        config.common.cpuFP16 = false;
+        config.common.int8Emb = false;
+        config.common.packWeight = false;
+
+        NMTModel model;
+        model.InitModel(config);
+        model.Factorize(config.common.factorFFN, config.common.factorOutput,
+                        config.common.factorRank, config.common.factorEnergy);
+
+        DumpModel(config, model);
+    }
+
     /* translation */
     else if (strcmp(config.translation.inputFN, "") != 0) {
 
@@ -62,7 +139,80 @@ int main(int argc, const char** argv)
 
         Translator translator;
         translator.Init(config, model);
+
+        MetricsExporter metrics;
+        metrics.Init(config, translator);
+        metrics.Start();
+
         translator.Translate();
+
+        metrics.Stop();
+    }
+
+    /* serving the models of a pool through the shared memory */
+    else if (strcmp(config.service.shmName, "") != 0 && strcmp(config.service.modelMapFN, "") != 0) {
+
+        /* disable gradient flow */
+        DISABLE_GRAD;
+
+        /* the models are loaded when they are first requested */
+        ModelPool pool;
+        pool.Init(argc, argv);
+
+        ShmServer server;
+        if (server.Init(config, pool))
+            server.Serve();
+    }
+
+    /* serving the client processes through the shared memory */
+    else if (strcmp(config.service.shmName, "") != 0) {
+
+        /* disable gradient flow */
+        DISABLE_GRAD;
+
+        /* the model is replaced by the reloader on SIGHUP */
+        ModelInstance instance;
+        if (!instance.Load(vector<string>(argv, argv + argc)))
+            return 1;
+
+        BatchScheduler scheduler;
+        scheduler.Init(*instance.config, *instance.translator);
+        scheduler.Start();
+
+        ModelReloader reloader;
+        reloader.Init(argc, argv, scheduler, &instance);
+        reloader.Start();
+
+        /* the scheduler switches the translator and its configuration on
+           reloading, while the exporter and the server read only the service
+           options of the first configuration (which is kept by Unload()) */
+        MetricsExporter metrics;
+        metrics.Init(*instance.config, *instance.translator, &scheduler);
+        metrics.Start();
+
+        ShmServer server;
+        if (server.Init(*instance.config, scheduler))
+            server.Serve();
+
+        metrics.Stop();
+        reloader.Stop();
+        scheduler.Stop();
+    }
+
+    /* converting the model to the mapped format */
+    else if (strcmp(config.common.dumpModelFN, "") != 0) {
+
+        /* disable gradient flow */
+        DISABLE_GRAD;
+
+        /* the weights are saved in their original data type */
+        config.common.cpuFP16 = false;
+        config.common.int8Emb = false;
+
+        NMTModel model;
+        model.InitModel(config);
+
+        DumpModel(config, model);
     }
 
     else {
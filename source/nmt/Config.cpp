@@ -19,6 +19,7 @@
  * $Created by: HU Chi (huchinlp@gmail.com) 2021-06
  */
 
+#include <cctype>
 #include <fstream>
 #include "Config.h"
 
@@ -59,6 +60,12 @@ NMTConfig::NMTConfig(int argc, const char** argv)
     common.Load(argsNum, (const char **)args);
     training.Load(argsNum, (const char **)args);
     translation.Load(argsNum, (const char **)args);
+    service.Load(argsNum, (const char **)args);
+
+    for (int i = 0; i < argsNum; i++) {
+        if (args[i] != NULL && args[i][0] == '-' && isalpha((unsigned char)args[i][1]))
+            optionNames.push_back(args[i] + 1);
+    }
 
     for (int i = 0; i < MAX(argc, argsNum); i++)
         delete[] args[i];
@@ -99,6 +106,88 @@ int NMTConfig::LoadFromFile(const char* configFN, char** args)
     return argsNum;
 }
 
+/*
+check whether an option is given. The name must be one of the options
+loaded by the configurations, so a misspelled name fails here rather
+than being never set.
+>> name - name of the option (without "-")
+<< return - whether the option is in the command or the config file
+*/
+bool NMTConfig::IsSet(const char* name)
+{
+    CheckNTErrors(model.IsLoaded(name) || common.IsLoaded(name) || training.IsLoaded(name) ||
+                  translation.IsLoaded(name) || service.IsLoaded(name),
+                  "Unknown option");
+
+    for (size_t i = 0; i < optionNames.size(); i++) {
+        if (optionNames[i] == name)
+            return true;
+    }
+    return false;
+}
+
+/*
+load a string option and record its name
+>> name - name of the option
+>> p - the value (for return)
+>> defaultP - the default value
+*/
+void OptionConfig::LoadString(const char* name, char* p, const char* defaultP)
+{
+    loadedNames.push_back(name);
+    XConfig::LoadString(name, p, defaultP);
+}
+
+/*
+load an integer option and record its name
+>> name - name of the option
+>> p - the value (for return)
+>> defaultP - the default value
+*/
+void OptionConfig::LoadInt(const char* name, int* p, int defaultP)
+{
+    loadedNames.push_back(name);
+    XConfig::LoadInt(name, p, defaultP);
+}
+
+/*
+load a boolean option and record its name
+>> name - name of the option
+>> p - the value (for return)
+>> defaultP - the default value
+*/
+void OptionConfig::LoadBool(const char* name, bool* p, bool defaultP)
+{
+    loadedNames.push_back(name);
+    XConfig::LoadBool(name, p, defaultP);
+}
+
+/*
+load a float option and record its name
+>> name - name of the option
+>> p - the value (for return)
+>> defaultP - the default value
+*/
+void OptionConfig::LoadFloat(const char* name, float* p, float defaultP)
+{
+    loadedNames.push_back(name);
+    XConfig::LoadFloat(name, p, defaultP);
+}
+
+/*
+check whether an option is loaded by the configuration
+>> name - name of the option (without "-")
+<< return - whether a Load*() call is made with the name
+*/
+bool OptionConfig::IsLoaded(const char* name)
+{
+    for (size_t i = 0; i < loadedNames.size(); i++) {
+        if (loadedNames[i] == name)
+            return true;
+    }
+    return false;
+}
+
 /* load model configuration from the command */
 void ModelConfig::Load(int argsNum, const char** args)
 {
@@ -179,10 +268,38 @@ void TranslationConfig::Load(int argsNum, const char** args)
     LoadString("output", outputFN, "");
     LoadInt("beam", &beamSize, 1);
     LoadInt("maxlen", &maxLen, 200);
+    LoadInt("batchmem", &batchMem, 0);
+    LoadInt("cachesize", &cacheSize, 0);
+    LoadString("tm", tmFN, "");
+    LoadInt("tmslots", &tmSlotNum, 1 << 20);
+    LoadInt("tmsize", &tmSize, 256);
+    LoadInt("enccachesize", &encCacheSize, 0);
+    LoadString("enccachedir", encCacheDir, "");
+    LoadInt("prefixcachesize", &prefixCacheSize, 0);
+    LoadBool("bpejoin", &bpeJoin, false);
+    LoadBool("prefix", &usePrefix, false);
     LoadFloat("lenalpha", &lenAlpha, 0.6F);
     LoadFloat("maxlenalpha", &maxLenAlpha, 1.25F);
 }
 
+/* load service configuration from the command */
+void ServiceConfig::Load(int argsNum, const char** args)
+{
+    Create(argsNum, args);
+    LoadInt("groupsize", &groupSize, 128);
+    LoadInt("maxqueue", &maxQueue, 0);
+    LoadFloat("maxwait", &maxWait, 5.0F);
+    LoadFloat("latencytarget", &latencyTarget, 0.0F);
+    LoadBool("warmup", &warmup, false);
+    LoadString("metrics", metricsFN, "");
+    LoadFloat("metricsinterval", &metricsInterval, 10.0F);
+    LoadString("modelmap", modelMapFN, "");
+    LoadInt("poolsize", &poolSize, 0);
+    LoadString("shm", shmName, "");
+    LoadInt("shmclients", &shmClients, 4);
+    LoadInt("shmslots", &shmSlots, 256);
+}
+
 /* load training configuration from the command */
 void CommonConfig::Load(int argsNum, const char** args)
 {
@@ -198,6 +315,17 @@ void CommonConfig::Load(int argsNum, const char** args)
     LoadInt("bucketsize", &bucketSize, wBatchSize);
     LoadInt("loginterval", &logInterval, 100);
     LoadBool("fp16", &useFP16, false);
+    LoadBool("checkmodel", &checkModel, false);
+    LoadString("dumpmodel", dumpModelFN, "");
+    LoadInt("loadthreads", &loadThreads, 0);
+    LoadBool("packweight", &packWeight, false);
+    LoadBool("cpufp16", &cpuFP16, false);
+    LoadBool("int8emb", &int8Emb, false);
+    LoadFloat("pruneheads", &pruneHeads, 0.0F);
+    LoadBool("factorffn", &factorFFN, false);
+    LoadBool("factoroutput", &factorOutput, false);
+    LoadInt("factorrank", &factorRank, 0);
+    LoadFloat("factorenergy", &factorEnergy, 0.9F);
 }
 
 /* 
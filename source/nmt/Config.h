@@ -40,8 +40,32 @@ namespace nmt
 
 #define MAX_PATH_LEN 1024
 
+/* the base of the configurations, which records the names of the loaded options */
+class OptionConfig : public XConfig
+{
+public:
+    /* names of the options loaded by the configuration */
+    vector<string> loadedNames;
+
+public:
+    /* load a string option */
+    void LoadString(const char* name, char* p, const char* defaultP);
+
+    /* load an integer option */
+    void LoadInt(const char* name, int* p, int defaultP);
+
+    /* load a boolean option */
+    void LoadBool(const char* name, bool* p, bool defaultP);
+
+    /* load a float option */
+    void LoadFloat(const char* name, float* p, float defaultP);
+
+    /* check whether an option is loaded by the configuration */
+    bool IsLoaded(const char* name);
+};
+
 /* training configuration */
-class TrainingConfig : public XConfig
+class TrainingConfig : public OptionConfig
 {
 public:
     /* path to the training file */
@@ -106,7 +130,7 @@ public:
 };
 
 /* translation configuration */
-class TranslationConfig : public XConfig 
+class TranslationConfig : public OptionConfig
 {
 public:
     /* path to the input file (for inference) */
@@ -127,13 +151,88 @@ public:
     /* max length of the generated sequence */
     int maxLen;
 
+    /* the maximum number of entries in the translation cache (0 disables it) */
+    int cacheSize;
+
+    /* the memory budget of a batch (in MB, 0 for the token budget) */
+    int batchMem;
+
+    /* path to the persistent translation memory (empty disables it) */
+    char tmFN[MAX_PATH_LEN];
+
+    /* number of hash slots of a new translation memory */
+    int tmSlotNum;
+
+    /* size of the entry region of a new translation memory (in MB) */
+    int tmSize;
+
+    /* the maximum size of the encoder cache (in MB, 0 disables it) */
+    int encCacheSize;
+
+    /* the directory to spill evicted entries of the encoder cache (empty for no spilling) */
+    char encCacheDir[MAX_PATH_LEN];
+
+    /* the maximum number of sessions in the cache of forced prefixes (0 disables it) */
+    int prefixCacheSize;
+
+    /* indicates whether the BPE separators ("@@ ") are removed from the outputs */
+    bool bpeJoin;
+
+    /* indicates whether an input line may give a forced target prefix after "|||" */
+    bool usePrefix;
+
+public:
+    /* load configuration from the command */
+    void Load(int argsNum, const char** args);
+};
+
+/* configuration of the translation service */
+class ServiceConfig : public OptionConfig
+{
+public:
+    /* the maximum time (in ms) a sentence waits for other requests to fill a batch */
+    float maxWait;
+
+    /* the maximum number of sentences dispatched to the translator at a time */
+    int groupSize;
+
+    /* the maximum number of waiting sentences, new requests are rejected beyond it (0 for no limit) */
+    int maxQueue;
+
+    /* the target of the p99 latency (in ms) to tune the batch size (0 for a fixed batch size) */
+    float latencyTarget;
+
+    /* indicates whether the translator is warmed up with synthetic batches before serving */
+    bool warmup;
+
+    /* path to the file of metrics (in the Prometheus text format, empty disables it) */
+    char metricsFN[MAX_PATH_LEN];
+
+    /* the interval (in seconds) to update the file of metrics */
+    float metricsInterval;
+
+    /* path to the list of models hosted by the model pool (one "id model [srcvocab tgtvocab]" per line) */
+    char modelMapFN[MAX_PATH_LEN];
+
+    /* the memory budget of the model pool (in MB, 0 for no limit) */
+    int poolSize;
+
+    /* name of the shared-memory channels of the clients (empty disables it) */
+    char shmName[MAX_PATH_LEN];
+
+    /* number of the shared-memory channels, i.e., client processes */
+    int shmClients;
+
+    /* number of the slots of each ring of a shared-memory channel */
+    int shmSlots;
+
 public:
     /* load configuration from the command */
     void Load(int argsNum, const char** args);
 };
 
 /* model configuration */
-class ModelConfig : public XConfig 
+class ModelConfig : public OptionConfig
 {
 public:
     /* indicates whether the encoder uses L1-Norm */
@@ -241,7 +340,7 @@ public:
 };
 
 /* common configuration */
-class CommonConfig : public XConfig 
+class CommonConfig : public OptionConfig
 {
 public:
     /* random seed */
@@ -277,6 +376,39 @@ public:
     /* indicates whether the model is running with FP16 data type */
     bool useFP16;
 
+    /* indicates whether the parameters of a mapped model are checked against their checksums */
+    bool checkModel;
+
+    /* path to save the model in the mapped format (empty for no conversion) */
+    char dumpModelFN[MAX_PATH_LEN];
+
+    /* number of threads to load the model (0 for the number of cores, up to 8) */
+    int loadThreads;
+
+    /* indicates whether the output projection is packed at loading for the CPU GEMM */
+    bool packWeight;
+
+    /* indicates whether the weights are stored in FP16 for inference on CPUs */
+    bool cpuFP16;
+
+    /* indicates whether the embedding matrices are stored in int8 for inference on CPUs */
+    bool int8Emb;
+
+    /* the ratio of the attention heads to prune (0 disables it) */
+    float pruneHeads;
+
+    /* indicates whether the FFN weights are factorized with the truncated SVD */
+    bool factorFFN;
+
+    /* indicates whether the output projection is factorized with the truncated SVD */
+    bool factorOutput;
+
+    /* the rank of the factorization (0 to use factorEnergy) */
+    int factorRank;
+
+    /* the ratio of the energy (squared singular values) kept by the factorization */
+    float factorEnergy;
+
 public:
     /* load configuration from the command */
     void Load(int argsNum, const char** args);
@@ -297,12 +429,21 @@ public:
     /* translation configuration */
     TranslationConfig translation;
 
+    /* service configuration */
+    ServiceConfig service;
+
+    /* names of the options given in the command (or the config file) */
+    vector<string> optionNames;
+
 public:
     /* load configuration from the command */
     NMTConfig(int argc, const char** argv);
 
     /* load configuration from a file */
     int LoadFromFile(const char* configFN, char** args);
+
+    /* check whether an option is given */
+    bool IsSet(const char* name);
 };
 
 /* split string by a delimiter */
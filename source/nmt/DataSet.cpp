@@ -129,6 +129,7 @@ Sample::Sample(IntList* s, IntList* t, int myKey)
     srcSeq = s;
     tgtSeq = t;
     bucketKey = myKey;
+    isPartial = false;
 }
 
 /* de-constructor */
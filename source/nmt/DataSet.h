@@ -48,6 +48,10 @@ struct Sample {
     /* target sequence (a list of tokens) */
     IntList * tgtSeq;
 
+    /* indicates whether the target sequence is a partial translation,
+       i.e., its decoding is stopped by the deadline */
+    bool isPartial;
+
     /* constructor */
     Sample(IntList* s, IntList* t = NULL, int myKey = -1);
 
@@ -285,9 +285,12 @@ run decoding for inference with pre-norm
 >> mask - mask that indicates which position is valid
 >> maskEncDec - mask for the encoder-decoder attention
 >> nstep - the current length of the decoder input
+>> maskDec - mask for the self-attention (only needed when
+             more than one token is fed, e.g., a forced prefix)
 << return - the output tensor of the decoder
 */
-XTensor AttDecoder::RunFastPreNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep)
+XTensor AttDecoder::RunFastPreNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep,
+                                   XTensor* maskDec)
 {
     /* clear the history */
     if (useHistory)
@@ -311,7 +314,7 @@ XTensor AttDecoder::RunFastPreNorm(XTensor& inputDec, XTensor& outputEnc, XTenso
         xn = selfAttLayerNorms[i].Run(x);
 
         /* self attention */
-        xn = selfAtts[i].Make(xn, xn, xn, NULL, &selfAttCache[i], SELF_ATT);
+        xn = selfAtts[i].Make(xn, xn, xn, maskDec, &selfAttCache[i], SELF_ATT);
 
         /* residual connection */
         SumMe(xn, x);
@@ -356,9 +359,12 @@ run decoding for inference with post-norm
 >> mask - mask that indicates which position is valid
 >> maskEncDec - mask for the encoder-decoder attention
 >> nstep - the current length of the decoder input
+>> maskDec - mask for the self-attention (only needed when
+             more than one token is fed, e.g., a forced prefix)
 << return - the output tensor of the decoder
 */
-XTensor AttDecoder::RunFastPostNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep)
+XTensor AttDecoder::RunFastPostNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep,
+                                    XTensor* maskDec)
 {
     /* clear the history */
     if (useHistory)
@@ -379,7 +385,7 @@ XTensor AttDecoder::RunFastPostNorm(XTensor& inputDec, XTensor& outputEnc, XTens
 
         /******************/
         /* self attention */
-        xn = selfAtts[i].Make(x, x, x, NULL, &selfAttCache[i], SELF_ATT);
+        xn = selfAtts[i].Make(x, x, x, maskDec, &selfAttCache[i], SELF_ATT);
 
         /* residual connection */
         SumMe(xn, x);
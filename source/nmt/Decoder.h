@@ -114,10 +114,12 @@ public:
                  XTensor* maskEncDec, int nstep);
 
     /* run decoding for inference with pre-norm */
-    XTensor RunFastPreNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep);
+    XTensor RunFastPreNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep,
+                           XTensor* maskDec = NULL);
 
     /* run decoding for inference with post-norm */
-    XTensor RunFastPostNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep);
+    XTensor RunFastPostNorm(XTensor& inputDec, XTensor& outputEnc, XTensor* maskEncDec, int nstep,
+                            XTensor* maskDec = NULL);
 };
 
 } /* end of the nmt namespace */
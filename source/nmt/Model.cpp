@@ -20,8 +20,13 @@
  * $Modified by: HU Chi (huchinlp@gmail.com) 2020-04
  */
 
+#include <atomic>
+#include <thread>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include "Model.h"
+#include "submodel/HalfWeight.h"
 
 /* the nmt namespace */
 namespace nmt
@@ -35,6 +40,7 @@ NMTModel::NMTModel()
     encoder = new AttEncoder();
     decoder = new AttDecoder();
     outputLayer = new OutputLayer();
+    mappedFile = NULL;
 }
 
 /* de-constructor */
@@ -43,6 +49,9 @@ NMTModel::~NMTModel()
     delete encoder;
     delete decoder;
     delete outputLayer;
+
+    /* the parameters may point into the mapped file */
+    delete mappedFile;
 }
 
 /* return a list to keep the configurations (interger) */
@@ -73,11 +82,45 @@ vector<int*> NMTModel::GetIntConfigs()
     return intConfig;
 }
 
+/* return a list to keep the configurations (boolean) */
+vector<bool*> NMTModel::GetBoolConfigs()
+{
+    /* 11 booleans */
+    vector<bool*> boolConfig = {
+        &(config->model.encoderL1Norm),
+        &(config->model.decoderL1Norm),
+        &(config->model.useBigAtt),
+        &(config->model.encFinalNorm),
+        &(config->model.decFinalNorm),
+        &(config->model.encPreLN),
+        &(config->model.decPreLN),
+        &(config->model.useEncHistory),
+        &(config->model.useDecHistory),
+        &(config->model.shareEncDecEmb),
+        &(config->model.shareDecInputOutputEmb),
+    };
+
+    return boolConfig;
+}
+
 /*
-initialize the model
+initialize the model. It exits if the model file can not be loaded.
 >> myConfig - configuration of the model
 */
 void NMTModel::InitModel(NMTConfig& myConfig)
+{
+    CheckNTErrors(TryInitModel(myConfig), "Failed to load the model file");
+}
+
+/*
+initialize the model. A model file that can not be loaded (e.g., a truncated
+file or a file of another model) is reported rather than fatal, as it is
+checked before any parameter is read, which lets a running service keep
+its model when reloading a bad file.
+>> myConfig - configuration of the model
+<< return - whether the model is loaded
+*/
+bool NMTModel::TryInitModel(NMTConfig& myConfig)
 {
     config = &myConfig;
     devID = config->common.devID;
@@ -86,7 +129,51 @@ void NMTModel::InitModel(NMTConfig& myConfig)
     vector<int*> intConfig = GetIntConfigs();
 
     FILE* modelFile = NULL;
-    modelFile = fopen(config->common.modelFN, "rb");
+
+    /* read model configurations from a file of the mapped format */
+    if (ModelFile::IsModelFile(config->common.modelFN)) {
+        mappedFile = new ModelFile();
+        if (!mappedFile->Open(config->common.modelFN)) {
+            LOG("failed to open the model file %s", config->common.modelFN);
+            return false;
+        }
+
+        LOG("loading configurations from the mapped model file...");
+
+        vector<bool*> boolConfig = GetBoolConfigs();
+        for (int i = 0; i < boolConfig.size(); i++)
+            *boolConfig[i] = mappedFile->header->bools[i] != 0;
+
+        int maxSrcLen = config->model.maxSrcLen;
+        for (int i = 0; i < intConfig.size(); i++)
+            *intConfig[i] = mappedFile->header->ints[i];
+
+        /* reset the maximum source sentence length */
+        config->model.maxSrcLen = MIN(maxSrcLen, config->model.maxSrcLen);
+
+        /* the decoding defaults of a bundle, unless they are given in the options */
+        size_t size = 0;
+        const ModelDecodingConfig* decoding =
+            (const ModelDecodingConfig*)mappedFile->GetSection(MODEL_SECTION_DECODING, &size);
+        if (decoding != NULL && size >= sizeof(ModelDecodingConfig)) {
+            LOG("loading decoding defaults from the model bundle...");
+            if (!config->IsSet("beam"))
+                config->translation.beamSize = decoding->beamSize;
+            if (!config->IsSet("lenalpha"))
+                config->translation.lenAlpha = decoding->lenAlpha;
+            if (!config->IsSet("maxlenalpha"))
+                config->translation.maxLenAlpha = decoding->maxLenAlpha;
+            if (!config->IsSet("maxlen"))
+                config->translation.maxLen = decoding->maxLen;
+            if (!config->IsSet("sbatch"))
+                config->common.sBatchSize = decoding->sBatchSize;
+            if (!config->IsSet("wbatch"))
+                config->common.wBatchSize = decoding->wBatchSize;
+        }
+    }
+    else {
+        modelFile = fopen(config->common.modelFN, "rb");
+    }
 
     /* read model configurations */
     if (modelFile) {
@@ -95,25 +182,37 @@ void NMTModel::InitModel(NMTConfig& myConfig)
 
         LOG("loading configurations from the model file...");
 
-        /* 11 booleans */
-        fread(&(config->model.encoderL1Norm), sizeof(bool), 1, modelFile);
-        fread(&(config->model.decoderL1Norm), sizeof(bool), 1, modelFile);
-        fread(&(config->model.useBigAtt), sizeof(bool), 1, modelFile);
-        fread(&(config->model.encFinalNorm), sizeof(bool), 1, modelFile);
-        fread(&(config->model.decFinalNorm), sizeof(bool), 1, modelFile);
-        fread(&(config->model.encPreLN), sizeof(bool), 1, modelFile);
-        fread(&(config->model.decPreLN), sizeof(bool), 1, modelFile);
-        fread(&(config->model.useEncHistory), sizeof(bool), 1, modelFile);
-        fread(&(config->model.useDecHistory), sizeof(bool), 1, modelFile);
-        fread(&(config->model.shareEncDecEmb), sizeof(bool), 1, modelFile);
-        fread(&(config->model.shareDecInputOutputEmb), sizeof(bool), 1, modelFile);
+        /* 11 booleans (in the order of GetBoolConfigs) */
+        size_t readNum = 0;
+        vector<bool*> boolConfig = GetBoolConfigs();
+        for (auto c : boolConfig)
+            readNum += fread(c, sizeof(bool), 1, modelFile);
 
         int maxSrcLen = config->model.maxSrcLen;
         for (auto c : intConfig) {
-            fread(c, sizeof(int), 1, modelFile);
+            readNum += fread(c, sizeof(int), 1, modelFile);
         }
         /* reset the maximum source sentence length */
         config->model.maxSrcLen = MIN(maxSrcLen, config->model.maxSrcLen);
+
+        if (readNum != boolConfig.size() + intConfig.size()) {
+            LOG("the model file %s is truncated", config->common.modelFN);
+            fclose(modelFile);
+            return false;
+        }
+    }
+
+    /* the sizes in the model file define the shapes of the parameters */
+    const ModelConfig& m = config->model;
+    if ((modelFile != NULL || mappedFile != NULL) &&
+        (m.encEmbDim <= 0 || m.decEmbDim <= 0 || m.encFFNHiddenDim <= 0 || m.decFFNHiddenDim <= 0 ||
+         m.encLayerNum < 0 || m.decLayerNum <= 0 || m.encSelfAttHeadNum <= 0 ||
+         m.decSelfAttHeadNum <= 0 || m.encDecAttHeadNum <= 0 ||
+         m.srcVocabSize <= 0 || m.tgtVocabSize <= 0)) {
+        LOG("invalid configurations in the model file %s", config->common.modelFN);
+        if (modelFile != NULL)
+            fclose(modelFile);
+        return false;
     }
 
     if (config->training.isTraining) {
@@ -136,7 +235,7 @@ void NMTModel::InitModel(NMTConfig& myConfig)
         fclose(trainF);
 
         /* start incremental training from a checkpoint */
-        if (modelFile) {
+        if (modelFile || mappedFile) {
             config->training.incremental = true;
         }
     }
@@ -145,6 +244,58 @@ void NMTModel::InitModel(NMTConfig& myConfig)
     decoder->InitModel(*config);
     outputLayer->InitModel(*config);
 
+    /* the head numbers of a model with pruned heads */
+    size_t headSize = 0;
+    const int32_t* heads = NULL;
+    if (mappedFile != NULL)
+        heads = (const int32_t*)mappedFile->GetSection(MODEL_SECTION_HEADS, &headSize);
+    if (heads != NULL) {
+        CheckNTErrors(!config->training.isTraining, "A model with pruned heads can not be trained");
+
+        vector<Attention*> atts;
+        GetAttentions(atts);
+        bool isValid = headSize == sizeof(int32_t) * atts.size();
+        for (size_t i = 0; isValid && i < atts.size(); i++)
+            isValid = heads[i] > 0 && heads[i] <= atts[i]->nhead &&
+                      (atts[i]->splitHeads || heads[i] == atts[i]->nhead);
+        if (!isValid) {
+            LOG("invalid head numbers in the model file %s", config->common.modelFN);
+            return false;
+        }
+
+        int headNum = 0;
+        int totalNum = 0;
+        for (size_t i = 0; i < atts.size(); i++) {
+            totalNum += atts[i]->nhead;
+            atts[i]->SetHeadNum(heads[i]);
+            headNum += heads[i];
+        }
+        LOG("using %d of %d attention heads", headNum, totalNum);
+    }
+
+    /* the ranks of the factorized weights, i.e., two for each FFN, then one for the output layer */
+    size_t rankSize = 0;
+    const int32_t* ranks = NULL;
+    if (mappedFile != NULL)
+        ranks = (const int32_t*)mappedFile->GetSection(MODEL_SECTION_RANKS, &rankSize);
+    if (ranks != NULL) {
+        vector<FFN*> ffns;
+        GetFFNs(ffns);
+        bool isValid = rankSize == sizeof(int32_t) * (2 * ffns.size() + 1);
+        for (size_t i = 0; isValid && i < 2 * ffns.size() + 1; i++)
+            isValid = ranks[i] >= 0;
+        if (!isValid) {
+            LOG("invalid ranks in the model file %s", config->common.modelFN);
+            return false;
+        }
+
+        for (size_t i = 0; i < ffns.size(); i++)
+            ffns[i]->SetRanks(ranks[2 * i], ranks[2 * i + 1]);
+        if (ranks[2 * ffns.size()] > 0)
+            outputLayer->SetRank(ranks[2 * ffns.size()]);
+        LOG("using the factorized weights of the model file");
+    }
+
     /* share encoder&decoder embeddings */
     if (config->model.shareEncDecEmb) {
         decoder->embedder = &(encoder->embedder);
@@ -160,8 +311,17 @@ void NMTModel::InitModel(NMTConfig& myConfig)
     ShowModelConfig();
 
     /* load parameters for translation or incremental training */
-    if (config->training.incremental || (!config->training.isTraining))
-        LoadFromFile(modelFile);
+    if (config->training.incremental || (!config->training.isTraining)) {
+        if (!CheckModelFile(modelFile)) {
+            if (modelFile != NULL)
+                fclose(modelFile);
+            return false;
+        }
+        if (mappedFile != NULL)
+            LoadFromMappedFile();
+        else
+            LoadFromFile(modelFile);
+    }
 
     if (config->training.isTraining) {
         TensorList params;
@@ -169,9 +329,20 @@ void NMTModel::InitModel(NMTConfig& myConfig)
         for (int i = 0; i < params.Size(); i++)
             AddParam(params[i]);
     }
+    else if (devID < 0) {
+        /* the output projection is packed to be stored in FP16 as well */
+        if (config->common.packWeight || config->common.cpuFP16)
+            PackWeights();
+        if (config->common.cpuFP16)
+            ConvertWeightsToHalf();
+        if (config->common.int8Emb)
+            QuantizeEmbeddings();
+    }
 
     if (modelFile)
         fclose(modelFile);
+
+    return true;
 }
 
 /*
@@ -229,8 +400,8 @@ make the decoding network
 XTensor NMTModel::MakeDecoder(XTensor& inputDec, XTensor& outputEnc,
                               XTensor* mask, XTensor& maskEncDec)
 {
-    return decoder->Make(inputDec, outputEnc, mask, &maskEncDec,
-                         inputDec.GetDim(1));
+    /* the whole target sequence is fed, so it starts at position 0 */
+    return decoder->Make(inputDec, outputEnc, mask, &maskEncDec, 0);
 }
 
 /*
@@ -456,14 +627,74 @@ XTensor NMTModel::MakeMTMaskDecInference(XTensor& paddingEnc)
     }
 }
 
+/*
+make the self-attention mask of the decoder for feeding several tokens
+at a time during inference (e.g., a forced prefix). The tokens start at
+position "start", and the keys of the earlier positions are in the cache.
+>> batchSize - the batch size
+>> lenQ - number of the tokens fed to the decoder
+>> start - position of the first token
+<< maskDec - mask of the decoder self-attention,
+   (nHead, batchSize, lenQ, start + lenQ) if nHead > 1 or RPR is used,
+   (batchSize, lenQ, start + lenQ) else.
+*/
+XTensor NMTModel::MakeMTMaskDecPrefix(int batchSize, int lenQ, int start)
+{
+    int headNum = config->model.decSelfAttHeadNum;
+    int lenKV = start + lenQ;
+    bool split = headNum > 1 || config->model.maxRelativeLength > 0;
+
+    int num = batchSize * lenQ * lenKV * (split ? headNum : 1);
+    float* values = new float[num];
+    for (int i = 0; i < num; i++) {
+        int q = (i / lenKV) % lenQ;
+        int k = i % lenKV;
+        values[i] = k <= start + q ? 0.0F : -1e9F;
+    }
+
+    XTensor maskDec;
+    if (split)
+        InitTensor4D(&maskDec, headNum, batchSize, lenQ, lenKV, X_FLOAT, devID);
+    else
+        InitTensor3D(&maskDec, batchSize, lenQ, lenKV, X_FLOAT, devID);
+    maskDec.SetData(values, num);
+
+    delete[] values;
+
+    return maskDec;
+}
+
+/*
+add a parameter to the list with its structural name
+>> list - the list of the parameters
+>> names - the names of the parameters (NULL if not used)
+>> param - the parameter
+>> format - the name, where "%d" is the index of the layer
+>> layer - index of the layer
+*/
+static void AddNamedParam(TensorList& list, vector<string>* names, XTensor* param,
+                          const char* format, int layer = 0)
+{
+    list.Add(param);
+    if (names != NULL) {
+        char name[MODEL_NAME_LEN];
+        snprintf(name, MODEL_NAME_LEN, format, layer);
+        names->push_back(name);
+    }
+}
+
 /*
 todo: used a fixed parameter order
 collect all parameters
 >> list - the list that keeps the parameters
+>> names - the structural names of the parameters, e.g., "encoder.layer3.ffn.w1"
+           (for return, NULL if not used)
 */
-void NMTModel::GetParams(TensorList& list)
+void NMTModel::GetParams(TensorList& list, vector<string>* names)
 {
     list.Clear();
+    if (names != NULL)
+        names->clear();
 
     if (config->model.useBigAtt) {
 
@@ -471,81 +702,89 @@ void NMTModel::GetParams(TensorList& list)
         if (!config->model.decoderOnly) {
             if (encoder->useHistory) {
                 for (int i = 0; i < encoder->nlayer + 1; i++)
-                    list.Add(&encoder->history->weights[i]);
+                    AddNamedParam(list, names, &encoder->history->weights[i], "encoder.history.weight%d", i);
                 for (int i = 0; i < encoder->nlayer; i++) {
-                    list.Add(&encoder->history->layerNorms[i].weight);
-                    list.Add(&encoder->history->layerNorms[i].bias);
+                    AddNamedParam(list, names, &encoder->history->layerNorms[i].weight, "encoder.history.norm%d.weight", i);
+                    AddNamedParam(list, names, &encoder->history->layerNorms[i].bias, "encoder.history.norm%d.bias", i);
                 }
             }
             for (int i = 0; i < encoder->nlayer; i++) {
-                list.Add(&encoder->selfAtts[i].weightQ);
-                list.Add(&encoder->selfAtts[i].weightK);
-                list.Add(&encoder->selfAtts[i].weightV);
-                list.Add(&encoder->selfAtts[i].biasQ);
-                list.Add(&encoder->selfAtts[i].biasK);
-                list.Add(&encoder->selfAtts[i].biasV);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightQ, "encoder.layer%d.selfatt.weightQ", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightK, "encoder.layer%d.selfatt.weightK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightV, "encoder.layer%d.selfatt.weightV", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasQ, "encoder.layer%d.selfatt.biasQ", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasK, "encoder.layer%d.selfatt.biasK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasV, "encoder.layer%d.selfatt.biasV", i);
                 if (encoder->selfAtts[i].useRPR)
-                    list.Add(&encoder->selfAtts[i].RPEmbK);
-                list.Add(&encoder->selfAtts[i].weightO);
-                list.Add(&encoder->selfAtts[i].biasO);
-                list.Add(&encoder->ffns[i].w1);
-                list.Add(&encoder->ffns[i].b1);
-                list.Add(&encoder->ffns[i].w2);
-                list.Add(&encoder->ffns[i].b2);
-                list.Add(&encoder->attLayerNorms[i].weight);
-                list.Add(&encoder->attLayerNorms[i].bias);
-                list.Add(&encoder->fnnLayerNorms[i].weight);
-                list.Add(&encoder->fnnLayerNorms[i].bias);
+                    AddNamedParam(list, names, &encoder->selfAtts[i].RPEmbK, "encoder.layer%d.selfatt.RPEmbK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightO, "encoder.layer%d.selfatt.weightO", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasO, "encoder.layer%d.selfatt.biasO", i);
+                AddNamedParam(list, names, &encoder->ffns[i].w1, "encoder.layer%d.ffn.w1", i);
+                if (encoder->ffns[i].rank1 > 0)
+                    AddNamedParam(list, names, &encoder->ffns[i].v1, "encoder.layer%d.ffn.v1", i);
+                AddNamedParam(list, names, &encoder->ffns[i].b1, "encoder.layer%d.ffn.b1", i);
+                AddNamedParam(list, names, &encoder->ffns[i].w2, "encoder.layer%d.ffn.w2", i);
+                if (encoder->ffns[i].rank2 > 0)
+                    AddNamedParam(list, names, &encoder->ffns[i].v2, "encoder.layer%d.ffn.v2", i);
+                AddNamedParam(list, names, &encoder->ffns[i].b2, "encoder.layer%d.ffn.b2", i);
+                AddNamedParam(list, names, &encoder->attLayerNorms[i].weight, "encoder.layer%d.selfattnorm.weight", i);
+                AddNamedParam(list, names, &encoder->attLayerNorms[i].bias, "encoder.layer%d.selfattnorm.bias", i);
+                AddNamedParam(list, names, &encoder->fnnLayerNorms[i].weight, "encoder.layer%d.ffnnorm.weight", i);
+                AddNamedParam(list, names, &encoder->fnnLayerNorms[i].bias, "encoder.layer%d.ffnnorm.bias", i);
             }
             if (encoder->finalNorm) {
-                list.Add(&encoder->encoderLayerNorm->weight);
-                list.Add(&encoder->encoderLayerNorm->bias);
+                AddNamedParam(list, names, &encoder->encoderLayerNorm->weight, "encoder.norm.weight");
+                AddNamedParam(list, names, &encoder->encoderLayerNorm->bias, "encoder.norm.bias");
             }
         }
 
         /* decoder parameters */
         if (decoder->useHistory) {
             for (int i = 0; i < decoder->nlayer + 1; i++)
-                list.Add(&decoder->history->weights[i]);
+                AddNamedParam(list, names, &decoder->history->weights[i], "decoder.history.weight%d", i);
             for (int i = 0; i < decoder->nlayer; i++) {
-                list.Add(&decoder->history->layerNorms[i].weight);
-                list.Add(&decoder->history->layerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->history->layerNorms[i].weight, "decoder.history.norm%d.weight", i);
+                AddNamedParam(list, names, &decoder->history->layerNorms[i].bias, "decoder.history.norm%d.bias", i);
             }
         }
 
         for (int i = 0; i < decoder->nlayer; i++) {
-            list.Add(&decoder->selfAtts[i].weightQ);
-            list.Add(&decoder->selfAtts[i].weightK);
-            list.Add(&decoder->selfAtts[i].weightV);
-            list.Add(&decoder->selfAtts[i].biasQ);
-            list.Add(&decoder->selfAtts[i].biasK);
-            list.Add(&decoder->selfAtts[i].biasV);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightQ, "decoder.layer%d.selfatt.weightQ", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightK, "decoder.layer%d.selfatt.weightK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightV, "decoder.layer%d.selfatt.weightV", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasQ, "decoder.layer%d.selfatt.biasQ", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasK, "decoder.layer%d.selfatt.biasK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasV, "decoder.layer%d.selfatt.biasV", i);
             if (decoder->selfAtts[i].useRPR)
-                list.Add(&decoder->selfAtts[i].RPEmbK);
-            list.Add(&decoder->selfAtts[i].weightO);
-            list.Add(&decoder->selfAtts[i].biasO);
-            list.Add(&decoder->selfAttLayerNorms[i].weight);
-            list.Add(&decoder->selfAttLayerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->selfAtts[i].RPEmbK, "decoder.layer%d.selfatt.RPEmbK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightO, "decoder.layer%d.selfatt.weightO", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasO, "decoder.layer%d.selfatt.biasO", i);
+            AddNamedParam(list, names, &decoder->selfAttLayerNorms[i].weight, "decoder.layer%d.selfattnorm.weight", i);
+            AddNamedParam(list, names, &decoder->selfAttLayerNorms[i].bias, "decoder.layer%d.selfattnorm.bias", i);
             if (!config->model.decoderOnly) {
-                list.Add(&decoder->enDeAtts[i].weightQ);
-                list.Add(&decoder->enDeAtts[i].weightK);
-                list.Add(&decoder->enDeAtts[i].weightV);
-                list.Add(&decoder->enDeAtts[i].biasQ);
-                list.Add(&decoder->enDeAtts[i].biasK);
-                list.Add(&decoder->enDeAtts[i].biasV);
-                list.Add(&decoder->enDeAtts[i].weightO);
-                list.Add(&decoder->enDeAtts[i].biasO);
-                list.Add(&decoder->enDeAttLayerNorms[i].weight);
-                list.Add(&decoder->enDeAttLayerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightQ, "decoder.layer%d.endeatt.weightQ", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightK, "decoder.layer%d.endeatt.weightK", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightV, "decoder.layer%d.endeatt.weightV", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasQ, "decoder.layer%d.endeatt.biasQ", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasK, "decoder.layer%d.endeatt.biasK", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasV, "decoder.layer%d.endeatt.biasV", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightO, "decoder.layer%d.endeatt.weightO", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasO, "decoder.layer%d.endeatt.biasO", i);
+                AddNamedParam(list, names, &decoder->enDeAttLayerNorms[i].weight, "decoder.layer%d.endeattnorm.weight", i);
+                AddNamedParam(list, names, &decoder->enDeAttLayerNorms[i].bias, "decoder.layer%d.endeattnorm.bias", i);
             }
             if (decoder->ffns != NULL) {
-                list.Add(&decoder->ffns[i].w1);
-                list.Add(&decoder->ffns[i].b1);
-                list.Add(&decoder->ffns[i].w2);
-                list.Add(&decoder->ffns[i].b2);
+                AddNamedParam(list, names, &decoder->ffns[i].w1, "decoder.layer%d.ffn.w1", i);
+                if (decoder->ffns[i].rank1 > 0)
+                    AddNamedParam(list, names, &decoder->ffns[i].v1, "decoder.layer%d.ffn.v1", i);
+                AddNamedParam(list, names, &decoder->ffns[i].b1, "decoder.layer%d.ffn.b1", i);
+                AddNamedParam(list, names, &decoder->ffns[i].w2, "decoder.layer%d.ffn.w2", i);
+                if (decoder->ffns[i].rank2 > 0)
+                    AddNamedParam(list, names, &decoder->ffns[i].v2, "decoder.layer%d.ffn.v2", i);
+                AddNamedParam(list, names, &decoder->ffns[i].b2, "decoder.layer%d.ffn.b2", i);
             }
-            list.Add(&decoder->ffnLayerNorms[i].weight);
-            list.Add(&decoder->ffnLayerNorms[i].bias);
+            AddNamedParam(list, names, &decoder->ffnLayerNorms[i].weight, "decoder.layer%d.ffnnorm.weight", i);
+            AddNamedParam(list, names, &decoder->ffnLayerNorms[i].bias, "decoder.layer%d.ffnnorm.bias", i);
         }
     }
     else {
@@ -553,99 +792,115 @@ void NMTModel::GetParams(TensorList& list)
         if (!config->model.decoderOnly) {
             if (encoder->useHistory) {
                 for (int i = 0; i < encoder->nlayer + 1; i++)
-                    list.Add(&encoder->history->weights[i]);
+                    AddNamedParam(list, names, &encoder->history->weights[i], "encoder.history.weight%d", i);
                 for (int i = 0; i < encoder->nlayer; i++) {
-                    list.Add(&encoder->history->layerNorms[i].weight);
-                    list.Add(&encoder->history->layerNorms[i].bias);
+                    AddNamedParam(list, names, &encoder->history->layerNorms[i].weight, "encoder.history.norm%d.weight", i);
+                    AddNamedParam(list, names, &encoder->history->layerNorms[i].bias, "encoder.history.norm%d.bias", i);
                 }
             }
             for (int i = 0; i < encoder->nlayer; i++) {
                 if (encoder->selfAtts[i].useRPR)
-                    list.Add(&encoder->selfAtts[i].RPEmbK);
-                list.Add(&encoder->selfAtts[i].weightK);
-                list.Add(&encoder->selfAtts[i].biasK);
-                list.Add(&encoder->selfAtts[i].weightV);
-                list.Add(&encoder->selfAtts[i].biasV);
-                list.Add(&encoder->selfAtts[i].weightQ);
-                list.Add(&encoder->selfAtts[i].biasQ);
-                list.Add(&encoder->selfAtts[i].weightO);
-                list.Add(&encoder->selfAtts[i].biasO);
-                list.Add(&encoder->attLayerNorms[i].weight);
-                list.Add(&encoder->attLayerNorms[i].bias);
-                list.Add(&encoder->ffns[i].w1);
-                list.Add(&encoder->ffns[i].b1);
-                list.Add(&encoder->ffns[i].w2);
-                list.Add(&encoder->ffns[i].b2);
-                list.Add(&encoder->fnnLayerNorms[i].weight);
-                list.Add(&encoder->fnnLayerNorms[i].bias);
+                    AddNamedParam(list, names, &encoder->selfAtts[i].RPEmbK, "encoder.layer%d.selfatt.RPEmbK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightK, "encoder.layer%d.selfatt.weightK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasK, "encoder.layer%d.selfatt.biasK", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightV, "encoder.layer%d.selfatt.weightV", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasV, "encoder.layer%d.selfatt.biasV", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightQ, "encoder.layer%d.selfatt.weightQ", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasQ, "encoder.layer%d.selfatt.biasQ", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].weightO, "encoder.layer%d.selfatt.weightO", i);
+                AddNamedParam(list, names, &encoder->selfAtts[i].biasO, "encoder.layer%d.selfatt.biasO", i);
+                AddNamedParam(list, names, &encoder->attLayerNorms[i].weight, "encoder.layer%d.selfattnorm.weight", i);
+                AddNamedParam(list, names, &encoder->attLayerNorms[i].bias, "encoder.layer%d.selfattnorm.bias", i);
+                AddNamedParam(list, names, &encoder->ffns[i].w1, "encoder.layer%d.ffn.w1", i);
+                if (encoder->ffns[i].rank1 > 0)
+                    AddNamedParam(list, names, &encoder->ffns[i].v1, "encoder.layer%d.ffn.v1", i);
+                AddNamedParam(list, names, &encoder->ffns[i].b1, "encoder.layer%d.ffn.b1", i);
+                AddNamedParam(list, names, &encoder->ffns[i].w2, "encoder.layer%d.ffn.w2", i);
+                if (encoder->ffns[i].rank2 > 0)
+                    AddNamedParam(list, names, &encoder->ffns[i].v2, "encoder.layer%d.ffn.v2", i);
+                AddNamedParam(list, names, &encoder->ffns[i].b2, "encoder.layer%d.ffn.b2", i);
+                AddNamedParam(list, names, &encoder->fnnLayerNorms[i].weight, "encoder.layer%d.ffnnorm.weight", i);
+                AddNamedParam(list, names, &encoder->fnnLayerNorms[i].bias, "encoder.layer%d.ffnnorm.bias", i);
             }
             if (encoder->finalNorm) {
-                list.Add(&encoder->encoderLayerNorm->weight);
-                list.Add(&encoder->encoderLayerNorm->bias);
+                AddNamedParam(list, names, &encoder->encoderLayerNorm->weight, "encoder.norm.weight");
+                AddNamedParam(list, names, &encoder->encoderLayerNorm->bias, "encoder.norm.bias");
             }
         }
 
         /* decoder parameters */
         if (decoder->useHistory) {
             for (int i = 0; i < decoder->nlayer + 1; i++)
-                list.Add(&decoder->history->weights[i]);
+                AddNamedParam(list, names, &decoder->history->weights[i], "decoder.history.weight%d", i);
             for (int i = 0; i < decoder->nlayer; i++) {
-                list.Add(&decoder->history->layerNorms[i].weight);
-                list.Add(&decoder->history->layerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->history->layerNorms[i].weight, "decoder.history.norm%d.weight", i);
+                AddNamedParam(list, names, &decoder->history->layerNorms[i].bias, "decoder.history.norm%d.bias", i);
             }
         }
 
         for (int i = 0; i < decoder->nlayer; i++) {
             if (decoder->selfAtts[i].useRPR)
-                list.Add(&decoder->selfAtts[i].RPEmbK);
-            list.Add(&decoder->selfAtts[i].weightK);
-            list.Add(&decoder->selfAtts[i].biasK);
-            list.Add(&decoder->selfAtts[i].weightV);
-            list.Add(&decoder->selfAtts[i].biasV);
-            list.Add(&decoder->selfAtts[i].weightQ);
-            list.Add(&decoder->selfAtts[i].biasQ);
-            list.Add(&decoder->selfAtts[i].weightO);
-            list.Add(&decoder->selfAtts[i].biasO);
-            list.Add(&decoder->selfAttLayerNorms[i].weight);
-            list.Add(&decoder->selfAttLayerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->selfAtts[i].RPEmbK, "decoder.layer%d.selfatt.RPEmbK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightK, "decoder.layer%d.selfatt.weightK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasK, "decoder.layer%d.selfatt.biasK", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightV, "decoder.layer%d.selfatt.weightV", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasV, "decoder.layer%d.selfatt.biasV", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightQ, "decoder.layer%d.selfatt.weightQ", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasQ, "decoder.layer%d.selfatt.biasQ", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].weightO, "decoder.layer%d.selfatt.weightO", i);
+            AddNamedParam(list, names, &decoder->selfAtts[i].biasO, "decoder.layer%d.selfatt.biasO", i);
+            AddNamedParam(list, names, &decoder->selfAttLayerNorms[i].weight, "decoder.layer%d.selfattnorm.weight", i);
+            AddNamedParam(list, names, &decoder->selfAttLayerNorms[i].bias, "decoder.layer%d.selfattnorm.bias", i);
             if (!config->model.decoderOnly) {
-                list.Add(&decoder->enDeAtts[i].weightK);
-                list.Add(&decoder->enDeAtts[i].biasK);
-                list.Add(&decoder->enDeAtts[i].weightV);
-                list.Add(&decoder->enDeAtts[i].biasV);
-                list.Add(&decoder->enDeAtts[i].weightQ);
-                list.Add(&decoder->enDeAtts[i].biasQ);
-                list.Add(&decoder->enDeAtts[i].weightO);
-                list.Add(&decoder->enDeAtts[i].biasO);
-                list.Add(&decoder->enDeAttLayerNorms[i].weight);
-                list.Add(&decoder->enDeAttLayerNorms[i].bias);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightK, "decoder.layer%d.endeatt.weightK", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasK, "decoder.layer%d.endeatt.biasK", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightV, "decoder.layer%d.endeatt.weightV", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasV, "decoder.layer%d.endeatt.biasV", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightQ, "decoder.layer%d.endeatt.weightQ", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasQ, "decoder.layer%d.endeatt.biasQ", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].weightO, "decoder.layer%d.endeatt.weightO", i);
+                AddNamedParam(list, names, &decoder->enDeAtts[i].biasO, "decoder.layer%d.endeatt.biasO", i);
+                AddNamedParam(list, names, &decoder->enDeAttLayerNorms[i].weight, "decoder.layer%d.endeattnorm.weight", i);
+                AddNamedParam(list, names, &decoder->enDeAttLayerNorms[i].bias, "decoder.layer%d.endeattnorm.bias", i);
             }
             if (decoder->ffns != NULL) {
-                list.Add(&decoder->ffns[i].w1);
-                list.Add(&decoder->ffns[i].b1);
-                list.Add(&decoder->ffns[i].w2);
-                list.Add(&decoder->ffns[i].b2);
+                AddNamedParam(list, names, &decoder->ffns[i].w1, "decoder.layer%d.ffn.w1", i);
+                if (decoder->ffns[i].rank1 > 0)
+                    AddNamedParam(list, names, &decoder->ffns[i].v1, "decoder.layer%d.ffn.v1", i);
+                AddNamedParam(list, names, &decoder->ffns[i].b1, "decoder.layer%d.ffn.b1", i);
+                AddNamedParam(list, names, &decoder->ffns[i].w2, "decoder.layer%d.ffn.w2", i);
+                if (decoder->ffns[i].rank2 > 0)
+                    AddNamedParam(list, names, &decoder->ffns[i].v2, "decoder.layer%d.ffn.v2", i);
+                AddNamedParam(list, names, &decoder->ffns[i].b2, "decoder.layer%d.ffn.b2", i);
             }
-            list.Add(&decoder->ffnLayerNorms[i].weight);
-            list.Add(&decoder->ffnLayerNorms[i].bias);
+            AddNamedParam(list, names, &decoder->ffnLayerNorms[i].weight, "decoder.layer%d.ffnnorm.weight", i);
+            AddNamedParam(list, names, &decoder->ffnLayerNorms[i].bias, "decoder.layer%d.ffnnorm.bias", i);
         }
     }
 
     if (decoder->finalNorm) {
-        list.Add(&decoder->decoderLayerNorm->weight);
-        list.Add(&decoder->decoderLayerNorm->bias);
+        AddNamedParam(list, names, &decoder->decoderLayerNorm->weight, "decoder.norm.weight");
+        AddNamedParam(list, names, &decoder->decoderLayerNorm->bias, "decoder.norm.bias");
     }
 
     if (!config->model.decoderOnly) {
-        list.Add(encoder->embedder.w);
+        AddNamedParam(list, names, encoder->embedder.w, "encoder.embedding.w");
     }
 
     if (!config->model.shareEncDecEmb) {
-        list.Add(decoder->embedder->w);
+        AddNamedParam(list, names, decoder->embedder->w, "decoder.embedding.w");
     }
 
-    if (!config->model.shareDecInputOutputEmb) {
-        list.Add(outputLayer->w);
+    if (outputLayer->rank > 0) {
+        AddNamedParam(list, names, outputLayer->u, "output.u");
+        AddNamedParam(list, names, outputLayer->v, "output.v");
+    }
+    else if (!config->model.shareDecInputOutputEmb) {
+        /* w is released for inference once it is packed */
+        if (outputLayer->w != NULL)
+            AddNamedParam(list, names, outputLayer->w, "output.w");
+        else
+            AddNamedParam(list, names, outputLayer->packedW, "output.packedw");
     }
 }
 
@@ -655,6 +910,13 @@ dump the model to a file
 */
 void NMTModel::DumpToFile(const char* fn)
 {
+    /* the shapes of the parameters are not derived from the configurations */
+    if (IsPruned() || IsFactorized()) {
+        LOG("saving the model in the mapped format as its shapes are changed");
+        DumpToMappedFile(fn);
+        return;
+    }
+
     double startT = GetClockSec();
     FILE* modelFile = fopen(fn, "wb");
     CheckNTErrors(modelFile, "Cannot open the model file");
@@ -689,7 +951,231 @@ void NMTModel::DumpToFile(const char* fn)
     LOG("model saved (took %.1fs)", elapsed);
 }
 
-/* read the parameters */
+/* the maximum number of threads to load a model by default */
+#define MAX_LOAD_THREAD_NUM 8
+
+/* the job of loading the parameters (shared by the loading threads) */
+struct ParamLoadJob
+{
+    /* path to the model file */
+    const char* fn;
+
+    /* the parameters */
+    TensorList* params;
+
+    /* the offset of each parameter in the file */
+    vector<uint64_t> offsets;
+
+    /* the parameters sorted by size (the largest first) */
+    vector<int> order;
+
+    /* size of an element in the file */
+    int fileUnitSize;
+
+    /* the next parameter to load (an index of the order) */
+    atomic<int> next;
+
+    /* time (in seconds) and bytes of each stage for each thread */
+    vector<double> readTime;
+    vector<double> convertTime;
+    vector<double> copyTime;
+    vector<uint64_t> readBytes;
+    vector<uint64_t> convertBytes;
+    vector<uint64_t> copyBytes;
+};
+
+/* move the file position to an offset (beyond 2GB on all platforms) */
+static void SeekFile(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+/*
+a loading thread. It takes the parameters one by one, reads the data with its
+own file handle, converts it to the data type of the parameter on the host
+(if needed) and copies it to the device. So the reading of a parameter
+overlaps the conversion and the copy of the others.
+>> job - the loading job
+>> id - id of the thread
+*/
+static void LoadParams(ParamLoadJob* job, int id)
+{
+    FILE* file = fopen(job->fn, "rb");
+    CheckNTErrors(file, "Failed to open the model file");
+
+    vector<char> buf;
+    int k;
+    while ((k = job->next++) < (int)job->order.size()) {
+        int i = job->order[k];
+        XTensor* p = (*job->params)[i];
+        size_t bytes = size_t(p->unitNum) * job->fileUnitSize;
+
+        double startT = GetClockSec();
+        buf.resize(bytes);
+        SeekFile(file, job->offsets[i]);
+        CheckNTErrors(fread(buf.data(), 1, bytes, file) == bytes, "Failed to read the model file");
+        job->readTime[id] += GetClockSec() - startT;
+        job->readBytes[id] += bytes;
+
+        if (job->fileUnitSize != p->unitSize) {
+            /* the model is stored in FP32 and the parameter is in FP16 */
+            startT = GetClockSec();
+            XTensor source;
+            XTensor target;
+            InitTensor(&source, p->order, p->dimSize, X_FLOAT, -1);
+            InitTensor(&target, p->order, p->dimSize, p->dataType, -1);
+            source.SetData(buf.data(), p->unitNum);
+            _ConvertDataType(&source, &target);
+            memcpy(buf.data(), target.data, size_t(p->unitNum) * p->unitSize);
+            job->convertTime[id] += GetClockSec() - startT;
+            job->convertBytes[id] += bytes;
+        }
+
+        startT = GetClockSec();
+        p->SetData(buf.data(), p->unitNum);
+        job->copyTime[id] += GetClockSec() - startT;
+        job->copyBytes[id] += size_t(p->unitNum) * p->unitSize;
+    }
+
+    fclose(file);
+}
+
+/*
+get the throughput of a loading stage
+>> times - time of each thread
+>> bytes - bytes of each thread
+<< return - the throughput (MB/s) of a thread
+*/
+static double GetLoadThroughput(const vector<double>& times, const vector<uint64_t>& bytes)
+{
+    double time = 0;
+    uint64_t size = 0;
+    for (size_t i = 0; i < times.size(); i++) {
+        time += times[i];
+        size += bytes[i];
+    }
+    return time > 0 ? size / time / (1024 * 1024) : 0;
+}
+
+/*
+get the size of an element of a parameter in a model file
+>> dataType - the data type (TENSOR_DATA_TYPE)
+<< return - the size in bytes (0 if the parameters are never in the data type)
+*/
+static int GetFileUnitSize(int dataType)
+{
+    if (dataType == X_FLOAT)
+        return sizeof(float);
+    if (dataType == X_FLOAT16)
+        return 2;
+    return 0;
+}
+
+/*
+check that the model file matches the parameters before any of them is read,
+so a file that can not be loaded is reported and nothing is half loaded.
+A mapped file should have every parameter (by name) in the same shape, and
+a file of the old format should have the size of the parameters in FP32
+(or in FP16 when running with FP16).
+>> file - the model file of the old format (after the configurations),
+          or NULL if the mapped file is used
+<< return - whether the parameters can be loaded
+*/
+bool NMTModel::CheckModelFile(FILE* file)
+{
+    const char* fn = config->common.modelFN;
+
+    TensorList params;
+    vector<string> names;
+    GetParams(params, &names);
+
+    if (mappedFile != NULL) {
+        if (params.Size() != (int)mappedFile->header->paramNum) {
+            LOG("the model file %s has %u parameters rather than %d",
+                fn, mappedFile->header->paramNum, (int)params.Size());
+            return false;
+        }
+
+        for (int i = 0; i < params.Size(); i++) {
+            XTensor* p = params[i];
+
+            /* the parameters are matched by their names rather than their positions */
+            int index = mappedFile->Find(names[i].c_str());
+            if (index < 0) {
+                LOG("the parameter %s is not in the model file %s", names[i].c_str(), fn);
+                return false;
+            }
+            const ModelParamEntry& entry = mappedFile->entries[index];
+
+            bool isMatched = entry.order == p->order;
+            for (int d = 0; isMatched && d < p->order; d++)
+                isMatched = entry.dims[d] == p->dimSize[d];
+            if (!isMatched) {
+                LOG("the shape of the parameter %s does not match the model file %s", entry.name, fn);
+                return false;
+            }
+
+            /* the data is read with the element size of its data type (the zero-copy
+               path uses that of the parameter), so a different unitSize is invalid */
+            if (entry.unitSize <= 0 || entry.unitSize != GetFileUnitSize(entry.dataType) ||
+                entry.size != uint64_t(p->unitNum) * entry.unitSize) {
+                LOG("invalid data type or size of the parameter %s in the model file %s", entry.name, fn);
+                return false;
+            }
+
+            if (config->common.checkModel && !mappedFile->Verify(index)) {
+                LOG("checksum mismatch of the parameter %s in the model file %s", entry.name, fn);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    if (file == NULL) {
+        LOG("no model file to load the parameters from");
+        return false;
+    }
+
+    uint64_t unitNum = 0;
+    for (int i = 0; i < params.Size(); i++)
+        unitNum += params[i]->unitNum;
+
+    /* the data of the parameters follows the configurations, and the data
+       type of the file is known by its size only */
+#ifdef _WIN32
+    uint64_t offset = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_END);
+    uint64_t fileSize = _ftelli64(file);
+#else
+    uint64_t offset = ftello(file);
+    fseeko(file, 0, SEEK_END);
+    uint64_t fileSize = ftello(file);
+#endif
+    SeekFile(file, offset);
+
+    uint64_t dataSize = fileSize >= offset ? fileSize - offset : 0;
+    uint64_t unitSize = config->common.useFP16 ? 2 : (params.Size() > 0 ? params[0]->unitSize : sizeof(float));
+    if (dataSize != unitNum * unitSize &&
+        !(config->common.useFP16 && dataSize == unitNum * sizeof(float))) {
+        LOG("the size of the model file %s does not match the parameters (%llu bytes for %llu values)",
+            fn, (unsigned long long)dataSize, (unsigned long long)unitNum);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+read the parameters. They are loaded by a pool of threads ("loadthreads"),
+each of which reads a parameter at its offset in the file. A model stored
+in FP32 is converted to FP16 on the host when running with FP16.
+>> file - the model file (after the configurations)
+*/
 void NMTModel::LoadFromFile(FILE* file)
 {
     double startT = GetClockSec();
@@ -699,9 +1185,9 @@ void NMTModel::LoadFromFile(FILE* file)
     TensorList params;
     GetParams(params);
 
-    int size = 0;
+    uint64_t unitNum = 0;
     for (int i = 0; i < params.Size(); i++) {
-        size += params[i]->unitNum;
+        unitNum += params[i]->unitNum;
     }
 
     if (config->common.useFP16) {
@@ -712,26 +1198,571 @@ void NMTModel::LoadFromFile(FILE* file)
     }
 
     /* convert parameters to FP16 before reading files */
-    if (config->common.useFP16) {
-        for (int i = 0; i < params.Size(); i++) {
-            XTensor* p = params[i];
-            InitTensor(p, p->order, p->dimSize, X_FLOAT16, p->devID, p->enableGrad && X_ENABLE_GRAD);
+    if (config->common.useFP16)
+        ConvertParamsToFP16(params);
+
+    ParamLoadJob job;
+    job.fn = config->common.modelFN;
+    job.params = &params;
+    job.fileUnitSize = params.Size() > 0 ? params[0]->unitSize : sizeof(float);
+
+    /* the data of the parameters follows the configurations one by one */
+#ifdef _WIN32
+    uint64_t offset = _ftelli64(file);
+    _fseeki64(file, 0, SEEK_END);
+    uint64_t fileSize = _ftelli64(file);
+#else
+    uint64_t offset = ftello(file);
+    fseeko(file, 0, SEEK_END);
+    uint64_t fileSize = ftello(file);
+#endif
+
+    /* the data type of the file is known by its size only, so any other
+       size (e.g., a truncated file or trailing bytes) is rejected */
+    uint64_t dataSize = fileSize >= offset ? fileSize - offset : 0;
+    if (config->common.useFP16 && dataSize == unitNum * sizeof(float)) {
+        LOG("converting the fp32 model to fp16");
+        job.fileUnitSize = sizeof(float);
+    }
+    CheckNTErrors(dataSize == unitNum * job.fileUnitSize,
+                  "The size of the model file does not match the parameters");
+
+    for (int i = 0; i < params.Size(); i++) {
+        job.offsets.push_back(offset);
+        job.order.push_back(i);
+        offset += uint64_t(params[i]->unitNum) * job.fileUnitSize;
+    }
+    sort(job.order.begin(), job.order.end(), [&params](int a, int b) {
+        return params[a]->unitNum > params[b]->unitNum;
+    });
+
+    int threadNum = config->common.loadThreads;
+    if (threadNum <= 0)
+        threadNum = MIN((int)thread::hardware_concurrency(), MAX_LOAD_THREAD_NUM);
+    threadNum = MAX(MIN(threadNum, (int)params.Size()), 1);
+
+    job.next = 0;
+    job.readTime.assign(threadNum, 0);
+    job.convertTime.assign(threadNum, 0);
+    job.copyTime.assign(threadNum, 0);
+    job.readBytes.assign(threadNum, 0);
+    job.convertBytes.assign(threadNum, 0);
+    job.copyBytes.assign(threadNum, 0);
+
+    vector<thread> workers;
+    for (int i = 0; i < threadNum; i++)
+        workers.push_back(thread(LoadParams, &job, i));
+    for (int i = 0; i < threadNum; i++)
+        workers[i].join();
+
+    double elapsed = GetClockSec() - startT;
+    LOG("model loaded (took %.1fs, %d threads)", elapsed, threadNum);
+    LOG("loading throughput per thread: read %.1f MB/s, convert %.1f MB/s, copy %.1f MB/s",
+        GetLoadThroughput(job.readTime, job.readBytes),
+        GetLoadThroughput(job.convertTime, job.convertBytes),
+        GetLoadThroughput(job.copyTime, job.copyBytes));
+}
+
+/*
+pack the output weight for inference on CPUs. The packed output weight of a
+model bundle is used in place if it matches the model, and the unpacked output
+weight is released unless it is tied to the decoder embedding. The other
+weights are not packed: they are (input, output) and MMul reads them as they are.
+*/
+void NMTModel::PackWeights()
+{
+    /* the factors are laid out for the GEMM already */
+    if (outputLayer->rank > 0)
+        return;
+
+    double startT = GetClockSec();
+
+    size_t size = 0;
+    const char* packed = NULL;
+    if (mappedFile != NULL)
+        packed = mappedFile->GetSection(MODEL_SECTION_PACKED_OUTPUT, &size);
+
+    XTensor* w = outputLayer->w;
+    if (packed != NULL && size == size_t(w->unitNum) * w->unitSize) {
+        outputLayer->PackWeight(packed);
+        LOG("using the packed output weight of the model bundle");
+    }
+    else {
+        outputLayer->PackWeight();
+        LOG("output weight packed (took %.2fs)", GetClockSec() - startT);
+    }
+
+    /* an untied weight is kept only to be saved to a model file */
+    if (strcmp(config->common.dumpModelFN, "") == 0) {
+        uint64_t released = outputLayer->ReleaseWeight();
+        if (released > 0)
+            LOG("released the unpacked output weight (%.1f MB)", (double)released / (1024 * 1024));
+    }
+}
+
+/*
+store the weights of the linear transformations (and the packed output
+weight) in FP16 for inference on CPUs. They are converted to FP32 in the
+GEMM kernel (see HalfWeight.h), while the biases, the layer normalization
+and the embeddings are kept in FP32.
+*/
+void NMTModel::ConvertWeightsToHalf()
+{
+    CheckNTErrors(!config->common.useFP16, "FP16 weights on CPUs do not work with -fp16");
+
+    vector<XTensor*> weights;
+    if (!config->model.decoderOnly) {
+        for (int i = 0; i < encoder->nlayer; i++) {
+            Attention& att = encoder->selfAtts[i];
+            weights.insert(weights.end(), { &att.weightQ, &att.weightK, &att.weightV, &att.weightO });
+        }
+    }
+    for (int i = 0; i < decoder->nlayer; i++) {
+        Attention& att = decoder->selfAtts[i];
+        weights.insert(weights.end(), { &att.weightQ, &att.weightK, &att.weightV, &att.weightO });
+        if (!config->model.decoderOnly) {
+            Attention& enDeAtt = decoder->enDeAtts[i];
+            weights.insert(weights.end(), { &enDeAtt.weightQ, &enDeAtt.weightK, &enDeAtt.weightV, &enDeAtt.weightO });
         }
+    }
+
+    vector<FFN*> ffns;
+    GetFFNs(ffns);
+    for (size_t i = 0; i < ffns.size(); i++) {
+        weights.push_back(&ffns[i]->w1);
+        weights.push_back(&ffns[i]->w2);
+        if (ffns[i]->rank1 > 0)
+            weights.push_back(&ffns[i]->v1);
+        if (ffns[i]->rank2 > 0)
+            weights.push_back(&ffns[i]->v2);
+    }
+
+    if (outputLayer->packedW != NULL)
+        weights.push_back(outputLayer->packedW);
+    if (outputLayer->rank > 0) {
+        weights.push_back(outputLayer->u);
+        weights.push_back(outputLayer->v);
+    }
+
+    uint64_t size = 0;
+    for (size_t i = 0; i < weights.size(); i++) {
+        ConvertToHalfWeight(weights[i]);
+        size += uint64_t(weights[i]->unitNum) * weights[i]->unitSize;
+    }
+
+    LOG("stored %d weights in fp16 on cpus (%.1f MB)", (int)weights.size(), (double)size / (1024 * 1024));
+}
+
+/*
+store the embedding matrices in int8 (with a scale for each row) on CPUs.
+A decoder embedding tied to the output weights is quantized only if the
+output layer has its own packed weight in FP16, as keeping a FP32 copy for
+the output layer would take more memory than the original matrix.
+*/
+void NMTModel::QuantizeEmbeddings()
+{
+    CheckNTErrors(!config->common.useFP16, "Int8 embeddings do not work with -fp16");
+
+    bool isTied = config->model.shareDecInputOutputEmb;
+    bool hasOwnOutput = outputLayer->rank > 0 ||
+                        (outputLayer->packedW != NULL && outputLayer->packedW->dataType == X_FLOAT16);
+
+    /* the decoder may share the embedder of the encoder */
+    Embedder* encEmb = config->model.decoderOnly ? NULL : &encoder->embedder;
+    Embedder* decEmb = decoder->embedder;
+
+    uint64_t size = 0;
+    if (encEmb != NULL && encEmb != decEmb) {
+        encEmb->Quantize();
+        size += uint64_t(encEmb->vSize) * encEmb->eSize;
+    }
+
+    if (!isTied || hasOwnOutput) {
+        decEmb->Quantize();
+        size += uint64_t(decEmb->vSize) * decEmb->eSize;
+    }
+    else {
+        LOG("the decoder embeddings are kept in fp32 as they are tied to the output weights "
+            "(use -cpufp16 to quantize them)");
+    }
+
+    if (size > 0)
+        LOG("stored the embeddings in int8 on cpus (%.1f MB)", (double)size / (1024 * 1024));
+}
+
+/*
+convert the parameters (and the positional embeddings) to FP16
+>> params - the parameters
+*/
+void NMTModel::ConvertParamsToFP16(TensorList& params)
+{
+    for (int i = 0; i < params.Size(); i++) {
+        XTensor* p = params[i];
+        InitTensor(p, p->order, p->dimSize, X_FLOAT16, p->devID, p->enableGrad && X_ENABLE_GRAD);
+    }
+
+    XTensor& encEmb = encoder->embedder.posEmbeddingBase;
+    encEmb = ConvertDataType(encEmb, X_FLOAT16);
+    if (!config->model.shareEncDecEmb) {
+        XTensor& decEmb = decoder->embedder->posEmbeddingBase;
+        decEmb = ConvertDataType(decEmb, X_FLOAT16);
+    }
+}
+
+/*
+dump the model to a file of the mapped format (see ModelFile.h). The
+parameters are named by their structural names in GetParams(). With the
+vocabularies, the file is a bundle that also keeps the vocabularies in the
+compact form and the decoding defaults (of the current options).
+>> fn - where to save the model
+>> srcVocab - the source vocabulary (NULL for no bundle)
+>> tgtVocab - the target vocabulary (NULL for no bundle)
+*/
+void NMTModel::DumpToMappedFile(const char* fn, Vocab* srcVocab, Vocab* tgtVocab)
+{
+    double startT = GetClockSec();
 
-        XTensor& encEmb = encoder->embedder.posEmbeddingBase;
-        encEmb = ConvertDataType(encEmb, X_FLOAT16);
-        if (!config->model.shareEncDecEmb) {
-            XTensor& decEmb = decoder->embedder->posEmbeddingBase;
-            decEmb = ConvertDataType(decEmb, X_FLOAT16);
+    TensorList params;
+    vector<string> names;
+    GetParams(params, &names);
+
+    /* the parameters are found by their names in loading */
+    vector<string> sortedNames(names);
+    sort(sortedNames.begin(), sortedNames.end());
+    CheckNTErrors(adjacent_find(sortedNames.begin(), sortedNames.end()) == sortedNames.end(),
+                  "Duplicated names of the parameters");
+
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+
+    vector<bool*> boolConfig = GetBoolConfigs();
+    vector<int*> intConfig = GetIntConfigs();
+    CheckNTErrors(boolConfig.size() <= MODEL_BOOL_NUM && intConfig.size() <= MODEL_INT_NUM,
+                  "Too many configurations for the model file");
+    for (int i = 0; i < boolConfig.size(); i++)
+        header.bools[i] = *boolConfig[i] ? 1 : 0;
+    for (int i = 0; i < intConfig.size(); i++)
+        header.ints[i] = *intConfig[i];
+
+    /* the layout and the checksums are filled by ModelFile::Write() */
+    vector<ModelParamEntry> entries(params.Size());
+    vector<const char*> buffers(params.Size());
+    for (int i = 0; i < params.Size(); i++) {
+        XTensor* p = params[i];
+        ModelParamEntry& entry = entries[i];
+        CheckNTErrors(p->order <= MODEL_MAX_DIM, "Too many dimensions for the model file");
+
+        memset(&entry, 0, sizeof(entry));
+        strcpy(entry.name, names[i].c_str());
+        entry.dataType = p->dataType;
+        entry.unitSize = p->unitSize;
+        entry.order = p->order;
+        for (int d = 0; d < p->order; d++)
+            entry.dims[d] = p->dimSize[d];
+
+        entry.size = uint64_t(p->unitNum) * p->unitSize;
+
+        /* copy the data to the host */
+        char* buffer = new char[entry.size];
+        XMemCopy(buffer, -1, p->data, p->devID, entry.size);
+        buffers[i] = buffer;
+    }
+
+    /* the sections follow the parameters */
+    vector<char> sections[MODEL_SECTION_NUM];
+    if (srcVocab != NULL && tgtVocab != NULL) {
+        CheckNTErrors(srcVocab->vocabSize <= config->model.srcVocabSize &&
+                      tgtVocab->vocabSize <= config->model.tgtVocabSize,
+                      "The vocabularies do not match the model");
+        srcVocab->DumpCompact(sections[MODEL_SECTION_SRC_VOCAB]);
+        tgtVocab->DumpCompact(sections[MODEL_SECTION_TGT_VOCAB]);
+
+        ModelDecodingConfig decoding;
+        decoding.beamSize = config->translation.beamSize;
+        decoding.lenAlpha = config->translation.lenAlpha;
+        decoding.maxLenAlpha = config->translation.maxLenAlpha;
+        decoding.maxLen = config->translation.maxLen;
+        decoding.sBatchSize = config->common.sBatchSize;
+        decoding.wBatchSize = config->common.wBatchSize;
+        const char* decodingData = (const char*)&decoding;
+        sections[MODEL_SECTION_DECODING].assign(decodingData, decodingData + sizeof(decoding));
+    }
+
+    /* the head numbers are needed to create the parameters of a pruned model */
+    if (IsPruned()) {
+        vector<Attention*> atts;
+        GetAttentions(atts);
+        vector<int32_t> heads(atts.size());
+        for (size_t i = 0; i < atts.size(); i++)
+            heads[i] = atts[i]->nhead;
+        const char* headData = (const char*)heads.data();
+        sections[MODEL_SECTION_HEADS].assign(headData, headData + sizeof(int32_t) * heads.size());
+    }
+
+    if (IsFactorized()) {
+        vector<FFN*> ffns;
+        GetFFNs(ffns);
+        vector<int32_t> ranks;
+        for (size_t i = 0; i < ffns.size(); i++) {
+            ranks.push_back(ffns[i]->rank1);
+            ranks.push_back(ffns[i]->rank2);
         }
+        ranks.push_back(outputLayer->rank);
+        const char* rankData = (const char*)ranks.data();
+        sections[MODEL_SECTION_RANKS].assign(rankData, rankData + sizeof(int32_t) * ranks.size());
+    }
+
+    /* cache the packed output weight, so it is not packed again at loading */
+    XTensor* packedW = outputLayer->packedW;
+    if (packedW != NULL && packedW->devID < 0) {
+        const char* packedData = (const char*)packedW->data;
+        sections[MODEL_SECTION_PACKED_OUTPUT].assign(packedData,
+                                                     packedData + size_t(packedW->unitNum) * packedW->unitSize);
     }
 
+    bool isWritten = ModelFile::Write(fn, header, entries, buffers, sections);
     for (int i = 0; i < params.Size(); i++)
-        params[i]->BinaryRead(file);
+        delete[] buffers[i];
+    CheckNTErrors(isWritten, "Cannot write the model file");
 
     double elapsed = GetClockSec() - startT;
-    LOG("model loaded (took %.1fs)", elapsed);
+    LOG("model saved in the mapped format (took %.1fs)", elapsed);
+}
+
+/*
+set the parameters with the mapped model file. On the CPU, a parameter of the
+same data type points into the mapping instead of being copied, so the pages
+are loaded on demand and shared by the processes using the same file.
+Otherwise (GPUs, training or another data type) the data is copied.
+*/
+void NMTModel::LoadFromMappedFile()
+{
+    double startT = GetClockSec();
+
+    LOG("loading parameters from the mapped model file...");
+
+    TensorList params;
+    vector<string> names;
+    GetParams(params, &names);
+
+    if (config->common.useFP16) {
+        LOG("running with fp16");
+        ConvertParamsToFP16(params);
+    }
+    else {
+        LOG("running with fp32");
+    }
+
+    /* the parameters have been checked against the file by CheckModelFile() */
+    int sharedNum = 0;
+    for (int i = 0; i < params.Size(); i++) {
+        XTensor* p = params[i];
+        int index = mappedFile->Find(names[i].c_str());
+        CheckNTErrors(index >= 0, "The parameters do not match the model file");
+        const ModelParamEntry& entry = mappedFile->entries[index];
+
+        char* data = (char*)mappedFile->GetData(index);
+
+        if (entry.dataType == p->dataType && p->devID < 0 && !config->training.isTraining) {
+            /* zero-copy: the tensor does not own the data */
+            p->DestroyData();
+            p->data = data;
+            p->isShared = true;
+            sharedNum++;
+        }
+        else if (entry.dataType == p->dataType) {
+            p->SetData(data, p->unitNum);
+        }
+        else {
+            /* convert the data on the host */
+            XTensor source;
+            XTensor target;
+            InitTensor(&source, p->order, p->dimSize, (TENSOR_DATA_TYPE)entry.dataType, -1);
+            InitTensor(&target, p->order, p->dimSize, p->dataType, -1);
+            source.SetData(data, p->unitNum);
+            _ConvertDataType(&source, &target);
+            p->SetData(target.data, p->unitNum);
+        }
+    }
+
+    double elapsed = GetClockSec() - startT;
+    LOG("model loaded (took %.1fs, %d of %d parameters mapped)", elapsed, sharedNum, (int)params.Size());
+}
+
+/*
+get the attention modules, i.e., the self-attentions of the encoder, then the
+self-attentions and the encoder-decoder attentions of the decoder
+>> atts - the attention modules
+*/
+void NMTModel::GetAttentions(vector<Attention*>& atts)
+{
+    atts.clear();
+    if (!config->model.decoderOnly) {
+        for (int i = 0; i < encoder->nlayer; i++)
+            atts.push_back(&encoder->selfAtts[i]);
+    }
+    for (int i = 0; i < decoder->nlayer; i++)
+        atts.push_back(&decoder->selfAtts[i]);
+    if (!config->model.decoderOnly) {
+        for (int i = 0; i < decoder->nlayer; i++)
+            atts.push_back(&decoder->enDeAtts[i]);
+    }
+}
+
+/* check whether some attention heads are pruned */
+bool NMTModel::IsPruned()
+{
+    vector<Attention*> atts;
+    GetAttentions(atts);
+    for (size_t i = 0; i < atts.size(); i++) {
+        if (atts[i]->nhead * atts[i]->headDim != atts[i]->embDim)
+            return true;
+    }
+    return false;
+}
+
+/*
+turn on/off the scoring of the attention heads (see Attention::ScoreHeads)
+>> isScoring - indicates whether the heads are scored
+*/
+void NMTModel::SetHeadScoring(bool isScoring)
+{
+    vector<Attention*> atts;
+    GetAttentions(atts);
+    for (size_t i = 0; i < atts.size(); i++) {
+        atts[i]->scoreHeads = isScoring;
+        atts[i]->headScores.clear();
+        atts[i]->headScoreNum = 0;
+    }
+}
+
+/*
+remove the least important attention heads. The scores accumulated by the
+attentions are normalized to sum to 1 in each attention, so that the layers
+are comparable, and the heads with the lowest scores over the whole model
+are removed. An attention keeps one head at least.
+>> ratio - the ratio of the heads to remove
+*/
+void NMTModel::PruneHeads(float ratio)
+{
+    CheckNTErrors(ratio >= 0 && ratio < 1, "The ratio of the pruned heads should be in [0, 1)");
+
+    vector<Attention*> atts;
+    GetAttentions(atts);
+
+    /* (score, attention, head) of the heads that can be removed */
+    vector<pair<double, pair<int, int>>> candidates;
+    int totalNum = 0;
+    for (size_t i = 0; i < atts.size(); i++) {
+        Attention* att = atts[i];
+        totalNum += att->nhead;
+        if (!att->splitHeads)
+            continue;
+        CheckNTErrors((int)att->headScores.size() == att->nhead, "The heads are not scored");
+
+        double sum = 0;
+        for (int h = 0; h < att->nhead; h++)
+            sum += att->headScores[h];
+        for (int h = 0; h < att->nhead; h++) {
+            double score = sum > 0 ? att->headScores[h] / sum : 0;
+            candidates.push_back(make_pair(score, make_pair((int)i, h)));
+        }
+    }
+
+    sort(candidates.begin(), candidates.end());
+
+    vector<vector<bool>> isRemoved(atts.size());
+    vector<int> keptNum(atts.size());
+    for (size_t i = 0; i < atts.size(); i++) {
+        isRemoved[i].assign(atts[i]->nhead, false);
+        keptNum[i] = atts[i]->nhead;
+    }
+
+    int removedNum = 0;
+    int targetNum = (int)(totalNum * ratio);
+    for (size_t c = 0; c < candidates.size() && removedNum < targetNum; c++) {
+        int i = candidates[c].second.first;
+        int h = candidates[c].second.second;
+        if (keptNum[i] <= 1)
+            continue;
+        isRemoved[i][h] = true;
+        keptNum[i]--;
+        removedNum++;
+    }
+
+    for (size_t i = 0; i < atts.size(); i++) {
+        if (keptNum[i] == atts[i]->nhead)
+            continue;
+        vector<int> heads;
+        for (int h = 0; h < atts[i]->nhead; h++) {
+            if (!isRemoved[i][h])
+                heads.push_back(h);
+        }
+        atts[i]->PruneHeads(heads);
+    }
 
+    SetHeadScoring(false);
+    LOG("pruned %d of %d attention heads", removedNum, totalNum);
+}
+
+/*
+get the FFN modules, i.e., those of the encoder, then those of the decoder
+>> ffns - the FFN modules
+*/
+void NMTModel::GetFFNs(vector<FFN*>& ffns)
+{
+    ffns.clear();
+    if (!config->model.decoderOnly) {
+        for (int i = 0; i < encoder->nlayer; i++)
+            ffns.push_back(&encoder->ffns[i]);
+    }
+    if (decoder->ffns != NULL) {
+        for (int i = 0; i < decoder->nlayer; i++)
+            ffns.push_back(&decoder->ffns[i]);
+    }
+}
+
+/* check whether some weights are factorized */
+bool NMTModel::IsFactorized()
+{
+    vector<FFN*> ffns;
+    GetFFNs(ffns);
+    for (size_t i = 0; i < ffns.size(); i++) {
+        if (ffns[i]->rank1 > 0 || ffns[i]->rank2 > 0)
+            return true;
+    }
+    return outputLayer->rank > 0;
+}
+
+/*
+factorize the weights with the truncated SVD (see LowRank.h). A weight is
+kept if its factors would not save computation at the rank.
+>> isFFN - indicates whether the FFN weights are factorized
+>> isOutput - indicates whether the output projection is factorized
+>> rank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy to keep if the rank is not given
+*/
+void NMTModel::Factorize(bool isFFN, bool isOutput, int rank, float energy)
+{
+    double startT = GetClockSec();
+    uint64_t oldNum = GetParamNum();
+
+    if (isFFN) {
+        vector<FFN*> ffns;
+        GetFFNs(ffns);
+        for (size_t i = 0; i < ffns.size(); i++) {
+            ffns[i]->Factorize(rank, energy);
+            LOG("factorized the FFN %d (ranks: %d, %d)", (int)i, ffns[i]->rank1, ffns[i]->rank2);
+        }
+    }
+
+    if (isOutput) {
+        outputLayer->Factorize(rank, energy);
+        LOG("factorized the output projection (rank: %d)", outputLayer->rank);
+    }
+
+    LOG("factorized the weights (took %.1fs, %.1fM -> %.1fM parameters)", GetClockSec() - startT,
+        (double)oldNum / 1e6, (double)GetParamNum() / 1e6);
 }
 
 /* get the total number of parameters */
@@ -747,6 +1778,68 @@ uint64_t NMTModel::GetParamNum()
     return totalNum;
 }
 
+/*
+get the size of the memory allocated for the parameters in bytes, i.e., the
+parameters without data (e.g., quantized embeddings) or with the data in a
+mapped file are not counted, while the int8 embeddings and the packed output
+weight (also when it is tied to the decoder embeddings) are
+*/
+uint64_t NMTModel::GetParamSize()
+{
+    TensorList params;
+    GetParams(params);
+    uint64_t totalSize = 0;
+    for (int i = 0; i < params.Size(); i++) {
+        if (params[i]->data == NULL || params[i]->isShared)
+            continue;
+        totalSize += uint64_t(params[i]->unitNum) * params[i]->unitSize;
+    }
+
+    /* the decoder may share the embedder of the encoder */
+    Embedder* encEmb = config->model.decoderOnly ? NULL : &encoder->embedder;
+    Embedder* decEmb = decoder->embedder;
+    Embedder* embs[] = { encEmb, decEmb != encEmb ? decEmb : NULL };
+    for (int i = 0; i < 2; i++) {
+        if (embs[i] != NULL && embs[i]->qw != NULL)
+            totalSize += uint64_t(embs[i]->vSize) * embs[i]->eSize * sizeof(int8_t) +
+                         uint64_t(embs[i]->vSize) * sizeof(float);
+    }
+
+    /* the packed weight is a parameter only if w is released */
+    XTensor* packedW = outputLayer->packedW;
+    if (packedW != NULL && packedW->data != NULL && !packedW->isShared) {
+        bool isListed = false;
+        for (int i = 0; i < params.Size() && !isListed; i++)
+            isListed = params[i] == packedW;
+        if (!isListed)
+            totalSize += uint64_t(packedW->unitNum) * packedW->unitSize;
+    }
+
+    return totalSize;
+}
+
+/*
+read every page of the parameters on the host, so that the pages of
+a mapped or lazily allocated model are faulted in before translation
+*/
+void NMTModel::TouchParams()
+{
+    TensorList params;
+    GetParams(params);
+
+    const size_t pageSize = 4096;
+    volatile unsigned char sum = 0;
+    for (int i = 0; i < params.Size(); i++) {
+        XTensor* param = params[i];
+        if (param->devID >= 0 || param->data == NULL)
+            continue;
+        const unsigned char* data = (const unsigned char*)param->data;
+        size_t size = size_t(param->unitNum) * param->unitSize;
+        for (size_t offset = 0; offset < size; offset += pageSize)
+            sum += data[offset];
+    }
+}
+
 /* set the training flags in all sub-models */
 void NMTModel::SetTrainingFlag(bool isTraining)
 {
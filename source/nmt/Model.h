@@ -29,6 +29,8 @@
 #include "submodel/FFN.h"
 #include "submodel/Output.h"
 #include "submodel/Attention.h"
+#include "ModelFile.h"
+#include "translate/Vocab.h"
 #include "../niutensor/train/XModel.h"
 
 /* the nmt namespace */
@@ -55,6 +57,9 @@ public:
     /* output layer */
     OutputLayer* outputLayer;
 
+    /* the mapped model file (NULL if the model is read from a file of the old format) */
+    ModelFile* mappedFile;
+
 public:
     /* constructor */
     NMTModel();
@@ -65,9 +70,15 @@ public:
     /* get configurations */
     vector<int*> GetIntConfigs();
 
-    /* initialize the model */
+    /* get configurations (boolean) */
+    vector<bool*> GetBoolConfigs();
+
+    /* initialize the model (a model file that can not be loaded is fatal) */
     void InitModel(NMTConfig& config);
 
+    /* initialize the model, and report a model file that can not be loaded */
+    bool TryInitModel(NMTConfig& config);
+
     /* print model configurations */
     void ShowModelConfig();
 
@@ -100,18 +111,69 @@ public:
     /* make the mask of the decoder for inference */
     XTensor MakeMTMaskDecInference(XTensor& paddingEnc);
 
+    /* make the self-attention mask of the decoder for feeding several tokens during inference */
+    XTensor MakeMTMaskDecPrefix(int batchSize, int lenQ, int start);
+
     /* get parameter matrices */
-    void GetParams(TensorList& list);
+    void GetParams(TensorList& list, vector<string>* names = NULL);
 
     /* dump the model to a file */
     void DumpToFile(const char* fn);
 
+    /* check that the model file matches the parameters before loading them */
+    bool CheckModelFile(FILE* file);
+
     /* read the parameters */
     void LoadFromFile(FILE* file);
 
+    /* dump the model to a file of the mapped format (a bundle with the vocabularies) */
+    void DumpToMappedFile(const char* fn, Vocab* srcVocab = NULL, Vocab* tgtVocab = NULL);
+
+    /* set the parameters with the mapped model file */
+    void LoadFromMappedFile();
+
+    /* pack the output weight for inference on CPUs */
+    void PackWeights();
+
+    /* store the weights of the linear transformations in FP16 on CPUs */
+    void ConvertWeightsToHalf();
+
+    /* store the embedding matrices in int8 on CPUs */
+    void QuantizeEmbeddings();
+
+    /* convert the parameters to FP16 */
+    void ConvertParamsToFP16(TensorList& params);
+
+    /* get the attention modules */
+    void GetAttentions(vector<Attention*>& atts);
+
+    /* check whether some attention heads are pruned */
+    bool IsPruned();
+
+    /* turn on/off the scoring of the attention heads */
+    void SetHeadScoring(bool isScoring);
+
+    /* remove the least important attention heads */
+    void PruneHeads(float ratio);
+
+    /* get the FFN modules */
+    void GetFFNs(vector<FFN*>& ffns);
+
+    /* check whether some weights are factorized */
+    bool IsFactorized();
+
+    /* factorize the weights with the truncated SVD */
+    void Factorize(bool isFFN, bool isOutput, int rank, float energy);
+
     /* get the number of parameters */
     uint64_t GetParamNum();
 
+    /* get the size of the memory allocated for the parameters in bytes */
+    uint64_t GetParamSize();
+
+    /* read every page of the parameters on the host */
+    void TouchParams();
+
     /* set the training flag */
     void SetTrainingFlag(bool isTraining);
 
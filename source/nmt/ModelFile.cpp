@@ -0,0 +1,341 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include "ModelFile.h"
+#include "../niutensor/tensor/XGlobal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+ModelFile::ModelFile()
+{
+    base = NULL;
+    size = 0;
+    isMapped = false;
+    header = NULL;
+    entries = NULL;
+}
+
+/* de-constructor */
+ModelFile::~ModelFile()
+{
+    Close();
+}
+
+/*
+check whether a file is of the mapped format
+>> fn - path to the file
+<< return - whether the file starts with the magic number
+*/
+bool ModelFile::IsModelFile(const char* fn)
+{
+    FILE* file = fopen(fn, "rb");
+    if (file == NULL)
+        return false;
+
+    char magic[8];
+    bool isModelFile = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                       memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+
+    return isModelFile;
+}
+
+/*
+write a model file. The caller gives the configurations in the header and
+the names, data types, shapes and sizes of the parameters, and the layout
+(the offsets) and the checksums are filled here.
+>> fn - path to the file
+>> header - the header (its layout and checksums are filled)
+>> entries - the parameter table (the offsets and checksums are filled)
+>> data - the data of each parameter (on the host)
+>> sections - the data of the sections (MODEL_SECTION_NUM of them, empty if unused)
+<< return - whether the file is written
+*/
+bool ModelFile::Write(const char* fn, ModelFileHeader& header, vector<ModelParamEntry>& entries,
+                      const vector<const char*>& data, const vector<char>* sections)
+{
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.paramNum = (uint32_t)entries.size();
+
+    /* the table follows the header, and the data follows the table */
+    header.tableOffset = sizeof(ModelFileHeader);
+    uint64_t offset = header.tableOffset + sizeof(ModelParamEntry) * entries.size();
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        ModelParamEntry& entry = entries[i];
+        offset = (offset + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+        entry.offset = offset;
+        entry.checksum = Checksum(data[i], entry.size);
+        offset += entry.size;
+    }
+
+    /* the sections follow the parameters */
+    for (int i = 0; i < MODEL_SECTION_NUM; i++) {
+        memset(&header.sections[i], 0, sizeof(ModelSection));
+        if (sections[i].empty())
+            continue;
+        offset = (offset + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+        header.sections[i].offset = offset;
+        header.sections[i].size = sections[i].size();
+        header.sections[i].checksum = Checksum(sections[i].data(), sections[i].size());
+        offset += sections[i].size();
+    }
+
+    header.fileSize = offset;
+    header.tableChecksum = Checksum(entries.data(), sizeof(ModelParamEntry) * entries.size());
+    header.headerChecksum = Checksum(&header, offsetof(ModelFileHeader, headerChecksum));
+
+    FILE* file = fopen(fn, "wb");
+    if (file == NULL)
+        return false;
+
+    bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                     fwrite(entries.data(), sizeof(ModelParamEntry), entries.size(), file) == entries.size();
+
+    const char padding[MODEL_ALIGN] = { 0 };
+    uint64_t pos = header.tableOffset + sizeof(ModelParamEntry) * entries.size();
+    for (size_t i = 0; i < entries.size() && isWritten; i++) {
+        isWritten = fwrite(padding, 1, entries[i].offset - pos, file) == entries[i].offset - pos &&
+                    fwrite(data[i], 1, entries[i].size, file) == entries[i].size;
+        pos = entries[i].offset + entries[i].size;
+    }
+    for (int i = 0; i < MODEL_SECTION_NUM && isWritten; i++) {
+        if (sections[i].empty())
+            continue;
+        isWritten = fwrite(padding, 1, header.sections[i].offset - pos, file) == header.sections[i].offset - pos &&
+                    fwrite(sections[i].data(), 1, sections[i].size(), file) == sections[i].size();
+        pos = header.sections[i].offset + header.sections[i].size;
+    }
+
+    return fclose(file) == 0 && isWritten;
+}
+
+/*
+open a model file and check the header and the parameter table. The data of
+the parameters is checked by Verify() on request, as reading it all would
+fault in the whole file.
+>> fn - path to the file
+<< return - whether the file is valid
+*/
+bool ModelFile::Open(const char* fn)
+{
+    Close();
+
+#ifndef _WIN32
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    fstat(fd, &st);
+    size = st.st_size;
+    if (size < sizeof(ModelFileHeader)) {
+        close(fd);
+        return false;
+    }
+
+    /* a private mapping, i.e., the pages are shared until they are written */
+    base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        base = NULL;
+        return false;
+    }
+    isMapped = true;
+#else
+    FILE* file = fopen(fn, "rb");
+    if (file == NULL)
+        return false;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    base = new char[size];
+    bool isRead = fread(base, 1, size, file) == size;
+    fclose(file);
+    if (!isRead) {
+        Close();
+        return false;
+    }
+#endif
+
+    header = (const ModelFileHeader*)base;
+    if (size < sizeof(ModelFileHeader) ||
+        memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0) {
+        Close();
+        return false;
+    }
+
+    if (header->version != MODEL_VERSION) {
+        LOG("unsupported version %u of the model file %s", header->version, fn);
+        Close();
+        return false;
+    }
+
+    if (header->headerChecksum != Checksum(header, offsetof(ModelFileHeader, headerChecksum)) ||
+        header->fileSize != size ||
+        header->tableOffset > size ||
+        sizeof(ModelParamEntry) * uint64_t(header->paramNum) > size - header->tableOffset) {
+        LOG("the model file %s is corrupted or truncated", fn);
+        Close();
+        return false;
+    }
+
+    entries = (const ModelParamEntry*)(base + header->tableOffset);
+    if (header->tableChecksum != Checksum(entries, sizeof(ModelParamEntry) * header->paramNum)) {
+        LOG("the parameter table of the model file %s is corrupted", fn);
+        Close();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header->paramNum; i++) {
+        if (memchr(entries[i].name, 0, MODEL_NAME_LEN) == NULL) {
+            LOG("invalid name of the parameter %u in the model file %s", i, fn);
+            Close();
+            return false;
+        }
+        /* the offset is compared first, so the sum never wraps around */
+        if (entries[i].offset % MODEL_ALIGN != 0 || entries[i].offset > size ||
+            entries[i].size > size - entries[i].offset) {
+            LOG("invalid parameter %s in the model file %s", entries[i].name, fn);
+            Close();
+            return false;
+        }
+    }
+
+    /* the sections are small, so they are always checked */
+    for (int i = 0; i < MODEL_SECTION_NUM; i++) {
+        const ModelSection& section = header->sections[i];
+        if (section.size == 0)
+            continue;
+        if (section.offset % MODEL_ALIGN != 0 || section.offset > size ||
+            section.size > size - section.offset ||
+            Checksum(base + section.offset, section.size) != section.checksum) {
+            LOG("invalid section %d in the model file %s", i, fn);
+            Close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* close the file */
+void ModelFile::Close()
+{
+#ifndef _WIN32
+    if (base != NULL && isMapped)
+        munmap(base, size);
+#endif
+    if (base != NULL && !isMapped)
+        delete[] base;
+
+    base = NULL;
+    size = 0;
+    isMapped = false;
+    header = NULL;
+    entries = NULL;
+}
+
+/*
+find a parameter by its name
+>> name - the structural name of the parameter
+<< return - index of the parameter (-1 if it is not found)
+*/
+int ModelFile::Find(const char* name)
+{
+    for (uint32_t i = 0; i < header->paramNum; i++) {
+        if (strcmp(entries[i].name, name) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+/*
+get the data of a parameter
+>> i - index of the parameter
+<< return - the data
+*/
+const char* ModelFile::GetData(int i)
+{
+    return base + entries[i].offset;
+}
+
+/*
+check the data of a parameter against its checksum
+>> i - index of the parameter
+<< return - whether the data is valid
+*/
+bool ModelFile::Verify(int i)
+{
+    return Checksum(GetData(i), entries[i].size) == entries[i].checksum;
+}
+
+/*
+get the data of a section
+>> type - the section
+>> sectionSize - size of the section in bytes (0 if it does not exist)
+<< return - the data (NULL if the section does not exist)
+*/
+const char* ModelFile::GetSection(ModelSectionType type, size_t* sectionSize)
+{
+    const ModelSection& section = header->sections[type];
+    *sectionSize = section.size;
+    return section.size > 0 ? base + section.offset : NULL;
+}
+
+/*
+compute the checksum of a block of data. It hashes 8 bytes at a time
+(in the way of FNV-1a), which is fast enough for the parameters.
+>> data - the data
+>> size - size of the data in bytes
+<< return - the checksum
+*/
+uint64_t ModelFile::Checksum(const void* data, size_t size)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = 14695981039346656037ULL;
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h ^= word;
+        h *= 1099511628211ULL;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+
+    return h ^ size;
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,221 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The mapped model format (version 2). A file has a header with a magic
+ * number, the version and the model configurations, a table of parameters
+ * (names, data types, shapes, offsets and checksums), and the data of the
+ * parameters aligned to 64 bytes. The file is mapped into memory, so the
+ * parameters on the host point into the mapping rather than being copied,
+ * and the processes that load the same model share the page cache.
+ *
+ * A model bundle is a file of this format with the optional sections, i.e.,
+ * the vocabularies in the compact form of Vocab and the decoding defaults,
+ * so that a translator can be started with the model file only. A bundle
+ * may also cache the packed output weight (see OutputLayer::PackWeight).
+ * A model with pruned attention heads keeps the head number of each
+ * attention in a section, and a model with factorized weights keeps their
+ * ranks in another, as the shapes of the parameters depend on them.
+ *
+ * File layout:
+ *     ModelFileHeader
+ *     ModelParamEntry * paramNum  (at tableOffset)
+ *     data of the parameters      (each at a 64-byte aligned offset)
+ *     data of the sections        (each at a 64-byte aligned offset)
+ */
+
+#ifndef __MODELFILE_H__
+#define __MODELFILE_H__
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+#define MODEL_MAGIC "NMTMODEL"
+#define MODEL_VERSION 2
+#define MODEL_ALIGN 64
+#define MODEL_NAME_LEN 64
+#define MODEL_MAX_DIM 8
+#define MODEL_BOOL_NUM 16
+#define MODEL_INT_NUM 32
+#define MODEL_SECTION_NUM 8
+
+/* the optional sections of a model file. A new section type takes a free
+   entry of the section table, and the readers that do not know it ignore
+   it (the shapes of the parameters are still checked), so adding a section
+   does not change the version. */
+enum ModelSectionType
+{
+    MODEL_SECTION_SRC_VOCAB,
+    MODEL_SECTION_TGT_VOCAB,
+    MODEL_SECTION_DECODING,
+    MODEL_SECTION_PACKED_OUTPUT,
+    MODEL_SECTION_HEADS,
+    MODEL_SECTION_RANKS
+};
+
+/* a section of a model file (the size is 0 if the section does not exist) */
+struct ModelSection
+{
+    /* offset of the data (aligned to MODEL_ALIGN) */
+    uint64_t offset;
+
+    /* size of the data in bytes */
+    uint64_t size;
+
+    /* checksum of the data */
+    uint64_t checksum;
+};
+
+/* the decoding defaults kept in a model bundle */
+struct ModelDecodingConfig
+{
+    int32_t beamSize;
+    float lenAlpha;
+    float maxLenAlpha;
+    int32_t maxLen;
+    int32_t sBatchSize;
+    int32_t wBatchSize;
+};
+
+/* the header of a model file */
+struct ModelFileHeader
+{
+    /* the magic number */
+    char magic[8];
+
+    /* the version of the format */
+    uint32_t version;
+
+    /* number of parameters */
+    uint32_t paramNum;
+
+    /* the boolean configurations (in the order of NMTModel::GetBoolConfigs) */
+    uint8_t bools[MODEL_BOOL_NUM];
+
+    /* the integer configurations (in the order of NMTModel::GetIntConfigs) */
+    int32_t ints[MODEL_INT_NUM];
+
+    /* offset of the parameter table */
+    uint64_t tableOffset;
+
+    /* size of the file */
+    uint64_t fileSize;
+
+    /* checksum of the parameter table */
+    uint64_t tableChecksum;
+
+    /* the optional sections (in the order of ModelSectionType) */
+    ModelSection sections[MODEL_SECTION_NUM];
+
+    /* checksum of the fields above */
+    uint64_t headerChecksum;
+};
+
+/* an entry of the parameter table */
+struct ModelParamEntry
+{
+    /* the structural name of the parameter (e.g., "encoder.layer3.ffn.w1") */
+    char name[MODEL_NAME_LEN];
+
+    /* the data type (TENSOR_DATA_TYPE) */
+    int32_t dataType;
+
+    /* size of an element in bytes */
+    int32_t unitSize;
+
+    /* number of dimensions */
+    int32_t order;
+
+    /* size of each dimension */
+    int32_t dims[MODEL_MAX_DIM];
+
+    /* offset of the data (aligned to MODEL_ALIGN) */
+    uint64_t offset;
+
+    /* size of the data in bytes */
+    uint64_t size;
+
+    /* checksum of the data */
+    uint64_t checksum;
+};
+
+/* a mapped model file */
+class ModelFile
+{
+private:
+    /* the data of the file */
+    char* base;
+
+    /* size of the file */
+    size_t size;
+
+    /* indicates whether the data is mapped (or read into a buffer) */
+    bool isMapped;
+
+public:
+    /* the header */
+    const ModelFileHeader* header;
+
+    /* the parameter table */
+    const ModelParamEntry* entries;
+
+public:
+    /* constructor */
+    ModelFile();
+
+    /* de-constructor */
+    ~ModelFile();
+
+    /* check whether a file is of the mapped format */
+    static bool IsModelFile(const char* fn);
+
+    /* write a model file */
+    static bool Write(const char* fn, ModelFileHeader& header, vector<ModelParamEntry>& entries,
+                      const vector<const char*>& data, const vector<char>* sections);
+
+    /* open a model file and check the header and the parameter table */
+    bool Open(const char* fn);
+
+    /* close the file */
+    void Close();
+
+    /* find a parameter by its name */
+    int Find(const char* name);
+
+    /* get the data of a parameter */
+    const char* GetData(int i);
+
+    /* check the data of a parameter against its checksum */
+    bool Verify(int i);
+
+    /* get the data of a section */
+    const char* GetSection(ModelSectionType type, size_t* sectionSize);
+
+    /* compute the checksum of a block of data */
+    static uint64_t Checksum(const void* data, size_t size);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __MODELFILE_H__ */
@@ -0,0 +1,638 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include "BatchScheduler.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/*
+constructor
+>> myNum - number of sentences
+>> myPriority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+*/
+ServiceRequest::ServiceRequest(int myNum, int myPriority, float timeout)
+{
+    num = myNum;
+    priority = myPriority;
+    status = REQUEST_OK;
+    remaining = myNum;
+    outputs = new IntList * [MAX(num, 1)];
+    partials = new bool[MAX(num, 1)];
+    for (int i = 0; i < num; i++) {
+        outputs[i] = NULL;
+        partials[i] = false;
+    }
+    arrival = chrono::steady_clock::now();
+    if (timeout > 0)
+        deadline = arrival + chrono::microseconds((long)(timeout * 1000));
+    else
+        deadline = chrono::steady_clock::time_point::max();
+}
+
+/* de-constructor */
+ServiceRequest::~ServiceRequest()
+{
+    for (int i = 0; i < num; i++)
+        delete outputs[i];
+    delete[] outputs;
+    delete[] partials;
+}
+
+/* constructor */
+PendingQueue::PendingQueue()
+{
+    maxLen = 0;
+}
+
+/* get the number of sentences */
+int PendingQueue::Size() const
+{
+    return int(sentences.size());
+}
+
+/*
+add a sentence
+>> sentence - the sentence
+*/
+void PendingQueue::Push(const PendingSentence& sentence)
+{
+    sentences.push_back(sentence);
+    maxLen = MAX(maxLen, int(sentence.sample->srcSeq->Size()));
+}
+
+/* update the maximum source length after the sentences are removed */
+void PendingQueue::UpdateMaxLen()
+{
+    maxLen = 0;
+    for (size_t i = 0; i < sentences.size(); i++)
+        maxLen = MAX(maxLen, int(sentences[i].sample->srcSeq->Size()));
+}
+
+/*
+check whether the sentences fill a batch, in the same way as the batch
+size is chosen in TranslateDataset::GetBatchSimple
+>> sBatchSize - the maximum number of sentences of a batch
+>> wBatchSize - the maximum number of tokens of a batch
+>> beamSize - the beam size
+*/
+bool PendingQueue::IsBatchFull(int sBatchSize, int wBatchSize, int beamSize) const
+{
+    int num = int(sentences.size());
+    return num >= sBatchSize || num * maxLen * beamSize >= wBatchSize;
+}
+
+/*
+get the time when the sentences are dispatched without a full batch, i.e.,
+when the oldest one has waited for the maximum time, or earlier if a
+deadline comes first
+>> maxWait - the maximum waiting time in ms
+<< return - the time (time_point::max() if there is no sentence)
+*/
+chrono::steady_clock::time_point PendingQueue::GetDispatchTime(float maxWait) const
+{
+    chrono::microseconds wait((long)(maxWait * 1000));
+    chrono::steady_clock::time_point time = chrono::steady_clock::time_point::max();
+
+    for (size_t i = 0; i < sentences.size(); i++) {
+        ServiceRequest* request = sentences[i].request;
+        time = MIN(time, request->arrival + wait);
+        time = MIN(time, request->deadline);
+    }
+
+    return time;
+}
+
+/*
+remove the sentences whose deadlines are passed
+>> now - the current time
+>> dropped - the removed sentences (appended)
+*/
+void PendingQueue::DropExpired(chrono::steady_clock::time_point now, vector<PendingSentence>& dropped)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < sentences.size(); i++) {
+        if (sentences[i].request->deadline <= now)
+            dropped.push_back(sentences[i]);
+        else
+            sentences[count++] = sentences[i];
+    }
+
+    sentences.resize(count);
+    UpdateMaxLen();
+}
+
+/*
+remove the sentences whose token ids are not in the vocabularies
+>> srcVocabSize - size of the source vocabulary
+>> tgtVocabSize - size of the target vocabulary
+>> dropped - the removed sentences (appended)
+*/
+void PendingQueue::DropInvalid(int srcVocabSize, int tgtVocabSize, vector<PendingSentence>& dropped)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < sentences.size(); i++) {
+        if (!IsValid(sentences[i].sample, srcVocabSize, tgtVocabSize))
+            dropped.push_back(sentences[i]);
+        else
+            sentences[count++] = sentences[i];
+    }
+
+    sentences.resize(count);
+    UpdateMaxLen();
+}
+
+/*
+take the first sentences in the order of priority and then deadline (the
+order of arrival is kept for the same priority and deadline)
+>> num - the maximum number of sentences
+>> group - the sentences (the output)
+*/
+void PendingQueue::Pop(int num, vector<PendingSentence>& group)
+{
+    stable_sort(sentences.begin(), sentences.end(),
+        [](const PendingSentence& a, const PendingSentence& b) {
+            if (a.request->priority != b.request->priority)
+                return a.request->priority > b.request->priority;
+            return a.request->deadline < b.request->deadline;
+        });
+
+    num = MIN(num, int(sentences.size()));
+    group.assign(sentences.begin(), sentences.begin() + num);
+    sentences.erase(sentences.begin(), sentences.begin() + num);
+    UpdateMaxLen();
+}
+
+/*
+check whether the token ids are in a vocabulary
+>> ids - the token ids
+>> vocabSize - size of the vocabulary
+<< return - whether 0 <= id < vocabSize for all ids
+*/
+static bool IsInVocab(const IntList* ids, int vocabSize)
+{
+    for (int i = 0; i < ids->count; i++) {
+        if (ids->items[i] < 0 || ids->items[i] >= vocabSize)
+            return false;
+    }
+    return true;
+}
+
+/*
+check whether the token ids of a sentence are in the vocabularies
+>> sample - the source sequence and the forced prefix
+>> srcVocabSize - size of the source vocabulary
+>> tgtVocabSize - size of the target vocabulary
+*/
+bool PendingQueue::IsValid(const Sample* sample, int srcVocabSize, int tgtVocabSize)
+{
+    return IsInVocab(sample->srcSeq, srcVocabSize) &&
+           (sample->tgtSeq == NULL || IsInVocab(sample->tgtSeq, tgtVocabSize));
+}
+
+/* constructor */
+BatchScheduler::BatchScheduler()
+{
+    translator = NULL;
+    nextTranslator = NULL;
+    config = NULL;
+    nextConfig = NULL;
+    running = false;
+    isDispatching = false;
+    groupNum = 0;
+    sentNum = 0;
+    droppedNum = 0;
+    rejectedNum = 0;
+    expiredNum = 0;
+}
+
+/* de-constructor */
+BatchScheduler::~BatchScheduler()
+{
+    Stop();
+}
+
+/*
+initialize the scheduler
+>> myConfig - configuration of the NMT system
+>> myTranslator - the translator (initialized), which should not be used
+                  by others while the scheduler is running
+*/
+void BatchScheduler::Init(NMTConfig& myConfig, Translator& myTranslator)
+{
+    config = &myConfig;
+    translator = &myTranslator;
+}
+
+/* start the dispatcher thread */
+void BatchScheduler::Start()
+{
+    CheckNTErrors(translator != NULL, "The scheduler is not initialized");
+
+    if (running)
+        return;
+
+    running = true;
+    isDispatching = true;
+    dispatcher = thread(&BatchScheduler::Dispatch, this);
+
+    LOG("batch scheduler started (maxWait=%.1fms, batchSize= %d sents | %d tokens)",
+        config->service.maxWait, config->common.sBatchSize, config->common.wBatchSize);
+}
+
+/* stop the dispatcher thread after the waiting sentences are translated */
+void BatchScheduler::Stop()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if (!running)
+            return;
+        running = false;
+    }
+
+    queueCond.notify_all();
+    dispatcher.join();
+
+    LOG("batch scheduler stopped (%ld sentences in %ld groups, %ld dropped, %ld requests rejected)",
+        sentNum, groupNum, droppedNum, rejectedNum);
+}
+
+/*
+submit a request. The sequences are copied, so they can be released
+after the call.
+>> srcs - the source sequences (token ids)
+>> prefixes - the forced target prefixes (NULL if not used, or NULL for some sequences)
+>> num - number of the sequences
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+<< return - the request, released by the caller after Wait(). Its status is
+            REQUEST_REJECTED if the queue is full, and the caller may retry later,
+            or REQUEST_INVALID if a source id is not in [0, srcVocabSize) or
+            a prefix id is not in [0, tgtVocabSize).
+*/
+ServiceRequest* BatchScheduler::Submit(IntList** srcs, IntList** prefixes, int num,
+                                       int priority, float timeout)
+{
+    vector<const int*> srcItems(num);
+    vector<int> srcLens(num);
+    vector<const int*> prefixItems(num, NULL);
+    vector<int> prefixLens(num, 0);
+
+    for (int i = 0; i < num; i++) {
+        srcItems[i] = srcs[i]->items;
+        srcLens[i] = int(srcs[i]->Size());
+        if (prefixes != NULL && prefixes[i] != NULL) {
+            prefixItems[i] = prefixes[i]->items;
+            prefixLens[i] = int(prefixes[i]->Size());
+        }
+    }
+
+    return Submit(srcItems.data(), srcLens.data(), prefixItems.data(), prefixLens.data(),
+                  num, priority, timeout);
+}
+
+/*
+submit a request given by arrays of token ids (e.g., in shared memory).
+The tokens are copied to the samples directly.
+>> srcs - the source token ids
+>> srcLens - the number of tokens of each source sequence
+>> prefixes - the forced target prefixes (NULL if not used, or NULL for some sequences)
+>> prefixLens - the number of tokens of each prefix (NULL if not used)
+>> num - number of the sequences
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+<< return - the request, released by the caller after Wait()
+*/
+ServiceRequest* BatchScheduler::Submit(const int** srcs, const int* srcLens,
+                                       const int** prefixes, const int* prefixLens,
+                                       int num, int priority, float timeout)
+{
+    ServiceRequest* request = new ServiceRequest(num, priority, timeout);
+
+    for (int i = 0; i < num; i++) {
+        bool hasPrefix = prefixes != NULL && prefixes[i] != NULL;
+        if (srcLens[i] < 0 || (hasPrefix && prefixLens[i] < 0)) {
+            request->status = REQUEST_INVALID;
+            request->remaining = 0;
+            return request;
+        }
+    }
+
+    /* the configuration is switched with the translator, so the
+       sentences are made and checked under the lock */
+    {
+        lock_guard<mutex> lock(queueMutex);
+        CheckNTErrors(running, "The scheduler is not running");
+
+        /* shed the load before copying the sequences */
+        if (config->service.maxQueue > 0 && queue.Size() >= config->service.maxQueue) {
+            request->status = REQUEST_REJECTED;
+            request->remaining = 0;
+            rejectedNum++;
+            return request;
+        }
+
+        vector<PendingSentence> sentences(num);
+        for (int i = 0; i < num; i++) {
+            /* the same length limit as the input file */
+            int len = MIN(srcLens[i], config->model.maxSrcLen - 1);
+            IntList* src = new IntList(len + 1);
+            src->Add(srcs[i], len);
+            if (len == 0 || src->Get(-1) != config->model.eos)
+                src->Add(config->model.eos);
+
+            IntList* prefix = NULL;
+            if (prefixes != NULL && prefixes[i] != NULL) {
+                int prefixLen = MIN(prefixLens[i], config->model.maxTgtLen - 1);
+                prefix = new IntList(MAX(prefixLen, 1));
+                prefix->Add(prefixes[i], prefixLen);
+            }
+
+            sentences[i].request = request;
+            sentences[i].index = i;
+            sentences[i].sample = new Sample(src, prefix);
+        }
+
+        /* the ids index the embeddings, so they are never trusted. They are
+           checked after they are copied, as the caller's memory may be
+           shared with another process. */
+        bool isValid = true;
+        for (int i = 0; i < num && isValid; i++)
+            isValid = PendingQueue::IsValid(sentences[i].sample, config->model.srcVocabSize,
+                                            config->model.tgtVocabSize);
+        if (!isValid) {
+            for (int i = 0; i < num; i++)
+                delete sentences[i].sample;
+            request->status = REQUEST_INVALID;
+            request->remaining = 0;
+            return request;
+        }
+
+        for (int i = 0; i < num; i++)
+            queue.Push(sentences[i]);
+    }
+
+    queueCond.notify_one();
+
+    return request;
+}
+
+/*
+wait until all sentences of a request are translated
+>> request - the request
+*/
+void BatchScheduler::Wait(ServiceRequest* request)
+{
+    unique_lock<mutex> lock(queueMutex);
+    doneCond.wait(lock, [request] { return request->remaining == 0; });
+}
+
+/*
+check whether all sentences of a request are translated (without blocking)
+>> request - the request
+*/
+bool BatchScheduler::IsDone(ServiceRequest* request)
+{
+    lock_guard<mutex> lock(queueMutex);
+    return request->remaining == 0;
+}
+
+/* get the number of waiting sentences */
+int BatchScheduler::GetQueueSize()
+{
+    lock_guard<mutex> lock(queueMutex);
+    return queue.Size();
+}
+
+/* check whether the queue is beyond the limit (new requests are rejected) */
+bool BatchScheduler::IsOverloaded()
+{
+    lock_guard<mutex> lock(queueMutex);
+    return config->service.maxQueue > 0 && queue.Size() >= config->service.maxQueue;
+}
+
+/*
+get the statistics of the scheduler
+>> stats - the statistics (for return)
+*/
+void BatchScheduler::GetStats(SchedulerStats& stats)
+{
+    lock_guard<mutex> lock(queueMutex);
+    stats.queueSize = queue.Size();
+    stats.groupNum = groupNum;
+    stats.sentNum = sentNum;
+    stats.droppedNum = droppedNum;
+    stats.rejectedNum = rejectedNum;
+    stats.expiredNum = expiredNum;
+    stats.latency = latency;
+}
+
+/*
+get the statistics of the translator in use
+>> stats - the statistics (for return)
+*/
+void BatchScheduler::GetTranslatorStats(TranslatorStats& stats)
+{
+    /* the translator is not released while we hold the lock */
+    lock_guard<mutex> lock(queueMutex);
+    translator->GetStats(stats);
+}
+
+/*
+switch to another translator for the following sentences. The sentences
+that have been dispatched are translated with the old one. The configuration
+is switched together, so new requests are checked against the vocabularies
+of the new model, and so are the waiting sentences. It returns after the
+switch, so the old translator and configuration can be released then.
+>> myTranslator - the new translator (initialized)
+>> myConfig - configuration of the new translator
+*/
+void BatchScheduler::SetTranslator(Translator* myTranslator, NMTConfig* myConfig)
+{
+    unique_lock<mutex> lock(queueMutex);
+
+    nextTranslator = myTranslator;
+    nextConfig = myConfig;
+    queueCond.notify_all();
+
+    doneCond.wait(lock, [this] { return nextTranslator == NULL || !isDispatching; });
+
+    if (nextTranslator != NULL) {
+        translator = nextTranslator;
+        config = nextConfig;
+        nextTranslator = NULL;
+        nextConfig = NULL;
+        DropInvalid();
+        doneCond.notify_all();
+    }
+}
+
+/*
+mark a sentence of a request as finished
+>> request - the request
+*/
+void BatchScheduler::Finish(ServiceRequest* request)
+{
+    request->remaining--;
+    if (request->remaining > 0)
+        return;
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (now >= request->deadline && request->status != REQUEST_INVALID) {
+        request->status = REQUEST_EXPIRED;
+        expiredNum++;
+    }
+
+    latency.Add(chrono::duration<float, milli>(now - request->arrival).count());
+}
+
+/*
+finish the requests of the sentences dropped before dispatching
+>> dropped - the sentences
+*/
+void BatchScheduler::Drop(vector<PendingSentence>& dropped)
+{
+    for (size_t i = 0; i < dropped.size(); i++) {
+        delete dropped[i].sample;
+        Finish(dropped[i].request);
+        droppedNum++;
+    }
+}
+
+/* remove the waiting sentences whose deadlines are passed */
+void BatchScheduler::DropExpired()
+{
+    vector<PendingSentence> dropped;
+    queue.DropExpired(chrono::steady_clock::now(), dropped);
+    Drop(dropped);
+}
+
+/*
+remove the waiting sentences that are invalid for the translator in use,
+i.e., those submitted before a switch to a model of smaller vocabularies.
+Their requests are finished as REQUEST_INVALID.
+*/
+void BatchScheduler::DropInvalid()
+{
+    vector<PendingSentence> dropped;
+    queue.DropInvalid(config->model.srcVocabSize, config->model.tgtVocabSize, dropped);
+    for (size_t i = 0; i < dropped.size(); i++)
+        dropped[i].request->status = REQUEST_INVALID;
+    Drop(dropped);
+}
+
+/*
+the loop of the dispatcher thread. The waiting sentences (up to "groupsize")
+are dispatched together when they fill a batch or when the oldest one has
+waited for the maximum time, in the order of priority and then deadline.
+The remaining sentences are dispatched without waiting when the scheduler
+is stopped.
+*/
+void BatchScheduler::Dispatch()
+{
+    unique_lock<mutex> lock(queueMutex);
+
+    while (true) {
+        /* switch the translator between two groups */
+        if (nextTranslator != NULL) {
+            translator = nextTranslator;
+            config = nextConfig;
+            nextTranslator = NULL;
+            nextConfig = NULL;
+            DropInvalid();
+            doneCond.notify_all();
+        }
+
+        int queueSize = queue.Size();
+        DropExpired();
+        if (queue.Size() != queueSize)
+            doneCond.notify_all();
+
+        if (queue.Size() == 0) {
+            if (!running)
+                break;
+            queueCond.wait(lock);
+            continue;
+        }
+
+        /* wait for more sentences to fill the batch */
+        chrono::steady_clock::time_point dispatchTime = queue.GetDispatchTime(config->service.maxWait);
+        bool isFull = queue.IsBatchFull(config->common.sBatchSize, config->common.wBatchSize,
+                                        config->translation.beamSize);
+        if (running && !isFull && chrono::steady_clock::now() < dispatchTime) {
+            queueCond.wait_until(lock, dispatchTime);
+            continue;
+        }
+
+        vector<PendingSentence> group;
+        queue.Pop(config->service.groupSize, group);
+
+        lock.unlock();
+        Run(group);
+        lock.lock();
+    }
+
+    isDispatching = false;
+    doneCond.notify_all();
+}
+
+/*
+translate a group of sentences and route the results to the requests
+>> group - the sentences
+*/
+void BatchScheduler::Run(vector<PendingSentence>& group)
+{
+    XList samples;
+    XList outputs;
+
+    /* the index of a sample is its position in the group */
+    vector<chrono::steady_clock::time_point> deadlines(group.size());
+    vector<chrono::steady_clock::time_point> arrivals(group.size());
+    for (size_t i = 0; i < group.size(); i++) {
+        group[i].sample->index = int(i);
+        samples.Add(group[i].sample);
+        deadlines[i] = group[i].request->deadline;
+        arrivals[i] = group[i].request->arrival;
+    }
+
+    translator->TranslateSamples(&samples, &outputs, &deadlines, &arrivals);
+
+    {
+        lock_guard<mutex> lock(queueMutex);
+        for (int i = 0; i < outputs.Size(); i++) {
+            Sample* output = (Sample*)outputs.Get(i);
+            PendingSentence& sentence = group[output->index];
+            sentence.request->outputs[sentence.index] = output->tgtSeq;
+            sentence.request->partials[sentence.index] = output->isPartial;
+            if (output->isPartial)
+                sentence.request->status = REQUEST_EXPIRED;
+            Finish(sentence.request);
+            output->tgtSeq = NULL;
+            delete output;
+        }
+        groupNum++;
+        sentNum += long(group.size());
+    }
+
+    doneCond.notify_all();
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,296 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The batch scheduler of the translation service. Requests of one or a few
+ * sentences are submitted by concurrent clients. A dispatcher thread sends
+ * the pending sentences to the translator when they fill a batch or when
+ * the oldest one has waited for "maxwait" milliseconds. The translator
+ * groups them by length, and the results are routed back to the requests.
+ *
+ * A request may have a priority and a deadline. Waiting sentences are
+ * dispatched by priority and then by deadline, those with passed deadlines
+ * are dropped before encoding, and a batch is stopped with the best partial
+ * hypotheses when a deadline is passed in decoding. New requests are
+ * rejected when the queue is longer than "maxqueue".
+ */
+
+#ifndef __BATCHSCHEDULER_H__
+#define __BATCHSCHEDULER_H__
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "Metrics.h"
+#include "../translate/Translator.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* status of a request */
+enum RequestStatus { REQUEST_OK, REQUEST_EXPIRED, REQUEST_REJECTED, REQUEST_INVALID };
+
+/* a request, i.e., a number of sentences submitted together */
+class ServiceRequest
+{
+public:
+    /* number of sentences */
+    int num;
+
+    /* the priority (a larger value is served first) */
+    int priority;
+
+    /* the status, REQUEST_EXPIRED means that the deadline is passed and
+       some outputs may be partial translations or NULL (dropped), and
+       REQUEST_INVALID means that nothing is translated for invalid
+       arguments (e.g., an unknown model) */
+    RequestStatus status;
+
+    /* the translations (aligned with the sources) */
+    IntList** outputs;
+
+    /* indicates whether each translation is partial, i.e., stopped by the deadline */
+    bool* partials;
+
+    /* number of sentences not translated yet */
+    int remaining;
+
+    /* the time when the request is submitted */
+    chrono::steady_clock::time_point arrival;
+
+    /* the deadline (time_point::max() if not used) */
+    chrono::steady_clock::time_point deadline;
+
+public:
+    /* constructor */
+    ServiceRequest(int myNum, int myPriority, float timeout);
+
+    /* de-constructor */
+    ~ServiceRequest();
+};
+
+/* a sentence waiting for translation */
+struct PendingSentence
+{
+    /* the request of the sentence */
+    ServiceRequest* request;
+
+    /* index of the sentence in the request */
+    int index;
+
+    /* the source sequence and the forced prefix */
+    Sample* sample;
+};
+
+/* the sentences waiting for translation, i.e., the policy of the scheduler
+   on which sentences are dispatched and when */
+class PendingQueue
+{
+private:
+    /* the sentences (in the order of arrival) */
+    deque<PendingSentence> sentences;
+
+    /* the maximum source length of the sentences */
+    int maxLen;
+
+private:
+    /* update the maximum source length after the sentences are removed */
+    void UpdateMaxLen();
+
+public:
+    /* constructor */
+    PendingQueue();
+
+    /* get the number of sentences */
+    int Size() const;
+
+    /* add a sentence */
+    void Push(const PendingSentence& sentence);
+
+    /* check whether the sentences fill a batch */
+    bool IsBatchFull(int sBatchSize, int wBatchSize, int beamSize) const;
+
+    /* get the time when the sentences are dispatched without a full batch */
+    chrono::steady_clock::time_point GetDispatchTime(float maxWait) const;
+
+    /* remove the sentences whose deadlines are passed */
+    void DropExpired(chrono::steady_clock::time_point now, vector<PendingSentence>& dropped);
+
+    /* remove the sentences whose token ids are not in the vocabularies */
+    void DropInvalid(int srcVocabSize, int tgtVocabSize, vector<PendingSentence>& dropped);
+
+    /* take the first sentences in the order of priority and then deadline */
+    void Pop(int num, vector<PendingSentence>& group);
+
+    /* check whether the token ids of a sentence are in the vocabularies */
+    static bool IsValid(const Sample* sample, int srcVocabSize, int tgtVocabSize);
+};
+
+/* statistics of the scheduler */
+struct SchedulerStats
+{
+    /* number of waiting sentences */
+    int queueSize;
+
+    /* number of dispatched groups */
+    long groupNum;
+
+    /* number of dispatched sentences */
+    long sentNum;
+
+    /* number of sentences dropped by the deadlines before dispatching */
+    long droppedNum;
+
+    /* number of rejected requests */
+    long rejectedNum;
+
+    /* number of requests that passed their deadlines */
+    long expiredNum;
+
+    /* latencies of the completed requests */
+    LatencyHistogram latency;
+};
+
+/* the scheduler that batches sentences across requests */
+class BatchScheduler
+{
+private:
+    /* the translator (used by the dispatcher thread only) */
+    Translator* translator;
+
+    /* the translator to switch to (NULL if not requested) */
+    Translator* nextTranslator;
+
+    /* configuration of the NMT system (that of the translator in use) */
+    NMTConfig* config;
+
+    /* the configuration to switch to with the next translator */
+    NMTConfig* nextConfig;
+
+    /* the sentences waiting for translation */
+    PendingQueue queue;
+
+    /* the mutex of the queue and the requests */
+    mutex queueMutex;
+
+    /* signaled when sentences are submitted or the scheduler is stopped */
+    condition_variable queueCond;
+
+    /* signaled when sentences are translated */
+    condition_variable doneCond;
+
+    /* the dispatcher thread */
+    thread dispatcher;
+
+    /* indicates whether the dispatcher is running */
+    bool running;
+
+    /* indicates whether the dispatcher thread is alive (it may drain the queue after stopping) */
+    bool isDispatching;
+
+    /* number of dispatched groups */
+    long groupNum;
+
+    /* number of dispatched sentences */
+    long sentNum;
+
+    /* number of sentences dropped by the deadlines before dispatching */
+    long droppedNum;
+
+    /* number of rejected requests */
+    long rejectedNum;
+
+    /* number of requests that passed their deadlines */
+    long expiredNum;
+
+    /* latencies of the completed requests */
+    LatencyHistogram latency;
+
+private:
+    /* remove the waiting sentences whose deadlines are passed */
+    void DropExpired();
+
+    /* remove the waiting sentences that are invalid for the translator in use */
+    void DropInvalid();
+
+    /* finish the requests of the sentences dropped before dispatching */
+    void Drop(vector<PendingSentence>& dropped);
+
+    /* mark a sentence of a request as finished */
+    void Finish(ServiceRequest* request);
+
+    /* the loop of the dispatcher thread */
+    void Dispatch();
+
+    /* translate a group of sentences and route the results to the requests */
+    void Run(vector<PendingSentence>& group);
+
+public:
+    /* constructor */
+    BatchScheduler();
+
+    /* de-constructor */
+    ~BatchScheduler();
+
+    /* initialize the scheduler */
+    void Init(NMTConfig& myConfig, Translator& myTranslator);
+
+    /* start the dispatcher thread */
+    void Start();
+
+    /* stop the dispatcher thread after the waiting sentences are translated */
+    void Stop();
+
+    /* submit a request */
+    ServiceRequest* Submit(IntList** srcs, IntList** prefixes, int num,
+                           int priority = 0, float timeout = 0);
+
+    /* submit a request given by arrays of token ids */
+    ServiceRequest* Submit(const int** srcs, const int* srcLens,
+                           const int** prefixes, const int* prefixLens,
+                           int num, int priority = 0, float timeout = 0);
+
+    /* get the number of waiting sentences */
+    int GetQueueSize();
+
+    /* check whether the queue is beyond the limit (new requests are rejected) */
+    bool IsOverloaded();
+    /* get the statistics of the scheduler */
+    void GetStats(SchedulerStats& stats);
+
+    /* get the statistics of the translator in use */
+    void GetTranslatorStats(TranslatorStats& stats);
+
+    /* switch to another translator (and its configuration) for the following sentences */
+    void SetTranslator(Translator* myTranslator, NMTConfig* myConfig);
+
+    /* wait until all sentences of a request are translated */
+    void Wait(ServiceRequest* request);
+
+    /* check whether all sentences of a request are translated (without blocking) */
+    bool IsDone(ServiceRequest* request);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __BATCHSCHEDULER_H__ */
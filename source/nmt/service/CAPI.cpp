@@ -0,0 +1,360 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstring>
+#include "CAPI.h"
+#include "ModelPool.h"
+#include "ModelInstance.h"
+#include "BatchScheduler.h"
+
+using namespace nmt;
+
+/* a translator of the C API */
+struct NMTHandle
+{
+    /* the model and its translator (NULL if a pool is used) */
+    ModelInstance* instance;
+
+    /* the scheduler that batches the calls of all threads (NULL if a pool is used) */
+    BatchScheduler* scheduler;
+
+    /* the pool of models given by "-modelmap" (NULL if not used) */
+    ModelPool* pool;
+};
+
+/* a model used by a call */
+struct NMTModelRef
+{
+    /* the scheduler of the model */
+    BatchScheduler* scheduler;
+
+    /* the translator of the model */
+    Translator* translator;
+
+    /* the id of the model in the pool (empty for the model of the handle) */
+    string id;
+};
+
+/*
+get the model of a call
+>> handle - the translator
+>> model - id of the model in the model map (NULL or empty for the model of the handle)
+>> ref - the model (for return)
+<< return - whether the model is found and loaded
+*/
+static bool AcquireModel(NMTHandle* handle, const char* model, NMTModelRef& ref)
+{
+    ref.scheduler = NULL;
+    ref.translator = NULL;
+    ref.id = model == NULL ? "" : model;
+
+    if (ref.id.empty()) {
+        if (handle->scheduler == NULL)
+            return false;
+        ref.scheduler = handle->scheduler;
+        ref.translator = handle->instance->translator;
+        return true;
+    }
+
+    if (handle->pool == NULL)
+        return false;
+    ref.scheduler = handle->pool->Acquire(ref.id, &ref.translator);
+    return ref.scheduler != NULL;
+}
+
+/*
+release the model of a call
+>> handle - the translator
+>> ref - the model
+*/
+static void ReleaseModel(NMTHandle* handle, NMTModelRef& ref)
+{
+    if (!ref.id.empty())
+        handle->pool->Release(ref.id);
+}
+
+/*
+make an empty result
+>> num - number of sentences
+>> hasText - indicates whether the translations are given as text
+<< return - the result
+*/
+static NMTResult* NewResult(int num, bool hasText)
+{
+    NMTResult* result = new NMTResult;
+    result->status = NMT_OK;
+    result->num = num;
+    result->texts = NULL;
+    result->ids = new int* [MAX(num, 1)];
+    result->lens = new int[MAX(num, 1)];
+    result->partials = new int[MAX(num, 1)];
+    for (int i = 0; i < num; i++) {
+        result->ids[i] = NULL;
+        result->lens[i] = 0;
+        result->partials[i] = 0;
+    }
+    if (hasText) {
+        result->texts = new char* [MAX(num, 1)];
+        for (int i = 0; i < num; i++)
+            result->texts[i] = NULL;
+    }
+    return result;
+}
+
+/*
+submit the sequences to the scheduler and copy the translations to a result
+>> ref - the model
+>> srcs - the source sequences
+>> prefixes - the forced prefixes (NULL if not used)
+>> rows - the rows of the sequences in the result
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+>> result - the result
+*/
+static void Run(NMTModelRef& ref, vector<IntList*>& srcs, vector<IntList*>& prefixes,
+                vector<int>& rows, int priority, float timeout, NMTResult* result)
+{
+    if (srcs.size() > 0) {
+        ServiceRequest* request = ref.scheduler->Submit(srcs.data(), prefixes.data(),
+                                                        int(srcs.size()), priority, timeout);
+        ref.scheduler->Wait(request);
+
+        if (request->status == REQUEST_EXPIRED)
+            result->status = NMT_EXPIRED;
+        else if (request->status == REQUEST_REJECTED)
+            result->status = NMT_REJECTED;
+        else if (request->status == REQUEST_INVALID)
+            result->status = NMT_ERROR;
+
+        for (int i = 0; i < request->num; i++) {
+            IntList* output = request->outputs[i];
+            if (output == NULL)
+                continue;
+            int row = rows[i];
+            result->lens[row] = int(output->Size());
+            result->partials[row] = request->partials[i] ? 1 : 0;
+            result->ids[row] = new int[MAX(output->count, 1)];
+            memcpy(result->ids[row], output->items, sizeof(int) * output->count);
+        }
+
+        delete request;
+    }
+
+    if (result->texts != NULL) {
+        for (int i = 0; i < result->num; i++) {
+            string line;
+            if (result->ids[i] != NULL) {
+                IntList ids(MAX(result->lens[i], 1));
+                ids.Add(result->ids[i], result->lens[i]);
+                line = ref.translator->MakeText(&ids);
+            }
+            result->texts[i] = new char[line.size() + 1];
+            strcpy(result->texts[i], line.c_str());
+        }
+    }
+}
+
+/* get the version of the API */
+int NMT_GetVersion()
+{
+    return NMT_API_VERSION;
+}
+
+/*
+create a translator
+>> argc - number of the options
+>> argv - the options, the same as those of the command line
+<< return - the translator (NULL if the model cannot be loaded)
+*/
+NMTHandle* NMT_Create(int argc, const char** argv)
+{
+    vector<string> args;
+    for (int i = 0; i < argc; i++)
+        args.push_back(argv[i]);
+
+    /* disable gradient flow */
+    DISABLE_GRAD;
+
+    /* the models of the model map are loaded when they are first requested */
+    NMTConfig config(argc, argv);
+    if (strcmp(config.service.modelMapFN, "") != 0) {
+        NMTHandle* handle = new NMTHandle;
+        handle->instance = NULL;
+        handle->scheduler = NULL;
+        handle->pool = new ModelPool();
+        handle->pool->Init(argc, argv);
+        return handle;
+    }
+
+    ModelInstance* instance = new ModelInstance();
+    if (!instance->Load(args)) {
+        delete instance;
+        return NULL;
+    }
+
+    NMTHandle* handle = new NMTHandle;
+    handle->instance = instance;
+    handle->pool = NULL;
+    handle->scheduler = new BatchScheduler();
+    handle->scheduler->Init(*instance->config, *instance->translator);
+    handle->scheduler->Start();
+
+    return handle;
+}
+
+/*
+release a translator
+>> handle - the translator
+*/
+void NMT_Destroy(NMTHandle* handle)
+{
+    if (handle == NULL)
+        return;
+
+    if (handle->scheduler != NULL) {
+        handle->scheduler->Stop();
+        delete handle->scheduler;
+    }
+    delete handle->instance;
+    delete handle->pool;
+    delete handle;
+}
+
+/*
+translate a batch of sentences
+>> handle - the translator
+>> model - id of the model in the model map (NULL for the model of the handle)
+>> lines - the tokenized (e.g., BPE) sentences, tokens are separated by spaces,
+           and a line may give a forced target prefix as "source ||| prefix"
+           if the option "prefix" is set
+>> num - number of sentences
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+<< return - the translations, released by NMT_FreeResult
+*/
+NMTResult* NMT_TranslateText(NMTHandle* handle, const char* model, const char** lines,
+                             int num, int priority, float timeout)
+{
+    NMTResult* result = NewResult(MAX(num, 0), true);
+    if (handle == NULL || lines == NULL || num < 0) {
+        result->status = NMT_ERROR;
+        return result;
+    }
+
+    NMTModelRef ref;
+    if (!AcquireModel(handle, model, ref)) {
+        result->status = NMT_ERROR;
+        return result;
+    }
+
+    vector<Sample*> samples;
+    vector<IntList*> srcs;
+    vector<IntList*> prefixes;
+    vector<int> rows;
+
+    /* empty lines are not translated */
+    for (int i = 0; i < num; i++) {
+        if (lines[i] == NULL || strspn(lines[i], " \t\r\n") == strlen(lines[i]))
+            continue;
+        Sample* sample = ref.translator->MakeSample(lines[i]);
+        samples.push_back(sample);
+        srcs.push_back(sample->srcSeq);
+        prefixes.push_back(sample->tgtSeq);
+        rows.push_back(i);
+    }
+
+    Run(ref, srcs, prefixes, rows, priority, timeout, result);
+    ReleaseModel(handle, ref);
+
+    /* the sequences are copied by the scheduler */
+    for (size_t i = 0; i < samples.size(); i++)
+        delete samples[i];
+
+    return result;
+}
+
+/*
+translate a batch of token-id sequences
+>> handle - the translator
+>> model - id of the model in the model map (NULL for the model of the handle)
+>> srcs - the source token ids (EOS is appended if missing), nothing is
+          translated and the status is NMT_ERROR if an id is not in
+          [0, srcVocabSize)
+>> srcLens - the number of tokens of each sequence
+>> num - number of sequences
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+<< return - the translations, released by NMT_FreeResult
+*/
+NMTResult* NMT_TranslateIds(NMTHandle* handle, const char* model, const int** srcs,
+                            const int* srcLens, int num, int priority, float timeout)
+{
+    NMTResult* result = NewResult(MAX(num, 0), false);
+    if (handle == NULL || srcs == NULL || srcLens == NULL || num < 0) {
+        result->status = NMT_ERROR;
+        return result;
+    }
+
+    NMTModelRef ref;
+    if (!AcquireModel(handle, model, ref)) {
+        result->status = NMT_ERROR;
+        return result;
+    }
+
+    vector<IntList*> srcLists;
+    vector<IntList*> prefixes;
+    vector<int> rows;
+
+    for (int i = 0; i < num; i++) {
+        if (srcs[i] == NULL || srcLens[i] <= 0)
+            continue;
+        IntList* src = new IntList(srcLens[i]);
+        src->Add(srcs[i], srcLens[i]);
+        srcLists.push_back(src);
+        prefixes.push_back(NULL);
+        rows.push_back(i);
+    }
+
+    Run(ref, srcLists, prefixes, rows, priority, timeout, result);
+    ReleaseModel(handle, ref);
+
+    for (size_t i = 0; i < srcLists.size(); i++)
+        delete srcLists[i];
+
+    return result;
+}
+
+/*
+release the translations
+>> result - the translations
+*/
+void NMT_FreeResult(NMTResult* result)
+{
+    if (result == NULL)
+        return;
+
+    for (int i = 0; i < result->num; i++) {
+        delete[] result->ids[i];
+        if (result->texts != NULL)
+            delete[] result->texts[i];
+    }
+    delete[] result->ids;
+    delete[] result->lens;
+    delete[] result->partials;
+    delete[] result->texts;
+    delete result;
+}
@@ -0,0 +1,111 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The C API for in-process translation (built with -DGEN_DLL=ON). A handle
+ * owns a model, its translator and a batch scheduler, so concurrent calls
+ * on the same handle are batched together. With "-modelmap", the handle
+ * owns a model pool instead, and a call names its model by the id in the
+ * model map. All functions except NMT_Destroy can be called from several
+ * threads at the same time.
+ *
+ * Usage:
+ *     const char* argv[] = {"nmt", "-model", "model.bin",
+ *                           "-srcvocab", "vocab.src", "-tgtvocab", "vocab.tgt"};
+ *     NMTHandle* handle = NMT_Create(7, argv);
+ *     const char* lines[] = {"hello world", "how are you"};
+ *     NMTResult* result = NMT_TranslateText(handle, NULL, lines, 2, 0, 0);
+ *     ... result->texts[i] ...
+ *     NMT_FreeResult(result);
+ *     NMT_Destroy(handle);
+ */
+
+#ifndef __CAPI_H__
+#define __CAPI_H__
+
+#if defined(_WIN32)
+#define NMT_API __declspec(dllexport)
+#else
+#define NMT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the version of the API */
+#define NMT_API_VERSION 2
+
+/* status of a translation */
+#define NMT_OK 0        /* all sentences are translated */
+#define NMT_EXPIRED 1   /* the time limit is passed, some translations are partial (see partials) or empty */
+#define NMT_REJECTED 2  /* the translator is overloaded, nothing is translated */
+#define NMT_ERROR 3     /* invalid arguments (e.g., ids out of the vocabulary) or an unknown model */
+
+/* a translator (opaque to the caller) */
+typedef struct NMTHandle NMTHandle;
+
+/* the translations of a call, released by NMT_FreeResult */
+typedef struct NMTResult
+{
+    /* the status (NMT_OK, NMT_EXPIRED, NMT_REJECTED or NMT_ERROR) */
+    int status;
+
+    /* number of sentences */
+    int num;
+
+    /* the translations as text, tokens are separated by spaces
+       (NULL for NMT_TranslateIds) */
+    char** texts;
+
+    /* the token ids of the translations (an entry is NULL if the sentence is dropped) */
+    int** ids;
+
+    /* the number of tokens of each translation */
+    int* lens;
+
+    /* 1 if a translation is partial, i.e., stopped by the time limit, and 0 otherwise */
+    int* partials;
+} NMTResult;
+
+/* get the version of the API */
+NMT_API int NMT_GetVersion();
+
+/* create a translator with the command-line options, NULL if the model cannot be loaded */
+NMT_API NMTHandle* NMT_Create(int argc, const char** argv);
+
+/* release a translator (no calls on it may be in progress) */
+NMT_API void NMT_Destroy(NMTHandle* handle);
+
+/* translate a batch of tokenized sentences, a line may give a forced prefix after "|||" (with -prefix),
+   the model is the id in the model map (NULL for the model of the handle) */
+NMT_API NMTResult* NMT_TranslateText(NMTHandle* handle, const char* model, const char** lines,
+                                     int num, int priority, float timeout);
+
+/* translate a batch of source token-id sequences,
+   the model is the id in the model map (NULL for the model of the handle) */
+NMT_API NMTResult* NMT_TranslateIds(NMTHandle* handle, const char* model, const int** srcs,
+                                    const int* srcLens, int num, int priority, float timeout);
+
+/* release the translations */
+NMT_API void NMT_FreeResult(NMTResult* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CAPI_H__ */
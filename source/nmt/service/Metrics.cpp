@@ -0,0 +1,334 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include "Metrics.h"
+#include "BatchScheduler.h"
+#include "../translate/Translator.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the upper bounds of the latency buckets (in ms) */
+const float LatencyHistogram::bounds[LATENCY_BUCKET_NUM] = {
+    1.0F, 2.0F, 5.0F, 10.0F, 20.0F, 50.0F, 100.0F, 200.0F,
+    500.0F, 1000.0F, 2000.0F, 5000.0F, 10000.0F, 20000.0F, 60000.0F, 1e30F
+};
+
+/* constructor */
+LatencyHistogram::LatencyHistogram()
+{
+    for (int i = 0; i < LATENCY_BUCKET_NUM; i++)
+        counts[i] = 0;
+    count = 0;
+    sum = 0;
+}
+
+/*
+add a sample
+>> latency - the latency (in ms)
+*/
+void LatencyHistogram::Add(float latency)
+{
+    int i = 0;
+    while (i < LATENCY_BUCKET_NUM - 1 && latency > bounds[i])
+        i++;
+
+    counts[i]++;
+    count++;
+    sum += latency;
+}
+
+/*
+estimate a quantile of the samples by linear interpolation in its bucket
+>> q - the quantile, e.g., 0.99
+<< return - the estimated latency (in ms)
+*/
+float LatencyHistogram::GetQuantile(float q) const
+{
+    if (count == 0)
+        return 0;
+
+    double rank = q * count;
+    long acc = 0;
+    for (int i = 0; i < LATENCY_BUCKET_NUM; i++) {
+        if (acc + counts[i] >= rank && counts[i] > 0) {
+            float lower = i == 0 ? 0 : bounds[i - 1];
+
+            /* we know nothing beyond the last bound */
+            if (i == LATENCY_BUCKET_NUM - 1)
+                return lower;
+
+            return lower + (bounds[i] - lower) * float((rank - acc) / counts[i]);
+        }
+        acc += counts[i];
+    }
+
+    return bounds[LATENCY_BUCKET_NUM - 2];
+}
+
+/*
+add a metric in the Prometheus text format
+>> text - the text (appended)
+>> name - name of the metric
+>> type - type of the metric (counter or gauge)
+>> help - description of the metric
+>> value - the value
+*/
+static void AddMetric(string& text, const char* name, const char* type,
+                      const char* help, double value)
+{
+    char line[1024];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %g\n",
+             name, help, name, type, name, value);
+    text += line;
+}
+
+/*
+add the hit and miss counters of a cache
+>> text - the text (appended)
+>> cache - name of the cache
+>> hitNum - number of hits
+>> missNum - number of misses
+*/
+static void AddCacheMetric(string& text, const char* cache, long hitNum, long missNum)
+{
+    char line[1024];
+    snprintf(line, sizeof(line),
+             "niutrans_cache_hits_total{cache=\"%s\"} %ld\n"
+             "niutrans_cache_misses_total{cache=\"%s\"} %ld\n"
+             "niutrans_cache_hit_ratio{cache=\"%s\"} %g\n",
+             cache, hitNum, cache, missNum, cache,
+             hitNum + missNum > 0 ? double(hitNum) / (hitNum + missNum) : 0.0);
+    text += line;
+}
+
+/* constructor */
+MetricsExporter::MetricsExporter()
+{
+    config = NULL;
+    translator = NULL;
+    scheduler = NULL;
+    running = false;
+    lastSentNum = 0;
+    lastWordNum = 0;
+}
+
+/* de-constructor */
+MetricsExporter::~MetricsExporter()
+{
+    Stop();
+}
+
+/*
+initialize the exporter
+>> myConfig - configuration of the NMT system
+>> myTranslator - the translator
+>> myScheduler - the scheduler (NULL if not used)
+*/
+void MetricsExporter::Init(NMTConfig& myConfig, Translator& myTranslator, BatchScheduler* myScheduler)
+{
+    config = &myConfig;
+    translator = &myTranslator;
+    scheduler = myScheduler;
+}
+
+/* check whether the exporter is enabled */
+bool MetricsExporter::IsEnabled()
+{
+    return config != NULL && strcmp(config->service.metricsFN, "") != 0;
+}
+
+/* start the exporter thread */
+void MetricsExporter::Start()
+{
+    if (!IsEnabled() || running)
+        return;
+
+    TranslatorStats stats;
+    if (scheduler != NULL)
+        scheduler->GetTranslatorStats(stats);
+    else
+        translator->GetStats(stats);
+    lastTime = chrono::steady_clock::now();
+    lastSentNum = stats.sentNum;
+    lastWordNum = stats.wordNum;
+
+    running = true;
+    worker = thread(&MetricsExporter::Run, this);
+
+    LOG("writing metrics to %s every %.1fs", config->service.metricsFN, config->service.metricsInterval);
+}
+
+/* stop the exporter thread (the metrics are written once more) */
+void MetricsExporter::Stop()
+{
+    {
+        lock_guard<mutex> lock(runMutex);
+        if (!running)
+            return;
+        running = false;
+    }
+
+    runCond.notify_all();
+    worker.join();
+
+    Dump();
+}
+
+/* the loop of the exporter thread */
+void MetricsExporter::Run()
+{
+    chrono::milliseconds interval((long)(config->service.metricsInterval * 1000));
+
+    unique_lock<mutex> lock(runMutex);
+    while (running) {
+        runCond.wait_for(lock, interval);
+        if (!running)
+            break;
+
+        lock.unlock();
+        Dump();
+        lock.lock();
+    }
+}
+
+/*
+write the metrics to the file. It is written to a temporary file first and
+then renamed, so readers never see a partial file.
+*/
+void MetricsExporter::Dump()
+{
+    /* the translator of a scheduler may be switched by reloading */
+    TranslatorStats stats;
+    if (scheduler != NULL)
+        scheduler->GetTranslatorStats(stats);
+    else
+        translator->GetStats(stats);
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double elapsed = chrono::duration<double>(now - lastTime).count();
+
+    /* the counters start from zero with a new translator */
+    if (stats.sentNum < lastSentNum || stats.wordNum < lastWordNum) {
+        lastSentNum = 0;
+        lastWordNum = 0;
+    }
+
+    string text;
+    AddMetric(text, "niutrans_sentences_total", "counter",
+              "Number of translated sentences (excluding cache hits).", double(stats.sentNum));
+    AddMetric(text, "niutrans_words_total", "counter",
+              "Number of source tokens of the translated sentences.", double(stats.wordNum));
+    AddMetric(text, "niutrans_output_words_total", "counter",
+              "Number of output tokens.", double(stats.outputNum));
+    AddMetric(text, "niutrans_batches_total", "counter",
+              "Number of translated batches.", double(stats.batchNum));
+    AddMetric(text, "niutrans_sentences_per_second", "gauge",
+              "Translated sentences per second since the last update.",
+              elapsed > 0 ? (stats.sentNum - lastSentNum) / elapsed : 0.0);
+    AddMetric(text, "niutrans_words_per_second", "gauge",
+              "Translated source tokens per second since the last update.",
+              elapsed > 0 ? (stats.wordNum - lastWordNum) / elapsed : 0.0);
+    AddMetric(text, "niutrans_batch_size", "gauge",
+              "Average number of sentences in a batch.",
+              stats.batchNum > 0 ? double(stats.sentNum) / stats.batchNum : 0.0);
+    AddMetric(text, "niutrans_effective_batch_size", "gauge",
+              "Average number of uncompleted sentences in a decoding step.",
+              stats.stepNum > 0 ? double(stats.activeNum) / stats.stepNum : 0.0);
+    AddMetric(text, "niutrans_batch_token_budget", "gauge",
+              "The current token budget of a batch.", double(stats.tokenBudget));
+    AddMetric(text, "niutrans_padding_ratio", "gauge",
+              "Ratio of paddings in the source batches.",
+              stats.paddedNum > 0 ? 1.0 - double(stats.wordNum) / stats.paddedNum : 0.0);
+    AddMetric(text, "niutrans_decoding_steps_per_sentence", "gauge",
+              "Average number of decoding steps of a sentence.",
+              stats.sentNum > 0 ? double(stats.activeNum) / stats.sentNum : 0.0);
+
+    text += "# HELP niutrans_cache_hits_total Number of cache hits.\n"
+            "# TYPE niutrans_cache_hits_total counter\n"
+            "# HELP niutrans_cache_misses_total Number of cache misses.\n"
+            "# TYPE niutrans_cache_misses_total counter\n"
+            "# HELP niutrans_cache_hit_ratio Ratio of cache hits.\n"
+            "# TYPE niutrans_cache_hit_ratio gauge\n";
+    AddCacheMetric(text, "translation", stats.cacheHitNum, stats.cacheMissNum);
+    AddCacheMetric(text, "memory", stats.memoryHitNum, stats.memoryMissNum);
+    AddCacheMetric(text, "encoder", stats.encoderHitNum, stats.encoderMissNum);
+    AddCacheMetric(text, "prefix", stats.prefixHitNum, stats.prefixMissNum);
+
+    if (scheduler != NULL) {
+        SchedulerStats schedulerStats;
+        scheduler->GetStats(schedulerStats);
+        const LatencyHistogram& latency = schedulerStats.latency;
+
+        AddMetric(text, "niutrans_queue_depth", "gauge",
+                  "Number of sentences waiting in the scheduler.", double(schedulerStats.queueSize));
+        AddMetric(text, "niutrans_requests_total", "counter",
+                  "Number of completed requests.", double(latency.count));
+        AddMetric(text, "niutrans_requests_expired_total", "counter",
+                  "Number of requests that passed their deadlines.", double(schedulerStats.expiredNum));
+        AddMetric(text, "niutrans_requests_rejected_total", "counter",
+                  "Number of requests rejected for a full queue.", double(schedulerStats.rejectedNum));
+        AddMetric(text, "niutrans_sentences_dropped_total", "counter",
+                  "Number of sentences dropped before translation for passed deadlines.",
+                  double(schedulerStats.droppedNum));
+
+        char line[1024];
+        text += "# HELP niutrans_request_latency_ms Latency of requests in ms.\n"
+                "# TYPE niutrans_request_latency_ms histogram\n";
+        long acc = 0;
+        for (int i = 0; i < LATENCY_BUCKET_NUM; i++) {
+            acc += latency.counts[i];
+            if (i < LATENCY_BUCKET_NUM - 1)
+                snprintf(line, sizeof(line), "niutrans_request_latency_ms_bucket{le=\"%g\"} %ld\n",
+                         LatencyHistogram::bounds[i], acc);
+            else
+                snprintf(line, sizeof(line), "niutrans_request_latency_ms_bucket{le=\"+Inf\"} %ld\n", acc);
+            text += line;
+        }
+        snprintf(line, sizeof(line), "niutrans_request_latency_ms_sum %g\nniutrans_request_latency_ms_count %ld\n",
+                 latency.sum, latency.count);
+        text += line;
+
+        text += "# HELP niutrans_request_latency_quantile_ms Estimated quantiles of the request latency in ms.\n"
+                "# TYPE niutrans_request_latency_quantile_ms gauge\n";
+        const float quantiles[] = { 0.5F, 0.95F, 0.99F };
+        for (int i = 0; i < 3; i++) {
+            snprintf(line, sizeof(line), "niutrans_request_latency_quantile_ms{quantile=\"%g\"} %g\n",
+                     quantiles[i], latency.GetQuantile(quantiles[i]));
+            text += line;
+        }
+    }
+
+    lastTime = now;
+    lastSentNum = stats.sentNum;
+    lastWordNum = stats.wordNum;
+
+    string tmpFN = string(config->service.metricsFN) + ".tmp";
+    FILE* file = fopen(tmpFN.c_str(), "wb");
+    if (file == NULL) {
+        LOG("cannot write the metrics to %s", tmpFN.c_str());
+        return;
+    }
+    fwrite(text.data(), 1, text.size(), file);
+    fclose(file);
+    rename(tmpFN.c_str(), config->service.metricsFN);
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,137 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Metrics of the translation service. The exporter periodically writes the
+ * statistics of the translator and the scheduler (throughput, latency,
+ * queue depth, batch fill, padding and cache hit rates) to a file in the
+ * Prometheus text format, e.g., for the textfile collector of node_exporter.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <condition_variable>
+#include "../Config.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+class Translator;
+class BatchScheduler;
+
+/* number of the latency buckets */
+#define LATENCY_BUCKET_NUM 16
+
+/* a histogram of latencies with fixed buckets */
+class LatencyHistogram
+{
+public:
+    /* the upper bounds of the buckets (in ms), the last one is unbounded */
+    static const float bounds[LATENCY_BUCKET_NUM];
+
+    /* number of the samples in each bucket */
+    long counts[LATENCY_BUCKET_NUM];
+
+    /* number of the samples */
+    long count;
+
+    /* sum of the samples (in ms) */
+    double sum;
+
+public:
+    /* constructor */
+    LatencyHistogram();
+
+    /* add a sample */
+    void Add(float latency);
+
+    /* estimate a quantile of the samples */
+    float GetQuantile(float q) const;
+};
+
+/* the exporter of the metrics */
+class MetricsExporter
+{
+private:
+    /* configuration of the NMT system */
+    NMTConfig* config;
+
+    /* the translator */
+    Translator* translator;
+
+    /* the scheduler (NULL if the translator is not driven by a scheduler) */
+    BatchScheduler* scheduler;
+
+    /* the exporter thread */
+    thread worker;
+
+    /* indicates whether the exporter is running */
+    bool running;
+
+    /* the mutex for stopping the exporter */
+    mutex runMutex;
+
+    /* signaled when the exporter is stopped */
+    condition_variable runCond;
+
+    /* the time of the last update */
+    chrono::steady_clock::time_point lastTime;
+
+    /* number of translated sentences at the last update */
+    long lastSentNum;
+
+    /* number of translated words at the last update */
+    long lastWordNum;
+
+private:
+    /* the loop of the exporter thread */
+    void Run();
+
+    /* write the metrics to the file */
+    void Dump();
+
+public:
+    /* constructor */
+    MetricsExporter();
+
+    /* de-constructor */
+    ~MetricsExporter();
+
+    /* initialize the exporter */
+    void Init(NMTConfig& myConfig, Translator& myTranslator, BatchScheduler* myScheduler = NULL);
+
+    /* check whether the exporter is enabled */
+    bool IsEnabled();
+
+    /* start the exporter thread */
+    void Start();
+
+    /* stop the exporter thread (the metrics are written once more) */
+    void Stop();
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,151 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include "ModelInstance.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+ModelInstance::ModelInstance()
+{
+    config = NULL;
+    model = NULL;
+    translator = NULL;
+}
+
+/* de-constructor (the translator should not be in use) */
+ModelInstance::~ModelInstance()
+{
+    delete translator;
+    delete model;
+    delete config;
+}
+
+/*
+check that the vocabularies of a model can be loaded, i.e., those in the
+model bundle are valid, or the vocabulary files can be opened
+>> config - configuration of the model
+>> bundle - the model file (NULL if the model is not a mapped file)
+<< return - whether the vocabularies can be loaded
+*/
+static bool CheckVocab(NMTConfig& config, ModelFile* bundle)
+{
+    size_t srcSize = 0;
+    size_t tgtSize = 0;
+    const char* srcData = NULL;
+    const char* tgtData = NULL;
+    if (bundle != NULL) {
+        srcData = bundle->GetSection(MODEL_SECTION_SRC_VOCAB, &srcSize);
+        tgtData = bundle->GetSection(MODEL_SECTION_TGT_VOCAB, &tgtSize);
+    }
+
+    /* the same choice as TranslateDataset::LoadVocab */
+    if (srcData != NULL && tgtData != NULL) {
+        Vocab vocab;
+        if (!vocab.LoadCompact(srcData, srcSize) || !vocab.LoadCompact(tgtData, tgtSize)) {
+            LOG("invalid vocabularies in the model bundle %s", config.common.modelFN);
+            return false;
+        }
+        return true;
+    }
+
+    const char* vocabFNs[] = { config.common.srcVocabFN, config.common.tgtVocabFN };
+    for (int i = 0; i < 2; i++) {
+        FILE* file = fopen(vocabFNs[i], "rb");
+        if (file == NULL) {
+            LOG("cannot open the vocabulary %s", vocabFNs[i]);
+            return false;
+        }
+        fclose(file);
+    }
+
+    return true;
+}
+
+/*
+load the model and initialize the translator. A model or vocabulary that
+can not be loaded is reported rather than fatal, so a failed reload keeps
+the service running.
+>> args - the command-line options
+>> modelFN - path to the model (NULL for the one in the options)
+>> srcVocabFN - path to the source vocabulary (NULL for the one in the options)
+>> tgtVocabFN - path to the target vocabulary (NULL for the one in the options)
+<< return - whether the model is loaded
+*/
+bool ModelInstance::Load(const vector<string>& args, const char* modelFN,
+                         const char* srcVocabFN, const char* tgtVocabFN)
+{
+    CheckNTErrors(model == NULL, "The model has been loaded");
+
+    vector<const char*> argv;
+    for (size_t i = 0; i < args.size(); i++)
+        argv.push_back(args[i].c_str());
+
+    config = new NMTConfig(int(argv.size()), argv.data());
+
+    if (modelFN != NULL) {
+        CheckNTErrors(strlen(modelFN) < MAX_PATH_LEN, "The path to the model is too long");
+        strcpy(config->common.modelFN, modelFN);
+    }
+    if (srcVocabFN != NULL) {
+        CheckNTErrors(strlen(srcVocabFN) < MAX_PATH_LEN, "The path to the vocabulary is too long");
+        strcpy(config->common.srcVocabFN, srcVocabFN);
+    }
+    if (tgtVocabFN != NULL) {
+        CheckNTErrors(strlen(tgtVocabFN) < MAX_PATH_LEN, "The path to the vocabulary is too long");
+        strcpy(config->common.tgtVocabFN, tgtVocabFN);
+    }
+
+    /* check the file before loading, as a bad path is fatal in loading */
+    FILE* file = fopen(config->common.modelFN, "rb");
+    if (file == NULL) {
+        LOG("cannot open the model %s", config->common.modelFN);
+        return false;
+    }
+    fclose(file);
+
+    /* the header and the sizes of the file are checked before the parameters are read */
+    model = new NMTModel();
+    if (!model->TryInitModel(*config) || !CheckVocab(*config, model->mappedFile)) {
+        delete model;
+        model = NULL;
+        return false;
+    }
+
+    translator = new Translator();
+    translator->Init(*config, *model);
+
+    return true;
+}
+
+/*
+release the model and the translator (which should not be in use). The
+configuration is kept, as others (e.g., a scheduler) may refer to it.
+*/
+void ModelInstance::Unload()
+{
+    delete translator;
+    delete model;
+    translator = NULL;
+    model = NULL;
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,67 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * A model instance of the translation service, i.e., a model with its own
+ * configuration and translator. Each instance parses the options again, as
+ * loading a model overrides the model options with those in the model file.
+ */
+
+#ifndef __MODELINSTANCE_H__
+#define __MODELINSTANCE_H__
+
+#include <string>
+#include <vector>
+#include "../translate/Translator.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* a model with its configuration and translator */
+class ModelInstance
+{
+public:
+    /* configuration of the model */
+    NMTConfig* config;
+
+    /* the model */
+    NMTModel* model;
+
+    /* the translator */
+    Translator* translator;
+
+public:
+    /* constructor */
+    ModelInstance();
+
+    /* de-constructor */
+    ~ModelInstance();
+
+    /* load the model and initialize the translator */
+    bool Load(const vector<string>& args, const char* modelFN = NULL,
+              const char* srcVocabFN = NULL, const char* tgtVocabFN = NULL);
+
+    /* release the model and the translator (the configuration is kept) */
+    void Unload();
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __MODELINSTANCE_H__ */
@@ -0,0 +1,257 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include "ModelPool.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+ModelPool::ModelPool()
+{
+    budget = 0;
+    usedSize = 0;
+    clock = 0;
+}
+
+/* de-constructor */
+ModelPool::~ModelPool()
+{
+    Clear();
+}
+
+/*
+initialize the pool
+>> argc - number of the command-line options
+>> argv - the command-line options
+*/
+void ModelPool::Init(int argc, const char** argv)
+{
+    args.clear();
+    for (int i = 0; i < argc; i++)
+        args.push_back(argv[i]);
+
+    NMTConfig config(argc, argv);
+    budget = uint64_t(config.service.poolSize) * 1024 * 1024;
+    LoadModelMap(config.service.modelMapFN);
+}
+
+/*
+load the list of models
+>> fn - path to the list, one "id model [srcvocab tgtvocab]" per line,
+        and lines starting with '#' are ignored
+*/
+void ModelPool::LoadModelMap(const char* fn)
+{
+    ifstream file(fn);
+    CheckNTErrors(file.is_open(), "Failed to open the model map");
+
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        istringstream fields(line);
+        string id;
+        PoolEntry entry;
+        if (!(fields >> id >> entry.modelFN))
+            continue;
+        fields >> entry.srcVocabFN >> entry.tgtVocabFN;
+
+        entry.instance = NULL;
+        entry.scheduler = NULL;
+        entry.memSize = 0;
+        entry.userNum = 0;
+        entry.isLoading = false;
+        entry.lastUse = 0;
+        entries[id] = entry;
+    }
+
+    LOG("model pool: %d models, budget=%luMB", int(entries.size()),
+        (unsigned long)(budget / 1024 / 1024));
+}
+
+/*
+get the scheduler of a model. The model is loaded if necessary, and it is
+not unloaded until it is released.
+>> id - id of the model
+>> translator - the translator of the model (for return, NULL if not used),
+                e.g., to make samples from text with its vocabularies
+<< return - the scheduler (NULL if the model cannot be loaded),
+            the caller calls Release() when it is done if it is not NULL
+*/
+BatchScheduler* ModelPool::Acquire(const string& id, Translator** translator)
+{
+    unique_lock<mutex> lock(poolMutex);
+
+    auto it = entries.find(id);
+    if (it == entries.end()) {
+        LOG("unknown model %s", id.c_str());
+        return NULL;
+    }
+
+    PoolEntry& entry = it->second;
+    entry.userNum++;
+    entry.lastUse = ++clock;
+
+    /* the model is being loaded by another user */
+    loadCond.wait(lock, [&entry] { return !entry.isLoading; });
+
+    if (entry.scheduler != NULL) {
+        if (translator != NULL)
+            *translator = entry.instance->translator;
+        return entry.scheduler;
+    }
+
+    /* make room before loading (the file size is a good estimate of the parameters) */
+    uint64_t estimate = 0;
+    FILE* file = fopen(entry.modelFN.c_str(), "rb");
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        estimate = uint64_t(ftell(file));
+        fclose(file);
+    }
+    Evict(estimate, id);
+
+    entry.isLoading = true;
+    entry.memSize = estimate;
+    usedSize += estimate;
+    lock.unlock();
+
+    /* other models are served while loading */
+    ModelInstance* instance = new ModelInstance();
+    BatchScheduler* scheduler = NULL;
+    bool isLoaded = instance->Load(args, entry.modelFN.c_str(),
+                                   entry.srcVocabFN.empty() ? NULL : entry.srcVocabFN.c_str(),
+                                   entry.tgtVocabFN.empty() ? NULL : entry.tgtVocabFN.c_str());
+    if (isLoaded) {
+        scheduler = new BatchScheduler();
+        scheduler->Init(*instance->config, *instance->translator);
+        scheduler->Start();
+    }
+
+    lock.lock();
+    usedSize -= estimate;
+
+    if (isLoaded) {
+        entry.instance = instance;
+        entry.scheduler = scheduler;
+        entry.memSize = instance->model->GetParamSize();
+        usedSize += entry.memSize;
+        LOG("model pool: loaded %s (%luMB, %luMB in use)", id.c_str(),
+            (unsigned long)(entry.memSize / 1024 / 1024), (unsigned long)(usedSize / 1024 / 1024));
+        Evict(0, id);
+    }
+    else {
+        delete instance;
+        entry.memSize = 0;
+        entry.userNum--;
+    }
+
+    entry.isLoading = false;
+    loadCond.notify_all();
+
+    if (translator != NULL && isLoaded)
+        *translator = instance->translator;
+
+    return scheduler;
+}
+
+/*
+release a model acquired before
+>> id - id of the model
+*/
+void ModelPool::Release(const string& id)
+{
+    lock_guard<mutex> lock(poolMutex);
+
+    auto it = entries.find(id);
+    CheckNTErrors(it != entries.end() && it->second.userNum > 0, "Invalid release of a model");
+    it->second.userNum--;
+}
+
+/*
+unload the least recently used idle models to make room. A model in use
+is never unloaded, so the budget may be exceeded when all models are busy.
+>> size - size of the room (in bytes)
+>> keep - id of the model that should be kept
+*/
+void ModelPool::Evict(uint64_t size, const string& keep)
+{
+    if (budget == 0)
+        return;
+
+    while (usedSize + size > budget) {
+        PoolEntry* victim = NULL;
+        string victimID;
+        for (auto& it : entries) {
+            PoolEntry& entry = it.second;
+            if (entry.scheduler == NULL || entry.userNum > 0 || it.first == keep)
+                continue;
+            if (victim == NULL || entry.lastUse < victim->lastUse) {
+                victim = &entry;
+                victimID = it.first;
+            }
+        }
+
+        if (victim == NULL) {
+            LOG("model pool: the budget is exceeded as all loaded models are in use");
+            break;
+        }
+
+        LOG("model pool: unloading %s", victimID.c_str());
+        Unload(*victim);
+    }
+}
+
+/*
+unload a model. Its scheduler has no waiting sentences as it is not in use.
+>> entry - the model
+*/
+void ModelPool::Unload(PoolEntry& entry)
+{
+    entry.scheduler->Stop();
+    delete entry.scheduler;
+    delete entry.instance;
+    entry.scheduler = NULL;
+    entry.instance = NULL;
+    usedSize -= entry.memSize;
+    entry.memSize = 0;
+}
+
+/* get the size of the loaded models in bytes */
+uint64_t ModelPool::GetUsedSize()
+{
+    lock_guard<mutex> lock(poolMutex);
+    return usedSize;
+}
+
+/* unload all models (they should not be in use) */
+void ModelPool::Clear()
+{
+    lock_guard<mutex> lock(poolMutex);
+    for (auto& it : entries) {
+        if (it.second.scheduler != NULL)
+            Unload(it.second);
+    }
+}
+
+} /* end of the nmt namespace */
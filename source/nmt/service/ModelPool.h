@@ -0,0 +1,136 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The model pool hosts several models (e.g., language pairs) in one process.
+ * The models are listed in the "modelmap" file and keyed by ids. A model is
+ * loaded when it is first requested, and each loaded model has its own
+ * translator and scheduler. When the parameters of the loaded models exceed
+ * the memory budget ("poolsize"), the least recently used idle models are
+ * unloaded.
+ */
+
+#ifndef __MODELPOOL_H__
+#define __MODELPOOL_H__
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <condition_variable>
+#include "ModelInstance.h"
+#include "BatchScheduler.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* a model in the pool */
+struct PoolEntry
+{
+    /* path to the model */
+    string modelFN;
+
+    /* path to the source vocabulary (empty for the one in the options) */
+    string srcVocabFN;
+
+    /* path to the target vocabulary (empty for the one in the options) */
+    string tgtVocabFN;
+
+    /* the loaded model (NULL if it is not loaded) */
+    ModelInstance* instance;
+
+    /* the scheduler of the model (NULL if it is not loaded) */
+    BatchScheduler* scheduler;
+
+    /* size of the parameters in bytes (estimated by the file size in loading) */
+    uint64_t memSize;
+
+    /* number of the users that acquired the model */
+    int userNum;
+
+    /* indicates whether the model is being loaded */
+    bool isLoading;
+
+    /* the time of the last use (a logical clock) */
+    long lastUse;
+};
+
+/* the pool of models */
+class ModelPool
+{
+private:
+    /* the command-line options (used to configure the models) */
+    vector<string> args;
+
+    /* the memory budget in bytes (0 for no limit) */
+    uint64_t budget;
+
+    /* size of the loaded models in bytes */
+    uint64_t usedSize;
+
+    /* the logical clock for the LRU order */
+    long clock;
+
+    /* the models */
+    unordered_map<string, PoolEntry> entries;
+
+    /* the mutex of the pool */
+    mutex poolMutex;
+
+    /* signaled when a model is loaded */
+    condition_variable loadCond;
+
+private:
+    /* load the list of models */
+    void LoadModelMap(const char* fn);
+
+    /* unload the least recently used idle models to make room */
+    void Evict(uint64_t size, const string& keep);
+
+    /* unload a model */
+    void Unload(PoolEntry& entry);
+
+public:
+    /* constructor */
+    ModelPool();
+
+    /* de-constructor */
+    ~ModelPool();
+
+    /* initialize the pool */
+    void Init(int argc, const char** argv);
+
+    /* get the scheduler of a model (loaded if necessary) */
+    BatchScheduler* Acquire(const string& id, Translator** translator = NULL);
+
+    /* release a model acquired before */
+    void Release(const string& id);
+
+    /* get the size of the loaded models in bytes */
+    uint64_t GetUsedSize();
+
+    /* unload all models */
+    void Clear();
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __MODELPOOL_H__ */
@@ -0,0 +1,164 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ModelReloader.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the interval (in ms) to check the signal */
+#define RELOAD_CHECK_INTERVAL 100
+
+volatile sig_atomic_t ModelReloader::signaled = 0;
+
+/* the signal handler */
+void ModelReloader::HandleSignal(int sig)
+{
+    signaled = 1;
+}
+
+/* constructor */
+ModelReloader::ModelReloader()
+{
+    scheduler = NULL;
+    current = NULL;
+    initial = NULL;
+    isPending = false;
+    running = false;
+}
+
+/*
+de-constructor. The scheduler should be stopped before it, as
+the translator of the scheduler may be owned by the reloader.
+*/
+ModelReloader::~ModelReloader()
+{
+    Stop();
+    delete current;
+}
+
+/*
+initialize the reloader
+>> argc - number of the command-line options
+>> argv - the command-line options
+>> myScheduler - the scheduler
+>> myInitial - the instance whose translator is used by the scheduler at first
+               (NULL if not given). Its model is unloaded after the first reload,
+               and its configuration is kept, as the scheduler refers to it.
+*/
+void ModelReloader::Init(int argc, const char** argv, BatchScheduler& myScheduler,
+                         ModelInstance* myInitial)
+{
+    args.clear();
+    for (int i = 0; i < argc; i++)
+        args.push_back(argv[i]);
+    scheduler = &myScheduler;
+    initial = myInitial;
+}
+
+/* start the loader thread and handle SIGHUP */
+void ModelReloader::Start()
+{
+    if (running)
+        return;
+
+    running = true;
+    worker = thread(&ModelReloader::Run, this);
+
+#ifndef _WIN32
+    signal(SIGHUP, HandleSignal);
+#endif
+}
+
+/* stop the loader thread */
+void ModelReloader::Stop()
+{
+    {
+        lock_guard<mutex> lock(reloadMutex);
+        if (!running)
+            return;
+        running = false;
+    }
+
+    reloadCond.notify_all();
+    worker.join();
+}
+
+/*
+request a reload
+>> modelFN - path to the new model (NULL for the one in the options,
+             e.g., after the file is replaced)
+*/
+void ModelReloader::Reload(const char* modelFN)
+{
+    {
+        lock_guard<mutex> lock(reloadMutex);
+        pendingFN = modelFN != NULL ? modelFN : "";
+        isPending = true;
+    }
+
+    reloadCond.notify_all();
+}
+
+/*
+the loop of the loader thread. The signal handler only sets a flag,
+so we check it periodically.
+*/
+void ModelReloader::Run()
+{
+    unique_lock<mutex> lock(reloadMutex);
+
+    while (running) {
+        reloadCond.wait_for(lock, chrono::milliseconds(RELOAD_CHECK_INTERVAL));
+
+        if (signaled) {
+            signaled = 0;
+            pendingFN = "";
+            isPending = true;
+        }
+
+        if (!running || !isPending)
+            continue;
+
+        string modelFN = pendingFN;
+        isPending = false;
+        lock.unlock();
+
+        LOG("reloading the model %s", modelFN.empty() ? "(the same path)" : modelFN.c_str());
+
+        ModelInstance* instance = new ModelInstance();
+        if (instance->Load(args, modelFN.empty() ? NULL : modelFN.c_str())) {
+            /* the old translator and its configuration are no longer used after the switch */
+            scheduler->SetTranslator(instance->translator, instance->config);
+            if (current != NULL)
+                delete current;
+            else if (initial != NULL)
+                initial->Unload();
+            current = instance;
+            LOG("switched to the model %s", instance->config->common.modelFN);
+        }
+        else {
+            delete instance;
+            LOG("failed to reload the model, keep using the old one");
+        }
+
+        lock.lock();
+    }
+}
+
+} /* end of the nmt namespace */
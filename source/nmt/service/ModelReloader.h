@@ -0,0 +1,111 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Hot reload of the model in the translation service. A reload is requested
+ * by Reload() or by SIGHUP. The new model is loaded by a background thread
+ * while the scheduler keeps serving with the old one, and the scheduler
+ * switches to it between two groups of sentences. The old model is released
+ * after the switch, i.e., after the sentences dispatched to it are done.
+ */
+
+#ifndef __MODELRELOADER_H__
+#define __MODELRELOADER_H__
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <csignal>
+#include <condition_variable>
+#include "ModelInstance.h"
+#include "BatchScheduler.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the reloader of models */
+class ModelReloader
+{
+private:
+    /* the command-line options (used to configure the new models) */
+    vector<string> args;
+
+    /* the scheduler */
+    BatchScheduler* scheduler;
+
+    /* the instance loaded by the reloader (NULL if the initial one is in use) */
+    ModelInstance* current;
+
+    /* the initial instance (not owned by the reloader, NULL if not given) */
+    ModelInstance* initial;
+
+    /* path to the model to load (empty for the one in the options) */
+    string pendingFN;
+
+    /* indicates whether a reload is requested */
+    bool isPending;
+
+    /* the loader thread */
+    thread worker;
+
+    /* indicates whether the loader is running */
+    bool running;
+
+    /* the mutex of the requests */
+    mutex reloadMutex;
+
+    /* signaled when a reload is requested or the loader is stopped */
+    condition_variable reloadCond;
+
+    /* set by the signal handler */
+    static volatile sig_atomic_t signaled;
+
+private:
+    /* the signal handler */
+    static void HandleSignal(int sig);
+
+    /* the loop of the loader thread */
+    void Run();
+
+public:
+    /* constructor */
+    ModelReloader();
+
+    /* de-constructor */
+    ~ModelReloader();
+
+    /* initialize the reloader */
+    void Init(int argc, const char** argv, BatchScheduler& myScheduler,
+              ModelInstance* myInitial = NULL);
+
+    /* start the loader thread and handle SIGHUP */
+    void Start();
+
+    /* stop the loader thread */
+    void Stop();
+
+    /* request a reload */
+    void Reload(const char* modelFN = NULL);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __MODELRELOADER_H__ */
@@ -0,0 +1,325 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstring>
+#include "ShmChannel.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the slots are aligned to cache lines */
+#define SHM_ALIGN(size) (((size) + 63) & ~((uint32_t)63))
+
+/* constructor */
+ShmRing::ShmRing()
+{
+    header = NULL;
+    slots = NULL;
+    slotNum = 0;
+    slotSize = 0;
+}
+
+/*
+attach the ring to the shared memory
+>> myHeader - the positions
+>> mySlots - the slots
+>> mySlotNum - number of slots (a power of 2)
+>> mySlotSize - size of a slot in bytes
+*/
+void ShmRing::Attach(ShmRingHeader* myHeader, char* mySlots, uint32_t mySlotNum, uint32_t mySlotSize)
+{
+    header = myHeader;
+    slots = mySlots;
+    slotNum = mySlotNum;
+    slotSize = mySlotSize;
+}
+
+/*
+get the free slot to write. Only the producer changes the tail, and
+the head is loaded with acquire semantics, so the consumer has done
+with the slot when we see it is free.
+<< return - the slot (NULL if the ring is full)
+*/
+ShmSlot* ShmRing::Back()
+{
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    if (tail - head >= slotNum)
+        return NULL;
+    return (ShmSlot*)(slots + (size_t)(tail & (slotNum - 1)) * slotSize);
+}
+
+/* publish the slot given by Back() */
+void ShmRing::Push()
+{
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+get the first slot to read. The tail is loaded with acquire semantics,
+so the slot is fully written when we see it.
+<< return - the slot (NULL if the ring is empty)
+*/
+ShmSlot* ShmRing::Front()
+{
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return (ShmSlot*)(slots + (size_t)(head & (slotNum - 1)) * slotSize);
+}
+
+/* release the slot given by Front() */
+void ShmRing::Pop()
+{
+    uint64_t head = __atomic_load_n(&header->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&header->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* constructor */
+ShmChannel::ShmChannel()
+{
+    base = NULL;
+    mapSize = 0;
+    isOwner = false;
+    maxLen = 0;
+    header = NULL;
+}
+
+/* de-constructor */
+ShmChannel::~ShmChannel()
+{
+    Close();
+}
+
+#ifndef _WIN32
+
+/*
+create a channel. An existing channel of the same name (e.g., left by
+a server that crashed) is replaced.
+>> myName - name of the shared-memory object (e.g., "/nmt.0")
+>> slotNum - number of slots of each ring
+>> myMaxLen - the maximum number of tokens in a slot
+<< return - whether the channel is created
+*/
+bool ShmChannel::Create(const char* myName, int slotNum, int myMaxLen)
+{
+    Close();
+
+    uint32_t num = 1;
+    while ((int)num < slotNum)
+        num <<= 1;
+    uint32_t slotSize = SHM_ALIGN(sizeof(ShmSlot) + sizeof(int32_t) * myMaxLen);
+
+    name = myName;
+    mapSize = sizeof(ShmHeader) + (size_t)2 * num * slotSize;
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        LOG("cannot create the shared memory %s", name.c_str());
+        return false;
+    }
+
+    if (ftruncate(fd, mapSize) != 0) {
+        LOG("cannot allocate the shared memory %s", name.c_str());
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    base = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CheckNTErrors(base != MAP_FAILED, "Cannot map the shared memory");
+
+    isOwner = true;
+    maxLen = myMaxLen;
+    header = (ShmHeader*)base;
+    memset(header, 0, sizeof(ShmHeader));
+    header->version = SHM_VERSION;
+    header->slotNum = num;
+    header->maxLen = maxLen;
+    header->slotSize = slotSize;
+
+    requests.Attach(&header->requests, base + sizeof(ShmHeader), num, slotSize);
+    responses.Attach(&header->responses, base + sizeof(ShmHeader) + (size_t)num * slotSize,
+                     num, slotSize);
+
+    /* clients check the magic number, so it is written last */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, SHM_MAGIC, sizeof(header->magic));
+
+    return true;
+}
+
+/*
+open a channel created by the server
+>> myName - name of the shared-memory object
+<< return - whether the channel is opened
+*/
+bool ShmChannel::Open(const char* myName)
+{
+    Close();
+
+    name = myName;
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    fstat(fd, &st);
+    if ((size_t)st.st_size < sizeof(ShmHeader)) {
+        close(fd);
+        return false;
+    }
+
+    mapSize = st.st_size;
+    base = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    CheckNTErrors(base != MAP_FAILED, "Cannot map the shared memory");
+
+    header = (ShmHeader*)base;
+    if (memcmp(header->magic, SHM_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SHM_VERSION ||
+        mapSize < sizeof(ShmHeader) + (size_t)2 * header->slotNum * header->slotSize ||
+        header->slotSize < sizeof(ShmSlot) + sizeof(int32_t) * (size_t)header->maxLen) {
+        LOG("invalid shared memory %s", name.c_str());
+        Close();
+        return false;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    maxLen = (int)header->maxLen;
+
+    requests.Attach(&header->requests, base + sizeof(ShmHeader),
+                    header->slotNum, header->slotSize);
+    responses.Attach(&header->responses, base + sizeof(ShmHeader) + (size_t)header->slotNum * header->slotSize,
+                     header->slotNum, header->slotSize);
+
+    return true;
+}
+
+/* close the channel */
+void ShmChannel::Close()
+{
+    if (base != NULL)
+        munmap(base, mapSize);
+    if (isOwner)
+        shm_unlink(name.c_str());
+
+    base = NULL;
+    header = NULL;
+    mapSize = 0;
+    isOwner = false;
+    maxLen = 0;
+}
+
+#else
+
+/* the shared memory is not supported on Windows */
+bool ShmChannel::Create(const char* myName, int slotNum, int myMaxLen)
+{
+    LOG("the shared memory is not supported on this platform");
+    return false;
+}
+
+/* the shared memory is not supported on Windows */
+bool ShmChannel::Open(const char* myName)
+{
+    return false;
+}
+
+/* close the channel */
+void ShmChannel::Close()
+{
+}
+
+#endif
+
+/* get the maximum number of tokens in a slot (the copy taken when the channel is created or opened) */
+int ShmChannel::GetMaxLen()
+{
+    return maxLen;
+}
+
+/*
+write a request to the channel
+>> id - the id of the request (copied to the response)
+>> tokens - the source token ids
+>> len - number of the source tokens
+>> prefix - the forced target prefix (NULL if not used)
+>> prefixLen - number of tokens of the prefix
+>> priority - the priority (a larger value is served first)
+>> timeout - the time limit in ms (0 for no limit)
+>> model - id of the model in the model map of the server (NULL for the model of the server)
+<< return - false if the ring is full (or the request is too long)
+*/
+bool ShmChannel::Send(uint64_t id, const int* tokens, int len, const int* prefix,
+                      int prefixLen, int priority, float timeout, const char* model)
+{
+    if (prefix == NULL)
+        prefixLen = 0;
+    if (len + prefixLen > GetMaxLen())
+        return false;
+    if (model != NULL && strlen(model) >= SHM_MODEL_LEN)
+        return false;
+
+    ShmSlot* slot = requests.Back();
+    if (slot == NULL)
+        return false;
+
+    slot->id = id;
+    slot->len = len;
+    slot->prefixLen = prefixLen;
+    slot->priority = priority;
+    slot->timeout = timeout;
+    slot->status = 0;
+    memset(slot->model, 0, sizeof(slot->model));
+    if (model != NULL)
+        strcpy(slot->model, model);
+    memcpy(slot->GetTokens(), tokens, sizeof(int) * len);
+    if (prefixLen > 0)
+        memcpy(slot->GetTokens() + len, prefix, sizeof(int) * prefixLen);
+
+    requests.Push();
+    return true;
+}
+
+/*
+get the name of the i-th channel
+>> name - the name given by the "shm" option
+>> i - index of the channel
+<< return - name of the shared-memory object
+*/
+string GetShmChannelName(const char* name, int i)
+{
+    string channelName = name;
+    if (channelName.empty() || channelName[0] != '/')
+        channelName = "/" + channelName;
+    return channelName + "." + to_string(i);
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,220 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The shared-memory transport between client processes and the translator.
+ * Each client has a channel, i.e., a POSIX shared-memory object that holds
+ * a request ring and a response ring. A ring is a lock-free queue of a
+ * single producer and a single consumer: the producer writes a slot and
+ * then publishes it by advancing the tail, and the consumer reads the slot
+ * in place and then releases it by advancing the head.
+ *
+ * A client opens its channel and writes the token ids of a sentence into
+ * the slot given by requests.Back() and calls requests.Push(). Translations
+ * come back in responses.Front() with the same id, and the client calls
+ * responses.Pop() after reading them. The server reads the request slots in
+ * place, so no text is parsed and the tokens are copied only once.
+ */
+
+#ifndef __SHMCHANNEL_H__
+#define __SHMCHANNEL_H__
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+#define SHM_MAGIC "NMTSHM\0\0"
+#define SHM_VERSION 1
+
+/* the maximum length of a model id in a slot (with the ending '\0') */
+#define SHM_MODEL_LEN 32
+
+/* a slot of a ring, followed by the tokens (the source and then the prefix) */
+struct ShmSlot
+{
+    /* the id given by the client (copied to the response) */
+    uint64_t id;
+
+    /* number of source tokens (number of target tokens in responses) */
+    int32_t len;
+
+    /* number of tokens of the forced prefix (0 if not used) */
+    int32_t prefixLen;
+
+    /* the priority (a larger value is served first) */
+    int32_t priority;
+
+    /* the time limit in ms (0 for no limit) */
+    float timeout;
+
+    /* the status of the translation (RequestStatus, in responses), and
+       REQUEST_EXPIRED with tokens means a partial translation, and
+       REQUEST_INVALID means an unknown model, an invalid length or a
+       token id out of the vocabulary */
+    int32_t status;
+
+    /* not used */
+    int32_t reserved;
+
+    /* id of the model in the model map (empty for the model of the server) */
+    char model[SHM_MODEL_LEN];
+
+    /* get the tokens */
+    int32_t* GetTokens() { return (int32_t*)(this + 1); }
+};
+
+/* the positions of a ring, on separate cache lines to avoid false sharing */
+struct ShmRingHeader
+{
+    /* number of slots popped by the consumer */
+    uint64_t head;
+    char pad1[56];
+
+    /* number of slots pushed by the producer */
+    uint64_t tail;
+    char pad2[56];
+};
+
+/* the header of a channel */
+struct ShmHeader
+{
+    /* the magic number */
+    char magic[8];
+
+    /* the version */
+    uint32_t version;
+
+    /* number of slots of each ring (a power of 2) */
+    uint32_t slotNum;
+
+    /* the maximum number of tokens in a slot */
+    uint32_t maxLen;
+
+    /* size of a slot in bytes */
+    uint32_t slotSize;
+
+    char pad[40];
+
+    /* the ring of requests (client -> server) */
+    ShmRingHeader requests;
+
+    /* the ring of responses (server -> client) */
+    ShmRingHeader responses;
+};
+
+/* a single-producer single-consumer ring in shared memory */
+class ShmRing
+{
+private:
+    /* the positions */
+    ShmRingHeader* header;
+
+    /* the slots */
+    char* slots;
+
+    /* number of slots */
+    uint32_t slotNum;
+
+    /* size of a slot in bytes */
+    uint32_t slotSize;
+
+public:
+    /* constructor */
+    ShmRing();
+
+    /* attach the ring to the shared memory */
+    void Attach(ShmRingHeader* myHeader, char* mySlots, uint32_t mySlotNum, uint32_t mySlotSize);
+
+    /* get the free slot to write (producer, NULL if the ring is full) */
+    ShmSlot* Back();
+
+    /* publish the slot given by Back() (producer) */
+    void Push();
+
+    /* get the first slot to read (consumer, NULL if the ring is empty) */
+    ShmSlot* Front();
+
+    /* release the slot given by Front() (consumer) */
+    void Pop();
+};
+
+/* the channel of a client */
+class ShmChannel
+{
+private:
+    /* name of the shared-memory object */
+    string name;
+
+    /* the mapped memory */
+    char* base;
+
+    /* size of the mapped memory */
+    size_t mapSize;
+
+    /* indicates whether the channel is created by us (removed when closed) */
+    bool isOwner;
+
+    /* the maximum number of tokens in a slot, kept out of the shared memory
+       as the other process may change the header */
+    int maxLen;
+
+public:
+    /* the header */
+    ShmHeader* header;
+
+    /* the requests (client -> server) */
+    ShmRing requests;
+
+    /* the responses (server -> client) */
+    ShmRing responses;
+
+public:
+    /* constructor */
+    ShmChannel();
+
+    /* de-constructor */
+    ~ShmChannel();
+
+    /* create a channel (server) */
+    bool Create(const char* myName, int slotNum, int myMaxLen);
+
+    /* open a channel created by the server (client) */
+    bool Open(const char* myName);
+
+    /* close the channel */
+    void Close();
+
+    /* get the maximum number of tokens in a slot */
+    int GetMaxLen();
+
+    /* write a request to the channel (client) */
+    bool Send(uint64_t id, const int* tokens, int len, const int* prefix = NULL,
+              int prefixLen = 0, int priority = 0, float timeout = 0, const char* model = NULL);
+};
+
+/* get the name of the i-th channel */
+string GetShmChannelName(const char* name, int i);
+
+} /* end of the nmt namespace */
+
+#endif /* __SHMCHANNEL_H__ */
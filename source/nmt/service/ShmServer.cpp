@@ -0,0 +1,274 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include "ShmServer.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the time (in microseconds) to sleep when no client is active */
+#define SHM_POLL_INTERVAL 50
+
+volatile sig_atomic_t ShmServer::stopped = 0;
+
+/* the signal handler */
+void ShmServer::HandleSignal(int sig)
+{
+    stopped = 1;
+}
+
+/* constructor */
+ShmServer::ShmServer()
+{
+    scheduler = NULL;
+    pool = NULL;
+    maxPending = 0;
+}
+
+/* de-constructor */
+ShmServer::~ShmServer()
+{
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].scheduler != NULL) {
+            pending[i].scheduler->Wait(pending[i].request);
+            ReleaseScheduler(pending[i].model);
+        }
+        delete pending[i].request;
+    }
+    for (size_t i = 0; i < channels.size(); i++)
+        delete channels[i];
+}
+
+/*
+create the channels to serve a model
+>> config - configuration of the NMT system
+>> myScheduler - the scheduler (started)
+<< return - whether all channels are created
+*/
+bool ShmServer::Init(NMTConfig& config, BatchScheduler& myScheduler)
+{
+    scheduler = &myScheduler;
+    pool = NULL;
+    return CreateChannels(config);
+}
+
+/*
+create the channels to serve the models of a pool. A model is loaded
+when it is first requested, and the server waits for the loading.
+>> config - configuration of the NMT system
+>> myPool - the pool (initialized)
+<< return - whether all channels are created
+*/
+bool ShmServer::Init(NMTConfig& config, ModelPool& myPool)
+{
+    scheduler = NULL;
+    pool = &myPool;
+    return CreateChannels(config);
+}
+
+/*
+create the channels
+>> config - configuration of the NMT system
+<< return - whether all channels are created
+*/
+bool ShmServer::CreateChannels(NMTConfig& config)
+{
+    maxPending = config.service.shmSlots;
+
+    /* a slot holds a source sequence with its prefix, or a translation */
+    int maxLen = config.model.maxSrcLen + config.model.maxTgtLen;
+
+    for (int i = 0; i < config.service.shmClients; i++) {
+        string name = GetShmChannelName(config.service.shmName, i);
+        ShmChannel* channel = new ShmChannel();
+        if (!channel->Create(name.c_str(), config.service.shmSlots, maxLen)) {
+            delete channel;
+            return false;
+        }
+        channels.push_back(channel);
+        pendingNums.push_back(0);
+    }
+
+    LOG("created %d shared-memory channels %s (slots=%d)",
+        config.service.shmClients, GetShmChannelName(config.service.shmName, 0).c_str(),
+        config.service.shmSlots);
+
+    return true;
+}
+
+/*
+get the scheduler of a model
+>> model - id of the model in the pool (empty for the model of the server)
+<< return - the scheduler (NULL if the model is unknown or cannot be loaded)
+*/
+BatchScheduler* ShmServer::AcquireScheduler(const string& model)
+{
+    if (model.size() >= SHM_MODEL_LEN)
+        return NULL;
+    if (pool == NULL)
+        return model.empty() ? scheduler : NULL;
+    if (model.empty())
+        return NULL;
+    return pool->Acquire(model);
+}
+
+/*
+release the scheduler of a model acquired before
+>> model - id of the model
+*/
+void ShmServer::ReleaseScheduler(const string& model)
+{
+    if (pool != NULL)
+        pool->Release(model);
+}
+
+/*
+submit the new requests of a channel. The tokens are read from the slots
+in place, and a slot is released after the tokens are copied to the samples.
+>> channel - index of the channel
+<< return - whether there are new requests
+*/
+bool ShmServer::Receive(int channel)
+{
+    ShmRing& requests = channels[channel]->requests;
+    int maxLen = channels[channel]->GetMaxLen();
+    bool received = false;
+
+    ShmSlot* slot;
+    while (pendingNums[channel] < maxPending && (slot = requests.Front()) != NULL) {
+        /* the slot is written by the client, so the lengths are read once
+           and checked against the server-side limit */
+        int len = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+        int prefixLen = __atomic_load_n(&slot->prefixLen, __ATOMIC_RELAXED);
+        bool isValid = len >= 0 && prefixLen >= 0 && len <= maxLen && prefixLen <= maxLen - len;
+        if (!isValid)
+            len = prefixLen = 0;
+        const int* src = slot->GetTokens();
+        const int* prefix = prefixLen > 0 ? slot->GetTokens() + len : NULL;
+
+        ShmPending item;
+        item.channel = channel;
+        item.id = slot->id;
+
+        /* the model id is not trusted to be terminated, and an id that fills
+           the field is rejected */
+        item.model.assign(slot->model, strnlen(slot->model, SHM_MODEL_LEN));
+        item.scheduler = isValid ? AcquireScheduler(item.model) : NULL;
+
+        /* the scheduler answers REQUEST_INVALID if an id is out of the vocabulary */
+        if (item.scheduler != NULL) {
+            item.request = item.scheduler->Submit(&src, &len, &prefix, &prefixLen, 1,
+                                                  slot->priority, slot->timeout);
+        }
+        else {
+            item.request = new ServiceRequest(1, slot->priority, 0);
+            item.request->status = REQUEST_INVALID;
+            item.request->remaining = 0;
+        }
+
+        requests.Pop();
+        pending.push_back(item);
+        pendingNums[channel]++;
+        received = true;
+    }
+
+    return received;
+}
+
+/*
+write the translations of the finished requests. A request stays if the
+response ring of its client is full, i.e., the client is slow to read.
+<< return - whether any translation is written
+*/
+bool ShmServer::Reply()
+{
+    bool replied = false;
+
+    for (auto it = pending.begin(); it != pending.end();) {
+        if (it->scheduler != NULL && !it->scheduler->IsDone(it->request)) {
+            it++;
+            continue;
+        }
+
+        ShmChannel* channel = channels[it->channel];
+        ShmSlot* slot = channel->responses.Back();
+        if (slot == NULL) {
+            it++;
+            continue;
+        }
+
+        ServiceRequest* request = it->request;
+        IntList* output = request->outputs[0];
+        int len = output == NULL ? 0 : MIN(int(output->Size()), channel->GetMaxLen());
+
+        slot->id = it->id;
+        slot->len = len;
+        slot->prefixLen = 0;
+        slot->priority = request->priority;
+        slot->timeout = 0;
+        slot->status = request->status;
+        memset(slot->model, 0, SHM_MODEL_LEN);
+        memcpy(slot->model, it->model.c_str(), MIN((int)it->model.size(), SHM_MODEL_LEN - 1));
+        if (len > 0)
+            memcpy(slot->GetTokens(), output->items, sizeof(int) * len);
+        channel->responses.Push();
+
+        if (it->scheduler != NULL)
+            ReleaseScheduler(it->model);
+        pendingNums[it->channel]--;
+        delete request;
+        it = pending.erase(it);
+        replied = true;
+    }
+
+    return replied;
+}
+
+/* serve the clients until SIGINT or SIGTERM */
+void ShmServer::Serve()
+{
+    stopped = 0;
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+
+    while (!stopped) {
+        bool isActive = false;
+        for (int i = 0; i < (int)channels.size(); i++)
+            isActive = Receive(i) || isActive;
+        isActive = Reply() || isActive;
+
+        /* we poll the rings as they have no notification across processes */
+        if (!isActive)
+            this_thread::sleep_for(chrono::microseconds(SHM_POLL_INTERVAL));
+    }
+
+    LOG("stopping the shared-memory server (%d requests pending)", (int)pending.size());
+
+    /* reply to the requests in translation if their clients are reading */
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].scheduler != NULL)
+            pending[i].scheduler->Wait(pending[i].request);
+    }
+    Reply();
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,126 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The server side of the shared-memory transport. It creates a channel for
+ * each client process ("<shm>.0", "<shm>.1", ...), polls the request rings,
+ * submits the requests to the batch scheduler straight from the slots, and
+ * writes the translations to the response rings when they are done. With a
+ * model pool, a request names its model in the slot, and it is submitted to
+ * the scheduler of that model.
+ */
+
+#ifndef __SHMSERVER_H__
+#define __SHMSERVER_H__
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+#include <csignal>
+#include "ShmChannel.h"
+#include "ModelPool.h"
+#include "BatchScheduler.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* a request being translated */
+struct ShmPending
+{
+    /* index of the channel of the request */
+    int channel;
+
+    /* the id given by the client */
+    uint64_t id;
+
+    /* the id of the model (in the model pool) */
+    string model;
+
+    /* the scheduler of the request (NULL if the request is invalid) */
+    BatchScheduler* scheduler;
+
+    /* the request of the scheduler */
+    ServiceRequest* request;
+};
+
+/* the server of the shared-memory channels */
+class ShmServer
+{
+private:
+    /* the channels */
+    vector<ShmChannel*> channels;
+
+    /* the scheduler (NULL if the models are hosted by a pool) */
+    BatchScheduler* scheduler;
+
+    /* the pool of models (NULL if not used) */
+    ModelPool* pool;
+
+    /* the requests being translated (in the order of arrival) */
+    deque<ShmPending> pending;
+
+    /* number of the requests being translated of each channel */
+    vector<int> pendingNums;
+
+    /* the maximum number of requests being translated of a channel */
+    int maxPending;
+
+    /* indicates whether SIGINT or SIGTERM is received */
+    static volatile sig_atomic_t stopped;
+
+private:
+    /* the signal handler */
+    static void HandleSignal(int sig);
+
+    /* create the channels */
+    bool CreateChannels(NMTConfig& config);
+
+    /* get the scheduler of a model */
+    BatchScheduler* AcquireScheduler(const string& model);
+
+    /* release the scheduler of a model */
+    void ReleaseScheduler(const string& model);
+
+    /* submit the new requests of a channel */
+    bool Receive(int channel);
+
+    /* write the translations of the finished requests */
+    bool Reply();
+
+public:
+    /* constructor */
+    ShmServer();
+
+    /* de-constructor */
+    ~ShmServer();
+
+    /* create the channels to serve a model */
+    bool Init(NMTConfig& config, BatchScheduler& myScheduler);
+
+    /* create the channels to serve the models of a pool */
+    bool Init(NMTConfig& config, ModelPool& myPool);
+
+    /* serve the clients until SIGINT or SIGTERM */
+    void Serve();
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __SHMSERVER_H__ */
@@ -20,8 +20,11 @@
   * $Modified by: HU Chi (huchinlp@gmail.com) 2020-04, 2020-06
   */
 
+#include <cmath>
+#include <cstring>
 #include "Attention.h"
 #include "Embedding.h"
+#include "HalfWeight.h"
 
 /* the nmt namespace */
 namespace nmt
@@ -38,6 +41,10 @@ Attention::Attention()
 {
     devID = -1;
     nhead = -1;
+    headDim = -1;
+    splitHeads = false;
+    scoreHeads = false;
+    headScoreNum = 0;
     kDim = -1;
     vDim = -1;
     embDim = -1;
@@ -79,6 +86,8 @@ void Attention::InitModel(NMTConfig& config, bool isEnc, bool isSelfAtt)
 
     dropoutP = config.model.attDropout;
     maxRP = config.model.maxRelativeLength;
+    headDim = embDim / nhead;
+    splitHeads = nhead > 1;
 
     /* initialize the parameters */
     InitTensor2D(&weightQ, embDim, embDim, X_FLOAT, devID);
@@ -92,7 +101,7 @@ void Attention::InitModel(NMTConfig& config, bool isEnc, bool isSelfAtt)
 
     /* currently, we only support k-only mode, i.e., we do not set RPR for values */
     if (useRPR)
-        InitTensor2D(&RPEmbK, maxRP * 2 + 1, embDim / nhead, X_FLOAT, devID);
+        InitTensor2D(&RPEmbK, maxRP * 2 + 1, headDim, X_FLOAT, devID);
 
     if (isTraining) {
         const float scale = 1.0F / sqrtf(2.0F);
@@ -112,6 +121,133 @@ void Attention::InitModel(NMTConfig& config, bool isEnc, bool isSelfAtt)
     }
 }
 
+/*
+set the number of heads of a pruned model. The transformations of Q, K and V
+have nhead * headDim outputs, and the output transformation has as many
+inputs. It is called before the parameters are loaded.
+>> n - number of the heads
+*/
+void Attention::SetHeadNum(int n)
+{
+    CheckNTErrors(n >= 1 && n <= nhead, "Invalid number of heads");
+    CheckNTErrors(splitHeads || n == nhead, "A single-head attention can not be pruned");
+
+    nhead = n;
+    int dim = nhead * headDim;
+    ResetTensor2D(&weightQ, embDim, dim, devID);
+    ResetTensor1D(&biasQ, dim, devID);
+    ResetTensor2D(&weightK, kDim, dim, devID);
+    ResetTensor1D(&biasK, dim, devID);
+    ResetTensor2D(&weightV, vDim, dim, devID);
+    ResetTensor1D(&biasV, dim, devID);
+    ResetTensor2D(&weightO, dim, embDim, devID);
+}
+
+/*
+keep the given heads and remove the others, i.e., keep the columns of the
+heads in weightQ/K/V (and the biases) and the rows of them in weightO
+>> heads - the heads to keep (in ascending order)
+*/
+void Attention::PruneHeads(const vector<int>& heads)
+{
+    CheckNTErrors(splitHeads && !heads.empty(), "Invalid heads to keep");
+
+    int dim = (int)heads.size() * headDim;
+    int oldDim = nhead * headDim;
+
+    XTensor* weights[] = { &weightQ, &weightK, &weightV };
+    XTensor* biases[] = { &biasQ, &biasK, &biasV };
+    for (int i = 0; i < 3; i++) {
+        XTensor* w = weights[i];
+        XTensor* b = biases[i];
+        int rowNum = w->dimSize[0];
+        vector<float> wData = GetHostData(*w);
+        vector<float> bData = GetHostData(*b);
+        vector<float> wKept((size_t)rowNum * dim);
+        vector<float> bKept(dim);
+
+        for (size_t h = 0; h < heads.size(); h++) {
+            for (int r = 0; r < rowNum; r++)
+                memcpy(wKept.data() + (size_t)r * dim + h * headDim,
+                       wData.data() + (size_t)r * oldDim + heads[h] * headDim, sizeof(float) * headDim);
+            memcpy(bKept.data() + h * headDim, bData.data() + heads[h] * headDim, sizeof(float) * headDim);
+        }
+
+        ResetTensor2D(w, rowNum, dim, devID);
+        w->SetData(wKept.data(), w->unitNum);
+        ResetTensor1D(b, dim, devID);
+        b->SetData(bKept.data(), b->unitNum);
+    }
+
+    vector<float> oData = GetHostData(weightO);
+    vector<float> oKept((size_t)dim * embDim);
+    for (size_t h = 0; h < heads.size(); h++)
+        memcpy(oKept.data() + h * headDim * embDim, oData.data() + (size_t)heads[h] * headDim * embDim,
+               sizeof(float) * headDim * embDim);
+    ResetTensor2D(&weightO, dim, embDim, devID);
+    weightO.SetData(oKept.data(), weightO.unitNum);
+
+    nhead = (int)heads.size();
+    headScores.clear();
+    headScoreNum = 0;
+}
+
+/*
+accumulate the importance of the heads. The importance of a head is the mean
+L2 norm of its contribution to the output, i.e., its output multiplied by
+its rows of weightO, over all positions.
+>> att - the outputs of the heads, (nhead, ..., headDim)
+*/
+void Attention::ScoreHeads(XTensor& att)
+{
+    CheckNTErrors(att.GetDim(0) == nhead && att.GetDim(-1) == headDim, "Invalid outputs of the heads");
+
+    XTensor output = att.dataType == X_FLOAT ? att : ConvertDataType(att, X_FLOAT);
+    vector<float> outputData = GetHostData(output);
+    vector<float> oData = GetHostData(weightO);
+
+    int posNum = output.unitNum / (nhead * headDim);
+    if (headScores.empty())
+        headScores.assign(nhead, 0);
+
+    vector<float> contribution(embDim);
+    for (int h = 0; h < nhead; h++) {
+        const float* wo = oData.data() + (size_t)h * headDim * embDim;
+        for (int p = 0; p < posNum; p++) {
+            const float* x = outputData.data() + ((size_t)h * posNum + p) * headDim;
+            fill(contribution.begin(), contribution.end(), 0.0F);
+            for (int i = 0; i < headDim; i++) {
+                const float* row = wo + (size_t)i * embDim;
+                for (int j = 0; j < embDim; j++)
+                    contribution[j] += x[i] * row[j];
+            }
+            double norm = 0;
+            for (int j = 0; j < embDim; j++)
+                norm += contribution[j] * contribution[j];
+            headScores[h] += sqrt(norm);
+        }
+    }
+    headScoreNum += posNum;
+}
+
+/*
+get the mask for the remaining heads. The masks are made for the configured
+number of heads, where the mask of each head is the same, so a layer with
+pruned heads uses the first ones.
+>> mask - the mask, (headNum, ...) or NULL
+>> headMask - the tensor to keep the new mask
+>> headNum - number of the heads of the attention weights
+<< return - the mask for the heads
+*/
+XTensor* Attention::GetHeadMask(XTensor* mask, XTensor& headMask, int headNum)
+{
+    if (mask == NULL || mask->order != 4 || mask->dimSize[0] <= headNum)
+        return mask;
+
+    headMask = SelectRange(*mask, 0, 0, headNum);
+    return &headMask;
+}
+
 /*
 make the network
 >> k - keys, B * L * H or N * B * L * H (when N > 1 and not using rpr attn).
@@ -130,17 +266,17 @@ XTensor Attention::Make(XTensor& k, XTensor& q, XTensor& v,
 {
     const bool isEnc = (!cache) ? true : false;
     // TODO: support new kv cache layout in rpr attn.
-    const bool split_in_kv_cache = nhead > 1 && !useRPR;
+    const bool split_in_kv_cache = splitHeads && !useRPR;
 
     /* linear transformation before self-attention */
     XTensor q2, k2, v2;
 
-    q2 = MulAndShift(q, weightQ, biasQ);
+    q2 = LinearTransform(q, weightQ, biasQ);
 
     if (!cache || isTraining || !(cache->enable)) {
         /* self attention for encoder layers */
-        k2 = MulAndShift(k, weightK, biasK);
-        v2 = MulAndShift(v, weightV, biasV);
+        k2 = LinearTransform(k, weightK, biasK);
+        v2 = LinearTransform(v, weightV, biasV);
 
         if (split_in_kv_cache) {
             q2 = Split(q2, q2.order - 1, nhead);
@@ -158,8 +294,8 @@ XTensor Attention::Make(XTensor& k, XTensor& q, XTensor& v,
             q2 = Split(q2, q2.order - 1, nhead);
         }
         if (attType == SELF_ATT) {
-            k2 = MulAndShift(k, weightK, biasK);
-            v2 = MulAndShift(v, weightV, biasV);
+            k2 = LinearTransform(k, weightK, biasK);
+            v2 = LinearTransform(v, weightV, biasV);
 
             const int concat_dim = split_in_kv_cache ? 2 : 1;
             if (split_in_kv_cache) {
@@ -182,8 +318,8 @@ XTensor Attention::Make(XTensor& k, XTensor& q, XTensor& v,
         }
         else if (attType == EN_DE_ATT) {
             if (cache->miss) {
-                cache->key = MulAndShift(k, weightK, biasK);
-                cache->value = MulAndShift(v, weightV, biasV);
+                cache->key = LinearTransform(k, weightK, biasK);
+                cache->value = LinearTransform(v, weightV, biasV);
                 cache->miss = false;
 
                 if (split_in_kv_cache) {
@@ -214,9 +350,9 @@ XTensor Attention::MakeAttention(XTensor& k, XTensor& q, XTensor& v,
     XTensor att;
 
     if (isTraining)
-        q = Scale(q, 1.0F / (float)sqrt((float)kDim / nhead));
+        q = Scale(q, 1.0F / (float)sqrt((float)headDim));
     else
-        ScaleMe(q, 1.0F / (float)sqrt((float)kDim / nhead));
+        ScaleMe(q, 1.0F / (float)sqrt((float)headDim));
 
     /* scalar = softmax(Q * K^T / sqrt(dk)) * V */
     att = BMMul(q, X_NOTRANS, k, X_TRANS);
@@ -225,6 +361,9 @@ XTensor Attention::MakeAttention(XTensor& k, XTensor& q, XTensor& v,
         att = ConvertDataType(att, X_FLOAT);
     }
 
+    XTensor headMask;
+    mask = GetHeadMask(mask, headMask, nhead);
+
     if (mask) {
         if (isTraining)
             att = Sum(att, *mask, /*inplace=*/true);
@@ -242,11 +381,14 @@ XTensor Attention::MakeAttention(XTensor& k, XTensor& q, XTensor& v,
     
     att = BMMul(att, v);
 
+    if (scoreHeads && splitHeads)
+        ScoreHeads(att);
+
     /* concatenate the heads */
-    if (nhead > 1)
-        return MulAndShift(Merge(att, att.order - 1), weightO, biasO);
+    if (splitHeads)
+        return LinearTransform(Merge(att, att.order - 1), weightO, biasO);
     else
-        return MulAndShift(att, weightO, biasO);
+        return LinearTransform(att, weightO, biasO);
 }
     
 /*
@@ -294,11 +436,14 @@ XTensor Attention::MakeRPRAttention(XTensor& k, XTensor& q, XTensor& v,
         relativeKey = ConvertDataType(relativeKey, X_FLOAT);
     }
 
-    float scaling = (float)sqrt(embDim / nhead);
+    float scaling = (float)sqrt(headDim);
     qheads = ScaleAndShift(qheads, 1.0F / scaling);
 
     dot = RPDotProduct(qheads, kheads, relativeKey, true);
 
+    XTensor headMask;
+    mask = GetHeadMask(mask, headMask, nhead);
+
     if (mask)
         dot = Sum(dot, *mask, /*inplace=*/true);
 
@@ -317,8 +462,11 @@ XTensor Attention::MakeRPRAttention(XTensor& k, XTensor& q, XTensor& v,
     if (dataType != att.dataType)
         att = ConvertDataType(att, dataType);
 
+    if (scoreHeads)
+        ScoreHeads(att);
+
     /* concatenate the heads */
-    return MulAndShift(Merge(att, att.order - 1), weightO, biasO);
+    return LinearTransform(Merge(att, att.order - 1), weightO, biasO);
 }
 
 /*
@@ -332,10 +480,9 @@ XTensor Attention::GetRPEmbedding(int lenQ, int lenKV, bool isEnc)
     XTensor range;
     XTensor embMatrix;
 
-    InitTensor1D(&range, lenKV, X_INT, devID);
-    int* index = new int[lenKV];
-
     if (isEnc) {
+        InitTensor1D(&range, lenKV, X_INT, devID);
+        int* index = new int[lenKV];
         for (int i = 0; i < lenKV; i++)
             index[i] = i;
         range.SetData(index, lenKV);
@@ -345,19 +492,24 @@ XTensor Attention::GetRPEmbedding(int lenQ, int lenKV, bool isEnc)
         range2DTrans = Transpose(range2D, 0, 1);
 
         embMatrix = Sum(range2D, range2DTrans, false, -1);
+        delete[] index;
     }
     else {
-        for (int i = 0; i < lenKV; i++)
-            index[i] = -lenKV + i + 1;
-        range.SetData(index, lenKV);
-        embMatrix = Unsqueeze(range, 0, lenQ);
+        /* the queries are the last lenQ positions of the sequence,
+           i.e., query i is at position lenKV - lenQ + i */
+        InitTensor2D(&embMatrix, lenQ, lenKV, X_INT, devID);
+        int* index = new int[lenQ * lenKV];
+        for (int i = 0; i < lenQ; i++) {
+            for (int j = 0; j < lenKV; j++)
+                index[i * lenKV + j] = j - (lenKV - lenQ + i);
+        }
+        embMatrix.SetData(index, lenQ * lenKV);
+        delete[] index;
     }
 
     ClipMe(embMatrix, -float(maxRP), float(maxRP));
     ScaleAndShiftMe(embMatrix, 1.0F, float(maxRP));
 
-    delete[] index;
-
     /* disable gradient flow */
     if (isTraining) {
         XTensor copyEmbMatrix;
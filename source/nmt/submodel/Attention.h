@@ -23,6 +23,7 @@
 #ifndef __ATTENTION_H__
 #define __ATTENTION_H__
 
+#include <vector>
 #include "NNUtil.h"
 #include "../Config.h"
 #include "../../niutensor/network/XNet.h"
@@ -76,9 +77,25 @@ public:
     /* device id */
     int devID;
 
-    /* head number */
+    /* head number (after pruning) */
     int nhead;
 
+    /* size of each head */
+    int headDim;
+
+    /* indicates whether the heads are split into a dimension, i.e., the
+       model has more than one head before pruning */
+    bool splitHeads;
+
+    /* indicates whether the importance of the heads is accumulated */
+    bool scoreHeads;
+
+    /* the accumulated importance of each head */
+    vector<double> headScores;
+
+    /* number of the positions accumulated in headScores */
+    double headScoreNum;
+
     /* transformation matrix for Q */
     XTensor weightQ;
 
@@ -137,6 +154,18 @@ public:
     /* initialize the model */
     void InitModel(NMTConfig& config, bool isEnc, bool isSelfAtt);
 
+    /* set the number of heads (of a pruned model) */
+    void SetHeadNum(int n);
+
+    /* keep the given heads and remove the others */
+    void PruneHeads(const vector<int>& heads);
+
+    /* accumulate the importance of the heads */
+    void ScoreHeads(XTensor& att);
+
+    /* get the mask for the (remaining) heads */
+    XTensor* GetHeadMask(XTensor* mask, XTensor& headMask, int headNum);
+
     /* make the network */
     XTensor Make(XTensor& k, XTensor& q, XTensor& v,
                  XTensor* mask, Cache* cache, int cacheType);
@@ -15,6 +15,8 @@
  */
 
 
+#include <cmath>
+#include <cstring>
 #include "Embedding.h"
 #include "../Config.h"
 #include "../../niutensor/tensor/core/CHeader.h"
@@ -41,6 +43,8 @@ Embedder::Embedder()
     padIdx = -1;
     maxLength = -1;
     isTraining = false;
+    qw = NULL;
+    qScale = NULL;
 }
 
 /* de-constructor */
@@ -49,6 +53,8 @@ Embedder::~Embedder()
     if (w)
         DelTensor(w);
     w = NULL;
+    delete[] qw;
+    delete[] qScale;
 }
 
 /*
@@ -118,6 +124,75 @@ void Embedder::MakePosEmbedding(int length)
     delete[] data;
 }
 
+/*
+quantize the word embedding matrix to int8 with a scale for each row
+(symmetric, i.e., scale = max(|row|) / 127) for inference on CPUs. The FP32
+matrix is released, and a row is dequantized when it is gathered. w keeps its
+shape as a parameter but has no data afterwards.
+*/
+void Embedder::Quantize()
+{
+    CheckNTErrors(w->devID < 0 && w->dataType == X_FLOAT, "Only FP32 embeddings on CPUs are quantized");
+
+    if (qw != NULL)
+        return;
+
+    qw = new int8_t[size_t(vSize) * eSize];
+    qScale = new float[vSize];
+
+    const float* data = (const float*)w->data;
+    for (int i = 0; i < vSize; i++) {
+        const float* row = data + size_t(i) * eSize;
+        int8_t* qRow = qw + size_t(i) * eSize;
+
+        float maxValue = 0;
+        for (int j = 0; j < eSize; j++)
+            maxValue = MAX(maxValue, fabsf(row[j]));
+
+        qScale[i] = maxValue / 127.0F;
+        float invScale = maxValue > 0 ? 127.0F / maxValue : 0;
+        for (int j = 0; j < eSize; j++)
+            qRow[j] = (int8_t)lrintf(row[j] * invScale);
+    }
+
+    /* the data may point into a mapped model file */
+    w->DestroyData();
+    w->data = NULL;
+    w->isShared = false;
+}
+
+/*
+gather the word embeddings from the int8 matrix
+>> input - the word indices
+<< return - the word embeddings (FP32), (..., eSize)
+*/
+XTensor Embedder::GatherQuantized(XTensor& input)
+{
+    CheckNTErrors(input.devID < 0 && input.dataType == X_INT, "The indices should be integers on CPUs");
+
+    int dims[MAX_TENSOR_DIM_NUM];
+    memcpy(dims, input.dimSize, sizeof(int) * input.order);
+    dims[input.order] = eSize;
+
+    XTensor embedding;
+    InitTensor(&embedding, input.order + 1, dims, X_FLOAT, devID);
+
+    const int* ids = (const int*)input.data;
+    float* data = (float*)embedding.data;
+    for (int i = 0; i < input.unitNum; i++) {
+        int id = ids[i];
+        CheckNTErrors(id >= 0 && id < vSize, "The word index is out of the vocabulary");
+
+        const int8_t* qRow = qw + size_t(id) * eSize;
+        float* row = data + size_t(i) * eSize;
+        float scale = qScale[id];
+        for (int j = 0; j < eSize; j++)
+            row[j] = qRow[j] * scale;
+    }
+
+    return embedding;
+}
+
 /*
 make the network
 >> input - the word indices
@@ -137,13 +212,15 @@ XTensor Embedder::Make(XTensor& input, bool isDec, int nstep)
 
     InitTensor1D(&position, input.GetDim(-1), X_INT, devID);
 
-    if (!isDec || isTraining || input.GetDim(-1) > 1) {
+    if (!isDec || isTraining) {
         position.Range(0, position.unitNum, 1);
         ScaleAndShiftMe(position, 1.0F, float(padIdx + 1));
     }
     else {
-        /* decoder embeddings during decoding */
-        position.SetDataFixed(nstep + padIdx + 1);
+        /* decoder embeddings during decoding, where the tokens
+           start at position nstep (e.g., after a cached prefix) */
+        position.Range(float(nstep), float(nstep + position.unitNum), 1);
+        ScaleAndShiftMe(position, 1.0F, float(padIdx + 1));
     }
 
     /* we make positional embeddings first */
@@ -152,7 +229,10 @@ XTensor Embedder::Make(XTensor& input, bool isDec, int nstep)
     posEmbedding = Unsqueeze(embTMP, 0, input.GetDim(0));
 
     /* then we make word embeddings */
-    wordEmbedding = Gather(*w, input);
+    if (qw != NULL)
+        wordEmbedding = GatherQuantized(input);
+    else
+        wordEmbedding = Gather(*w, input);
 
     if (isTraining)
         wordEmbedding = Linear(wordEmbedding, sqrtf((float)eSize), 0.0F, true);
@@ -23,6 +23,7 @@
 #ifndef __EMBEDDING_H__
 #define __EMBEDDING_H__
 
+#include <cstdint>
 #include "../Config.h"
 #include "../../niutensor/network/XNet.h"
 
@@ -68,6 +69,11 @@ public:
     /* word embedding matrix */
     XTensor* w;
 
+    /* the int8 word embedding matrix (vSize * eSize) and the scale of each
+       row, NULL if w is used */
+    int8_t* qw;
+    float* qScale;
+
     /* predefined positional embeddings. It can speeds up
        the embedding processing by re-loading. */
     XTensor posEmbeddingBase;
@@ -88,6 +94,12 @@ public:
     /* make positional embeddings */
     void MakePosEmbedding(int length);
 
+    /* quantize the word embedding matrix to int8 */
+    void Quantize();
+
+    /* gather the word embeddings from the int8 matrix */
+    XTensor GatherQuantized(XTensor& input);
+
     /* make the network */
     XTensor Make(XTensor& input, bool isDec, int nstep);
 };
@@ -22,6 +22,9 @@
 
 #include "FFN.h"
 #include "Embedding.h"
+#include "HalfWeight.h"
+#include "LowRank.h"
+#include "NNUtil.h"
 #include "../Config.h"
 #include "../../niutensor/tensor/core/CHeader.h"
 #include "../../niutensor/tensor/function/FHeader.h"
@@ -44,6 +47,8 @@ FFN::FFN()
     outSize = -1;
     hSize = -1;
     devID = -1;
+    rank1 = 0;
+    rank2 = 0;
     isTraining = false;
 }
 
@@ -81,6 +86,69 @@ void FFN::InitModel(NMTConfig& config, bool isEnc)
     }
 }
 
+/*
+set the ranks of the factorized transformations. The factors are created
+without data, as they are loaded from a model file then.
+>> r1 - rank of transformation 1 (0 for the full matrix)
+>> r2 - rank of transformation 2 (0 for the full matrix)
+*/
+void FFN::SetRanks(int r1, int r2)
+{
+    rank1 = r1;
+    rank2 = r2;
+
+    if (rank1 > 0) {
+        ResetTensor2D(&w1, inSize, rank1, devID);
+        ResetTensor2D(&v1, rank1, hSize, devID);
+    }
+    if (rank2 > 0) {
+        ResetTensor2D(&w2, hSize, rank2, devID);
+        ResetTensor2D(&v2, rank2, outSize, devID);
+    }
+}
+
+/*
+factorize a transformation with the truncated SVD
+>> w - the matrix, which keeps the first factor then
+>> v - the second factor
+>> rank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy to keep if the rank is not given
+<< return - the rank (0 if the matrix is kept)
+*/
+static int FactorizeWeight(XTensor& w, XTensor& v, int rank, float energy)
+{
+    int rows = w.dimSize[0];
+    int cols = w.dimSize[1];
+    vector<float> wData = GetHostData(w);
+    vector<float> uData;
+    vector<float> vData;
+
+    int r = FactorizeMatrix(wData.data(), rows, cols, rank, energy, uData, vData);
+    if (r == 0)
+        return 0;
+
+    ResetTensor2D(&w, rows, r, w.devID);
+    w.SetData(uData.data(), w.unitNum);
+    ResetTensor2D(&v, r, cols, w.devID);
+    v.SetData(vData.data(), v.unitNum);
+
+    return r;
+}
+
+/*
+factorize the transformations with the truncated SVD. A matrix is kept if
+the factors would not save computation.
+>> rank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy to keep if the rank is not given
+*/
+void FFN::Factorize(int rank, float energy)
+{
+    CheckNTErrors(rank1 == 0 && rank2 == 0, "The transformations are factorized already");
+
+    rank1 = FactorizeWeight(w1, v1, rank, energy);
+    rank2 = FactorizeWeight(w2, v2, rank, energy);
+}
+
 /*
 make the network
 y = max(0, x * w1 + b1) * w2 + b2
@@ -91,14 +159,19 @@ XTensor FFN::Make(XTensor& input)
 {
     XTensor t1;
 
-    /* t1 = max(0, x * w1 + b1) */
-    t1 = Rectify(MulAndShift(input, w1, b1));
+    /* t1 = max(0, x * w1 + b1), with two thin GEMMs if w1 is factorized */
+    if (rank1 > 0)
+        t1 = Rectify(LinearTransform(LinearTransform(input, w1), v1, b1));
+    else
+        t1 = Rectify(LinearTransform(input, w1, b1));
     
     if (isTraining && dropoutP > 0)
         t1 = Dropout(t1, dropoutP, /*inplace=*/true);
 
     /* result = t1 * w2 + b2 */
-    return MulAndShift(t1, w2, b2);
+    if (rank2 > 0)
+        return LinearTransform(LinearTransform(t1, w2), v2, b2);
+    return LinearTransform(t1, w2, b2);
 }
 
 } /* end of the nmt namespace */
\ No newline at end of file
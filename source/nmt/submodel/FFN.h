@@ -64,6 +64,20 @@ public:
     /* bias of transformation 2 */
     XTensor b2;
 
+    /* rank of the factorized transformation 1 (0 if it is not factorized),
+       where w1 (inSize, rank1) * v1 (rank1, hSize) approximates the matrix */
+    int rank1;
+
+    /* the second factor of transformation 1 */
+    XTensor v1;
+
+    /* rank of the factorized transformation 2 (0 if it is not factorized),
+       where w2 (hSize, rank2) * v2 (rank2, outSize) approximates the matrix */
+    int rank2;
+
+    /* the second factor of transformation 2 */
+    XTensor v2;
+
     /* dropout probability */
     DTYPE dropoutP;
 
@@ -80,6 +94,12 @@ public:
     /* initialize the model */
     void InitModel(NMTConfig& config, bool isEnc);
 
+    /* set the ranks of the factorized transformations */
+    void SetRanks(int r1, int r2);
+
+    /* factorize the transformations with the truncated SVD */
+    void Factorize(int rank, float energy);
+
     /* make the network */
     XTensor Make(XTensor& input);
 };
@@ -0,0 +1,523 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <condition_variable>
+#include "HalfWeight.h"
+#include "../../niutensor/tensor/core/CHeader.h"
+
+using namespace std;
+
+#if defined(__F16C__) && defined(__FMA__)
+#include <immintrin.h>
+#define USE_F16C
+#endif
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the maximum number of threads of the GEMM */
+#define HALF_GEMM_MAX_THREAD_NUM 8
+
+/* the minimum number of multiply-adds of a GEMM run by several threads,
+   below which waking the threads costs more than it saves */
+#define HALF_GEMM_PARALLEL_MIN (1 << 18)
+
+/* the columns of the output are split into blocks of this width at least */
+#define HALF_GEMM_BLOCK 64
+
+/* convert a FP32 value to FP16 (round to nearest even) */
+static unsigned short FloatToHalfScalar(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t absx = x & 0x7FFFFFFF;
+
+    /* inf and nan */
+    if (absx >= 0x7F800000)
+        return (unsigned short)(sign | (absx > 0x7F800000 ? 0x7E00 : 0x7C00));
+
+    /* beyond the maximum (65504) after rounding */
+    if (absx >= 0x477FF000)
+        return (unsigned short)(sign | 0x7C00);
+
+    /* subnormal numbers of FP16 */
+    if (absx < 0x38800000) {
+        if (absx < 0x33000000)
+            return (unsigned short)sign;
+        uint32_t mant = (absx & 0x7FFFFF) | 0x800000;
+        int shift = 126 - int(absx >> 23);
+        uint32_t h = mant >> shift;
+        uint32_t rem = mant & ((1U << shift) - 1);
+        uint32_t halfway = 1U << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1)))
+            h++;
+        return (unsigned short)(sign | h);
+    }
+
+    /* normal numbers: rebias the exponent and round the mantissa */
+    uint32_t h = (absx - 0x38000000) >> 13;
+    uint32_t rem = absx & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+        h++;
+    return (unsigned short)(sign | h);
+}
+
+/* convert a FP16 value to FP32 */
+static float HalfToFloatScalar(unsigned short h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t x;
+
+    if (exp == 0x1F) {
+        x = sign | 0x7F800000 | (mant << 13);
+    }
+    else if (exp != 0) {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    else if (mant == 0) {
+        x = sign;
+    }
+    else {
+        /* normalize a subnormal number */
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        x = sign | (exp << 23) | ((mant & 0x3FF) << 13);
+    }
+
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+/*
+convert FP32 values to FP16 (round to nearest even)
+>> src - the FP32 values
+>> tgt - the FP16 values
+>> num - number of values
+*/
+void FloatToHalf(const float* src, unsigned short* tgt, size_t num)
+{
+    size_t i = 0;
+#ifdef USE_F16C
+    for (; i + 8 <= num; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(tgt + i), h);
+    }
+#endif
+    for (; i < num; i++)
+        tgt[i] = FloatToHalfScalar(src[i]);
+}
+
+/*
+convert FP16 values to FP32
+>> src - the FP16 values
+>> tgt - the FP32 values
+>> num - number of values
+*/
+void HalfToFloat(const unsigned short* src, float* tgt, size_t num)
+{
+    size_t i = 0;
+#ifdef USE_F16C
+    for (; i + 8 <= num; i += 8)
+        _mm256_storeu_ps(tgt + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+    for (; i < num; i++)
+        tgt[i] = HalfToFloatScalar(src[i]);
+}
+
+/*
+convert a weight on CPUs to FP16 in place. The weight keeps X_FLOAT16 as its
+data type, and the data is in the IEEE layout read by the kernel below.
+>> w - the weight
+*/
+void ConvertToHalfWeight(XTensor* w)
+{
+    CheckNTErrors(w->devID < 0, "Only weights on CPUs are converted");
+    CheckNTErrors(w->dataType == X_FLOAT, "The weight should be FP32");
+
+    vector<float> values((const float*)w->data, (const float*)w->data + w->unitNum);
+
+    /* the data may point into a mapped model file */
+    w->DestroyData();
+    w->data = NULL;
+    w->isShared = false;
+
+    InitTensor(w, w->order, w->dimSize, X_FLOAT16, -1);
+    FloatToHalf(values.data(), (unsigned short*)w->data, values.size());
+}
+
+/* check whether a weight is stored in FP16 on CPUs */
+bool IsHalfWeight(const XTensor& w)
+{
+    return w.devID < 0 && w.dataType == X_FLOAT16;
+}
+
+/*
+the GEMM kernel: y = x * w + b for the columns [colBegin, colEnd) of y.
+It computes 4 rows and 16 columns of y at a time in registers, so a FP16
+row segment of w is converted once for 4 rows.
+>> x - the input, (m, k)
+>> w - the FP16 weight, (k, n)
+>> b - the bias, (n), or NULL
+>> y - the output, (m, n)
+>> colBegin - the first column
+>> colEnd - the column after the last one
+*/
+static void GemmHalf(const float* x, const unsigned short* w, const float* b, float* y,
+                     int m, int k, int n, int colBegin, int colEnd)
+{
+    int col = colBegin;
+
+#ifdef USE_F16C
+    for (; col + 16 <= colEnd; col += 16) {
+        __m256 b0 = b != NULL ? _mm256_loadu_ps(b + col) : _mm256_setzero_ps();
+        __m256 b1 = b != NULL ? _mm256_loadu_ps(b + col + 8) : _mm256_setzero_ps();
+
+        int row = 0;
+        for (; row + 4 <= m; row += 4) {
+            __m256 acc[4][2];
+            for (int r = 0; r < 4; r++) {
+                acc[r][0] = b0;
+                acc[r][1] = b1;
+            }
+            const float* xr = x + size_t(row) * k;
+            const unsigned short* wc = w + col;
+            for (int i = 0; i < k; i++, wc += n) {
+                __m256 w0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)wc));
+                __m256 w1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(wc + 8)));
+                for (int r = 0; r < 4; r++) {
+                    __m256 xv = _mm256_broadcast_ss(xr + size_t(r) * k + i);
+                    acc[r][0] = _mm256_fmadd_ps(xv, w0, acc[r][0]);
+                    acc[r][1] = _mm256_fmadd_ps(xv, w1, acc[r][1]);
+                }
+            }
+            for (int r = 0; r < 4; r++) {
+                _mm256_storeu_ps(y + size_t(row + r) * n + col, acc[r][0]);
+                _mm256_storeu_ps(y + size_t(row + r) * n + col + 8, acc[r][1]);
+            }
+        }
+
+        /* the remaining rows */
+        for (; row < m; row++) {
+            __m256 acc0 = b0;
+            __m256 acc1 = b1;
+            const float* xr = x + size_t(row) * k;
+            const unsigned short* wc = w + col;
+            for (int i = 0; i < k; i++, wc += n) {
+                __m256 xv = _mm256_broadcast_ss(xr + i);
+                acc0 = _mm256_fmadd_ps(xv, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)wc)), acc0);
+                acc1 = _mm256_fmadd_ps(xv, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(wc + 8))), acc1);
+            }
+            _mm256_storeu_ps(y + size_t(row) * n + col, acc0);
+            _mm256_storeu_ps(y + size_t(row) * n + col + 8, acc1);
+        }
+    }
+#endif
+
+    if (col == colEnd)
+        return;
+
+    /* the remaining columns (or all of them without F16C) */
+    int width = colEnd - col;
+    vector<float> wRow(width);
+    for (int row = 0; row < m; row++) {
+        float* yr = y + size_t(row) * n;
+        for (int j = col; j < colEnd; j++)
+            yr[j] = b != NULL ? b[j] : 0;
+    }
+    for (int i = 0; i < k; i++) {
+        HalfToFloat(w + size_t(i) * n + col, wRow.data(), width);
+        for (int row = 0; row < m; row++) {
+            float xv = x[size_t(row) * k + i];
+            float* yr = y + size_t(row) * n + col;
+            for (int j = 0; j < width; j++)
+                yr[j] += xv * wRow[j];
+        }
+    }
+}
+
+/*
+the threads of the GEMM. They are started on the first large GEMM and wait
+for the next one, as a GEMM of the decoding takes tens of microseconds and
+starting threads for each call would cost more than the GEMM itself. A GEMM
+is split into column blocks, which are taken by the caller and the workers.
+*/
+class HalfGemmPool
+{
+private:
+    /* the workers */
+    vector<thread> workers;
+
+    /* the mutex of the jobs */
+    mutex jobMutex;
+
+    /* signaled when a job is posted or the pool is stopped */
+    condition_variable jobCond;
+
+    /* signaled when a worker is done with a job */
+    condition_variable doneCond;
+
+    /* the id of the current job (a new id wakes the workers) */
+    long jobID;
+
+    /* number of the workers still running the current job */
+    int busyNum;
+
+    /* indicates whether the pool is stopped */
+    bool stopped;
+
+    /* the arguments of the current job */
+    const float* x;
+    const unsigned short* w;
+    const float* b;
+    float* y;
+    int m;
+    int k;
+    int n;
+    int blockWidth;
+    int blockNum;
+
+    /* the next block to run */
+    atomic<int> nextBlock;
+
+    /* the mutex that lets one GEMM use the pool at a time */
+    mutex callMutex;
+
+private:
+    /* run the blocks of the current job until none is left */
+    void RunBlocks()
+    {
+        int block;
+        while ((block = nextBlock.fetch_add(1)) < blockNum) {
+            int colBegin = block * blockWidth;
+            GemmHalf(x, w, b, y, m, k, n, colBegin, MIN(colBegin + blockWidth, n));
+        }
+    }
+
+    /*
+    the loop of a worker
+    >> doneID - the id of the last job posted before the worker is started,
+                which the worker should not run
+    */
+    void Work(long doneID)
+    {
+        while (true) {
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobCond.wait(lock, [this, doneID] { return stopped || jobID != doneID; });
+                if (stopped)
+                    return;
+                doneID = jobID;
+            }
+
+            RunBlocks();
+
+            lock_guard<mutex> lock(jobMutex);
+            if (--busyNum == 0)
+                doneCond.notify_one();
+        }
+    }
+
+public:
+    /* constructor */
+    HalfGemmPool()
+    {
+        jobID = 0;
+        busyNum = 0;
+        stopped = false;
+        blockNum = 0;
+    }
+
+    /* de-constructor */
+    ~HalfGemmPool()
+    {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopped = true;
+        }
+        jobCond.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+
+    /* get the pool shared by all GEMMs */
+    static HalfGemmPool& Get()
+    {
+        static HalfGemmPool pool;
+        return pool;
+    }
+
+    /*
+    run a GEMM with the caller and the workers. A GEMM that arrives while
+    another one is running waits for it, as the threads are busy anyway.
+    >> myX, myW, myB, myY, myM, myK, myN - the arguments of GemmHalf()
+    >> threadNum - number of threads (including the caller)
+    */
+    void Run(const float* myX, const unsigned short* myW, const float* myB, float* myY,
+             int myM, int myK, int myN, int threadNum)
+    {
+        lock_guard<mutex> callLock(callMutex);
+
+        /* a new worker skips the jobs before it, which are done (callMutex
+           is held, so jobID does not change here) */
+        while ((int)workers.size() < threadNum - 1)
+            workers.push_back(thread(&HalfGemmPool::Work, this, jobID));
+
+        /* a few blocks for each thread balance the load, and a block is a
+           multiple of the 16 columns of the kernel */
+        int width = (myN + threadNum * 4 - 1) / (threadNum * 4);
+        width = MAX((width + 15) / 16 * 16, HALF_GEMM_BLOCK);
+
+        {
+            lock_guard<mutex> lock(jobMutex);
+            x = myX;
+            w = myW;
+            b = myB;
+            y = myY;
+            m = myM;
+            k = myK;
+            n = myN;
+            blockWidth = width;
+            blockNum = (myN + width - 1) / width;
+            nextBlock = 0;
+            busyNum = (int)workers.size();
+            jobID++;
+        }
+        jobCond.notify_all();
+
+        RunBlocks();
+
+        unique_lock<mutex> lock(jobMutex);
+        doneCond.wait(lock, [this] { return busyNum == 0; });
+    }
+};
+
+/*
+get the number of threads of a GEMM. A small GEMM, e.g., a decoding step
+of a single sentence, runs on the caller only.
+>> m - number of rows of the output
+>> k - the inner dimension
+>> n - number of columns of the output
+<< return - number of threads
+*/
+static int GetHalfGemmThreadNum(int m, int k, int n)
+{
+    static const int maxThreadNum = MAX(MIN((int)thread::hardware_concurrency(), HALF_GEMM_MAX_THREAD_NUM), 1);
+
+    if ((double)m * k * n < HALF_GEMM_PARALLEL_MIN)
+        return 1;
+    return MAX(MIN(maxThreadNum, n / HALF_GEMM_BLOCK), 1);
+}
+
+/*
+y = x * w + b, where w is a FP16 weight on CPUs
+>> x - the input (FP32), (..., k)
+>> w - the weight (FP16), (k, n)
+>> b - the bias (FP32), (n), or NULL
+<< return - the output (FP32), (..., n)
+*/
+XTensor MulHalf(const XTensor& x, const XTensor& w, const XTensor* b)
+{
+    CheckNTErrors(IsHalfWeight(w) && w.order == 2, "The weight should be a FP16 matrix on CPUs");
+    CheckNTErrors(x.devID < 0 && x.dataType == X_FLOAT, "The input should be FP32 on CPUs");
+    CheckNTErrors(x.dimSize[x.order - 1] == w.dimSize[0], "Unmatched dimensions");
+
+    int k = w.dimSize[0];
+    int n = w.dimSize[1];
+    int m = x.unitNum / k;
+
+    int dims[MAX_TENSOR_DIM_NUM];
+    memcpy(dims, x.dimSize, sizeof(int) * x.order);
+    dims[x.order - 1] = n;
+
+    XTensor y;
+    InitTensor(&y, x.order, dims, X_FLOAT, -1);
+
+    const float* bias = NULL;
+    if (b != NULL && b->unitNum > 0) {
+        CheckNTErrors(b->dataType == X_FLOAT && b->unitNum == n, "Invalid bias");
+        bias = (const float*)b->data;
+    }
+
+    MulHalf((const float*)x.data, (const unsigned short*)w.data, bias, (float*)y.data,
+            m, k, n, GetHalfGemmThreadNum(m, k, n));
+
+    return y;
+}
+
+/*
+y = x * w + b on arrays, where w is in FP16. The result does not depend on
+the number of threads, as a column of y is computed by one thread.
+>> x - the input (FP32), (m, k)
+>> w - the weight (FP16), (k, n)
+>> b - the bias (FP32), (n), or NULL
+>> y - the output (FP32), (m, n)
+>> m - number of rows of the output
+>> k - the inner dimension
+>> n - number of columns of the output
+>> threadNum - number of threads (including the caller)
+*/
+void MulHalf(const float* x, const unsigned short* w, const float* b, float* y,
+             int m, int k, int n, int threadNum)
+{
+    if (threadNum > 1)
+        HalfGemmPool::Get().Run(x, w, b, y, m, k, n, threadNum);
+    else
+        GemmHalf(x, w, b, y, m, k, n, 0, n);
+}
+
+/*
+y = x * w + b, with the FP16 kernel if w is a FP16 weight on CPUs
+>> x - the input, (..., k)
+>> w - the weight, (k, n)
+>> b - the bias, (n)
+<< return - the output, (..., n)
+*/
+XTensor LinearTransform(const XTensor& x, const XTensor& w, const XTensor& b)
+{
+    if (IsHalfWeight(w))
+        return MulHalf(x, w, &b);
+    return MulAndShift(x, w, b);
+}
+
+/*
+y = x * w, with the FP16 kernel if w is a FP16 weight on CPUs
+>> x - the input, (..., k)
+>> w - the weight, (k, n)
+<< return - the output, (..., n)
+*/
+XTensor LinearTransform(const XTensor& x, const XTensor& w)
+{
+    if (IsHalfWeight(w))
+        return MulHalf(x, w);
+    return MMul(x, w);
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,65 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * FP16 weights for inference on CPUs. The weights of the linear
+ * transformations are stored in IEEE half precision, and the GEMM kernel
+ * here converts them to FP32 in registers (F16C) and accumulates in FP32,
+ * so the weight memory and the bandwidth of the memory-bound decoding are
+ * halved while the activations stay in FP32.
+ */
+
+#ifndef __HALFWEIGHT_H__
+#define __HALFWEIGHT_H__
+
+#include <cstddef>
+#include "../../niutensor/tensor/XTensor.h"
+
+using namespace nts;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* convert FP32 values to FP16 (round to nearest even) */
+void FloatToHalf(const float* src, unsigned short* tgt, size_t num);
+
+/* convert FP16 values to FP32 */
+void HalfToFloat(const unsigned short* src, float* tgt, size_t num);
+
+/* convert a weight on CPUs to FP16 in place */
+void ConvertToHalfWeight(XTensor* w);
+
+/* check whether a weight is stored in FP16 on CPUs */
+bool IsHalfWeight(const XTensor& w);
+
+/* y = x * w + b, where w is a FP16 weight on CPUs */
+XTensor MulHalf(const XTensor& x, const XTensor& w, const XTensor* b = NULL);
+
+/* y = x * w + b on arrays, where w is in FP16, with a given number of threads */
+void MulHalf(const float* x, const unsigned short* w, const float* b, float* y,
+             int m, int k, int n, int threadNum);
+
+/* y = x * w + b, with the FP16 kernel if w is a FP16 weight on CPUs */
+XTensor LinearTransform(const XTensor& x, const XTensor& w, const XTensor& b);
+
+/* y = x * w, with the FP16 kernel if w is a FP16 weight on CPUs */
+XTensor LinearTransform(const XTensor& x, const XTensor& w);
+
+} /* end of the nmt namespace */
+
+#endif /* __HALFWEIGHT_H__ */
@@ -0,0 +1,259 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cmath>
+#include <algorithm>
+#include "LowRank.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the maximum number of the Jacobi sweeps */
+#define LOWRANK_MAX_SWEEPS 50
+
+/*
+compute the eigen-decomposition of a symmetric matrix with the cyclic
+Jacobi method. A rotation changes the rows and the columns p and q, and as
+the matrix stays symmetric, only the rows are computed (contiguously) and
+copied to the columns.
+>> a - the matrix (n x n, row-major), which is destroyed
+>> n - size of the matrix
+>> values - the eigenvalues
+>> vectors - the eigenvectors in the rows (n x n, row-major)
+*/
+static void JacobiEigen(vector<double>& a, int n, vector<double>& values, vector<double>& vectors)
+{
+    vectors.assign((size_t)n * n, 0);
+    for (int i = 0; i < n; i++)
+        vectors[(size_t)i * n + i] = 1;
+
+    double norm = 0;
+    for (size_t i = 0; i < a.size(); i++)
+        norm += a[i] * a[i];
+
+    for (int sweep = 0; sweep < LOWRANK_MAX_SWEEPS; sweep++) {
+        double offDiag = 0;
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++)
+                offDiag += a[(size_t)p * n + q] * a[(size_t)p * n + q];
+        }
+        if (offDiag <= 1e-22 * norm)
+            break;
+
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double* ap = a.data() + (size_t)p * n;
+                double* aq = a.data() + (size_t)q * n;
+                double apq = ap[q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+
+                /* the rotation that zeros a[p][q] */
+                double theta = (aq[q] - ap[p]) / (2 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1);
+                double s = t * c;
+
+                for (int k = 0; k < n; k++) {
+                    if (k == p || k == q)
+                        continue;
+                    double apk = ap[k];
+                    double aqk = aq[k];
+                    ap[k] = c * apk - s * aqk;
+                    aq[k] = s * apk + c * aqk;
+                    a[(size_t)k * n + p] = ap[k];
+                    a[(size_t)k * n + q] = aq[k];
+                }
+                ap[p] -= t * apq;
+                aq[q] += t * apq;
+                ap[q] = 0;
+                aq[p] = 0;
+
+                double* vp = vectors.data() + (size_t)p * n;
+                double* vq = vectors.data() + (size_t)q * n;
+                for (int k = 0; k < n; k++) {
+                    double vpk = vp[k];
+                    double vqk = vq[k];
+                    vp[k] = c * vpk - s * vqk;
+                    vq[k] = s * vpk + c * vqk;
+                }
+            }
+        }
+    }
+
+    values.resize(n);
+    for (int i = 0; i < n; i++)
+        values[i] = a[(size_t)i * n + i];
+}
+
+/*
+get the rank of a factorization
+>> energies - the squared singular values in descending order
+>> rows - number of rows of the matrix
+>> cols - number of columns of the matrix
+>> rank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy to keep if the rank is not given
+<< return - the rank (0 if the factorization does not save computation)
+*/
+static int GetFactorRank(const vector<double>& energies, int rows, int cols, int rank, float energy)
+{
+    int n = (int)energies.size();
+    int r = rank;
+    if (r <= 0) {
+        double total = 0;
+        for (int i = 0; i < n; i++)
+            total += energies[i];
+
+        double sum = 0;
+        for (r = 0; r < n && sum < energy * total; r++)
+            sum += energies[r];
+    }
+    r = std::min(std::max(r, 1), n);
+
+    if ((double)r * (rows + cols) >= (double)rows * cols)
+        return 0;
+    return r;
+}
+
+/*
+factorize a matrix into two thin matrices with its truncated SVD, i.e.,
+W ~ U * V, where U (rows x r) keeps the left singular vectors scaled by the
+singular values and V (r x cols) keeps the right singular vectors
+>> w - the matrix (rows x cols, row-major)
+>> rows - number of rows
+>> cols - number of columns
+>> rank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy (the sum of the squared singular values)
+            to keep if the rank is not given
+>> u - the first factor (rows x r)
+>> v - the second factor (r x cols)
+>> keptEnergy - the ratio of the energy kept by the factorization
+<< return - the rank r (0 if the factorization does not save computation,
+            where u and v are not set)
+*/
+int FactorizeMatrix(const float* w, int rows, int cols, int rank, float energy,
+                    vector<float>& u, vector<float>& v, double* keptEnergy)
+{
+    /* the Gram matrix of the smaller side */
+    bool byCols = cols <= rows;
+    int n = byCols ? cols : rows;
+    vector<double> gram((size_t)n * n, 0);
+
+    if (byCols) {
+        /* W^T * W, accumulated row by row */
+        vector<double> row(n);
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < n; j++)
+                row[j] = w[(size_t)i * cols + j];
+            for (int j = 0; j < n; j++) {
+                double* g = gram.data() + (size_t)j * n;
+                for (int k = j; k < n; k++)
+                    g[k] += row[j] * row[k];
+            }
+        }
+    }
+    else {
+        /* W * W^T */
+        for (int j = 0; j < n; j++) {
+            const float* wj = w + (size_t)j * cols;
+            for (int k = j; k < n; k++) {
+                const float* wk = w + (size_t)k * cols;
+                double sum = 0;
+                for (int c = 0; c < cols; c++)
+                    sum += (double)wj[c] * wk[c];
+                gram[(size_t)j * n + k] = sum;
+            }
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        for (int k = j + 1; k < n; k++)
+            gram[(size_t)k * n + j] = gram[(size_t)j * n + k];
+    }
+
+    vector<double> values;
+    vector<double> vectors;
+    JacobiEigen(gram, n, values, vectors);
+
+    /* the eigenvalues (squared singular values) in descending order */
+    vector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&values](int a, int b) { return values[a] > values[b]; });
+
+    vector<double> energies(n);
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        energies[i] = std::max(values[order[i]], 0.0);
+        total += energies[i];
+    }
+
+    int r = GetFactorRank(energies, rows, cols, rank, energy);
+    if (r == 0)
+        return 0;
+
+    if (keptEnergy != NULL) {
+        double sum = 0;
+        for (int i = 0; i < r; i++)
+            sum += energies[i];
+        *keptEnergy = total > 0 ? sum / total : 1.0;
+    }
+
+    u.assign((size_t)rows * r, 0);
+    v.assign((size_t)r * cols, 0);
+
+    if (byCols) {
+        /* V = Q^T, U = W * Q */
+        for (int k = 0; k < r; k++) {
+            for (int j = 0; j < cols; j++)
+                v[(size_t)k * cols + j] = (float)vectors[(size_t)order[k] * n + j];
+        }
+        for (int i = 0; i < rows; i++) {
+            const float* wi = w + (size_t)i * cols;
+            for (int k = 0; k < r; k++) {
+                const float* vk = v.data() + (size_t)k * cols;
+                double sum = 0;
+                for (int j = 0; j < cols; j++)
+                    sum += (double)wi[j] * vk[j];
+                u[(size_t)i * r + k] = (float)sum;
+            }
+        }
+    }
+    else {
+        /* U = Q, V = Q^T * W */
+        for (int i = 0; i < rows; i++) {
+            for (int k = 0; k < r; k++)
+                u[(size_t)i * r + k] = (float)vectors[(size_t)order[k] * n + i];
+        }
+        vector<double> vk(cols);
+        for (int k = 0; k < r; k++) {
+            fill(vk.begin(), vk.end(), 0.0);
+            const double* q = vectors.data() + (size_t)order[k] * n;
+            for (int i = 0; i < rows; i++) {
+                const float* wi = w + (size_t)i * cols;
+                for (int j = 0; j < cols; j++)
+                    vk[j] += q[i] * wi[j];
+            }
+            for (int j = 0; j < cols; j++)
+                v[(size_t)k * cols + j] = (float)vk[j];
+        }
+    }
+
+    return r;
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,45 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Low-rank factorization of the weights. A matrix W (m x n) is approximated
+ * by the product of two thin matrices U (m x r) and V (r x n) from its
+ * truncated SVD, so that x * W is computed as (x * U) * V with r * (m + n)
+ * rather than m * n multiply-adds for each row of x. The SVD is computed
+ * from the eigen-decomposition of the Gram matrix of the smaller side,
+ * which is small for the weights of a Transformer.
+ */
+
+#ifndef __LOWRANK_H__
+#define __LOWRANK_H__
+
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* factorize a matrix into two thin matrices with its truncated SVD */
+int FactorizeMatrix(const float* w, int rows, int cols, int rank, float energy,
+                    vector<float>& u, vector<float>& v, double* keptEnergy = NULL);
+
+} /* end of the nmt namespace */
+
+#endif /* __LOWRANK_H__ */
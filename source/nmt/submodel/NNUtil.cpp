@@ -82,4 +82,46 @@ XTensor AutoGather(XTensor& src, XTensor& index)
     }
 }
 
+/*
+re-create a 2d tensor without data (the data may point into a mapped file)
+>> t - the tensor
+>> rowNum - number of rows
+>> colNum - number of columns
+>> devID - the device id
+*/
+void ResetTensor2D(XTensor* t, int rowNum, int colNum, int devID)
+{
+    t->DestroyData();
+    t->data = NULL;
+    t->isShared = false;
+    InitTensor2D(t, rowNum, colNum, X_FLOAT, devID);
+}
+
+/*
+re-create a 1d tensor without data
+>> t - the tensor
+>> num - number of elements
+>> devID - the device id
+*/
+void ResetTensor1D(XTensor* t, int num, int devID)
+{
+    t->DestroyData();
+    t->data = NULL;
+    t->isShared = false;
+    InitTensor1D(t, num, X_FLOAT, devID);
+}
+
+/*
+copy the data of a FP32 tensor to the host
+>> t - the tensor
+<< return - the data
+*/
+std::vector<float> GetHostData(const XTensor& t)
+{
+    CheckNTErrors(t.dataType == X_FLOAT, "The tensor should be FP32");
+    std::vector<float> data(t.unitNum);
+    XMemCopy(data.data(), -1, t.data, t.devID, sizeof(float) * t.unitNum);
+    return data;
+}
+
 } /* end of the nmt namespace */
\ No newline at end of file
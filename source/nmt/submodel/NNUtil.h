@@ -22,6 +22,7 @@
 #ifndef __NNUTIL_H__
 #define __NNUTIL_H__
 
+#include <vector>
 #include "../../niutensor/tensor/XGlobal.h"
 #include "../../niutensor/tensor/core/CHeader.h"
 #include "../../niutensor/tensor/function/FHeader.h"
@@ -36,6 +37,15 @@ namespace nmt
 /* the gather function for tensor with any dimension */
 XTensor AutoGather(XTensor& src, XTensor& index);
 
+/* re-create a 2d tensor without data (the data may point into a mapped file) */
+void ResetTensor2D(XTensor* t, int rowNum, int colNum, int devID);
+
+/* re-create a 1d tensor without data */
+void ResetTensor1D(XTensor* t, int num, int devID);
+
+/* copy the data of a FP32 tensor to the host */
+std::vector<float> GetHostData(const XTensor& t);
+
 } /* end of the nmt namespace */
 
 #endif /* __NNUTIL_H__ */
\ No newline at end of file
@@ -22,6 +22,9 @@
 
 #include "Output.h"
 #include "Embedding.h"
+#include "HalfWeight.h"
+#include "LowRank.h"
+#include "NNUtil.h"
 #include "../../niutensor/tensor/core/CHeader.h"
 
 /* the nmt namespace */
@@ -42,13 +45,24 @@ OutputLayer::OutputLayer()
     hSize = -1;
     isTraining = false;
     shareDecInputOutputEmb = false;
+    w = NULL;
+    packedW = NULL;
+    rank = 0;
+    u = NULL;
+    v = NULL;
 }
 
 /* de-constructor */
 OutputLayer::~OutputLayer()
 {
-    if (!shareDecInputOutputEmb)
+    if (!shareDecInputOutputEmb && w != NULL)
         DelTensor(w);
+    if (packedW != NULL)
+        DelTensor(packedW);
+    if (u != NULL)
+        DelTensor(u);
+    if (v != NULL)
+        DelTensor(v);
 }
 
 /*
@@ -73,6 +87,128 @@ void OutputLayer::InitModel(NMTConfig& config)
     }
 }
 
+/*
+transpose a matrix tile by tile, so that both the reads and the writes of a
+tile stay in the cache
+>> a - the matrix, (rows, cols)
+>> b - the transposed matrix, (cols, rows)
+>> rows - number of rows of a
+>> cols - number of columns of a
+*/
+template<class T>
+static void TransposeBlocked(const T* a, T* b, int rows, int cols)
+{
+    const int tile = 32;
+    for (int i0 = 0; i0 < rows; i0 += tile) {
+        int i1 = MIN(i0 + tile, rows);
+        for (int j0 = 0; j0 < cols; j0 += tile) {
+            int j1 = MIN(j0 + tile, cols);
+            for (int i = i0; i < i1; i++) {
+                for (int j = j0; j < j1; j++)
+                    b[size_t(j) * rows + i] = a[size_t(i) * cols + j];
+            }
+        }
+    }
+}
+
+/*
+pack the weight for inference on CPUs. w is (vSize, hSize) as it may be
+shared with the decoder embedding, so the output GEMM multiplies by its
+transpose and reads w by columns. A transposed copy lets the GEMM run
+without transposition on a weight laid out row by row.
+>> packed - the packed weight kept in a model bundle (NULL to pack w here)
+*/
+void OutputLayer::PackWeight(const void* packed)
+{
+    CheckNTErrors(w != NULL && w->devID < 0, "Only weights on CPUs are packed");
+
+    if (packedW != NULL)
+        DelTensor(packedW);
+    packedW = NewTensor2D(hSize, vSize, w->dataType, devID);
+
+    /* use the packed weight of the bundle in place */
+    if (packed != NULL) {
+        packedW->DestroyData();
+        packedW->data = (void*)packed;
+        packedW->isShared = true;
+        return;
+    }
+
+    if (w->unitSize == sizeof(float))
+        TransposeBlocked((const float*)w->data, (float*)packedW->data, vSize, hSize);
+    else if (w->unitSize == sizeof(unsigned short))
+        TransposeBlocked((const unsigned short*)w->data, (unsigned short*)packedW->data, vSize, hSize);
+    else
+        ShowNTErrors("Unsupported data type of the output weight");
+}
+
+/*
+release the weight after it is packed, as the inference reads the packed
+copy only. The weight is kept if it is shared with the decoder embedding.
+<< return - size of the released weight in bytes
+*/
+uint64_t OutputLayer::ReleaseWeight()
+{
+    if (shareDecInputOutputEmb || w == NULL || packedW == NULL)
+        return 0;
+
+    uint64_t size = uint64_t(w->unitNum) * w->unitSize;
+    DelTensor(w);
+    w = NULL;
+    return size;
+}
+
+/*
+set the rank of the factorized output projection. The factors are created
+without data, as they are loaded from a model file then. The weight is
+released unless it is shared with the decoder embedding.
+>> r - the rank
+*/
+void OutputLayer::SetRank(int r)
+{
+    CheckNTErrors(r > 0 && rank == 0, "Invalid rank of the output projection");
+
+    rank = r;
+    u = NewTensor2D(hSize, rank, X_FLOAT, devID);
+    v = NewTensor2D(rank, vSize, X_FLOAT, devID);
+
+    if (!shareDecInputOutputEmb) {
+        DelTensor(w);
+        w = NULL;
+    }
+}
+
+/*
+factorize the output projection with the truncated SVD. The projection is
+kept if the factors would not save computation.
+>> targetRank - the target rank (0 to use the energy)
+>> energy - the ratio of the energy to keep if the rank is not given
+*/
+void OutputLayer::Factorize(int targetRank, float energy)
+{
+    CheckNTErrors(rank == 0, "The output projection is factorized already");
+
+    /* the output is input * w^T */
+    vector<float> wData = GetHostData(*w);
+    vector<float> wt(wData.size());
+    TransposeBlocked(wData.data(), wt.data(), vSize, hSize);
+
+    vector<float> uData;
+    vector<float> vData;
+    int r = FactorizeMatrix(wt.data(), hSize, vSize, targetRank, energy, uData, vData);
+    if (r == 0)
+        return;
+
+    SetRank(r);
+    u->SetData(uData.data(), u->unitNum);
+    v->SetData(vData.data(), v->unitNum);
+
+    if (packedW != NULL) {
+        DelTensor(packedW);
+        packedW = NULL;
+    }
+}
+
 /*
 make the network
 >> input - the input tensor, (batch, srcLen, hiddenDim)
@@ -83,10 +219,19 @@ XTensor OutputLayer::Make(XTensor& input, bool normalized)
 {
     XTensor output;
 
-    output = MMul(input, X_NOTRANS, *w, X_TRANS);
+    if (rank > 0)
+        output = LinearTransform(LinearTransform(input, *u), *v);
+    else if (packedW != NULL && IsHalfWeight(*packedW))
+        output = MulHalf(input, *packedW);
+    else if (packedW != NULL)
+        output = MMul(input, *packedW);
+    else
+        output = MMul(input, X_NOTRANS, *w, X_TRANS);
 
     /* use softmax for training */
-    if (w->enableGrad)
+    if (rank == 0 && w != NULL && w->enableGrad)
+        return Softmax(output, -1);
+    if (rank > 0 && u->enableGrad)
         return Softmax(output, -1);
 
     /* normalize the output for beam search */
@@ -52,9 +52,23 @@ public:
     /* vector size of the linear transformation */
     int hSize;
 
-    /* transformation matrix */
+    /* transformation matrix (NULL if it is released after packing) */
     XTensor* w;
 
+    /* the transposed copy of w ([hSize, vSize]) packed for the CPU GEMM at
+       loading (NULL if it is not used) */
+    XTensor* packedW;
+
+    /* rank of the factorized output projection (0 if it is not factorized),
+       where u (hSize, rank) * v (rank, vSize) approximates the transpose of w */
+    int rank;
+
+    /* the first factor */
+    XTensor* u;
+
+    /* the second factor */
+    XTensor* v;
+
 public:
     /* set the training flag */
     void SetTrainingFlag(bool myIsTraining);
@@ -68,6 +82,18 @@ public:
     /* initialize the model */
     void InitModel(NMTConfig& config);
 
+    /* pack the weight for inference on CPUs */
+    void PackWeight(const void* packed = NULL);
+
+    /* release the weight that is replaced by the packed one */
+    uint64_t ReleaseWeight();
+
+    /* set the rank of the factorized output projection */
+    void SetRank(int r);
+
+    /* factorize the output projection with the truncated SVD */
+    void Factorize(int targetRank, float energy);
+
     /* make the network */
     XTensor Make(XTensor& input, bool normalized);
 };
@@ -0,0 +1,132 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include "BatchSizeController.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* number of the recent sentences to estimate the p99 latency */
+#define BSC_WINDOW_SIZE 256
+
+/* number of sentences needed before the budget grows */
+#define BSC_MIN_SAMPLES 32
+
+/* the factor to cut the budget */
+#define BSC_DECREASE 0.7F
+
+/* the budget grows when the p99 latency is below this ratio of the target */
+#define BSC_HEADROOM 0.8F
+
+/* the budget grows by this fraction of the maximum budget at a time */
+#define BSC_INCREASE 0.0625F
+
+/* constructor */
+BatchSizeController::BatchSizeController()
+{
+    target = 0;
+    budget = 0;
+    minBudget = 0;
+    maxBudget = 0;
+    windowPos = 0;
+    windowNum = 0;
+}
+
+/*
+initialize the controller
+>> config - configuration of the NMT system
+*/
+void BatchSizeController::Init(NMTConfig& config)
+{
+    target = config.service.latencyTarget;
+    maxBudget = config.common.wBatchSize;
+
+    /* a batch has one sentence at least */
+    minBudget = MIN(config.translation.beamSize, maxBudget);
+    budget = maxBudget;
+
+    window.assign(BSC_WINDOW_SIZE, 0);
+    windowPos = 0;
+    windowNum = 0;
+}
+
+/* check whether the controller is enabled */
+bool BatchSizeController::IsEnabled()
+{
+    return target > 0;
+}
+
+/* get the token budget of the next batch */
+int BatchSizeController::GetBudget()
+{
+    return IsEnabled() ? budget : maxBudget;
+}
+
+/* get the p99 latency of the window */
+float BatchSizeController::GetP99()
+{
+    vector<float> latencies(window.begin(), window.begin() + windowNum);
+    int k = MAX((int)(latencies.size() * 0.99F + 0.5F) - 1, 0);
+    nth_element(latencies.begin(), latencies.begin() + k, latencies.end());
+    return latencies[k];
+}
+
+/*
+update the budget with the measurements of a batch
+>> latencies - the latencies (in ms) of the sentences of the batch,
+               from their arrival to the end of decoding
+>> decodeTime - the time (in ms) to translate the batch
+>> isWaiting - indicates whether other sentences are waiting for translation
+*/
+void BatchSizeController::Update(const vector<float>& latencies, float decodeTime, bool isWaiting)
+{
+    if (!IsEnabled() || latencies.empty())
+        return;
+
+    for (size_t i = 0; i < latencies.size(); i++) {
+        window[windowPos] = latencies[i];
+        windowPos = (windowPos + 1) % BSC_WINDOW_SIZE;
+        windowNum = MIN(windowNum + 1, BSC_WINDOW_SIZE);
+    }
+
+    float p99 = GetP99();
+    int oldBudget = budget;
+
+    if (decodeTime > target) {
+        /* a batch alone misses the target, so we scale the budget directly */
+        budget = (int)(budget * BSC_HEADROOM * target / decodeTime);
+    }
+    else if (p99 > target) {
+        budget = (int)(budget * BSC_DECREASE);
+    }
+    else if (isWaiting && windowNum >= BSC_MIN_SAMPLES && p99 < target * BSC_HEADROOM) {
+        budget += MAX((int)(maxBudget * BSC_INCREASE), 1);
+    }
+
+    budget = MAX(MIN(budget, maxBudget), minBudget);
+
+    /* the latencies before a cut do not reflect the new budget */
+    if (budget < oldBudget) {
+        windowPos = 0;
+        windowNum = 0;
+    }
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,87 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The adaptive batch size. The token budget of a batch (-wbatch) is tuned
+ * after each batch to keep the p99 latency of the sentences (from arrival
+ * to the end of decoding) under "latencytarget". The budget is cut when the
+ * p99 latency is beyond the target or a batch alone takes longer than the
+ * target, and it grows when there is headroom and sentences are waiting,
+ * i.e., when larger batches would serve them sooner with more throughput.
+ */
+
+#ifndef __BATCHSIZECONTROLLER_H__
+#define __BATCHSIZECONTROLLER_H__
+
+#include <vector>
+#include "../Config.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the controller of the token budget of batches */
+class BatchSizeController
+{
+private:
+    /* the target of the p99 latency in ms (0 disables the controller) */
+    float target;
+
+    /* the current token budget */
+    int budget;
+
+    /* the minimum token budget */
+    int minBudget;
+
+    /* the maximum token budget (-wbatch) */
+    int maxBudget;
+
+    /* the latencies (in ms) of the recent sentences */
+    vector<float> window;
+
+    /* position of the next latency in the window */
+    int windowPos;
+
+    /* number of latencies in the window */
+    int windowNum;
+
+private:
+    /* get the p99 latency of the window */
+    float GetP99();
+
+public:
+    /* constructor */
+    BatchSizeController();
+
+    /* initialize the controller */
+    void Init(NMTConfig& config);
+
+    /* check whether the controller is enabled */
+    bool IsEnabled();
+
+    /* get the token budget of the next batch */
+    int GetBudget();
+
+    /* update the budget with the measurements of a batch */
+    void Update(const vector<float>& latencies, float decodeTime, bool isWaiting);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __BATCHSIZECONTROLLER_H__ */
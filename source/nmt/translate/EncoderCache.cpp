@@ -0,0 +1,408 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include "EncoderCache.h"
+#include "TranslationMemory.h"
+#include "../submodel/HalfWeight.h"
+#include "../../niutensor/tensor/core/CHeader.h"
+
+using namespace nts;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* size of an entry in bytes */
+static size_t GetEntrySize(const EncoderCacheEntry& entry)
+{
+    return entry.key.size() + entry.data.size() * sizeof(float);
+}
+
+/*
+make the keys (source token ids) and lengths of the sequences in a batch
+>> input - the input of the encoder, (B, L)
+>> padding - the padding of the input, (B, L)
+>> keys - the keys (raw bytes of the token ids without paddings)
+>> lens - the lengths of the sequences
+*/
+void MakeSourceKeys(XTensor& input, XTensor& padding, vector<string>& keys, vector<int>& lens)
+{
+    int batchSize = input.GetDim(0);
+    int maxLen = input.GetDim(1);
+
+    XTensor inputCPU;
+    XTensor paddingCPU;
+    InitTensorOnCPU(&inputCPU, &input);
+    InitTensorOnCPU(&paddingCPU, &padding);
+    CopyValues(input, inputCPU);
+    CopyValues(padding, paddingCPU);
+
+    keys.resize(batchSize);
+    lens.resize(batchSize);
+    for (int i = 0; i < batchSize; i++) {
+        int len = 0;
+        while (len < maxLen && paddingCPU.Get2D(i, len) > 0.0F)
+            len++;
+        lens[i] = len;
+        keys[i].assign((const char*)((int*)inputCPU.data + i * maxLen), sizeof(int) * len);
+    }
+}
+
+/* constructor */
+EncoderCache::EncoderCache()
+{
+    capacity = 0;
+    size = 0;
+    modelHash = 0;
+    hitNum = 0;
+    missNum = 0;
+}
+
+/* de-constructor */
+EncoderCache::~EncoderCache()
+{
+    Clear();
+}
+
+/*
+initialize the cache
+>> config - configuration of the NMT system
+*/
+void EncoderCache::Init(NMTConfig& config)
+{
+    Clear();
+
+    capacity = (size_t)config.translation.encCacheSize * 1024 * 1024;
+    spillDir = config.translation.encCacheDir;
+
+    /* spilled files can outlive the process, so we tell models apart */
+    if (spillDir != "")
+        modelHash = TranslationMemory::HashFile(config.common.modelFN, 0);
+}
+
+/* check whether the cache is enabled */
+bool EncoderCache::IsEnabled()
+{
+    return capacity > 0;
+}
+
+/*
+get the path to the spilled file of a key
+>> key - the key (source token ids)
+*/
+string EncoderCache::GetSpillFile(const string& key)
+{
+    char name[64];
+    sprintf(name, "/%016llx.enc",
+            (unsigned long long)HashBytes(key.data(), key.size(), modelHash));
+    return spillDir + name;
+}
+
+/*
+write an entry to the spill directory
+>> entry - the entry
+*/
+void EncoderCache::Spill(const EncoderCacheEntry& entry)
+{
+    if (spillDir == "")
+        return;
+
+    string fn = GetSpillFile(entry.key);
+
+    /* the entry has been spilled before */
+    FILE* file = fopen(fn.c_str(), "rb");
+    if (file != NULL) {
+        fclose(file);
+        return;
+    }
+
+    file = fopen(fn.c_str(), "wb");
+    if (file == NULL)
+        return;
+
+    int keySize = (int)entry.key.size();
+    int dataNum = (int)entry.data.size();
+    fwrite(&keySize, sizeof(int), 1, file);
+    fwrite(entry.key.data(), 1, keySize, file);
+    fwrite(&entry.len, sizeof(int), 1, file);
+    fwrite(&dataNum, sizeof(int), 1, file);
+    fwrite(entry.data.data(), sizeof(float), dataNum, file);
+    fclose(file);
+}
+
+/*
+read an entry from the spill directory
+>> key - the key (source token ids)
+>> entry - the entry to be filled
+<< return - whether the entry is found
+*/
+bool EncoderCache::Unspill(const string& key, EncoderCacheEntry& entry)
+{
+    if (spillDir == "")
+        return false;
+
+    FILE* file = fopen(GetSpillFile(key).c_str(), "rb");
+    if (file == NULL)
+        return false;
+
+    bool ok = false;
+    int keySize = 0;
+    int dataNum = 0;
+
+    if (fread(&keySize, sizeof(int), 1, file) == 1 && keySize == (int)key.size()) {
+        entry.key.resize(keySize);
+        if (fread(&entry.key[0], 1, keySize, file) == (size_t)keySize && entry.key == key &&
+            fread(&entry.len, sizeof(int), 1, file) == 1 &&
+            fread(&dataNum, sizeof(int), 1, file) == 1 && dataNum >= 0) {
+            entry.data.resize(dataNum);
+            ok = fread(entry.data.data(), sizeof(float), dataNum, file) == (size_t)dataNum;
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/*
+insert an entry and evict the least recently used ones if necessary
+(the caller holds the lock)
+>> entry - the entry (its data is moved into the cache)
+*/
+void EncoderCache::Insert(EncoderCacheEntry& entry)
+{
+    size_t entrySize = GetEntrySize(entry);
+
+    if (index.find(entry.key) != index.end())
+        return;
+
+    if (entrySize > capacity) {
+        Spill(entry);
+        return;
+    }
+
+    entries.push_front(move(entry));
+    index[entries.front().key] = entries.begin();
+    size += entrySize;
+
+    while (size > capacity) {
+        EncoderCacheEntry& last = entries.back();
+        Spill(last);
+        size -= GetEntrySize(last);
+        index.erase(last.key);
+        entries.pop_back();
+    }
+}
+
+/*
+copy the cached data of a key into a batch
+>> key - the key (source token ids)
+>> row - the row of the sequence in the batch
+>> batchSize - the batch size
+>> maxLen - the length of the batch (with paddings)
+>> dim - the hidden size
+>> buf - the data of the batch, blocks of (batchSize, maxLen, dim)
+<< return - whether the key is found
+*/
+bool EncoderCache::Fetch(const string& key, int row, int batchSize, int maxLen,
+                         int dim, vector<float>& buf)
+{
+    lock_guard<mutex> lock(cacheMutex);
+
+    EncoderCacheEntry loaded;
+    const EncoderCacheEntry* entry = NULL;
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+        entry = &(*it->second);
+    }
+    else if (Unspill(key, loaded)) {
+        entry = &loaded;
+    }
+    else {
+        return false;
+    }
+
+    size_t rowSize = (size_t)entry->len * dim;
+    size_t blockSize = (size_t)batchSize * maxLen * dim;
+    int blockNum = rowSize > 0 ? (int)(entry->data.size() / rowSize) : 0;
+    CheckNTErrors((size_t)blockNum * blockSize == buf.size(), "Invalid encoder cache entry");
+
+    for (int k = 0; k < blockNum; k++)
+        memcpy(buf.data() + k * blockSize + (size_t)row * maxLen * dim,
+               entry->data.data() + k * rowSize, sizeof(float) * rowSize);
+
+    if (entry == &loaded)
+        Insert(loaded);
+
+    return true;
+}
+
+/*
+run the encoder (or use the cached results) and fill the decoder cache.
+We reuse the cached results only if all sequences in the batch are found.
+Otherwise the batch is encoded as usual and the results of all sequences
+are added to the cache. In both cases, the keys and values of the
+encoder-decoder attention are put into the decoder cache, so the decoder
+does not compute them again for every hypothesis in the beam.
+>> model - the model
+>> input - the input of the encoder, (B, L)
+>> padding - the padding of the input, (B, L)
+>> maskEnc - the encoder mask
+>> beamSize - the beam size
+<< return - the encoder output, (B, L, E)
+*/
+XTensor EncoderCache::Encode(NMTModel* model, XTensor& input, XTensor& padding,
+                             XTensor& maskEnc, int beamSize)
+{
+    AttDecoder* decoder = model->decoder;
+    int batchSize = input.GetDim(0);
+    int maxLen = input.GetDim(1);
+    int dim = model->config->model.encEmbDim;
+    int layerNum = decoder->nlayer;
+    int blockNum = 1 + 2 * layerNum;
+    size_t blockSize = (size_t)batchSize * maxLen * dim;
+
+    CheckNTErrors(dim == model->config->model.decEmbDim,
+                  "The encoder cache requires the same size of encoder and decoder embeddings");
+
+    vector<string> keys;
+    vector<int> lens;
+    MakeSourceKeys(input, padding, keys, lens);
+
+    /* look up the cache */
+    vector<float> buf(blockSize * blockNum, 0.0F);
+    bool allHit = true;
+    for (int i = 0; i < batchSize && allHit; i++)
+        allHit = Fetch(keys[i], i, batchSize, maxLen, dim, buf);
+
+    XTensor encoding;
+    XTensor* kv = new XTensor[2 * layerNum];
+
+    if (allHit) {
+        hitNum += batchSize;
+
+        for (int k = 0; k < blockNum; k++) {
+            XTensor& block = k == 0 ? encoding : kv[k - 1];
+            InitTensor3D(&block, batchSize, maxLen, dim, X_FLOAT, input.devID);
+            block.SetData(buf.data() + k * blockSize, block.unitNum);
+            if (model->config->common.useFP16)
+                block = ConvertDataType(block, X_FLOAT16);
+        }
+    }
+    else {
+        missNum += batchSize;
+
+        /* make the encoding network */
+        if (model->config->model.encPreLN)
+            encoding = model->encoder->RunFastPreNorm(input, &maskEnc);
+        else
+            encoding = model->encoder->RunFastPostNorm(input, &maskEnc);
+
+        /* keys and values of the encoder-decoder attention */
+        for (int i = 0; i < layerNum; i++) {
+            Attention& att = decoder->enDeAtts[i];
+            kv[2 * i] = LinearTransform(encoding, att.weightK, att.biasK);
+            kv[2 * i + 1] = LinearTransform(encoding, att.weightV, att.biasV);
+        }
+
+        /* save the results of each sequence */
+        vector<EncoderCacheEntry> newEntries(batchSize);
+        for (int i = 0; i < batchSize; i++) {
+            newEntries[i].key = keys[i];
+            newEntries[i].len = lens[i];
+            newEntries[i].data.resize((size_t)blockNum * lens[i] * dim);
+        }
+
+        for (int k = 0; k < blockNum; k++) {
+            XTensor& block = k == 0 ? encoding : kv[k - 1];
+            XTensor blockCPU;
+            InitTensor3D(&blockCPU, batchSize, maxLen, dim, X_FLOAT, -1);
+            if (block.dataType == X_FLOAT16) {
+                XTensor converted = ConvertDataType(block, X_FLOAT);
+                CopyValues(converted, blockCPU);
+            }
+            else {
+                CopyValues(block, blockCPU);
+            }
+
+            const float* data = (const float*)blockCPU.data;
+            for (int i = 0; i < batchSize; i++) {
+                size_t rowSize = (size_t)lens[i] * dim;
+                memcpy(newEntries[i].data.data() + k * rowSize,
+                       data + (size_t)i * maxLen * dim, sizeof(float) * rowSize);
+            }
+        }
+
+        lock_guard<mutex> lock(cacheMutex);
+        for (int i = 0; i < batchSize; i++)
+            Insert(newEntries[i]);
+    }
+
+    /* fill the decoder cache (in the same layout as Attention::Make) */
+    for (int i = 0; i < layerNum; i++) {
+        Attention& att = decoder->enDeAtts[i];
+        Cache& cache = decoder->enDeAttCache[i];
+
+        if (beamSize > 1) {
+            cache.key = Unsqueeze(kv[2 * i], kv[2 * i].order - 2, beamSize);
+            cache.value = Unsqueeze(kv[2 * i + 1], kv[2 * i + 1].order - 2, beamSize);
+            cache.key.ReshapeMerged(cache.key.order - 4);
+            cache.value.ReshapeMerged(cache.value.order - 4);
+        }
+        else {
+            cache.key = kv[2 * i];
+            cache.value = kv[2 * i + 1];
+        }
+
+        if (att.splitHeads && !att.useRPR) {
+            cache.key = Split(cache.key, cache.key.order - 1, att.nhead);
+            cache.value = Split(cache.value, cache.value.order - 1, att.nhead);
+        }
+
+        cache.miss = false;
+    }
+
+    delete[] kv;
+
+    return encoding;
+}
+
+/* remove all entries */
+void EncoderCache::Clear()
+{
+    lock_guard<mutex> lock(cacheMutex);
+    entries.clear();
+    index.clear();
+    size = 0;
+}
+
+/* get the number of hits */
+long EncoderCache::GetHitNum()
+{
+    return hitNum;
+}
+
+/* get the number of misses */
+long EncoderCache::GetMissNum()
+{
+    return missNum;
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,139 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * A cache of encoder outputs. For each source sequence it keeps the output
+ * of the encoder and the keys and values of the encoder-decoder attention
+ * of every decoder layer, so that re-decoding the same sources (e.g., with
+ * different decoding settings) can skip the encoder. Entries are kept in
+ * host memory under a size budget, and evicted entries can be spilled to a
+ * directory and loaded back later.
+ */
+
+#ifndef __ENCODERCACHE_H__
+#define __ENCODERCACHE_H__
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include "../Model.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* an entry of the encoder cache */
+struct EncoderCacheEntry
+{
+    /* the key (source token ids) */
+    string key;
+
+    /* length of the source sequence */
+    int len;
+
+    /* the encoder output and the keys and values of each layer,
+       each of them is (len, E) */
+    vector<float> data;
+};
+
+/* the encoder cache */
+class EncoderCache
+{
+private:
+    /* the maximum size of the cache in bytes */
+    size_t capacity;
+
+    /* the current size of the cache in bytes */
+    size_t size;
+
+    /* the directory to spill evicted entries (empty for no spilling) */
+    string spillDir;
+
+    /* the hash of the model (for the names of spilled files) */
+    uint64_t modelHash;
+
+    /* entries in the order of use (the most recent one first) */
+    list<EncoderCacheEntry> entries;
+
+    /* the index from keys to entries */
+    unordered_map<string, list<EncoderCacheEntry>::iterator> index;
+
+    /* the cache is shared by all users of a translator */
+    mutex cacheMutex;
+
+    /* number of hits */
+    atomic<long> hitNum;
+
+    /* number of misses */
+    atomic<long> missNum;
+
+private:
+    /* get the path to the spilled file of a key */
+    string GetSpillFile(const string& key);
+
+    /* write an entry to the spill directory */
+    void Spill(const EncoderCacheEntry& entry);
+
+    /* read an entry from the spill directory */
+    bool Unspill(const string& key, EncoderCacheEntry& entry);
+
+    /* insert an entry and evict the old ones if necessary */
+    void Insert(EncoderCacheEntry& entry);
+
+    /* copy the cached data of a key into a batch */
+    bool Fetch(const string& key, int row, int batchSize, int maxLen,
+               int dim, vector<float>& buf);
+
+public:
+    /* constructor */
+    EncoderCache();
+
+    /* de-constructor */
+    ~EncoderCache();
+
+    /* initialize the cache */
+    void Init(NMTConfig& config);
+
+    /* check whether the cache is enabled */
+    bool IsEnabled();
+
+    /* run the encoder (or use the cached results) and fill the decoder cache */
+    XTensor Encode(NMTModel* model, XTensor& input, XTensor& padding,
+                   XTensor& maskEnc, int beamSize);
+
+    /* remove all entries */
+    void Clear();
+
+    /* get the number of hits */
+    long GetHitNum();
+
+    /* get the number of misses */
+    long GetMissNum();
+};
+
+/* make the keys (source token ids) and lengths of the sequences in a batch */
+void MakeSourceKeys(XTensor& input, XTensor& padding, vector<string>& keys, vector<int>& lens);
+
+} /* end of the nmt namespace */
+
+#endif /* __ENCODERCACHE_H__ */
@@ -0,0 +1,137 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <climits>
+#include "MemoryCostModel.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+MemoryCostModel::MemoryCostModel()
+{
+    budget = 0;
+    unitSize = 4;
+    beamSize = 1;
+    maxLen = 0;
+    maxLenAlpha = 0;
+    encEmbDim = 0;
+    encFFNDim = 0;
+    encHeadNum = 0;
+    decEmbDim = 0;
+    decFFNDim = 0;
+    decHeadNum = 0;
+    crossHeadNum = 0;
+    decLayerNum = 0;
+    vocabSize = 0;
+}
+
+/*
+initialize the model
+>> config - configuration of the NMT system
+*/
+void MemoryCostModel::Init(NMTConfig& config)
+{
+    budget = (size_t)config.translation.batchMem * 1024 * 1024;
+    unitSize = config.common.useFP16 ? 2 : 4;
+    beamSize = config.translation.beamSize;
+    maxLen = config.translation.maxLen;
+    maxLenAlpha = config.translation.maxLenAlpha;
+    encEmbDim = config.model.encEmbDim;
+    encFFNDim = config.model.encFFNHiddenDim;
+    encHeadNum = config.model.encSelfAttHeadNum;
+    decEmbDim = config.model.decEmbDim;
+    decFFNDim = config.model.decFFNHiddenDim;
+    decHeadNum = config.model.decSelfAttHeadNum;
+    crossHeadNum = config.model.encDecAttHeadNum;
+    decLayerNum = config.model.decLayerNum;
+    vocabSize = config.model.tgtVocabSize;
+}
+
+/* check whether the memory budget is used */
+bool MemoryCostModel::IsEnabled()
+{
+    return budget > 0;
+}
+
+/* get the memory budget in bytes */
+size_t MemoryCostModel::GetBudget()
+{
+    return budget;
+}
+
+/*
+estimate the peak memory of a batch. The layers are run one by one, so
+only the activations of a layer are counted, while the caches of all
+decoder layers are kept through decoding.
+>> batchSize - number of sentences
+>> srcLen - the maximum source length (with EOS)
+>> prefixLen - length of the forced prefixes
+<< return - the estimated memory in bytes
+*/
+size_t MemoryCostModel::Estimate(int batchSize, int srcLen, int prefixLen)
+{
+    size_t b = (size_t)batchSize;
+    size_t rows = b * beamSize;
+    size_t l = (size_t)srcLen;
+
+    /* the output length limit of the searchers, with the start symbol and the prefix */
+    size_t t = (size_t)MIN(int(float(srcLen) * maxLenAlpha), maxLen) + prefixLen + 1;
+
+    /* a layer of the encoder: q, k, v, the output, the FFN and the attention weights */
+    size_t encoder = b * l * (4 * encEmbDim + encFFNDim) + b * encHeadNum * l * l;
+
+    /* the keys and values of the encoder-decoder attention (for each hypothesis) */
+    size_t crossCache = (size_t)decLayerNum * 2 * rows * l * decEmbDim;
+
+    /* the keys and values of the self-attention at the maximum length */
+    size_t selfCache = (size_t)decLayerNum * 2 * rows * t * decEmbDim;
+
+    /* a decoder layer of a step (the prefix is fed in one pass) */
+    size_t tokens = (size_t)(prefixLen + 1);
+    size_t step = rows * tokens * (4 * decEmbDim + decFFNDim) +
+                  rows * tokens * (decHeadNum * t + crossHeadNum * l);
+
+    /* the logits, the log-probabilities and the accumulated scores */
+    size_t scores = 3 * rows * vocabSize;
+
+    /* the states of the hypotheses (token ids and back-pointers) */
+    size_t states = 2 * sizeof(int) * rows * t;
+
+    return (encoder + crossCache + selfCache + step + scores) * unitSize + states;
+}
+
+/*
+get the maximum number of sentences of a batch within the budget
+>> srcLen - the maximum source length (with EOS)
+>> prefixLen - length of the forced prefixes
+<< return - the number of sentences (at least 1, a sentence beyond the
+            budget is translated alone)
+*/
+int MemoryCostModel::GetMaxBatchSize(int srcLen, int prefixLen)
+{
+    if (!IsEnabled())
+        return INT_MAX;
+
+    /* the cost is linear in the batch size */
+    size_t cost = Estimate(1, srcLen, prefixLen);
+    return (int)MAX(MIN(budget / cost, (size_t)INT_MAX), (size_t)1);
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,87 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The memory cost model of translation. It estimates the peak memory of a
+ * batch from the model configuration and the search settings, including the
+ * encoder activations, the encoder-decoder attention cache, the decoder
+ * self-attention cache at the maximum output length, the activations of a
+ * decoding step and the [B * beam, V] score tensors. It is used to fill
+ * batches up to a memory budget ("batchmem") rather than a token budget.
+ */
+
+#ifndef __MEMORYCOSTMODEL_H__
+#define __MEMORYCOSTMODEL_H__
+
+#include <cstddef>
+#include "../Config.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the estimator of the memory of a batch */
+class MemoryCostModel
+{
+private:
+    /* the memory budget of a batch in bytes (0 disables it) */
+    size_t budget;
+
+    /* size of an element of the activations in bytes */
+    int unitSize;
+
+    /* the beam size */
+    int beamSize;
+
+    /* the maximum output length and its ratio to the source length */
+    int maxLen;
+    float maxLenAlpha;
+
+    /* the model configuration */
+    int encEmbDim;
+    int encFFNDim;
+    int encHeadNum;
+    int decEmbDim;
+    int decFFNDim;
+    int decHeadNum;
+    int crossHeadNum;
+    int decLayerNum;
+    int vocabSize;
+
+public:
+    /* constructor */
+    MemoryCostModel();
+
+    /* initialize the model */
+    void Init(NMTConfig& config);
+
+    /* check whether the memory budget is used */
+    bool IsEnabled();
+
+    /* get the memory budget in bytes */
+    size_t GetBudget();
+
+    /* estimate the peak memory of a batch in bytes */
+    size_t Estimate(int batchSize, int srcLen, int prefixLen = 0);
+
+    /* get the maximum number of sentences of a batch within the budget */
+    int GetMaxBatchSize(int srcLen, int prefixLen = 0);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __MEMORYCOSTMODEL_H__ */
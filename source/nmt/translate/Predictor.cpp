@@ -78,6 +78,7 @@ void StateBundle::MakeStates(int num)
 Predictor::Predictor()
 {
     startSymbol = 2;
+    prefix = NULL;
 }
 
 /* de-constructor */
@@ -120,6 +121,16 @@ void Predictor::SetStartSymbol(int symbol)
     startSymbol = symbol;
 }
 
+/*
+set the forced prefixes. They are fed to the decoder at the first step,
+and the following steps start after them.
+>> myPrefix - the forced prefixes (NULL if not used)
+*/
+void Predictor::SetPrefix(ForcedPrefix* myPrefix)
+{
+    prefix = myPrefix;
+}
+
 /*
 read a state
 >> model - the  model that keeps the network created so far
@@ -163,8 +174,16 @@ void Predictor::Predict(StateBundle* next, XTensor& aliveState, XTensor& encodin
     InitTensor2D(&first, batchSize, 1, X_INT, inputEnc.devID);
     first.SetDataFixed(startSymbol);
 
+    /* the self-attention mask (only for the forced prefixes) */
+    XTensor* maskSelf = NULL;
+
     /* add a new word into the input sequence of the decoder side */
-    if (isStart) {
+    if (isStart && prefix != NULL) {
+        /* feed the start symbol and the prefixes in one pass */
+        inputDec = prefix->input;
+        maskSelf = &prefix->mask;
+    }
+    else if (isStart) {
         inputDec = Identity(first);
     }
     else {
@@ -209,14 +228,24 @@ void Predictor::Predict(StateBundle* next, XTensor& aliveState, XTensor& encodin
     /* decoder mask */
     m->MakeMTMaskDec(paddingEnc, paddingDec, maskDec, maskEncDec);
 
+    /* the position of the first token fed to the decoder */
+    int pos = nstep;
+    if (prefix != NULL)
+        pos = isStart ? prefix->start : nstep + prefix->len;
+
     /* make the decoding network */
     if (m->config->model.decPreLN)
-        decoding = m->decoder->RunFastPreNorm(inputDec, encoding, &maskEncDec, nstep);
+        decoding = m->decoder->RunFastPreNorm(inputDec, encoding, &maskEncDec, pos, maskSelf);
     else
-        decoding = m->decoder->RunFastPostNorm(inputDec, encoding, &maskEncDec, nstep);
+        decoding = m->decoder->RunFastPostNorm(inputDec, encoding, &maskEncDec, pos, maskSelf);
 
     CheckNTErrors(decoding.order >= 2, "The tensor must be of order 2 or larger!");
 
+    /* we only predict the token after the last one */
+    int lenDec = decoding.GetDim(decoding.order - 2);
+    if (lenDec > 1)
+        decoding = SelectRange(decoding, decoding.order - 2, lenDec - 1, lenDec);
+
     /* generate the output probabilities */
     output = m->outputLayer->Make(decoding, true);
 }
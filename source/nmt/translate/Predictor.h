@@ -26,6 +26,7 @@
 
 #include "../Model.h"
 #include "LengthPenalty.h"
+#include "PrefixCache.h"
 
 using namespace std;
 
@@ -138,6 +139,9 @@ private:
     /* end symbol */
     int endSymbol;
 
+    /* the forced prefixes fed at the first step (NULL if not used) */
+    ForcedPrefix* prefix;
+
 public:
     /* constructor */
     Predictor();
@@ -151,6 +155,9 @@ public:
     /* set the start symbol */
     void SetStartSymbol(int symbol);
 
+    /* set the forced prefixes */
+    void SetPrefix(ForcedPrefix* myPrefix);
+
     /* read a state */
     void Read(NMTModel* model, StateBundle* state);
 
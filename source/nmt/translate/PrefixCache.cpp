@@ -0,0 +1,293 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstring>
+#include "PrefixCache.h"
+#include "EncoderCache.h"
+#include "../../niutensor/tensor/core/CHeader.h"
+
+using namespace nts;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+PrefixCache::PrefixCache()
+{
+    capacity = 0;
+    hitNum = 0;
+    missNum = 0;
+}
+
+/* de-constructor */
+PrefixCache::~PrefixCache()
+{
+    Clear();
+}
+
+/*
+initialize the cache
+>> config - configuration of the NMT system
+*/
+void PrefixCache::Init(NMTConfig& config)
+{
+    capacity = config.translation.prefixCacheSize;
+    Clear();
+}
+
+/* check whether the cache is enabled */
+bool PrefixCache::IsEnabled()
+{
+    return capacity > 0;
+}
+
+/*
+restore the decoder states of the longest cached prefix shared by a batch.
+The states of the first "start" positions of every sequence are put into
+the decoder self-attention cache, where "start" is the minimum length of
+the common prefixes of the cached tokens and the new tokens. We keep at
+least one token to feed so that the decoder produces a prediction.
+>> model - the model
+>> keys - the keys of the sequences (source token ids)
+>> tokens - the decoder tokens of the sequences (all of the same length)
+>> beamSize - the beam size
+<< return - number of the restored positions
+*/
+int PrefixCache::Restore(NMTModel* model, const vector<string>& keys,
+                         const vector<vector<int>>& tokens, int beamSize)
+{
+    if (!IsEnabled())
+        return 0;
+
+    AttDecoder* decoder = model->decoder;
+    int batchSize = (int)keys.size();
+    int dim = model->config->model.decEmbDim;
+    int start = (int)tokens[0].size() - 1;
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    vector<const PrefixCacheEntry*> found(batchSize);
+    for (int i = 0; i < batchSize && start > 0; i++) {
+        auto it = index.find(keys[i]);
+        if (it == index.end()) {
+            start = 0;
+            break;
+        }
+
+        const vector<int>& cached = it->second->tokens;
+        int common = 0;
+        while (common < start && common < (int)cached.size() &&
+               cached[common] == tokens[i][common])
+            common++;
+
+        start = MIN(start, common);
+        found[i] = &(*it->second);
+    }
+
+    if (start == 0) {
+        missNum += batchSize;
+        return 0;
+    }
+
+    hitNum += batchSize;
+
+    size_t rowSize = (size_t)start * dim;
+    vector<float> buf(rowSize * batchSize * beamSize);
+
+    for (int l = 0; l < decoder->nlayer; l++) {
+        Attention& att = decoder->selfAtts[l];
+        Cache& cache = decoder->selfAttCache[l];
+
+        for (int kv = 0; kv < 2; kv++) {
+            for (int i = 0; i < batchSize; i++) {
+                const PrefixCacheEntry* entry = found[i];
+                const float* src = entry->data.data() +
+                                   (size_t)(2 * l + kv) * entry->tokens.size() * dim;
+                for (int j = 0; j < beamSize; j++)
+                    memcpy(buf.data() + (size_t)(i * beamSize + j) * rowSize, src,
+                           sizeof(float) * rowSize);
+            }
+
+            XTensor states;
+            InitTensor3D(&states, batchSize * beamSize, start, dim, X_FLOAT, model->devID);
+            states.SetData(buf.data(), states.unitNum);
+            if (model->config->common.useFP16)
+                states = ConvertDataType(states, X_FLOAT16);
+
+            /* the same layout as Attention::Make */
+            if (att.splitHeads && !att.useRPR)
+                states = Split(states, states.order - 1, att.nhead);
+
+            if (kv == 0)
+                cache.key = states;
+            else
+                cache.value = states;
+        }
+
+        cache.miss = false;
+    }
+
+    return start;
+}
+
+/*
+save the decoder states of a batch. It is called after the prefixes are
+fed, so the self-attention cache keeps the states of all decoder tokens.
+>> model - the model
+>> keys - the keys of the sequences (source token ids)
+>> tokens - the decoder tokens of the sequences (all of the same length)
+>> beamSize - the beam size (all hypotheses of a sequence are the same here)
+*/
+void PrefixCache::Save(NMTModel* model, const vector<string>& keys,
+                       const vector<vector<int>>& tokens, int beamSize)
+{
+    if (!IsEnabled())
+        return;
+
+    AttDecoder* decoder = model->decoder;
+    int batchSize = (int)keys.size();
+    int dim = model->config->model.decEmbDim;
+    int len = (int)tokens[0].size();
+    size_t rowSize = (size_t)len * dim;
+
+    vector<PrefixCacheEntry> newEntries(batchSize);
+    for (int i = 0; i < batchSize; i++) {
+        newEntries[i].key = keys[i];
+        newEntries[i].tokens = tokens[i];
+        newEntries[i].data.resize(2 * decoder->nlayer * rowSize);
+    }
+
+    for (int l = 0; l < decoder->nlayer; l++) {
+        Attention& att = decoder->selfAtts[l];
+        Cache& cache = decoder->selfAttCache[l];
+
+        for (int kv = 0; kv < 2; kv++) {
+            XTensor states = kv == 0 ? cache.key : cache.value;
+
+            if (att.splitHeads && !att.useRPR)
+                states = Merge(states, states.order - 1);
+            if (states.dataType == X_FLOAT16)
+                states = ConvertDataType(states, X_FLOAT);
+
+            CheckNTErrors(states.GetDim(1) == len, "Invalid states of the prefixes");
+
+            XTensor statesCPU;
+            InitTensorOnCPU(&statesCPU, &states);
+            CopyValues(states, statesCPU);
+
+            const float* data = (const float*)statesCPU.data;
+            for (int i = 0; i < batchSize; i++)
+                memcpy(newEntries[i].data.data() + (size_t)(2 * l + kv) * rowSize,
+                       data + (size_t)i * beamSize * rowSize, sizeof(float) * rowSize);
+        }
+    }
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    for (int i = 0; i < batchSize; i++) {
+        auto it = index.find(keys[i]);
+        if (it != index.end()) {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+
+        entries.push_front(move(newEntries[i]));
+        index[entries.front().key] = entries.begin();
+    }
+
+    /* evict the least recently used sessions */
+    while ((int)entries.size() > capacity) {
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+/* remove all entries */
+void PrefixCache::Clear()
+{
+    lock_guard<mutex> lock(cacheMutex);
+    entries.clear();
+    index.clear();
+}
+
+/* get the number of hits */
+long PrefixCache::GetHitNum()
+{
+    return hitNum;
+}
+
+/* get the number of misses */
+long PrefixCache::GetMissNum()
+{
+    return missNum;
+}
+
+/* constructor */
+ForcedPrefix::ForcedPrefix()
+{
+    len = 0;
+    start = 0;
+}
+
+/*
+make the decoder input of the prefixes
+>> model - the model
+>> srcInput - the input of the encoder, (B, L)
+>> srcPadding - the padding of the encoder input, (B, L)
+>> prefixes - the forced prefixes (all of the same length)
+>> startSymbol - the start symbol of the decoder
+>> beamSize - the beam size
+>> cache - the prefix cache (NULL if not used)
+*/
+void ForcedPrefix::Make(NMTModel* model, XTensor& srcInput, XTensor& srcPadding, IntList** prefixes,
+                        int startSymbol, int beamSize, PrefixCache* cache)
+{
+    int batchSize = srcInput.GetDim(0);
+    len = (int)prefixes[0]->Size();
+
+    vector<int> lens;
+    MakeSourceKeys(srcInput, srcPadding, keys, lens);
+
+    tokens.resize(batchSize);
+    for (int i = 0; i < batchSize; i++) {
+        CheckNTErrors((int)prefixes[i]->Size() == len, "The prefixes in a batch must be of the same length");
+        tokens[i].clear();
+        tokens[i].push_back(startSymbol);
+        tokens[i].insert(tokens[i].end(), prefixes[i]->items, prefixes[i]->items + len);
+    }
+
+    start = 0;
+    if (cache != NULL)
+        start = cache->Restore(model, keys, tokens, beamSize);
+
+    /* the remaining tokens are fed in one pass */
+    int num = len + 1 - start;
+    int* ids = new int[batchSize * beamSize * num];
+    for (int i = 0; i < batchSize; i++) {
+        for (int j = 0; j < beamSize; j++)
+            memcpy(ids + (i * beamSize + j) * num, tokens[i].data() + start, sizeof(int) * num);
+    }
+
+    InitTensor2D(&input, batchSize * beamSize, num, X_INT, srcInput.devID);
+    input.SetData(ids, input.unitNum);
+    mask = model->MakeMTMaskDecPrefix(batchSize * beamSize, num, start);
+
+    delete[] ids;
+}
+
+} /* end of the nmt namespace */
@@ -0,0 +1,144 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Prefix-constrained decoding. A forced target prefix is fed to the decoder
+ * in one teacher-forced pass before free decoding. The prefix cache keeps
+ * the decoder self-attention states of the prefix for each source sentence
+ * (a session), so when the same sentence comes again with an extended or
+ * edited prefix, only the tokens after the longest common prefix are fed.
+ */
+
+#ifndef __PREFIXCACHE_H__
+#define __PREFIXCACHE_H__
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../Model.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* an entry of the prefix cache */
+struct PrefixCacheEntry
+{
+    /* the key (source token ids) */
+    string key;
+
+    /* the decoder tokens, i.e., the start symbol and the prefix */
+    vector<int> tokens;
+
+    /* the keys and values of the self-attention of each layer,
+       each of them is (tokens.size(), E) */
+    vector<float> data;
+};
+
+/* the LRU cache of decoder states of forced prefixes */
+class PrefixCache
+{
+private:
+    /* the maximum number of sessions */
+    int capacity;
+
+    /* entries in the order of use (the most recent one first) */
+    list<PrefixCacheEntry> entries;
+
+    /* the index from keys to entries */
+    unordered_map<string, list<PrefixCacheEntry>::iterator> index;
+
+    /* the cache is shared by all users of a translator */
+    mutex cacheMutex;
+
+    /* number of hits */
+    atomic<long> hitNum;
+
+    /* number of misses */
+    atomic<long> missNum;
+
+public:
+    /* constructor */
+    PrefixCache();
+
+    /* de-constructor */
+    ~PrefixCache();
+
+    /* initialize the cache */
+    void Init(NMTConfig& config);
+
+    /* check whether the cache is enabled */
+    bool IsEnabled();
+
+    /* restore the decoder states of the longest cached prefix shared by a batch */
+    int Restore(NMTModel* model, const vector<string>& keys,
+                const vector<vector<int>>& tokens, int beamSize);
+
+    /* save the decoder states of a batch */
+    void Save(NMTModel* model, const vector<string>& keys,
+              const vector<vector<int>>& tokens, int beamSize);
+
+    /* remove all entries */
+    void Clear();
+
+    /* get the number of hits */
+    long GetHitNum();
+
+    /* get the number of misses */
+    long GetMissNum();
+};
+
+/* the forced prefixes of a batch */
+class ForcedPrefix
+{
+public:
+    /* the keys of the sequences (source token ids) */
+    vector<string> keys;
+
+    /* the decoder tokens of each sequence, i.e., the start symbol and the prefix */
+    vector<vector<int>> tokens;
+
+    /* length of the prefixes (the same for all sequences) */
+    int len;
+
+    /* position of the first token fed to the decoder
+       (the states of the earlier ones are restored from the cache) */
+    int start;
+
+    /* the tokens fed to the decoder in one pass, (B * beamSize, len + 1 - start) */
+    XTensor input;
+
+    /* the self-attention mask of the input */
+    XTensor mask;
+
+public:
+    /* constructor */
+    ForcedPrefix();
+
+    /* make the decoder input of the prefixes */
+    void Make(NMTModel* model, XTensor& srcInput, XTensor& srcPadding, IntList** prefixes,
+              int startSymbol, int beamSize, PrefixCache* cache);
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __PREFIXCACHE_H__ */
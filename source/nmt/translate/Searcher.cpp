@@ -43,6 +43,13 @@ BeamSearch::BeamSearch()
     isEarlyStop = false;
     needReorder = false;
     scalarMaxLength = 0.0F;
+    encoderCache = NULL;
+    prefixCache = NULL;
+    callback = NULL;
+    callbackArg = NULL;
+    deadlines = NULL;
+    stepNum = 0;
+    activeNum = 0;
 }
 
 /* de-constructor */
@@ -96,9 +103,11 @@ void BeamSearch::Prepare(int myBatchSize, int myBeamSize)
     /* prepare for the indices of alive states */
     aliveStatePids.Clear();
     aliveSentList.Clear();
+    streamedNums.Clear();
     for (int i = 0; i < batchSize; i++) {
         aliveStatePids.Add(i);
         aliveSentList.Add(i);
+        streamedNums.Add(0);
     }
 }
 
@@ -109,9 +118,11 @@ search for the most promising states
 >> padding - padding of the input
 >> outputs - outputs that represent the sequences as rows
 >> score - score of the sequences
+>> prefixes - the forced target prefixes of the same length (NULL if not used),
+              the outputs are the tokens after them
 */
 void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding, 
-                        IntList** outputs, XTensor& score)
+                        IntList** outputs, XTensor& score, IntList** prefixes)
 {
     Predictor predictor;
     XTensor maskEnc;
@@ -124,12 +135,17 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
     CheckNTErrors(startSymbol >= 0, "The search class is not initialized!");
 
     Prepare(input.GetDim(0), beamSize);
+    isTimedOut.assign(batchSize, false);
+    stepNum = 0;
+    activeNum = 0;
 
     /* encoder mask */
     model->MakeMTMaskEnc(padding, maskEnc);
 
     /* make the encoding network */
-    if (model->config->model.encPreLN)
+    if (encoderCache != NULL && encoderCache->IsEnabled())
+        encoding = encoderCache->Encode(model, input, padding, maskEnc, beamSize);
+    else if (model->config->model.encPreLN)
         encoding = model->encoder->RunFastPreNorm(input, &maskEnc);
     else
         encoding = model->encoder->RunFastPostNorm(input, &maskEnc);
@@ -147,6 +163,14 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
 
     CheckNTErrors(lengthLimit > 0, "no max length specified!");
 
+    /* the forced prefixes are fed at the first step */
+    ForcedPrefix prefix;
+    if (prefixes != NULL) {
+        prefix.Make(model, input, padding, prefixes, startSymbol, beamSize, prefixCache);
+        predictor.SetPrefix(&prefix);
+        lengthLimit = MAX(lengthLimit - prefix.len, 1);
+    }
+
     StateBundle* states = new StateBundle[lengthLimit + 1];
     StateBundle* first = states;
     StateBundle* cur = NULL;
@@ -166,6 +190,9 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
     InitTensor1D(&reorderState, batchSize * beamSize, X_INT, input.devID);
     SetAscendingOrder(reorderState, 0);
 
+    /* number of the uncompleted sentences */
+    int aliveNum = batchSize;
+
     /* generate the sequence from left to right */
     for (int l = 0; l < lengthLimit; l++) {
         if (beamSize > 1) {
@@ -184,6 +211,10 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
         predictor.Predict(next, aliveState, encodingBeam, inputBeam,
             paddingBeam, batchSize * beamSize, l == 0, reorderState, needReorder, l);
 
+        /* keep the decoder states of the prefixes for the following requests */
+        if (l == 0 && prefixes != NULL && prefixCache != NULL)
+            prefixCache->Save(model, prefix.keys, prefix.tokens, beamSize);
+
         /* compute the model score (given the prediction probability) */
         Score(cur, next);
 
@@ -196,8 +227,30 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
         /* push complete hypotheses into the heap */
         Collect(next);
 
-        /* stop searching when all hypotheses are completed */
-        if (IsAllCompleted(next)) {
+        /* stream the tokens that will not change */
+        if (callback != NULL)
+            Stream(next);
+
+        /* stop the sentences whose deadlines are passed (the others go on) */
+        if (deadlines != NULL && l + 1 < lengthLimit)
+            StopExpired(next);
+
+        stepNum++;
+        activeNum += aliveNum;
+        aliveNum = 0;
+        for (int i = 0; i < batchSize; i++) {
+            if (isTimedOut[i])
+                continue;
+            for (int j = 0; j < beamSize; j++) {
+                if (!next->states[i * beamSize + j].isCompleted) {
+                    aliveNum++;
+                    break;
+                }
+            }
+        }
+
+        /* stop searching when all hypotheses are completed or stopped */
+        if (aliveNum == 0) {
             break;
         }
 
@@ -210,6 +263,15 @@ void BeamSearch::Search(NMTModel* model, XTensor& input, XTensor& padding,
 
     Dump(outputs, &score);
 
+    /* stream the rest of the outputs */
+    if (callback != NULL) {
+        for (int i = 0; i < batchSize; i++) {
+            int streamed = MIN(streamedNums[i], int(outputs[i]->Size()));
+            callback(i, outputs[i]->items + streamed, int(outputs[i]->Size()) - streamed,
+                     true, callbackArg);
+        }
+    }
+
     delete[] states;
 }
 
@@ -496,6 +558,10 @@ void BeamSearch::Collect(StateBundle* beam)
         CheckNTErrors(state.pid >= 0 && state.pid < batchSize,
             "Invalid sample id!");
 
+        /* the output of a stopped sentence is fixed */
+        if (isTimedOut[state.pid])
+            continue;
+
         /* check if this is the first end symbol. It is false
            if there have been end symbols in previously generated words. */
         bool isCompleted = state.isCompleted && 
@@ -513,23 +579,62 @@ fill the hypothesis heap with incomplete hypotheses
 >> beam  - the beam that keeps a number of states (final)
 */
 void BeamSearch::FillHeap(StateBundle* beam)
+{
+    for (int i = 0; i < beam->stateNum / beamSize; i++) {
+        if (!isTimedOut[i])
+            FillHeap(beam, i);
+    }
+}
+
+/*
+fill the hypothesis heap of a sentence with its incomplete hypotheses
+>> beam  - the beam that keeps a number of states
+>> i - index of the sentence
+*/
+void BeamSearch::FillHeap(StateBundle* beam, int i)
 {
     State* states = beam->states;
 
-    for (int i = 0; i < beam->stateNum / beamSize; i++) {
-        for (int j = 0; j < beamSize; j++) {
-            State& state = states[i * beamSize + j];
+    for (int j = 0; j < beamSize; j++) {
+        State& state = states[i * beamSize + j];
 
-            /* we push the incomplete hypothesis into the heap */
-            if (fullHypos[state.pid].Count() == 0) {
+        /* we push the incomplete hypothesis into the heap */
+        if (fullHypos[state.pid].Count() == 0) {
+            fullHypos[state.pid].Push(HeapNode<float>(&state, state.modelScore));
+        }
+        else {
+            auto node = fullHypos[state.pid].Top();
+            float score = node.value;
+            if (score < state.modelScore)
                 fullHypos[state.pid].Push(HeapNode<float>(&state, state.modelScore));
-            }
-            else {
-                auto node = fullHypos[state.pid].Top();
-                float score = node.value;
-                if (score < state.modelScore)
-                    fullHypos[state.pid].Push(HeapNode<float>(&state, state.modelScore));
-            }
+        }
+    }
+}
+
+/*
+stop the sentences whose deadlines are passed. The heap of such a sentence
+is filled with its hypotheses so far, so its output is the best (possibly
+incomplete) hypothesis at the deadline, while the other sentences of the
+batch go on.
+>> beam - the beam that keeps a number of states
+*/
+void BeamSearch::StopExpired(StateBundle* beam)
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+    for (int i = 0; i < batchSize; i++) {
+        if (isTimedOut[i] || deadlines[i] > now)
+            continue;
+
+        bool isCompleted = true;
+        for (int j = 0; j < beamSize; j++) {
+            if (!beam->states[i * beamSize + j].isCompleted)
+                isCompleted = false;
+        }
+
+        if (!isCompleted) {
+            FillHeap(beam, i);
+            isTimedOut[i] = true;
         }
     }
 }
@@ -581,6 +686,81 @@ void BeamSearch::Dump(IntList** output, XTensor* score)
     }
 }
 
+/*
+get the output tokens of a hypothesis (in the same way as Dump)
+>> state - the last state of the hypothesis
+>> path - the tokens
+*/
+static void GetPath(State* state, IntList& path)
+{
+    bool isCompleted = true;
+
+    path.Clear();
+    while (state != NULL) {
+        if (!state->isCompleted)
+            isCompleted = false;
+        if (!isCompleted)
+            path.Add(state->prediction);
+        state = state->last;
+    }
+    path.Reverse();
+}
+
+/*
+stream the tokens shared by all hypotheses of each sentence. The output
+of a sentence is one of the completed hypotheses in the heap or the
+extension of an alive hypothesis, so the common prefix of them is stable.
+>> beam - the beam that keeps a number of states
+*/
+void BeamSearch::Stream(StateBundle* beam)
+{
+    IntList path;
+    IntList common;
+
+    for (int i = 0; i < batchSize; i++) {
+        /* the rest of a stopped sentence is streamed after the search */
+        if (isTimedOut[i])
+            continue;
+
+        int commonNum = -1;
+        XHeap<MIN_HEAP, float>& heap = fullHypos[i];
+        int aliveNum = beamSize;
+
+        for (int j = 0; j < aliveNum + heap.count; j++) {
+            State* state = NULL;
+            if (j < aliveNum) {
+                state = beam->states + i * beamSize + j;
+                if (state->isCompleted)
+                    continue;
+            }
+            else {
+                state = (State*)heap.items[j - aliveNum].index;
+            }
+
+            GetPath(state, path);
+
+            if (commonNum < 0) {
+                common.Clear();
+                for (int k = 0; k < path.Size(); k++)
+                    common.Add(path[k]);
+                commonNum = int(path.Size());
+            }
+            else {
+                int k = 0;
+                while (k < commonNum && k < path.Size() && common[k] == path[k])
+                    k++;
+                commonNum = k;
+            }
+        }
+
+        if (commonNum > streamedNums[i]) {
+            callback(i, common.items + streamedNums[i], commonNum - streamedNums[i],
+                     false, callbackArg);
+            streamedNums[i] = commonNum;
+        }
+    }
+}
+
 /*
 check if the token is an end symbol
 >> token - token to be checked
@@ -722,6 +902,71 @@ XTensor BeamSearch::MakeFirstMask(StateBundle* beam)
     return mask;
 }
 
+/*
+set the encoder cache
+>> cache - the encoder cache (NULL if not used)
+*/
+void BeamSearch::SetEncoderCache(EncoderCache* cache)
+{
+    encoderCache = cache;
+}
+
+/*
+set the prefix cache
+>> cache - the cache of decoder states of forced prefixes (NULL if not used)
+*/
+void BeamSearch::SetPrefixCache(PrefixCache* cache)
+{
+    prefixCache = cache;
+}
+
+/*
+set the callback to stream the outputs
+>> myCallback - the callback (NULL if not used)
+>> arg - the argument of the callback
+*/
+void BeamSearch::SetCallback(TokenCallback myCallback, void* arg)
+{
+    callback = myCallback;
+    callbackArg = arg;
+}
+
+/*
+set the deadlines of the sentences of the next search. When the deadline
+of a sentence is passed, it is stopped with its best hypothesis so far
+(possibly incomplete), and the other sentences of the batch go on.
+>> myDeadlines - the deadline of each sentence (NULL if not used), which is
+                 kept until the search is done
+*/
+void BeamSearch::SetDeadlines(const chrono::steady_clock::time_point* myDeadlines)
+{
+    deadlines = myDeadlines;
+}
+
+/*
+check whether a sentence of the last search is stopped by its deadline
+>> i - index of the sentence in the batch
+*/
+bool BeamSearch::IsTimedOut(int i)
+{
+    return isTimedOut[i];
+}
+
+/* get the number of decoding steps of the last search */
+int BeamSearch::GetStepNum()
+{
+    return stepNum;
+}
+
+/*
+get the number of the uncompleted sentences summed over the steps
+of the last search, i.e., the effective batch size times the steps
+*/
+int BeamSearch::GetActiveNum()
+{
+    return activeNum;
+}
+
 /* constructor */
 GreedySearch::GreedySearch()
 {
@@ -731,6 +976,13 @@ GreedySearch::GreedySearch()
     endSymbols = new int[32];
     startSymbol = -1;
     scalarMaxLength = -1;
+    encoderCache = NULL;
+    prefixCache = NULL;
+    callback = NULL;
+    callbackArg = NULL;
+    deadlines = NULL;
+    stepNum = 0;
+    activeNum = 0;
 }
 
 /* de-constructor */
@@ -795,25 +1047,97 @@ void GreedySearch::SetEnd(const int* tokens, const int tokenNum)
     endSymbolNum = tokenNum;
 }
 
+/*
+set the encoder cache
+>> cache - the encoder cache (NULL if not used)
+*/
+void GreedySearch::SetEncoderCache(EncoderCache* cache)
+{
+    encoderCache = cache;
+}
+
+/*
+set the prefix cache
+>> cache - the cache of decoder states of forced prefixes (NULL if not used)
+*/
+void GreedySearch::SetPrefixCache(PrefixCache* cache)
+{
+    prefixCache = cache;
+}
+
+/*
+set the callback to stream the outputs
+>> myCallback - the callback (NULL if not used)
+>> arg - the argument of the callback
+*/
+void GreedySearch::SetCallback(TokenCallback myCallback, void* arg)
+{
+    callback = myCallback;
+    callbackArg = arg;
+}
+
+/*
+set the deadlines of the sentences of the next search. When the deadline
+of a sentence is passed, it is stopped with its best hypothesis so far
+(possibly incomplete), and the other sentences of the batch go on.
+>> myDeadlines - the deadline of each sentence (NULL if not used), which is
+                 kept until the search is done
+*/
+void GreedySearch::SetDeadlines(const chrono::steady_clock::time_point* myDeadlines)
+{
+    deadlines = myDeadlines;
+}
+
+/*
+check whether a sentence of the last search is stopped by its deadline
+>> i - index of the sentence in the batch
+*/
+bool GreedySearch::IsTimedOut(int i)
+{
+    return isTimedOut[i];
+}
+
+/* get the number of decoding steps of the last search */
+int GreedySearch::GetStepNum()
+{
+    return stepNum;
+}
+
+/*
+get the number of the uncompleted sentences summed over the steps
+of the last search, i.e., the effective batch size times the steps
+*/
+int GreedySearch::GetActiveNum()
+{
+    return activeNum;
+}
+
 /*
 search for the most promising states
 >> model - the transformer model
 >> input - input of the model
 >> padding - padding of the input
 >> outputs - outputs tokens of the search results
+>> prefixes - the forced target prefixes of the same length (NULL if not used),
+              the outputs are the tokens after them
 */
 void GreedySearch::Search(NMTModel* model, XTensor& input, 
-                          XTensor& padding, IntList** outputs)
+                          XTensor& padding, IntList** outputs, IntList** prefixes)
 {
     XTensor maskEnc;
     XTensor encoding;
     batchSize = input.GetDim(0);
+    isTimedOut.assign(batchSize, false);
+    stepNum = 0;
+    activeNum = 0;
 
     /* encoder mask */
     model->MakeMTMaskEnc(padding, maskEnc);
 
     /* make the encoding network */
-    if (model->config->model.encPreLN)
+    if (encoderCache != NULL && encoderCache->IsEnabled())
+        encoding = encoderCache->Encode(model, input, padding, maskEnc, 1);
+    else if (model->config->model.encPreLN)
         encoding = model->encoder->RunFastPreNorm(input, &maskEnc);
     else
         encoding = model->encoder->RunFastPostNorm(input, &maskEnc);
@@ -823,6 +1147,13 @@ void GreedySearch::Search(NMTModel* model, XTensor& input,
 
     CheckNTErrors(lengthLimit > 0, "Invalid maximum output length");
 
+    /* the forced prefixes are fed at the first step */
+    ForcedPrefix prefix;
+    if (prefixes != NULL) {
+        prefix.Make(model, input, padding, prefixes, startSymbol, 1, prefixCache);
+        lengthLimit = MAX(lengthLimit - prefix.len, 1);
+    }
+
     /* the first token */
     XTensor inputDec;
     InitTensor2D(&inputDec, batchSize, 1, X_INT, input.devID);
@@ -842,16 +1173,43 @@ void GreedySearch::Search(NMTModel* model, XTensor& input,
     InitTensorOnCPU(&indexCPU, &inputDec);
     InitTensor2D(&bestScore, batchSize, 1, encoding.dataType, encoding.devID);
 
-    for (int l = 0; l < lengthLimit; l++) {
+    int finishedSentNum = 0;
 
-        /* decoder mask */
-        maskEncDec = model->MakeMTMaskDecInference(padding);
+    for (int l = 0; l < lengthLimit; l++) {
 
-        /* make the decoding network */
-        if (model->config->model.decPreLN)
-            decoding = model->decoder->RunFastPreNorm(inputDec, encoding, &maskEncDec, l);
-        else
-            decoding = model->decoder->RunFastPostNorm(inputDec, encoding, &maskEncDec, l);
+        if (l == 0 && prefixes != NULL) {
+            /* feed the start symbol and the prefixes in one pass */
+            XTensor paddingDec;
+            XTensor maskDec;
+            InitTensor(&paddingDec, &prefix.input);
+            paddingDec.SetDataFixed(1);
+            model->MakeMTMaskDec(padding, paddingDec, maskDec, maskEncDec);
+
+            if (model->config->model.decPreLN)
+                decoding = model->decoder->RunFastPreNorm(prefix.input, encoding, &maskEncDec,
+                                                          prefix.start, &prefix.mask);
+            else
+                decoding = model->decoder->RunFastPostNorm(prefix.input, encoding, &maskEncDec,
+                                                           prefix.start, &prefix.mask);
+
+            /* we only predict the token after the last one */
+            int lenDec = decoding.GetDim(decoding.order - 2);
+            decoding = SelectRange(decoding, decoding.order - 2, lenDec - 1, lenDec);
+
+            /* keep the decoder states of the prefixes for the following requests */
+            if (prefixCache != NULL)
+                prefixCache->Save(model, prefix.keys, prefix.tokens, 1);
+        }
+        else {
+            /* decoder mask */
+            maskEncDec = model->MakeMTMaskDecInference(padding);
+
+            /* make the decoding network */
+            if (model->config->model.decPreLN)
+                decoding = model->decoder->RunFastPreNorm(inputDec, encoding, &maskEncDec, l + prefix.len);
+            else
+                decoding = model->decoder->RunFastPostNorm(inputDec, encoding, &maskEncDec, l + prefix.len);
+        }
 
         /* generate the output probabilities */
         prob = model->outputLayer->Make(decoding, false);
@@ -864,13 +1222,39 @@ void GreedySearch::Search(NMTModel* model, XTensor& input,
         CopyValues(inputDec, indexCPU);
 
         for (int i = 0; i < batchSize; i++) {
-            if (IsEnd(indexCPU.GetInt(i)))
+            int token = indexCPU.GetInt(i);
+            if (finishedFlags[i] == 1)
+                continue;
+
+            if (IsEnd(token)) {
                 finishedFlags[i] = 1;
-            else if (finishedFlags[i] != 1)
-                (outputs[i])->Add(indexCPU.GetInt(i));
+                if (callback != NULL)
+                    callback(i, NULL, 0, true, callbackArg);
+            }
+            else {
+                (outputs[i])->Add(token);
+                if (callback != NULL)
+                    callback(i, &token, 1, false, callbackArg);
+            }
+        }
+
+        stepNum++;
+        activeNum += batchSize - finishedSentNum;
+
+        /* stop the sentences whose deadlines are passed (the others go on) */
+        if (deadlines != NULL && l + 1 < lengthLimit) {
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            for (int i = 0; i < batchSize; i++) {
+                if (finishedFlags[i] == 0 && deadlines[i] <= now) {
+                    finishedFlags[i] = 1;
+                    isTimedOut[i] = true;
+                    if (callback != NULL)
+                        callback(i, NULL, 0, true, callbackArg);
+                }
+            }
         }
 
-        int finishedSentNum = 0;
+        finishedSentNum = 0;
         for (int i = 0; i < batchSize; i++)
             finishedSentNum += finishedFlags[i];
         if (finishedSentNum == batchSize) {
@@ -879,6 +1263,14 @@ void GreedySearch::Search(NMTModel* model, XTensor& input,
         }
     }
 
+    /* the sequences that reach the maximum length */
+    if (callback != NULL) {
+        for (int i = 0; i < batchSize; i++) {
+            if (finishedFlags[i] != 1)
+                callback(i, NULL, 0, true, callbackArg);
+        }
+    }
+
     delete[] finishedFlags;
 }
 
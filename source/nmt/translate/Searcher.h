@@ -23,8 +23,12 @@
 #ifndef __SEARCHER_H__
 #define __SEARCHER_H__
 
+#include <chrono>
+#include <vector>
 #include "../Model.h"
 #include "Predictor.h"
+#include "EncoderCache.h"
+#include "PrefixCache.h"
 
 using namespace std;
 
@@ -32,6 +36,16 @@ using namespace std;
 namespace nmt
 {
 
+/* the callback to stream the outputs of a sequence in a batch. It is
+   called with the tokens that are committed to the output since the last
+   call, and once more with isFinal = true when the sequence is completed.
+>> index - index of the sequence in the batch
+>> tokens - the newly committed tokens
+>> tokenNum - number of the tokens
+>> isFinal - whether the sequence is completed
+>> arg - the argument given with the callback */
+typedef void (*TokenCallback)(int index, const int* tokens, int tokenNum, bool isFinal, void* arg);
+
 /* The class organizes the search process. It calls "predictors" to generate
    distributions of the predictions and prunes the search space by beam pruning.
    This makes a graph where each path represents a translation hypotheses.
@@ -81,6 +95,33 @@ private:
     /* whether we need to reorder the states */
     bool needReorder;
 
+    /* number of the streamed tokens of each sentence */
+    IntList streamedNums;
+
+    /* the encoder cache (NULL if not used) */
+    EncoderCache* encoderCache;
+
+    /* the cache of decoder states of forced prefixes (NULL if not used) */
+    PrefixCache* prefixCache;
+
+    /* the callback to stream the outputs (NULL if not used) */
+    TokenCallback callback;
+
+    /* the argument of the callback */
+    void* callbackArg;
+
+    /* the deadline of each sentence of the batch (NULL if not used) */
+    const chrono::steady_clock::time_point* deadlines;
+
+    /* indicates whether each sentence of the last search is stopped by its deadline */
+    vector<bool> isTimedOut;
+
+    /* number of decoding steps of the last search */
+    int stepNum;
+
+    /* number of the uncompleted sentences summed over the steps of the last search */
+    int activeNum;
+
 public:
     /* constructor */
     BeamSearch();
@@ -92,7 +133,8 @@ public:
     void Init(NMTConfig& config);
 
     /* search for the most promising states */
-    void Search(NMTModel* model, XTensor& input, XTensor& padding, IntList** output, XTensor& score);
+    void Search(NMTModel* model, XTensor& input, XTensor& padding, IntList** output, XTensor& score,
+                IntList** prefixes = NULL);
 
     /* preparation */
     void Prepare(int myBatchSize, int myBeamSize);
@@ -112,6 +154,12 @@ public:
     /* fill the hypotheses heap with incomplete hypotheses */
     void FillHeap(StateBundle* beam);
 
+    /* fill the hypotheses heap of a sentence with its incomplete hypotheses */
+    void FillHeap(StateBundle* beam, int i);
+
+    /* stop the sentences whose deadlines are passed */
+    void StopExpired(StateBundle* beam);
+
     /* save the output sequences and score */
     void Dump(IntList** output, XTensor* score);
 
@@ -130,6 +178,30 @@ public:
 
     /* make a mask to prevent duplicated entries in beam expansion for the first position */
     XTensor MakeFirstMask(StateBundle* beam);
+
+    /* set the encoder cache */
+    void SetEncoderCache(EncoderCache* cache);
+
+    /* set the prefix cache */
+    void SetPrefixCache(PrefixCache* cache);
+
+    /* set the callback to stream the outputs */
+    void SetCallback(TokenCallback myCallback, void* arg);
+
+    /* set the deadlines of the sentences of the next search */
+    void SetDeadlines(const chrono::steady_clock::time_point* myDeadlines);
+
+    /* check whether a sentence of the last search is stopped by its deadline */
+    bool IsTimedOut(int i);
+
+    /* get the number of decoding steps of the last search */
+    int GetStepNum();
+
+    /* get the number of the uncompleted sentences summed over the steps of the last search */
+    int GetActiveNum();
+
+    /* stream the tokens shared by all hypotheses of each sentence */
+    void Stream(StateBundle* beam);
 };
 
 class GreedySearch
@@ -153,6 +225,30 @@ private:
     /* scalar of the input sequence (for max number of search steps) */
     float scalarMaxLength;
 
+    /* the encoder cache (NULL if not used) */
+    EncoderCache* encoderCache;
+
+    /* the cache of decoder states of forced prefixes (NULL if not used) */
+    PrefixCache* prefixCache;
+
+    /* the callback to stream the outputs (NULL if not used) */
+    TokenCallback callback;
+
+    /* the argument of the callback */
+    void* callbackArg;
+
+    /* the deadline of each sentence of the batch (NULL if not used) */
+    const chrono::steady_clock::time_point* deadlines;
+
+    /* indicates whether each sentence of the last search is stopped by its deadline */
+    vector<bool> isTimedOut;
+
+    /* number of decoding steps of the last search */
+    int stepNum;
+
+    /* number of the uncompleted sentences summed over the steps of the last search */
+    int activeNum;
+
 public:
 
     /* constructor */
@@ -165,7 +261,8 @@ public:
     void Init(NMTConfig& config);
 
     /* search for the most promising states */
-    void Search(NMTModel* model, XTensor& input, XTensor& padding, IntList** outputs);
+    void Search(NMTModel* model, XTensor& input, XTensor& padding, IntList** outputs,
+                IntList** prefixes = NULL);
 
     /* preparation */
     void Prepare(int myBatchSize);
@@ -175,6 +272,27 @@ public:
 
     /* set end symbols for search */
     void SetEnd(const int* tokens, const int tokenNum);
+
+    /* set the encoder cache */
+    void SetEncoderCache(EncoderCache* cache);
+
+    /* set the prefix cache */
+    void SetPrefixCache(PrefixCache* cache);
+
+    /* set the callback to stream the outputs */
+    void SetCallback(TokenCallback myCallback, void* arg);
+
+    /* set the deadlines of the sentences of the next search */
+    void SetDeadlines(const chrono::steady_clock::time_point* myDeadlines);
+
+    /* check whether a sentence of the last search is stopped by its deadline */
+    bool IsTimedOut(int i);
+
+    /* get the number of decoding steps of the last search */
+    int GetStepNum();
+
+    /* get the number of the uncompleted sentences summed over the steps of the last search */
+    int GetActiveNum();
 };
 
 } /* end of the nmt namespace */
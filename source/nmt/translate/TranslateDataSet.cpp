@@ -19,8 +19,11 @@
  * $Created by: HU Chi (huchinlp@gmail.com) 2021-06
  */
 
+#include <thread>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 #include "TranslateDataSet.h"
 #include "../../niutensor/tensor/XTensor.h"
 
@@ -29,32 +32,108 @@ using namespace nts;
 /* the nmt namespace */
 namespace nmt {
 
-/* transfrom a line to a sequence */
-Sample* TranslateDataset::LoadSample(string line)
-{
-    const string delimiter = " ";
+/* the minimum number of lines to tokenize in parallel */
+#define TOKENIZE_MIN_LINES 4096
 
-    /* load tokens and transform them to ids */
-    vector<string> srcTokens = SplitString(line, delimiter,
-                                           config->model.maxSrcLen - 1);
+/* the maximum number of threads to tokenize the lines */
+#define TOKENIZE_MAX_THREADS 8
+
+/*
+transform the tokens of a string (separated by spaces) to ids. The tokens
+are looked up in place, i.e., they are not copied to strings.
+>> s - the string
+>> len - length of the string
+>> vocab - the vocabulary
+>> maxNum - the maximum number of tokens
+<< return - the ids (the unknown tokens are mapped to unkID)
+*/
+static IntList* TokensToIDs(const char* s, size_t len, const Vocab& vocab, int maxNum)
+{
+    int spaceNum = (int)std::count(s, s + len, ' ');
+    IntList* ids = new IntList(MAX(MIN(spaceNum + 1, maxNum), 1));
+
+    size_t start = 0;
+    while (start < len && ids->Size() < maxNum) {
+        const char* space = (const char*)memchr(s + start, ' ', len - start);
+        size_t end = space == NULL ? len : space - s;
+        if (end > start) {
+            int id = vocab.GetID(s + start, end - start);
+            ids->Add(id < 0 ? vocab.unkID : id);
+        }
+        start = end + 1;
+    }
 
-    IntList* srcSeq = new IntList(int(srcTokens.size()));
-    Sample* sample = new Sample(srcSeq);
+    return ids;
+}
 
-    for (const string& token : srcTokens) {
-        if (srcVocab.token2id.find(token) == srcVocab.token2id.end())
-            srcSeq->Add(srcVocab.unkID);
-        else
-            srcSeq->Add(srcVocab.token2id.at(token));
+/*
+transfrom a line to a sequence. It does not allocate memory for the tokens,
+so it can be called by several threads at a time.
+>> line - the tokens separated by spaces, with an optional forced prefix
+           after "|||" (if "prefix" is set)
+<< return - the sample
+*/
+Sample* TranslateDataset::LoadSample(const string& line)
+{
+    const string prefixDelimiter = "|||";
+
+    /* a line may come with a forced target prefix, i.e., "source ||| prefix",
+       which is opt-in as "|||" may be a token of the source otherwise */
+    IntList* tgtSeq = NULL;
+    size_t srcLen = line.size();
+    size_t prefixPos = config->translation.usePrefix ? line.find(prefixDelimiter) : string::npos;
+    if (prefixPos != string::npos) {
+        size_t tgtStart = prefixPos + prefixDelimiter.size();
+        tgtSeq = TokensToIDs(line.data() + tgtStart, line.size() - tgtStart,
+                             tgtVocab, config->model.maxTgtLen - 1);
+        srcLen = prefixPos;
     }
 
-    /* the sequence should ends with EOS */
-    if(srcSeq->Get(-1) != srcVocab.eosID)
+    /* load tokens and transform them to ids */
+    IntList* srcSeq = TokensToIDs(line.data(), srcLen, srcVocab, config->model.maxSrcLen - 1);
+    Sample* sample = new Sample(srcSeq, tgtSeq);
+
+    /* the sequence should ends with EOS (the source may be empty, e.g., "||| x") */
+    if (srcSeq->count == 0 || srcSeq->Get(-1) != srcVocab.eosID)
         srcSeq->Add(srcVocab.eosID);
     
     return sample;
 }
 
+/*
+transform lines to sequences. The lines of a large buffer are split into
+chunks that are tokenized by several threads.
+>> lines - the lines
+>> samples - the samples (the output, aligned with the lines)
+*/
+void TranslateDataset::LoadSamples(const vector<string>& lines, vector<Sample*>& samples)
+{
+    int lineNum = (int)lines.size();
+    samples.resize(lineNum);
+
+    int threadNum = 1;
+    if (lineNum >= TOKENIZE_MIN_LINES)
+        threadNum = MAX(MIN((int)thread::hardware_concurrency(), TOKENIZE_MAX_THREADS), 1);
+
+    int chunkSize = (lineNum + threadNum - 1) / threadNum;
+    auto tokenize = [&](int start) {
+        int end = MIN(start + chunkSize, lineNum);
+        for (int i = start; i < end; i++)
+            samples[i] = LoadSample(lines[i]);
+    };
+
+    if (threadNum == 1) {
+        tokenize(0);
+        return;
+    }
+
+    vector<thread> threads;
+    for (int t = 0; t < threadNum; t++)
+        threads.emplace_back(tokenize, t * chunkSize);
+    for (auto& t : threads)
+        t.join();
+}
+
 /*
 read data from a file to the buffer
 */
@@ -63,24 +142,50 @@ bool TranslateDataset::LoadBatchToBuf()
     int id = 0;
     ClearBuf();
     emptyLines.Clear();
+    dupLines.Clear();
+    dupSources.Clear();
 
     string line;
 
+    /* the first occurrence of each line in the buffer */
+    unordered_map<string, int> firstLines;
+
+    /* the lines to translate and their indices */
+    vector<string> lines;
+    vector<int> lineIDs;
+
     while (getline(*ifp, line) && id < config->common.bufSize) {
 
+        auto first = firstLines.find(line);
+
         /* handle empty lines */
-        if (line.size() > 0) {
-            Sample* sequence = LoadSample(line);
-            sequence->index = id;
-            buf->Add(sequence);
+        if (line.size() == 0) {
+            emptyLines.Add(id);
+        }
+
+        /* a duplicated line is translated only once, and the result
+           is copied to it when we sort the outputs */
+        else if (first != firstLines.end()) {
+            dupLines.Add(id);
+            dupSources.Add(first->second);
         }
+
         else {
-            emptyLines.Add(id);
+            firstLines[line] = id;
+            lineIDs.push_back(id);
+            lines.push_back(std::move(line));
         }
 
         id++;
     }
 
+    vector<Sample*> samples;
+    LoadSamples(lines, samples);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i]->index = lineIDs[i];
+        buf->Add(samples[i]);
+    }
+
     /* hacky code to solve the issue with fp16 */
     appendEmptyLine = false;
     if (id > 0 && id % 2 != 0) {
@@ -91,17 +196,39 @@ bool TranslateDataset::LoadBatchToBuf()
         appendEmptyLine = true;
     }
 
-    SortBySrcLengthDescending();
+    SortBuf();
+
     XPRINT1(0, stderr, "[INFO] loaded %d sentences\n", appendEmptyLine ? id - 1 : id);
+    if (dupLines.Size() > 0)
+        XPRINT1(0, stderr, "[INFO] found %d duplicated sentences\n", int(dupLines.Size()));
 
     return true;
 }
 
+/*
+sort the buffer for batching, i.e., by source length (in descending order)
+with sequences that have forced prefixes of the same length put together,
+as the prefixes in a batch are fed to the decoder in one pass
+*/
+void TranslateDataset::SortBuf()
+{
+    SortBySrcLengthDescending();
+
+    stable_sort(buf->items, buf->items + buf->count,
+        [](void* a, void* b) {
+            IntList* prefixA = ((Sample*)(a))->tgtSeq;
+            IntList* prefixB = ((Sample*)(b))->tgtSeq;
+            return (prefixA == NULL ? 0 : prefixA->Size()) >
+                   (prefixB == NULL ? 0 : prefixB->Size());
+        });
+}
+
 /* constructor */
 TranslateDataset::TranslateDataset()
 {
     ifp = NULL;
     appendEmptyLine = false;
+    wBatchSize = 0;
 }
 
 /*
@@ -120,15 +247,39 @@ bool TranslateDataset::GetBatchSimple(XList* inputs, XList* info)
     int maxLen = int(longestsample->srcSeq->Size());
 
     /* we choose the max-token strategy to maximize the throughput */
-    while (realBatchSize * maxLen * config->translation.beamSize < config->common.wBatchSize
+    int tokenBudget = wBatchSize > 0 ? wBatchSize : config->common.wBatchSize;
+    while (realBatchSize * maxLen * config->translation.beamSize < tokenBudget
            && realBatchSize < config->common.sBatchSize) {
         realBatchSize++;
     }
 
+    /* the forced prefixes in a batch must be of the same length */
+    int prefixLen = longestsample->tgtSeq == NULL ? 0 : int(longestsample->tgtSeq->Size());
+
+    /* fill the batch up to the memory budget instead. The token budget is still
+       applied if it is tuned for the latency, and a batch beyond the budget
+       is split, i.e., the rest of it is left for the next batch */
+    if (memoryCost.IsEnabled()) {
+        int memBatchSize = memoryCost.GetMaxBatchSize(maxLen, prefixLen);
+        if (wBatchSize > 0)
+            realBatchSize = MIN(realBatchSize, memBatchSize);
+        else
+            realBatchSize = memBatchSize;
+    }
+
     realBatchSize = MIN(realBatchSize, config->common.sBatchSize);
 
     /* make sure the batch size is valid */
     realBatchSize = MIN(int(buf->Size()) - bufIdx, realBatchSize);
+
+    for (int i = 1; i < realBatchSize; i++) {
+        IntList* prefix = ((Sample*)(buf->Get(bufIdx + i)))->tgtSeq;
+        if ((prefix == NULL ? 0 : int(prefix->Size())) != prefixLen) {
+            realBatchSize = i;
+            break;
+        }
+    }
+
     realBatchSize = MAX(2 * (realBatchSize / 2), realBatchSize % 2);
 
     CheckNTErrors(maxLen != 0, "Invalid length");
@@ -146,6 +297,11 @@ bool TranslateDataset::GetBatchSimple(XList* inputs, XList* info)
     *totalLength = 0;
     indices->Clear();
 
+    /* the forced prefixes (optional) */
+    XList* prefixes = info->Size() > 2 ? (XList*)(info->Get(2)) : NULL;
+    if (prefixes != NULL)
+        prefixes->Clear();
+
     /* right padding */
     int curSrc = 0;
     for (int i = 0; i < realBatchSize; ++i) {
@@ -153,6 +309,8 @@ bool TranslateDataset::GetBatchSimple(XList* inputs, XList* info)
         IntList* src = sequence->srcSeq;
         indices->Add(sequence->index);
         *totalLength += src->Size();
+        if (prefixes != NULL && prefixLen > 0)
+            prefixes->Add(sequence->tgtSeq);
 
         curSrc = maxLen * i;
         memcpy(&(batchValues[curSrc]), src->items, sizeof(int) * src->Size());
@@ -184,21 +342,11 @@ constructor
 */
 void TranslateDataset::Init(NMTConfig& myConfig, bool notUsed)
 {
-    config = &myConfig;
-
-    /* load the source and target vocabulary */
-    srcVocab.Load(config->common.srcVocabFN);
-
-    /* share the source and target vocabulary */
-    if (strcmp(config->common.srcVocabFN, config->common.tgtVocabFN) == 0)
-        tgtVocab.CopyFrom(srcVocab);
+    /* the vocabularies may have been loaded by the translator */
+    if (srcVocab.vocabSize < 0)
+        LoadVocab(myConfig);
     else
-        tgtVocab.Load(config->common.tgtVocabFN);
-
-    srcVocab.SetSpecialID(config->model.sos, config->model.eos,
-                          config->model.pad, config->model.unk);
-    tgtVocab.SetSpecialID(config->model.sos, config->model.eos,
-                          config->model.pad, config->model.unk);
+        config = &myConfig;
 
     /* translate the content in a file */
     if (strcmp(config->translation.inputFN, "") != 0) {
@@ -212,6 +360,48 @@ void TranslateDataset::Init(NMTConfig& myConfig, bool notUsed)
     LoadBatchToBuf();
 }
 
+/*
+load the source and target vocabularies
+>> myConfig - configuration of the NMT system
+>> bundle - the model file (the vocabularies in it are used if it is a bundle)
+*/
+void TranslateDataset::LoadVocab(NMTConfig& myConfig, ModelFile* bundle)
+{
+    config = &myConfig;
+
+    size_t srcSize = 0;
+    size_t tgtSize = 0;
+    const char* srcData = NULL;
+    const char* tgtData = NULL;
+    if (bundle != NULL) {
+        srcData = bundle->GetSection(MODEL_SECTION_SRC_VOCAB, &srcSize);
+        tgtData = bundle->GetSection(MODEL_SECTION_TGT_VOCAB, &tgtSize);
+    }
+
+    /* use the vocabularies of the model bundle in place */
+    if (srcData != NULL && tgtData != NULL) {
+        if (strcmp(config->common.srcVocabFN, "") != 0 || strcmp(config->common.tgtVocabFN, "") != 0)
+            LOG("the vocabularies of the model bundle are used instead of the vocabulary files");
+        CheckNTErrors(srcVocab.LoadCompact(srcData, srcSize), "Invalid source vocabulary in the model bundle");
+        CheckNTErrors(tgtVocab.LoadCompact(tgtData, tgtSize), "Invalid target vocabulary in the model bundle");
+    }
+    else {
+        /* load the source and target vocabulary */
+        srcVocab.Load(config->common.srcVocabFN);
+
+        /* share the source and target vocabulary */
+        if (strcmp(config->common.srcVocabFN, config->common.tgtVocabFN) == 0)
+            tgtVocab.CopyFrom(srcVocab);
+        else
+            tgtVocab.Load(config->common.tgtVocabFN);
+    }
+
+    srcVocab.SetSpecialID(config->model.sos, config->model.eos,
+                          config->model.pad, config->model.unk);
+    tgtVocab.SetSpecialID(config->model.sos, config->model.eos,
+                          config->model.pad, config->model.unk);
+}
+
 /* this is a place-holder function to avoid errors */
 Sample* TranslateDataset::LoadSample()
 {
@@ -27,7 +27,9 @@
 #include <string>
 #include <fstream>
 #include "Vocab.h"
+#include "MemoryCostModel.h"
 #include "../DataSet.h"
+#include "../ModelFile.h"
 
 using namespace std;
 
@@ -44,12 +46,24 @@ public:
     /* the indices of empty lines */
     IntList emptyLines;
 
+    /* the indices of lines that duplicate an earlier line in the buffer */
+    IntList dupLines;
+
+    /* the indices of the earlier lines that are duplicated (aligned with dupLines) */
+    IntList dupSources;
+
     /* the source vocabulary */
     Vocab srcVocab;
 
     /* the target vocabulary */
     Vocab tgtVocab;
 
+    /* the maximum number of tokens in a batch (0 for the one in the options) */
+    int wBatchSize;
+
+    /* the memory cost model (the batches are filled up to its budget if enabled) */
+    MemoryCostModel memoryCost;
+
     /* the input file stream */
     istream* ifp;
 
@@ -60,11 +74,20 @@ public:
     /* initialization function */
     void Init(NMTConfig& myConfig, bool notUsed) override;
 
+    /* load the source and target vocabularies */
+    void LoadVocab(NMTConfig& myConfig, ModelFile* bundle = NULL);
+
+    /* sort the buffer for batching */
+    void SortBuf();
+
     /* load a sample from the buffer */
     Sample* LoadSample() override;
 
     /* transfrom a line to a sequence */
-    Sample* LoadSample(string line);
+    Sample* LoadSample(const string& line);
+
+    /* transfrom lines to sequences (in parallel for many lines) */
+    void LoadSamples(const vector<string>& lines, vector<Sample*>& samples);
 
     /* load the samples into tensors from the buffer */
     bool GetBatchSimple(XList* inputs, XList* info) override;
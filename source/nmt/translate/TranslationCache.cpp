@@ -0,0 +1,157 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include "TranslationCache.h"
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* constructor */
+TranslationCache::TranslationCache()
+{
+    capacity = 0;
+    hitNum = 0;
+    missNum = 0;
+}
+
+/* de-constructor */
+TranslationCache::~TranslationCache()
+{
+    Clear();
+}
+
+/*
+initialize the cache
+>> config - configuration of the NMT system
+*/
+void TranslationCache::Init(NMTConfig& config)
+{
+    capacity = config.translation.cacheSize;
+
+    /* a cached translation is only valid under the same decoding settings */
+    char buf[256];
+    sprintf(buf, "%d|%.4f|%.4f|%d|", config.translation.beamSize,
+            config.translation.lenAlpha, config.translation.maxLenAlpha,
+            config.translation.maxLen);
+    settings = buf;
+
+    Clear();
+}
+
+/* check whether the cache is enabled */
+bool TranslationCache::IsEnabled()
+{
+    return capacity > 0;
+}
+
+/*
+make the key of a source sequence
+>> src - the source token ids
+<< return - the settings followed by the raw bytes of the ids
+*/
+string TranslationCache::MakeKey(const IntList* src)
+{
+    string key = settings;
+    key.append((const char*)src->items, sizeof(int) * src->count);
+    return key;
+}
+
+/*
+look up the translation of a source sequence
+>> src - the source token ids
+>> tgt - the list to keep the target token ids (if hit)
+<< return - whether we find the sequence in the cache
+*/
+bool TranslationCache::Lookup(const IntList* src, IntList* tgt)
+{
+    if (!IsEnabled())
+        return false;
+
+    string key = MakeKey(src);
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    auto it = index.find(key);
+    if (it == index.end()) {
+        missNum++;
+        return false;
+    }
+
+    /* move the entry to the front */
+    entries.splice(entries.begin(), entries, it->second);
+
+    const vector<int>& ids = it->second->second;
+    for (size_t i = 0; i < ids.size(); i++)
+        tgt->Add(ids[i]);
+
+    hitNum++;
+    return true;
+}
+
+/*
+add a translation to the cache
+>> src - the source token ids
+>> tgt - the target token ids
+*/
+void TranslationCache::Add(const IntList* src, const IntList* tgt)
+{
+    if (!IsEnabled() || src == NULL || tgt == NULL)
+        return;
+
+    string key = MakeKey(src);
+
+    lock_guard<mutex> lock(cacheMutex);
+
+    auto it = index.find(key);
+    if (it != index.end()) {
+        entries.splice(entries.begin(), entries, it->second);
+        return;
+    }
+
+    entries.emplace_front(key, vector<int>(tgt->items, tgt->items + tgt->count));
+    index[key] = entries.begin();
+
+    /* evict the least recently used entries */
+    while ((int)entries.size() > capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+/* remove all entries */
+void TranslationCache::Clear()
+{
+    lock_guard<mutex> lock(cacheMutex);
+    entries.clear();
+    index.clear();
+}
+
+/* get the number of hits */
+long TranslationCache::GetHitNum()
+{
+    return hitNum;
+}
+
+/* get the number of misses */
+long TranslationCache::GetMissNum()
+{
+    return missNum;
+}
+
+} /* end of the nmt namespace */
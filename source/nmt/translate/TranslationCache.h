@@ -0,0 +1,105 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * An in-memory LRU cache of translations. The key is the sequence of
+ * source token ids together with the decoding settings, so the cache
+ * can be kept across batches and requests of the same translator.
+ */
+
+#ifndef __TRANSLATIONCACHE_H__
+#define __TRANSLATIONCACHE_H__
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../Config.h"
+#include "../../niutensor/tensor/XList.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the LRU cache of translations */
+class TranslationCache
+{
+private:
+    /* an entry of the cache (key and the target token ids) */
+    typedef pair<string, vector<int>> CacheEntry;
+
+    /* the maximum number of entries */
+    int capacity;
+
+    /* the decoding settings (prefix of all keys) */
+    string settings;
+
+    /* entries in the order of use (the most recent one first) */
+    list<CacheEntry> entries;
+
+    /* the index from keys to entries */
+    unordered_map<string, list<CacheEntry>::iterator> index;
+
+    /* the cache is shared by all users of a translator */
+    mutex cacheMutex;
+
+    /* number of hits (read by other threads without the lock) */
+    atomic<long> hitNum;
+
+    /* number of misses */
+    atomic<long> missNum;
+
+private:
+    /* make the key of a source sequence */
+    string MakeKey(const IntList* src);
+
+public:
+    /* constructor */
+    TranslationCache();
+
+    /* de-constructor */
+    ~TranslationCache();
+
+    /* initialize the cache */
+    void Init(NMTConfig& config);
+
+    /* check whether the cache is enabled */
+    bool IsEnabled();
+
+    /* look up the translation of a source sequence */
+    bool Lookup(const IntList* src, IntList* tgt);
+
+    /* add a translation to the cache */
+    void Add(const IntList* src, const IntList* tgt);
+
+    /* remove all entries */
+    void Clear();
+
+    /* get the number of hits */
+    long GetHitNum();
+
+    /* get the number of misses */
+    long GetMissNum();
+};
+
+} /* end of the nmt namespace */
+
+#endif /* __TRANSLATIONCACHE_H__ */
@@ -0,0 +1,396 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include "TranslationMemory.h"
+#include "../ModelFile.h"
+#include "../../niutensor/tensor/XGlobal.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#endif
+
+/* the nmt namespace */
+namespace nmt
+{
+
+/* the entries are aligned to 8 bytes */
+#define TM_ALIGN(size) (((size) + 7) & ~((uint64_t)7))
+
+/* the maximum number of probes for a key */
+#define TM_MAX_PROBE 64
+
+/* the size of a block when hashing a file */
+#define TM_HASH_BLOCK (1 << 20)
+
+/*
+the FNV-1a hash of a block of bytes
+>> data - the data
+>> size - size of the data in bytes
+>> seed - the initial value of the hash
+<< return - the hash
+*/
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = seed ^ 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+compute a hash that identifies the content of a file. For a model of the
+mapped format, we hash the parameter table (with the checksums of all
+parameters) and the sections, which identify the whole model without
+reading the data. Other files are hashed in full, a block at a time.
+>> fn - path to the file
+>> seed - the initial value of the hash
+<< return - the hash
+*/
+uint64_t TranslationMemory::HashFile(const char* fn, uint64_t seed)
+{
+    uint64_t h = seed;
+    if (fn == NULL || strcmp(fn, "") == 0)
+        return h;
+
+    if (ModelFile::IsModelFile(fn)) {
+        ModelFile modelFile;
+        CheckNTErrors(modelFile.Open(fn), "Cannot open the model file for hashing");
+        h = HashBytes(modelFile.entries, sizeof(ModelParamEntry) * modelFile.header->paramNum, h);
+        h = HashBytes(modelFile.header->sections, sizeof(modelFile.header->sections), h);
+        return h;
+    }
+
+    FILE* file = fopen(fn, "rb");
+    CheckNTErrors(file, "Cannot open the file for hashing");
+
+    char* block = new char[TM_HASH_BLOCK];
+    size_t readSize;
+    while ((readSize = fread(block, 1, TM_HASH_BLOCK, file)) > 0) {
+        uint64_t checksum = ModelFile::Checksum(block, readSize);
+        h = HashBytes(&checksum, sizeof(checksum), h);
+    }
+
+    delete[] block;
+    fclose(file);
+
+    return h;
+}
+
+/* constructor */
+TranslationMemory::TranslationMemory()
+{
+    fd = -1;
+    base = NULL;
+    mapSize = 0;
+    header = NULL;
+    slots = NULL;
+    context = 0;
+    fullReported = false;
+    slotNum = 0;
+    dataStart = 0;
+    hitNum = 0;
+    missNum = 0;
+}
+
+/* de-constructor */
+TranslationMemory::~TranslationMemory()
+{
+    Close();
+}
+
+#ifndef _WIN32
+
+/*
+open (or create) the translation memory
+>> config - configuration of the NMT system
+*/
+void TranslationMemory::Init(NMTConfig& config)
+{
+    Close();
+
+    if (strcmp(config.translation.tmFN, "") == 0)
+        return;
+
+    fileName = config.translation.tmFN;
+
+    /* a translation is only valid for the same model, vocabularies and decoding settings */
+    char buf[256];
+    sprintf(buf, "%d|%.4f|%.4f|%d|", config.translation.beamSize,
+            config.translation.lenAlpha, config.translation.maxLenAlpha,
+            config.translation.maxLen);
+    context = HashBytes(buf, strlen(buf), 0);
+    context = HashFile(config.common.modelFN, context);
+    context = HashFile(config.common.srcVocabFN, context);
+    context = HashFile(config.common.tgtVocabFN, context);
+
+    fd = open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+    CheckNTErrors(fd >= 0, "Cannot open the translation memory");
+
+    /* the first process creates the file, others wait for it */
+    flock(fd, LOCK_EX);
+
+    struct stat st;
+    fstat(fd, &st);
+
+    if (st.st_size == 0) {
+        uint32_t slotNum = 1;
+        while ((int)slotNum < config.translation.tmSlotNum)
+            slotNum <<= 1;
+        uint64_t dataSize = (uint64_t)config.translation.tmSize * 1024 * 1024;
+
+        mapSize = sizeof(TMHeader) + sizeof(uint64_t) * slotNum + dataSize;
+        CheckNTErrors(ftruncate(fd, mapSize) == 0, "Cannot allocate the translation memory");
+
+        TMHeader newHeader;
+        memset(&newHeader, 0, sizeof(newHeader));
+        memcpy(newHeader.magic, TM_MAGIC, sizeof(newHeader.magic));
+        newHeader.version = TM_VERSION;
+        newHeader.slotNum = slotNum;
+        newHeader.dataSize = dataSize;
+        CheckNTErrors(pwrite(fd, &newHeader, sizeof(newHeader), 0) == sizeof(newHeader),
+                      "Cannot write the translation memory");
+        LOG("created the translation memory %s (slots=%u, size=%dMB)",
+            fileName.c_str(), slotNum, config.translation.tmSize);
+    }
+    else {
+        TMHeader oldHeader;
+        CheckNTErrors(pread(fd, &oldHeader, sizeof(oldHeader), 0) == sizeof(oldHeader),
+                      "Cannot read the translation memory");
+        CheckNTErrors(memcmp(oldHeader.magic, TM_MAGIC, sizeof(oldHeader.magic)) == 0 &&
+                      oldHeader.version == TM_VERSION &&
+                      oldHeader.slotNum > 0 && (oldHeader.slotNum & (oldHeader.slotNum - 1)) == 0 &&
+                      oldHeader.dataSize <= (uint64_t)st.st_size &&
+                      oldHeader.dataUsed <= oldHeader.dataSize,
+                      "Invalid translation memory file");
+        mapSize = sizeof(TMHeader) + sizeof(uint64_t) * oldHeader.slotNum + oldHeader.dataSize;
+        CheckNTErrors((uint64_t)st.st_size >= mapSize, "The translation memory file is truncated");
+    }
+
+    flock(fd, LOCK_UN);
+
+    base = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CheckNTErrors(base != MAP_FAILED, "Cannot map the translation memory");
+
+    header = (TMHeader*)base;
+    slots = (uint64_t*)(base + sizeof(TMHeader));
+    fullReported = false;
+
+    /* the file can be written by other processes, so we keep our own copy of its layout */
+    slotNum = header->slotNum;
+    dataStart = sizeof(TMHeader) + sizeof(uint64_t) * slotNum;
+
+    LOG("translation memory %s loaded (%lu entries)",
+        fileName.c_str(), (unsigned long)header->entryNum);
+}
+
+/* close the file */
+void TranslationMemory::Close()
+{
+    if (base != NULL)
+        munmap(base, mapSize);
+    if (fd >= 0)
+        close(fd);
+
+    fd = -1;
+    base = NULL;
+    header = NULL;
+    slots = NULL;
+    mapSize = 0;
+    slotNum = 0;
+    dataStart = 0;
+}
+
+#else
+
+/* the translation memory is not supported on Windows */
+void TranslationMemory::Init(NMTConfig& config)
+{
+    if (strcmp(config.translation.tmFN, "") != 0)
+        LOG("the translation memory is not supported on this platform, ignored");
+}
+
+/* close the file */
+void TranslationMemory::Close()
+{
+}
+
+#endif
+
+/* check whether the translation memory is enabled */
+bool TranslationMemory::IsEnabled()
+{
+    return base != NULL;
+}
+
+/*
+compute the hash of a key
+>> src - the source token ids
+<< return - the hash (never 0)
+*/
+uint64_t TranslationMemory::HashKey(const IntList* src)
+{
+    uint64_t h = HashBytes(src->items, sizeof(int) * src->count, context);
+    return h == 0 ? 1 : h;
+}
+
+/*
+find the entry of a key. Slots are loaded with acquire semantics, so
+an entry is fully written when we see it. The offsets and lengths come
+from a shared file, so they are checked against the mapped size before
+the entry is read.
+>> src - the source token ids
+>> hash - hash of the key
+<< return - the entry (NULL if not found)
+*/
+TMEntry* TranslationMemory::Find(const IntList* src, uint64_t hash)
+{
+    uint32_t mask = slotNum - 1;
+    uint32_t slot = (uint32_t)hash & mask;
+
+    for (int i = 0; i < TM_MAX_PROBE; i++) {
+        uint64_t offset = __atomic_load_n(&slots[slot], __ATOMIC_ACQUIRE);
+        if (offset == 0)
+            return NULL;
+
+        if (offset < dataStart || offset % 8 != 0 || offset > mapSize - sizeof(TMEntry))
+            return NULL;
+
+        TMEntry* entry = (TMEntry*)(base + offset);
+        uint64_t idSize = sizeof(int) * ((uint64_t)entry->srcLen + entry->tgtLen);
+        if (idSize > mapSize - offset - sizeof(TMEntry))
+            return NULL;
+
+        /* compare the full key to rule out hash collisions */
+        if (entry->hash == hash && entry->context == context &&
+            entry->srcLen == (uint32_t)src->count &&
+            memcmp(entry + 1, src->items, sizeof(int) * src->count) == 0)
+            return entry;
+
+        slot = (slot + 1) & mask;
+    }
+
+    return NULL;
+}
+
+/*
+look up the translation of a source sequence
+>> src - the source token ids
+>> tgt - the list to keep the target token ids (if hit)
+<< return - whether we find the sequence in the translation memory
+*/
+bool TranslationMemory::Lookup(const IntList* src, IntList* tgt)
+{
+    if (!IsEnabled())
+        return false;
+
+    TMEntry* entry = Find(src, HashKey(src));
+    if (entry == NULL) {
+        missNum++;
+        return false;
+    }
+
+    const int* ids = (const int*)(entry + 1) + entry->srcLen;
+    for (uint32_t i = 0; i < entry->tgtLen; i++)
+        tgt->Add(ids[i]);
+
+    hitNum++;
+    return true;
+}
+
+/*
+add a translation to the translation memory. The entry is appended to the
+data region first and then published by setting a slot.
+>> src - the source token ids
+>> tgt - the target token ids
+*/
+void TranslationMemory::Add(const IntList* src, const IntList* tgt)
+{
+    if (!IsEnabled() || src == NULL || tgt == NULL)
+        return;
+
+#ifndef _WIN32
+    uint64_t hash = HashKey(src);
+
+    lock_guard<mutex> lock(writeMutex);
+    flock(fd, LOCK_EX);
+
+    uint64_t entrySize = TM_ALIGN(sizeof(TMEntry) + sizeof(int) * (src->count + tgt->count));
+    uint64_t dataEnd = mapSize - dataStart;
+
+    if (Find(src, hash) == NULL) {
+        if (header->dataUsed > dataEnd || entrySize > dataEnd - header->dataUsed ||
+            header->entryNum * 4 >= (uint64_t)slotNum * 3) {
+            if (!fullReported)
+                LOG("the translation memory %s is full, no more entries will be added", fileName.c_str());
+            fullReported = true;
+        }
+        else {
+            /* find a free slot */
+            uint32_t mask = slotNum - 1;
+            uint32_t slot = (uint32_t)hash & mask;
+            int probe = 0;
+            while (probe < TM_MAX_PROBE && slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+                probe++;
+            }
+
+            if (probe < TM_MAX_PROBE) {
+                uint64_t offset = dataStart + header->dataUsed;
+                TMEntry* entry = (TMEntry*)(base + offset);
+                entry->hash = hash;
+                entry->context = context;
+                entry->srcLen = src->count;
+                entry->tgtLen = tgt->count;
+                int* ids = (int*)(entry + 1);
+                memcpy(ids, src->items, sizeof(int) * src->count);
+                memcpy(ids + src->count, tgt->items, sizeof(int) * tgt->count);
+
+                header->dataUsed += entrySize;
+                header->entryNum++;
+
+                /* publish the entry */
+                __atomic_store_n(&slots[slot], offset, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    flock(fd, LOCK_UN);
+#endif
+}
+
+/* get the number of hits */
+long TranslationMemory::GetHitNum()
+{
+    return hitNum;
+}
+
+/* get the number of misses */
+long TranslationMemory::GetMissNum()
+{
+    return missNum;
+}
+
+} /* end of the nmt namespace */
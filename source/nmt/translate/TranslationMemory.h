@@ -0,0 +1,172 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * A persistent translation memory. It is a hash table kept in a memory-mapped
+ * file, which maps (model, decoding settings, source ids) to target ids.
+ * Several translator processes on the same host can share the file: readers
+ * never take a lock, and writers are serialized by a file lock. Entries are
+ * append-only, and a slot is published only after its entry is written.
+ *
+ * File layout: | header | slots (uint64 x slotNum) | entries ... |
+ */
+
+#ifndef __TRANSLATIONMEMORY_H__
+#define __TRANSLATIONMEMORY_H__
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include "../Config.h"
+#include "../../niutensor/tensor/XList.h"
+
+using namespace std;
+
+/* the nmt namespace */
+namespace nmt
+{
+
+#define TM_MAGIC "NTTMEM01"
+#define TM_VERSION 1
+
+/* the header of a translation memory file */
+struct TMHeader
+{
+    /* magic number */
+    char magic[8];
+
+    /* version of the file format */
+    uint32_t version;
+
+    /* number of hash slots (a power of two) */
+    uint32_t slotNum;
+
+    /* capacity of the entry region in bytes */
+    uint64_t dataSize;
+
+    /* used bytes of the entry region */
+    uint64_t dataUsed;
+
+    /* number of entries */
+    uint64_t entryNum;
+};
+
+/* an entry of the translation memory, followed by the source and target ids */
+struct TMEntry
+{
+    /* hash of the whole key */
+    uint64_t hash;
+
+    /* hash of the model and decoding settings */
+    uint64_t context;
+
+    /* number of source ids */
+    uint32_t srcLen;
+
+    /* number of target ids */
+    uint32_t tgtLen;
+};
+
+/* the memory-mapped translation memory */
+class TranslationMemory
+{
+private:
+    /* path to the file */
+    string fileName;
+
+    /* file descriptor */
+    int fd;
+
+    /* the mapped file */
+    char* base;
+
+    /* size of the mapped file */
+    uint64_t mapSize;
+
+    /* number of hash slots (copied from the header when the file is opened) */
+    uint32_t slotNum;
+
+    /* offset of the entry region */
+    uint64_t dataStart;
+
+    /* the header (in the mapped file) */
+    TMHeader* header;
+
+    /* hash slots (in the mapped file), 0 means empty */
+    uint64_t* slots;
+
+    /* hash of the model and decoding settings */
+    uint64_t context;
+
+    /* serializes writers in the same process */
+    mutex writeMutex;
+
+    /* indicates whether we have reported that the memory is full */
+    bool fullReported;
+
+    /* number of hits */
+    atomic<long> hitNum;
+
+    /* number of misses */
+    atomic<long> missNum;
+
+private:
+    /* compute the hash of a key */
+    uint64_t HashKey(const IntList* src);
+
+    /* find the entry of a key */
+    TMEntry* Find(const IntList* src, uint64_t hash);
+
+public:
+    /* constructor */
+    TranslationMemory();
+
+    /* de-constructor */
+    ~TranslationMemory();
+
+    /* open (or create) the translation memory */
+    void Init(NMTConfig& config);
+
+    /* close the file */
+    void Close();
+
+    /* check whether the translation memory is enabled */
+    bool IsEnabled();
+
+    /* look up the translation of a source sequence */
+    bool Lookup(const IntList* src, IntList* tgt);
+
+    /* add a translation to the translation memory */
+    void Add(const IntList* src, const IntList* tgt);
+
+    /* get the number of hits */
+    long GetHitNum();
+
+    /* get the number of misses */
+    long GetMissNum();
+
+    /* compute a hash that identifies the content of a file */
+    static uint64_t HashFile(const char* fn, uint64_t seed);
+};
+
+/* the FNV-1a hash of a block of bytes */
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed);
+
+} /* end of the nmt namespace */
+
+#endif /* __TRANSLATIONMEMORY_H__ */
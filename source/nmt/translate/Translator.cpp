@@ -20,8 +20,10 @@
  * $Modified by: HU Chi (huchinlp@gmail.com) 2020-04, 2020-06
  */
 
+#include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 #include "Searcher.h"
 #include "Translator.h"
 #include "../../niutensor/tensor/XTensor.h"
@@ -34,6 +36,12 @@ using namespace nts;
 namespace nmt
 {
 
+/* the shortest length bucket of the warmup */
+#define WARMUP_MIN_LEN 8
+
+/* size of the buffer to write the translations (in bytes) */
+#define OUTPUT_BUF_SIZE (1 << 20)
+
 /* constructor */
 Translator::Translator()
 {
@@ -41,6 +49,12 @@ Translator::Translator()
     model = NULL;
     seacher = NULL;
     outputBuf = new XList;
+    streamCallback = NULL;
+    streamArg = NULL;
+    streamIndices = NULL;
+    deadlines = NULL;
+    arrivals = NULL;
+    memset(&stats, 0, sizeof(stats));
 }
 
 /* de-constructor */
@@ -65,21 +79,221 @@ void Translator::Init(NMTConfig& myConfig, NMTModel& myModel)
             config->translation.lenAlpha, config->translation.maxLenAlpha);
         seacher = new BeamSearch();
         ((BeamSearch*)seacher)->Init(myConfig);
+        ((BeamSearch*)seacher)->SetEncoderCache(&encoderCache);
+        ((BeamSearch*)seacher)->SetPrefixCache(&prefixCache);
     }
     else if (config->translation.beamSize == 1) {
         LOG("translating with greedy search (batchSize= %d sents | %d tokens, maxLenAlpha=%.2f)", 
             config->common.sBatchSize, config->common.wBatchSize, config->translation.maxLenAlpha);
         seacher = new GreedySearch();
         ((GreedySearch*)seacher)->Init(myConfig);
+        ((GreedySearch*)seacher)->SetEncoderCache(&encoderCache);
+        ((GreedySearch*)seacher)->SetPrefixCache(&prefixCache);
     }
     else {
         CheckNTErrors(false, "Invalid beam size\n");
     }
+
+    SetStreamCallback(streamCallback, streamArg);
+
+    batchLoader.LoadVocab(myConfig, model->mappedFile);
+
+    cache.Init(myConfig);
+    if (cache.IsEnabled())
+        LOG("translation cache enabled (size=%d)", config->translation.cacheSize);
+
+    memory.Init(myConfig);
+
+    /* the caches keep the keys and values with all heads */
+    if (model->IsPruned() && (config->translation.encCacheSize > 0 || config->translation.prefixCacheSize > 0)) {
+        LOG("the encoder and prefix caches are disabled for a model with pruned heads");
+        config->translation.encCacheSize = 0;
+        config->translation.prefixCacheSize = 0;
+    }
+
+    encoderCache.Init(myConfig);
+    if (encoderCache.IsEnabled())
+        LOG("encoder cache enabled (size=%dMB)", config->translation.encCacheSize);
+
+    prefixCache.Init(myConfig);
+    if (prefixCache.IsEnabled())
+        LOG("prefix cache enabled (size=%d)", config->translation.prefixCacheSize);
+
+    batchLoader.memoryCost.Init(myConfig);
+    if (batchLoader.memoryCost.IsEnabled())
+        LOG("memory-budgeted batching enabled (budget=%dMB)", config->translation.batchMem);
+
+    batchSizeController.Init(myConfig);
+    if (batchSizeController.IsEnabled())
+        LOG("adaptive batch size enabled (p99 latency target=%.1fms)", config->service.latencyTarget);
+
+    {
+        lock_guard<mutex> lock(statsMutex);
+        stats.tokenBudget = batchSizeController.GetBudget();
+    }
+
+    if (config->service.warmup)
+        Warmup();
+}
+
+/*
+run synthetic batches to warm up the translator, so that the first requests
+do not pay for the growth of the memory pool, page faults and cold code paths.
+The weights are read page by page first. Then for each length bucket (halved
+from the maximum source length) we translate a full batch and a batch of one
+sentence. The longest buckets go first, so the memory pool grows to the
+high-water mark at once and is reused by the following batches. Nothing of
+the warmup is kept in the outputs, the caches or the statistics.
+*/
+void Translator::Warmup()
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    model->TouchParams();
+
+    /* the warmup batches are not streamed */
+    TokenCallback callback = streamCallback;
+    void* arg = streamArg;
+    SetStreamCallback(NULL, NULL);
+
+    XTensor batchEnc;
+    XTensor paddingEnc;
+    XList info;
+    XList inputs;
+    int wordCount;
+    IntList indices;
+    XList prefixes;
+    inputs.Add(&batchEnc);
+    inputs.Add(&paddingEnc);
+    info.Add(&wordCount);
+    info.Add(&indices);
+    info.Add(&prefixes);
+
+    /* synthetic tokens avoid the special symbols */
+    int firstID = MAX(MAX(config->model.sos, config->model.eos), MAX(config->model.pad, config->model.unk)) + 1;
+    int idNum = MAX(batchLoader.srcVocab.vocabSize - firstID, 1);
+    unsigned int seed = 1;
+    int batchNum = 0;
+
+    for (int len = config->model.maxSrcLen - 1; len >= WARMUP_MIN_LEN; len /= 2) {
+        /* a full batch (as large as the budgets allow) and then a single sentence */
+        for (int sentNum = config->common.sBatchSize; sentNum > 0; sentNum = sentNum > 1 ? 1 : 0) {
+            batchLoader.ClearBuf();
+            for (int i = 0; i < sentNum; i++) {
+                IntList* src = new IntList(len + 1);
+                for (int j = 0; j < len; j++) {
+                    seed = seed * 1103515245 + 12345;
+                    src->Add(firstID + int((seed >> 16) % idNum));
+                }
+                src->Add(config->model.eos);
+                Sample* sample = new Sample(src, NULL);
+                sample->index = i;
+                batchLoader.buf->Add(sample);
+            }
+
+            batchLoader.wBatchSize = batchSizeController.IsEnabled() ? batchSizeController.GetBudget() : 0;
+            batchLoader.GetBatchSimple(&inputs, &info);
+            TranslateBatch(batchEnc, paddingEnc, indices, prefixes);
+            batchNum++;
+
+            for (int i = 0; i < outputBuf->Size(); i++)
+                delete (Sample*)outputBuf->Get(i);
+            outputBuf->Clear();
+        }
+    }
+
+    batchLoader.ClearBuf();
+    encoderCache.Clear();
+    SetStreamCallback(callback, arg);
+
+    {
+        lock_guard<mutex> lock(statsMutex);
+        memset(&stats, 0, sizeof(stats));
+        stats.tokenBudget = batchSizeController.GetBudget();
+    }
+
+    LOG("warmed up with %d batches in %.1fs", batchNum,
+        chrono::duration<float>(chrono::steady_clock::now() - start).count());
+}
+
+/*
+set the callback to stream the translations token by token. The callback
+is called with the index of the input line, and a line can be streamed
+before the lines ahead of it.
+>> callback - the callback (NULL if not used)
+>> arg - the argument of the callback
+*/
+void Translator::SetStreamCallback(TokenCallback callback, void* arg)
+{
+    streamCallback = callback;
+    streamArg = arg;
+
+    if (seacher == NULL)
+        return;
+
+    TokenCallback batchCallback = callback != NULL ? StreamBatch : NULL;
+    if (config->translation.beamSize > 1)
+        ((BeamSearch*)seacher)->SetCallback(batchCallback, this);
+    else
+        ((GreedySearch*)seacher)->SetCallback(batchCallback, this);
+}
+
+/*
+forward the streamed tokens of a batch to the stream callback
+>> index - index of the sequence in the batch
+>> tokens - the newly committed tokens
+>> tokenNum - number of the tokens
+>> isFinal - whether the sequence is completed
+>> arg - the translator
+*/
+void Translator::StreamBatch(int index, const int* tokens, int tokenNum, bool isFinal, void* arg)
+{
+    Translator* translator = (Translator*)arg;
+    translator->streamCallback(translator->streamIndices->Get(index), tokens, tokenNum,
+                               isFinal, translator->streamArg);
+}
+
+/*
+stream a whole translation (e.g., one found in the cache)
+>> sample - the translation
+*/
+void Translator::StreamSample(Sample* sample)
+{
+    if (streamCallback == NULL)
+        return;
+
+    IntList* tgt = sample->tgtSeq;
+    streamCallback(sample->index, tgt != NULL ? tgt->items : NULL,
+                   tgt != NULL ? tgt->count : 0, true, streamArg);
 }
 
 /* sort the outputs by the indices (in ascending order) */
 void Translator::SortOutputs()
 {
+    /* fan the translations out to the duplicated lines */
+    if (batchLoader.dupLines.Size() > 0) {
+        unordered_map<int, Sample*> samples;
+        for (int i = 0; i < outputBuf->Size(); i++) {
+            Sample* sample = (Sample*)outputBuf->Get(i);
+            samples[sample->index] = sample;
+        }
+
+        for (int i = 0; i < batchLoader.dupLines.Size(); i++) {
+            Sample* source = samples[batchLoader.dupSources[i]];
+            CheckNTErrors(source != NULL, "Cannot find the translation of a duplicated line");
+
+            IntList* tgt = new IntList();
+            for (int j = 0; j < source->tgtSeq->Size(); j++)
+                tgt->Add(source->tgtSeq->Get(j));
+
+            Sample* sample = new Sample(NULL, tgt);
+            sample->index = batchLoader.dupLines[i];
+            sample->isPartial = source->isPartial;
+            outputBuf->Add(sample);
+            StreamSample(sample);
+        }
+    }
+
     sort(outputBuf->items, outputBuf->items + outputBuf->count,
         [](void* a, void* b) {
             return ((Sample*)(a))->index <
@@ -92,9 +306,11 @@ translate a batch of sequences
 >> batchEnc - the batch of inputs
 >> paddingEnc - the paddings of inputs
 >> indices - indices of input sequences
-the results will be saved in the output buffer
+>> prefixes - the forced target prefixes (empty if not used)
+the results will be saved in the output buffer, and a sequence stopped by
+its deadline is marked as partial (Sample::isPartial)
 */
-void Translator::TranslateBatch(XTensor& batchEnc, XTensor& paddingEnc, IntList& indices)
+void Translator::TranslateBatch(XTensor& batchEnc, XTensor& paddingEnc, IntList& indices, XList& prefixes)
 {
     int batchSize = batchEnc.GetDim(0);
     for (int i = 0; i < model->decoder->nlayer; ++i) {
@@ -106,32 +322,163 @@ void Translator::TranslateBatch(XTensor& batchEnc, XTensor& paddingEnc, IntList&
     for (int i = 0; i < batchSize; i++)
         outputs[i] = new IntList();
 
+    IntList** forced = prefixes.Size() > 0 ? (IntList**)prefixes.items : NULL;
+
+    /* the translations start with the forced prefixes */
+    streamIndices = &indices;
+    if (streamCallback != NULL && forced != NULL) {
+        for (int i = 0; i < batchSize; i++)
+            streamCallback(indices[i], forced[i]->items, forced[i]->count, false, streamArg);
+    }
+
+    /* each sequence is stopped at its own deadline */
+    vector<chrono::steady_clock::time_point> batchDeadlines;
+    if (deadlines != NULL) {
+        for (int i = 0; i < batchSize; i++)
+            batchDeadlines.push_back((*deadlines)[indices[i]]);
+    }
+    const chrono::steady_clock::time_point* myDeadlines = deadlines != NULL ? batchDeadlines.data() : NULL;
+
+    vector<bool> isPartial(batchSize, false);
+    int stepNum = 0;
+    int activeNum = 0;
+
     /* greedy search */
     if (config->translation.beamSize == 1) {
-        ((GreedySearch*)seacher)->Search(model, batchEnc, paddingEnc, outputs);
+        GreedySearch* greedy = (GreedySearch*)seacher;
+        greedy->SetDeadlines(myDeadlines);
+        greedy->Search(model, batchEnc, paddingEnc, outputs, forced);
+        greedy->SetDeadlines(NULL);
+        for (int i = 0; i < batchSize; i++)
+            isPartial[i] = greedy->IsTimedOut(i);
+        stepNum = greedy->GetStepNum();
+        activeNum = greedy->GetActiveNum();
     }
 
     /* beam search */
     if (config->translation.beamSize > 1) {
         XTensor score;
-        ((BeamSearch*)seacher)->Search(model, batchEnc, paddingEnc, outputs, score);
+        BeamSearch* beam = (BeamSearch*)seacher;
+        beam->SetDeadlines(myDeadlines);
+        beam->Search(model, batchEnc, paddingEnc, outputs, score, forced);
+        beam->SetDeadlines(NULL);
+        for (int i = 0; i < batchSize; i++)
+            isPartial[i] = beam->IsTimedOut(i);
+        stepNum = beam->GetStepNum();
+        activeNum = beam->GetActiveNum();
+    }
+
+    int outputNum = 0;
+    for (int i = 0; i < batchSize; i++)
+        outputNum += int(outputs[i]->Size());
+
+    {
+        lock_guard<mutex> lock(statsMutex);
+        stats.sentNum += batchSize;
+        stats.batchNum++;
+        stats.outputNum += outputNum;
+        stats.paddedNum += batchEnc.unitNum;
+        stats.stepNum += stepNum;
+        stats.activeNum += activeNum;
     }
 
     /* save the outputs to the buffer */
     for (int i = 0; i < batchSize; i++) {
+        /* the translation starts with the forced prefix */
+        if (forced != NULL) {
+            IntList* output = new IntList(int(forced[i]->Size() + outputs[i]->Size()));
+            output->Add(forced[i]->items, forced[i]->count);
+            output->Add(outputs[i]->items, outputs[i]->count);
+            delete outputs[i];
+            outputs[i] = output;
+        }
+
         Sample* sample = new Sample(NULL, outputs[i]);
         sample->index = indices[i];
+        sample->isPartial = isPartial[i];
         outputBuf->Add(sample);
     }
 
     delete[] outputs;
 }
 
-/* the translation function */
-bool Translator::Translate()
+/* 
+move the sequences translated before (i.e., those in the cache or
+the translation memory) from the buffer to the outputs
+*/
+void Translator::LookupCache()
 {
-    batchLoader.Init(*config, false);
+    if (!cache.IsEnabled() && !memory.IsEnabled())
+        return;
+
+    XList* buf = batchLoader.buf;
+    int count = 0;
+
+    for (int i = 0; i < buf->Size(); i++) {
+        Sample* sample = (Sample*)buf->Get(i);
+
+        /* the translation of a sequence with a forced prefix depends on the prefix */
+        if (sample->tgtSeq != NULL) {
+            buf->items[count++] = sample;
+            continue;
+        }
 
+        IntList* tgt = new IntList();
+
+        bool hit = cache.Lookup(sample->srcSeq, tgt);
+
+        /* fall back to the translation memory and keep the hit in the cache */
+        if (!hit && memory.Lookup(sample->srcSeq, tgt)) {
+            cache.Add(sample->srcSeq, tgt);
+            hit = true;
+        }
+
+        if (hit) {
+            Sample* output = new Sample(NULL, tgt);
+            output->index = sample->index;
+            outputBuf->Add(output);
+            StreamSample(output);
+            delete sample;
+        }
+        else {
+            delete tgt;
+            buf->items[count++] = sample;
+        }
+    }
+
+    /* the remaining sequences are still sorted by length */
+    buf->count = count;
+}
+
+/*
+add the translations of a batch to the cache and the translation memory
+>> bufStart - position of the first sequence of the batch in the buffer
+>> outputStart - position of the first translation of the batch in the outputs
+*/
+void Translator::UpdateCache(int bufStart, int outputStart)
+{
+    if (!cache.IsEnabled() && !memory.IsEnabled())
+        return;
+
+    for (int i = outputStart; i < outputBuf->Size(); i++) {
+        Sample* sample = (Sample*)batchLoader.buf->Get(bufStart + i - outputStart);
+        Sample* output = (Sample*)outputBuf->Get(i);
+
+        /* the partial translations stopped by the deadlines are not kept */
+        if (sample->tgtSeq != NULL || output->isPartial)
+            continue;
+        cache.Add(sample->srcSeq, output->tgtSeq);
+        memory.Add(sample->srcSeq, output->tgtSeq);
+    }
+}
+
+/*
+translate the sequences in the buffer of the batch loader
+>> showProgress - whether to report the progress on stderr
+the results will be saved in the output buffer (sorted by the indices)
+*/
+void Translator::TranslateBuf(bool showProgress)
+{
     /* inputs */
     XTensor batchEnc;
     XTensor paddingEnc;
@@ -141,14 +488,55 @@ bool Translator::Translate()
     XList inputs;
     int wordCount;
     IntList indices;
+    XList prefixes;
     inputs.Add(&batchEnc);
     inputs.Add(&paddingEnc);
     info.Add(&wordCount);
     info.Add(&indices);
+    info.Add(&prefixes);
+
+    /* the sentences arrive at the translator now if not given */
+    chrono::steady_clock::time_point bufTime = chrono::steady_clock::now();
+    vector<float> latencies;
+
+    LookupCache();
 
     while (!batchLoader.IsEmpty()) {
+        DropExpired();
+        if (batchLoader.IsEmpty())
+            break;
+
+        int bufStart = batchLoader.bufIdx;
+        int outputStart = outputBuf->Size();
+        batchLoader.wBatchSize = batchSizeController.IsEnabled() ? batchSizeController.GetBudget() : 0;
         batchLoader.GetBatchSimple(&inputs, &info);
-        TranslateBatch(batchEnc, paddingEnc, indices);
+
+        chrono::steady_clock::time_point batchStart = chrono::steady_clock::now();
+
+        TranslateBatch(batchEnc, paddingEnc, indices, prefixes);
+        UpdateCache(bufStart, outputStart);
+
+        /* tune the batch size with the latencies of the batch */
+        if (batchSizeController.IsEnabled()) {
+            chrono::steady_clock::time_point batchEnd = chrono::steady_clock::now();
+            latencies.clear();
+            for (int i = 0; i < indices.Size(); i++) {
+                chrono::steady_clock::time_point arrival = arrivals != NULL ? (*arrivals)[indices[i]] : bufTime;
+                latencies.push_back(chrono::duration<float, milli>(batchEnd - arrival).count());
+            }
+            batchSizeController.Update(latencies,
+                                       chrono::duration<float, milli>(batchEnd - batchStart).count(),
+                                       !batchLoader.IsEmpty());
+        }
+
+        {
+            lock_guard<mutex> lock(statsMutex);
+            stats.wordNum += wordCount;
+            stats.tokenBudget = batchSizeController.GetBudget();
+        }
+
+        if (!showProgress)
+            continue;
         if (batchLoader.appendEmptyLine)
             fprintf(stderr, "%d/%d\n", batchLoader.bufIdx - 1, batchLoader.buf->Size() - 1);
         else
@@ -160,8 +548,56 @@ bool Translator::Translate()
         Sample* sample = new Sample(NULL, NULL);
         sample->index = batchLoader.emptyLines[i];
         outputBuf->Add(sample);
+        StreamSample(sample);
     }
     SortOutputs();
+}
+
+/*
+remove the sequences whose deadlines are passed from the rest of the
+buffer. They are not translated and get empty outputs.
+*/
+void Translator::DropExpired()
+{
+    if (deadlines == NULL)
+        return;
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    XList* buf = batchLoader.buf;
+    int count = batchLoader.bufIdx;
+
+    for (int i = batchLoader.bufIdx; i < buf->Size(); i++) {
+        Sample* sample = (Sample*)buf->Get(i);
+        if ((*deadlines)[sample->index] <= now) {
+            Sample* output = new Sample(NULL, NULL);
+            output->index = sample->index;
+            outputBuf->Add(output);
+            StreamSample(output);
+            delete sample;
+        }
+        else
+            buf->items[count++] = sample;
+    }
+
+    /* the remaining sequences are still sorted for batching */
+    buf->count = count;
+}
+
+/* the translation function */
+bool Translator::Translate()
+{
+    batchLoader.Init(*config, false);
+
+    TranslateBuf(true);
+
+    if (cache.IsEnabled())
+        LOG("translation cache: %ld hits, %ld misses", cache.GetHitNum(), cache.GetMissNum());
+    if (memory.IsEnabled())
+        LOG("translation memory: %ld hits, %ld misses", memory.GetHitNum(), memory.GetMissNum());
+    if (encoderCache.IsEnabled())
+        LOG("encoder cache: %ld hits, %ld misses", encoderCache.GetHitNum(), encoderCache.GetMissNum());
+    if (prefixCache.IsEnabled())
+        LOG("prefix cache: %ld hits, %ld misses", prefixCache.GetHitNum(), prefixCache.GetMissNum());
 
     /* dump the translation results */
     if (strcmp(config->translation.outputFN, "") != 0)
@@ -178,38 +614,146 @@ bool Translator::Translate()
     return true;
 }
 
-/* dump the translation results to a file */
-void Translator::DumpResToFile(const char* ofn)
+/*
+get the statistics of translation. It can be called by other threads
+while translating, as the statistics of the translator are read under
+statsMutex and the hit and miss counters of the caches are atomic.
+>> myStats - the statistics (for return)
+*/
+void Translator::GetStats(TranslatorStats& myStats)
 {
-    ofstream f(ofn);
+    {
+        lock_guard<mutex> lock(statsMutex);
+        myStats = stats;
+    }
+
+    myStats.cacheHitNum = cache.GetHitNum();
+    myStats.cacheMissNum = cache.GetMissNum();
+    myStats.memoryHitNum = memory.GetHitNum();
+    myStats.memoryMissNum = memory.GetMissNum();
+    myStats.encoderHitNum = encoderCache.GetHitNum();
+    myStats.encoderMissNum = encoderCache.GetMissNum();
+    myStats.prefixHitNum = prefixCache.GetHitNum();
+    myStats.prefixMissNum = prefixCache.GetMissNum();
+}
+
+/*
+translate the sequences given by the caller rather than read from the input.
+The sequences are batched by length in the same way as the input file.
+>> samples - the source sequences (ending with EOS) and their forced prefixes (optional),
+             they are owned by the translator after the call
+>> outputs - the translations (with the indices of the samples), released by the caller
+>> myDeadlines - the deadlines of the samples (indexed by Sample::index, NULL if not used).
+                 A sequence is dropped (i.e., its output is NULL) if its deadline is
+                 passed before it is translated, and a sequence in translation is
+                 stopped with its best partial hypothesis at its deadline (with
+                 Sample::isPartial set) while the rest of its batch goes on.
+>> myArrivals - the arrival times of the samples (indexed by Sample::index, NULL if they
+                arrive at the call). They are used to tune the batch size for the latency.
+*/
+void Translator::TranslateSamples(XList* samples, XList* outputs,
+                                  const vector<chrono::steady_clock::time_point>* myDeadlines,
+                                  const vector<chrono::steady_clock::time_point>* myArrivals)
+{
+    batchLoader.ClearBuf();
+    batchLoader.emptyLines.Clear();
+    batchLoader.dupLines.Clear();
+    batchLoader.dupSources.Clear();
+    batchLoader.appendEmptyLine = false;
+
+    for (int i = 0; i < samples->Size(); i++)
+        batchLoader.buf->Add(samples->Get(i));
+    samples->Clear();
+
+    batchLoader.SortBuf();
+
+    deadlines = myDeadlines;
+    arrivals = myArrivals;
+    TranslateBuf(false);
+    deadlines = NULL;
+    arrivals = NULL;
+
+    for (int i = 0; i < outputBuf->Size(); i++)
+        outputs->Add(outputBuf->Get(i));
+    outputBuf->Clear();
+}
+
+/*
+transform a line of tokens to a sample. It can be called by other threads
+when the translator is running, as the vocabularies are not changed.
+>> line - the tokens separated by spaces, with an optional forced prefix
+           after "|||" (if "prefix" is set)
+<< return - the sample (the source sequence ends with EOS)
+*/
+Sample* Translator::MakeSample(const string& line)
+{
+    return batchLoader.LoadSample(line);
+}
+
+/*
+transform the token ids of a translation to a line
+>> ids - the target token ids
+<< return - the tokens separated by spaces
+*/
+string Translator::MakeText(const IntList* ids)
+{
+    string line;
+    AppendTokens(line, ids);
+    if (!line.empty() && line.back() == ' ')
+        line.pop_back();
+    return line;
+}
+
+/*
+append the tokens of a translation to a buffer (see Vocab::AppendTokens)
+>> text - the buffer
+>> ids - the target token ids
+*/
+void Translator::AppendTokens(string& text, const IntList* ids)
+{
+    batchLoader.tgtVocab.AppendTokens(text, ids->items, ids->count, config->translation.bpeJoin);
+}
+
+/*
+write the translations to a stream. The lines are assembled in a buffer
+that is written in bulk when it is full, rather than token by token.
+>> out - the stream
+*/
+void Translator::DumpRes(ostream& out)
+{
+    string text;
+    text.reserve(OUTPUT_BUF_SIZE + OUTPUT_BUF_SIZE / 8);
+
     int sentNum = batchLoader.appendEmptyLine ? outputBuf->Size() - 1 : outputBuf->Size();
     for (int i = 0; i < sentNum; i++) {
         Sample* sample = (Sample*)outputBuf->Get(i);
-        if (sample->tgtSeq != NULL) {
-            for (int j = 0; j < sample->tgtSeq->Size(); j++) {
-                int id = sample->tgtSeq->Get(j);
-                f << batchLoader.tgtVocab.id2token[id] << " ";
-            }
+        if (sample->tgtSeq != NULL)
+            AppendTokens(text, sample->tgtSeq);
+        text += '\n';
+
+        if (text.size() >= OUTPUT_BUF_SIZE) {
+            out.write(text.data(), text.size());
+            text.clear();
         }
-        f << "\n";
     }
+
+    out.write(text.data(), text.size());
+    out.flush();
+}
+
+/* dump the translation results to a file */
+void Translator::DumpResToFile(const char* ofn)
+{
+    ofstream f(ofn, ios::binary);
+    CheckNTErrors(f.is_open(), "Failed to open the output file");
+    DumpRes(f);
     f.close();
 }
 
 /* dump the translation results to stdout */
 void Translator::DumpResToStdout()
 {
-    int sentNum = batchLoader.appendEmptyLine ? outputBuf->Size() - 1 : outputBuf->Size();
-    for (int i = 0; i < sentNum; i++) {
-        Sample* sample = (Sample*)outputBuf->Get(i);
-        if (sample->tgtSeq != NULL) {
-            for (int j = 0; j < sample->tgtSeq->Size(); j++) {
-                int id = sample->tgtSeq->Get(j);
-                cout << batchLoader.tgtVocab.id2token[id] <<  " ";
-            }
-        }
-        cout << "\n";
-    }
+    DumpRes(cout);
 }
 
 } /* end of the nmt namespace */
\ No newline at end of file
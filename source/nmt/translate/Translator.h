@@ -23,19 +23,84 @@ It will dump the result to the output file if specified, else the standard outpu
 #ifndef __TRANSLATOR_H__
 #define __TRANSLATOR_H__
 
+#include <mutex>
+#include <chrono>
+#include <vector>
 #include "../Model.h"
 #include "Searcher.h"
 #include "TranslateDataSet.h"
+#include "BatchSizeController.h"
+#include "TranslationCache.h"
+#include "TranslationMemory.h"
 
 /* the nmt namespace */
 namespace nmt
 {
 
+/* statistics of the translator (accumulated since it is initialized) */
+struct TranslatorStats
+{
+    /* number of translated sentences (excluding cache hits) */
+    long sentNum;
+
+    /* number of source tokens of the translated sentences */
+    long wordNum;
+
+    /* number of output tokens */
+    long outputNum;
+
+    /* number of batches */
+    long batchNum;
+
+    /* number of source tokens including paddings */
+    long paddedNum;
+
+    /* number of decoding steps */
+    long stepNum;
+
+    /* number of the uncompleted sentences summed over the decoding steps */
+    long activeNum;
+
+    /* hits and misses of the translation cache */
+    long cacheHitNum;
+    long cacheMissNum;
+
+    /* hits and misses of the translation memory */
+    long memoryHitNum;
+    long memoryMissNum;
+
+    /* hits and misses of the encoder cache */
+    long encoderHitNum;
+    long encoderMissNum;
+
+    /* hits and misses of the prefix cache */
+    long prefixHitNum;
+    long prefixMissNum;
+
+    /* the current token budget of a batch */
+    long tokenBudget;
+};
+
 class Translator
 {
 private:
     /* translate a batch of sequences */
-    void TranslateBatch(XTensor& batchEnc, XTensor& paddingEnc, IntList& indices);
+    void TranslateBatch(XTensor& batchEnc, XTensor& paddingEnc, IntList& indices, XList& prefixes);
+
+    /* move the sequences translated before from the buffer to the outputs */
+    void LookupCache();
+
+    /* add the translations of a batch to the cache and the translation memory */
+    void UpdateCache(int bufStart, int outputStart);
+
+    /* translate the sequences in the buffer of the batch loader */
+    void TranslateBuf(bool showProgress);
+
+    /* run synthetic batches to warm up the translator */
+    void Warmup();
+
+    /* remove the sequences whose deadlines are passed from the buffer */
+    void DropExpired();
 
 private:
     /* the translation model */
@@ -53,6 +118,55 @@ private:
     /* output buffer */
     XList* outputBuf;
 
+    /* the cache of translations (kept across batches) */
+    TranslationCache cache;
+
+    /* the persistent translation memory (shared across runs and processes) */
+    TranslationMemory memory;
+
+    /* the cache of encoder outputs (kept across batches) */
+    EncoderCache encoderCache;
+
+    /* the cache of decoder states of forced prefixes (kept across batches) */
+    PrefixCache prefixCache;
+
+    /* the callback to stream the translations (NULL if not used) */
+    TokenCallback streamCallback;
+
+    /* the argument of the stream callback */
+    void* streamArg;
+
+    /* indices of the sequences in the batch being translated */
+    IntList* streamIndices;
+
+    /* the deadlines of the sequences being translated (NULL if not used) */
+    const vector<chrono::steady_clock::time_point>* deadlines;
+
+    /* the arrival times of the sequences being translated (NULL if not used) */
+    const vector<chrono::steady_clock::time_point>* arrivals;
+
+    /* the controller of the batch size */
+    BatchSizeController batchSizeController;
+
+    /* the statistics of translation (the cache statistics are filled on request) */
+    TranslatorStats stats;
+
+    /* the mutex of the statistics, which may be read by other threads */
+    mutex statsMutex;
+
+private:
+    /* forward the streamed tokens of a batch to the stream callback */
+    static void StreamBatch(int index, const int* tokens, int tokenNum, bool isFinal, void* arg);
+
+    /* stream a whole translation */
+    void StreamSample(Sample* sample);
+
+    /* append the tokens of a translation to a buffer */
+    void AppendTokens(string& text, const IntList* ids);
+
+    /* write the translations to a stream */
+    void DumpRes(ostream& out);
+
 public:
     /* constructor */
     Translator();
@@ -63,9 +177,26 @@ public:
     /* initialize the translator */
     void Init(NMTConfig& myConfig, NMTModel& myModel);
 
+    /* set the callback to stream the translations token by token */
+    void SetStreamCallback(TokenCallback callback, void* arg);
+
     /* the translation function */
     bool Translate();
 
+    /* get the statistics of translation */
+    void GetStats(TranslatorStats& myStats);
+
+    /* translate the sequences given by the caller */
+    void TranslateSamples(XList* samples, XList* outputs,
+                          const vector<chrono::steady_clock::time_point>* myDeadlines = NULL,
+                          const vector<chrono::steady_clock::time_point>* myArrivals = NULL);
+
+    /* transform a line of tokens to a sample (it only reads the vocabularies) */
+    Sample* MakeSample(const string& line);
+
+    /* transform the token ids of a translation to a line (it only reads the vocabularies) */
+    string MakeText(const IntList* ids);
+
     /* sort the outputs by the indices (in ascending order) */
     void SortOutputs();
 
@@ -20,6 +20,7 @@
  */
 
 #include <fstream>
+#include <cstring>
 #include "Vocab.h"
 #include "../Config.h"
 
@@ -35,7 +36,76 @@ void Vocab::SetSpecialID(int sos, int eos, int pad, int unk)
     unkID = unk;
 }
 
-/* load a vocabulary from a file */
+/* the magic number of the compact form */
+static const char VOCAB_MAGIC[4] = { 'V', 'O', 'C', 'B' };
+
+/* hash a token (FNV-1a) */
+static uint64_t HashToken(const char* token, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)token[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+build the compact form of a vocabulary
+>> tokens - the tokens indexed by their ids (empty for the ids without tokens)
+>> vocabSize - size of the vocabulary
+>> sosID - the first id of the tokens
+>> output - the data of the compact form
+*/
+static void BuildCompact(const vector<string>& tokens, int vocabSize, int sosID, vector<char>& output)
+{
+    VocabDataHeader header;
+    memcpy(header.magic, VOCAB_MAGIC, sizeof(VOCAB_MAGIC));
+    header.vocabSize = vocabSize;
+    header.sosID = sosID;
+    header.idNum = (int)tokens.size();
+
+    int tokenNum = 0;
+    vector<uint32_t> tokenOffsets(header.idNum + 1);
+    string tokenPool;
+    for (int i = 0; i < header.idNum; i++) {
+        tokenOffsets[i] = (uint32_t)tokenPool.size();
+        tokenPool += tokens[i];
+        if (!tokens[i].empty())
+            tokenNum++;
+    }
+    tokenOffsets[header.idNum] = (uint32_t)tokenPool.size();
+    header.poolSize = (uint32_t)tokenPool.size();
+
+    /* keep the load factor below 0.5 */
+    header.bucketNum = 1;
+    while (header.bucketNum < 2 * tokenNum + 1)
+        header.bucketNum *= 2;
+
+    vector<int32_t> tokenBuckets(header.bucketNum, -1);
+    for (int i = 0; i < header.idNum; i++) {
+        if (tokens[i].empty())
+            continue;
+        uint64_t b = HashToken(tokens[i].data(), tokens[i].size()) & (header.bucketNum - 1);
+        while (tokenBuckets[b] >= 0)
+            b = (b + 1) & (header.bucketNum - 1);
+        tokenBuckets[b] = i;
+    }
+
+    output.clear();
+    const char* headerData = (const char*)&header;
+    output.insert(output.end(), headerData, headerData + sizeof(header));
+    output.insert(output.end(), (const char*)tokenOffsets.data(),
+                  (const char*)(tokenOffsets.data() + tokenOffsets.size()));
+    output.insert(output.end(), (const char*)tokenBuckets.data(),
+                  (const char*)(tokenBuckets.data() + tokenBuckets.size()));
+    output.insert(output.end(), tokenPool.begin(), tokenPool.end());
+}
+
+/*
+load a vocabulary from a file, and convert it to the compact form
+>> vocabFN - the vocabulary file
+*/
 void Vocab::Load(const string& vocabFN)
 {
     string vsz, sid;
@@ -47,17 +117,23 @@ void Vocab::Load(const string& vocabFN)
     sosID = (int)stol(sid);
     vocabSize = (int)stol(vsz);
 
+    /* the ids before sosID have empty tokens */
+    vector<string> tokens(MAX(vocabSize, 0));
     string word, id;
     for (int i = 0; i < vocabSize - sosID; i++) {
         f >> word >> id;
-        token2id[word] = (int)stol(id);
-        id2token[(int)stol(id)] = word;
-    }
-    for (int i = 0; i < sosID; i++) {
-        id2token[i] = "";
+        int wordID = (int)stol(id);
+        CheckNTErrors(wordID >= 0, "Invalid id in the vocabulary file");
+        if (wordID >= (int)tokens.size())
+            tokens.resize(wordID + 1);
+        tokens[wordID] = word;
     }
 
     f.close();
+
+    buf = make_shared<vector<char>>();
+    BuildCompact(tokens, vocabSize, sosID, *buf);
+    CheckNTErrors(LoadCompact(buf->data(), buf->size()), "Failed to build the vocabulary");
 }
 
 /* save a vocabulary to a file */
@@ -66,26 +142,199 @@ void Vocab::Save(const string& vocabFN)
     ofstream f(vocabFN, ios::out);
 
     /* the first line: size of the vocab and the start id */
-    f << vocabSize << "\t" << sosID;
+    f << vocabSize << "\t" << sosID << "\n";
 
     /* other lines: words and indices */
-    for (const auto& p : token2id)
-        f << p.first << "\t" << p.second;
+    for (int i = sosID; data != NULL && i < data->idNum; i++) {
+        if (offsets[i + 1] > offsets[i])
+            f << GetToken(i) << "\t" << i << "\n";
+    }
 
     f.close();
 }
 
 /*
-copy data from another vocabulary
+copy data from another vocabulary (the compact form is shared)
 >> v - the target vocabulary
 */
 void Vocab::CopyFrom(const Vocab& v)
 {
-    for (const auto& w2i : v.token2id)
-        token2id.insert(w2i);
+    vocabSize = v.vocabSize;
+    sosID = v.sosID;
+    data = v.data;
+    offsets = v.offsets;
+    buckets = v.buckets;
+    pool = v.pool;
+    buf = v.buf;
+}
+
+/*
+load a vocabulary in the compact form. The data is used in place, so it
+should live as long as the vocabulary. It may come from a model file, so
+it is checked before it is used, i.e., the sizes fit in the data, the
+offsets are monotonic, the buckets are ids or -1, and at least one bucket
+is empty (which ends a lookup in GetID()). The vocabulary is not changed
+if the data is invalid.
+>> compact - the data
+>> size - size of the data in bytes
+<< return - whether the data is valid
+*/
+bool Vocab::LoadCompact(const char* compact, size_t size)
+{
+    const VocabDataHeader* header = (const VocabDataHeader*)compact;
+    if (size < sizeof(VocabDataHeader) || memcmp(header->magic, VOCAB_MAGIC, sizeof(VOCAB_MAGIC)) != 0)
+        return false;
+
+    if (header->idNum < 0 || header->bucketNum <= 0 ||
+        (header->bucketNum & (header->bucketNum - 1)) != 0 ||
+        header->sosID < 0 || header->vocabSize < 0)
+        return false;
+
+    /* the sizes are compared with the rest of the data one by one, so
+       the sum never overflows */
+    uint64_t rest = size - sizeof(VocabDataHeader);
+    uint64_t offsetsSize = sizeof(uint32_t) * (uint64_t(header->idNum) + 1);
+    if (offsetsSize > rest)
+        return false;
+    rest -= offsetsSize;
+    uint64_t bucketsSize = sizeof(int32_t) * uint64_t(header->bucketNum);
+    if (bucketsSize > rest)
+        return false;
+    rest -= bucketsSize;
+    if (header->poolSize > rest)
+        return false;
 
-    for (const auto& i2w : v.id2token)
-        id2token.insert(i2w);
+    const uint32_t* myOffsets = (const uint32_t*)(compact + sizeof(VocabDataHeader));
+    const int32_t* myBuckets = (const int32_t*)(compact + sizeof(VocabDataHeader) + offsetsSize);
+
+    if (myOffsets[0] != 0 || myOffsets[header->idNum] > header->poolSize)
+        return false;
+    for (int i = 0; i < header->idNum; i++) {
+        if (myOffsets[i] > myOffsets[i + 1])
+            return false;
+    }
+
+    bool hasEmpty = false;
+    for (int b = 0; b < header->bucketNum; b++) {
+        if (myBuckets[b] < -1 || myBuckets[b] >= header->idNum)
+            return false;
+        if (myBuckets[b] == -1)
+            hasEmpty = true;
+    }
+    if (!hasEmpty)
+        return false;
+
+    data = header;
+    offsets = myOffsets;
+    buckets = myBuckets;
+    pool = compact + sizeof(VocabDataHeader) + offsetsSize + bucketsSize;
+    vocabSize = header->vocabSize;
+    sosID = header->sosID;
+
+    return true;
+}
+
+/*
+dump the vocabulary in the compact form
+>> output - the data (the output)
+*/
+void Vocab::DumpCompact(vector<char>& output) const
+{
+    CheckNTErrors(data != NULL, "The vocabulary is not loaded");
+    output.assign((const char*)data, pool + data->poolSize);
+}
+
+/*
+get the id of a token
+>> token - the token (not necessarily null-terminated)
+>> len - length of the token
+<< return - the id (-1 if the token is not in the vocabulary)
+*/
+int Vocab::GetID(const char* token, size_t len) const
+{
+    int mask = data->bucketNum - 1;
+    uint64_t b = HashToken(token, len) & mask;
+    for (int id = buckets[b]; id >= 0; b = (b + 1) & mask, id = buckets[b]) {
+        if (offsets[id + 1] - offsets[id] == len && memcmp(pool + offsets[id], token, len) == 0)
+            return id;
+    }
+    return -1;
+}
+
+/*
+get the id of a token
+>> token - the token
+<< return - the id (-1 if the token is not in the vocabulary)
+*/
+int Vocab::GetID(const string& token) const
+{
+    return GetID(token.data(), token.size());
+}
+
+/*
+check whether an id is in the vocabulary
+>> id - the id
+<< return - whether the id has a token (the ids before sosID have empty tokens)
+*/
+bool Vocab::HasID(int id) const
+{
+    return id >= 0 && id < data->idNum && (id < data->sosID || offsets[id + 1] > offsets[id]);
+}
+
+/*
+get the token of an id
+>> id - the id
+<< return - the token (empty if the id is not in the vocabulary)
+*/
+string Vocab::GetToken(int id) const
+{
+    if (id < 0 || id >= data->idNum)
+        return string();
+    return string(pool + offsets[id], offsets[id + 1] - offsets[id]);
+}
+
+/*
+get the token of an id without copying it
+>> id - the id
+>> len - length of the token (0 if the id is not in the vocabulary)
+<< return - the token in the string pool (not null-terminated)
+*/
+const char* Vocab::GetToken(int id, size_t* len) const
+{
+    if (id < 0 || id >= data->idNum) {
+        *len = 0;
+        return pool;
+    }
+    *len = offsets[id + 1] - offsets[id];
+    return pool + offsets[id];
+}
+
+/*
+append the tokens of a sequence to a buffer, each followed by a space.
+The tokens are copied from the string pool, and with "bpeJoin", the BPE
+separators are removed in the same pass, i.e., a token ending with "@@" is
+appended without "@@" and the space. The ids without tokens are skipped.
+>> text - the buffer
+>> ids - the token ids
+>> num - number of the ids
+>> bpeJoin - whether to join the BPE pieces
+*/
+void Vocab::AppendTokens(string& text, const int* ids, int num, bool bpeJoin) const
+{
+    for (int i = 0; i < num; i++) {
+        if (!HasID(ids[i]))
+            continue;
+
+        size_t len = 0;
+        const char* token = GetToken(ids[i], &len);
+        if (bpeJoin && len >= 2 && token[len - 2] == '@' && token[len - 1] == '@') {
+            text.append(token, len - 2);
+        }
+        else {
+            text.append(token, len);
+            text += ' ';
+        }
+    }
 }
 
 /* constructor */
@@ -96,6 +345,10 @@ Vocab::Vocab()
     padID = -1;
     unkID = -1;
     vocabSize = -1;
+    data = NULL;
+    offsets = NULL;
+    buckets = NULL;
+    pool = NULL;
 }
 
 } /* end of the nmt namespace */
@@ -23,14 +23,48 @@
 #define __VOCAB_H__
 
 #include <cstdio>
-#include <unordered_map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
 
 using namespace std;
 
 /* the nmt namespace */
 namespace nmt {
 
-/* the vocabulary class */
+/* the header of the compact form of a vocabulary */
+struct VocabDataHeader
+{
+    /* the magic number */
+    char magic[4];
+
+    /* size of the vocabulary */
+    int32_t vocabSize;
+
+    /* the first id of the tokens */
+    int32_t sosID;
+
+    /* number of ids (the maximum id + 1) */
+    int32_t idNum;
+
+    /* number of buckets of the hash index (a power of 2) */
+    int32_t bucketNum;
+
+    /* size of the string pool */
+    uint32_t poolSize;
+};
+
+/*
+the vocabulary class. A vocabulary is kept in the compact form:
+    VocabDataHeader
+    uint32_t offsets[idNum + 1]  (the token of id i is pool[offsets[i], offsets[i + 1]))
+    int32_t buckets[bucketNum]   (the ids in an open-addressing hash index, -1 for empty)
+    char pool[poolSize]          (the tokens without separators)
+A vocabulary of a model bundle is used in place (e.g., in a mapped file), so
+loading it takes no time, and a vocabulary file is converted to this form at
+loading. A token is looked up with one hash and no allocation.
+*/
 struct Vocab
 {
     /* id of start-of-sequence token */
@@ -48,11 +82,15 @@ struct Vocab
     /* size of the vocabulary */
     int vocabSize;
 
-    /* a dict that maps tokens to ids */
-    unordered_map<string, int> token2id;
+    /* the compact form */
+    const VocabDataHeader* data;
+    const uint32_t* offsets;
+    const int32_t* buckets;
+    const char* pool;
 
-    /* a dict that maps ids to words */
-    unordered_map<int, string> id2token;
+    /* the data of the compact form if it is built from a vocabulary file
+       (it is shared by the copies of the vocabulary) */
+    shared_ptr<vector<char>> buf;
 
     /* set ids for special tokens */
     void SetSpecialID(int sos, int eos, int pad, int unk);
@@ -66,6 +104,30 @@ struct Vocab
     /* copy data from another vocab */
     void CopyFrom(const Vocab& v);
 
+    /* load a vocabulary in the compact form */
+    bool LoadCompact(const char* compact, size_t size);
+
+    /* dump the vocabulary in the compact form */
+    void DumpCompact(vector<char>& output) const;
+
+    /* get the id of a token (-1 if it is not in the vocabulary) */
+    int GetID(const char* token, size_t len) const;
+
+    /* get the id of a token (-1 if it is not in the vocabulary) */
+    int GetID(const string& token) const;
+
+    /* check whether an id is in the vocabulary */
+    bool HasID(int id) const;
+
+    /* get the token of an id (empty if it is not in the vocabulary) */
+    string GetToken(int id) const;
+
+    /* get the token of an id in the string pool (not null-terminated) */
+    const char* GetToken(int id, size_t* len) const;
+
+    /* append the tokens of a sequence to a buffer, each followed by a space */
+    void AppendTokens(string& text, const int* ids, int num, bool bpeJoin) const;
+
     /* constructor */
     Vocab();
 };
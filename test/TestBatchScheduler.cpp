@@ -0,0 +1,225 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the policy of the batch scheduler (PendingQueue): the waiting
+ * sentences are dispatched by priority and then by deadline, those with
+ * passed deadlines or invalid ids are dropped, and a group is dispatched
+ * when it fills a batch or when the first sentence should be served.
+ */
+
+#include <cstdio>
+#include <vector>
+#include "../source/nmt/service/BatchScheduler.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/*
+make a waiting sentence
+>> request - the request
+>> index - index of the sentence in the request
+>> len - number of the source tokens (ids 0, 1, ...)
+>> prefixID - the id of a one-token prefix (-1 for no prefix)
+<< return - the sentence
+*/
+static PendingSentence MakeSentence(ServiceRequest* request, int index, int len, int prefixID = -1)
+{
+    IntList* src = new IntList(len);
+    for (int i = 0; i < len; i++)
+        src->Add(i);
+
+    IntList* prefix = NULL;
+    if (prefixID >= 0) {
+        prefix = new IntList(1);
+        prefix->Add(prefixID);
+    }
+
+    PendingSentence sentence;
+    sentence.request = request;
+    sentence.index = index;
+    sentence.sample = new Sample(src, prefix);
+    return sentence;
+}
+
+/*
+release the samples of sentences
+>> sentences - the sentences
+*/
+static void DeleteSamples(vector<PendingSentence>& sentences)
+{
+    for (size_t i = 0; i < sentences.size(); i++)
+        delete sentences[i].sample;
+    sentences.clear();
+}
+
+/* the sentences are dispatched by priority, then by deadline, then by arrival */
+static void TestOrder()
+{
+    ServiceRequest low(2, 0, 0);
+    ServiceRequest high(1, 5, 0);
+    ServiceRequest urgent(1, 0, 10000);
+    ServiceRequest later(1, 0, 60000);
+    ServiceRequest middle(1, 2, 0);
+
+    PendingQueue queue;
+    queue.Push(MakeSentence(&low, 0, 3));
+    queue.Push(MakeSentence(&later, 0, 3));
+    queue.Push(MakeSentence(&high, 0, 3));
+    queue.Push(MakeSentence(&low, 1, 3));
+    queue.Push(MakeSentence(&urgent, 0, 3));
+    queue.Push(MakeSentence(&middle, 0, 3));
+    CHECK(queue.Size() == 6);
+
+    vector<PendingSentence> group;
+    queue.Pop(2, group);
+    CHECK(group.size() == 2);
+    CHECK(group[0].request == &high && group[1].request == &middle);
+    CHECK(queue.Size() == 4);
+    DeleteSamples(group);
+
+    /* a request of a higher priority submitted later goes first */
+    ServiceRequest newer(1, 1, 0);
+    queue.Push(MakeSentence(&newer, 0, 3));
+
+    queue.Pop(10, group);
+    CHECK(group.size() == 5);
+    if (group.size() == 5) {
+        CHECK(group[0].request == &newer);
+        CHECK(group[1].request == &urgent && group[2].request == &later);
+        CHECK(group[3].request == &low && group[3].index == 0);
+        CHECK(group[4].request == &low && group[4].index == 1);
+    }
+    CHECK(queue.Size() == 0);
+    DeleteSamples(group);
+}
+
+/* the sentences with passed deadlines are dropped, and the others are kept in order */
+static void TestDeadline()
+{
+    ServiceRequest expired(1, 9, 0.001F);
+    ServiceRequest unlimited(2, 0, 0);
+    ServiceRequest future(1, 0, 60000);
+
+    CHECK(unlimited.deadline == chrono::steady_clock::time_point::max());
+    CHECK(future.deadline > future.arrival);
+
+    PendingQueue queue;
+    queue.Push(MakeSentence(&unlimited, 0, 2));
+    queue.Push(MakeSentence(&expired, 0, 40));
+    queue.Push(MakeSentence(&future, 0, 2));
+    queue.Push(MakeSentence(&unlimited, 1, 2));
+
+    /* the dispatch time is the earliest deadline or the end of the wait */
+    CHECK(queue.GetDispatchTime(1000.0F) == expired.deadline);
+    CHECK(PendingQueue().GetDispatchTime(5.0F) == chrono::steady_clock::time_point::max());
+
+    /* the long sentence fills the batch by tokens until it is dropped */
+    CHECK(queue.IsBatchFull(10, 40 * 4, 1));
+
+    vector<PendingSentence> dropped;
+    queue.DropExpired(expired.deadline, dropped);
+    CHECK(dropped.size() == 1 && dropped[0].request == &expired);
+    CHECK(queue.Size() == 3);
+    CHECK(!queue.IsBatchFull(10, 40 * 4, 1));
+    DeleteSamples(dropped);
+
+    /* nothing else is passed yet */
+    queue.DropExpired(future.deadline - chrono::milliseconds(1), dropped);
+    CHECK(dropped.empty());
+    CHECK(queue.GetDispatchTime(1000.0F) == unlimited.arrival + chrono::milliseconds(1000));
+
+    queue.DropExpired(future.deadline, dropped);
+    CHECK(dropped.size() == 1 && dropped[0].request == &future);
+    DeleteSamples(dropped);
+
+    vector<PendingSentence> group;
+    queue.Pop(10, group);
+    CHECK(group.size() == 2 && group[0].index == 0 && group[1].index == 1);
+    DeleteSamples(group);
+}
+
+/* a batch is full by the number of sentences or the number of tokens */
+static void TestBatchFull()
+{
+    ServiceRequest request(4, 0, 0);
+    PendingQueue queue;
+    CHECK(!queue.IsBatchFull(1, 100, 1));
+
+    queue.Push(MakeSentence(&request, 0, 5));
+    queue.Push(MakeSentence(&request, 1, 9));
+    queue.Push(MakeSentence(&request, 2, 2));
+
+    /* 3 sentences of at most 9 tokens with a beam of 4 */
+    CHECK(queue.IsBatchFull(3, 1000, 4));
+    CHECK(!queue.IsBatchFull(4, 1000, 4));
+    CHECK(queue.IsBatchFull(4, 3 * 9 * 4, 4));
+    CHECK(!queue.IsBatchFull(4, 3 * 9 * 4 + 1, 4));
+
+    /* the maximum length is updated when the longest sentence is taken */
+    vector<PendingSentence> group;
+    queue.Pop(2, group);
+    CHECK(queue.Size() == 1);
+    CHECK(queue.IsBatchFull(4, 2, 1) && !queue.IsBatchFull(4, 3, 1));
+    DeleteSamples(group);
+    queue.Pop(1, group);
+    DeleteSamples(group);
+}
+
+/* the sentences with ids out of the vocabularies are dropped */
+static void TestInvalid()
+{
+    ServiceRequest request(3, 0, 0);
+    PendingQueue queue;
+    queue.Push(MakeSentence(&request, 0, 4));
+    queue.Push(MakeSentence(&request, 1, 8));
+    queue.Push(MakeSentence(&request, 2, 2, 6));
+
+    /* the source ids are 0-3 and the prefix id is 2 */
+    PendingSentence single = MakeSentence(&request, 0, 4, 2);
+    CHECK(PendingQueue::IsValid(single.sample, 4, 3));
+    CHECK(!PendingQueue::IsValid(single.sample, 3, 3));
+    CHECK(!PendingQueue::IsValid(single.sample, 4, 2));
+    delete single.sample;
+
+    vector<PendingSentence> dropped;
+    queue.DropInvalid(8, 7, dropped);
+    CHECK(dropped.empty());
+
+    queue.DropInvalid(5, 6, dropped);
+    CHECK(dropped.size() == 2);
+    if (dropped.size() == 2)
+        CHECK(dropped[0].index == 1 && dropped[1].index == 2);
+    CHECK(queue.Size() == 1);
+    DeleteSamples(dropped);
+
+    vector<PendingSentence> group;
+    queue.Pop(10, group);
+    CHECK(group.size() == 1 && group[0].index == 0);
+    DeleteSamples(group);
+}
+
+int main()
+{
+    TestOrder();
+    TestDeadline();
+    TestBatchFull();
+    TestInvalid();
+
+    return FinishTests();
+}
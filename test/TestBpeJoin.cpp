@@ -0,0 +1,92 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the output text of the translations (Vocab::AppendTokens), which
+ * is checked byte by byte with and without "bpejoin".
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include "../source/nmt/translate/Vocab.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/* the tokens of the test vocabulary, where the ids 0-2 are special ones */
+static const int SOS_ID = 3;
+static const int VOCAB_SIZE = 10;
+static const char* TOKENS[] = { "", "", "", "hel@@", "lo", "wor@@", "ld", "a@@", "@@", "x@" };
+
+/*
+get the text of a sequence
+>> v - the vocabulary
+>> ids - the token ids
+>> num - number of the ids
+>> bpeJoin - whether to join the BPE pieces
+<< return - the text appended to "|"
+*/
+static string GetText(const Vocab& v, const int* ids, int num, bool bpeJoin)
+{
+    string text = "|";
+    v.AppendTokens(text, ids, num, bpeJoin);
+    return text;
+}
+
+int main()
+{
+    const string vocabFN = "TestBpeJoin.vocab";
+    ofstream f(vocabFN, ios::out);
+    f << VOCAB_SIZE << "\t" << SOS_ID << "\n";
+    for (int i = SOS_ID; i < VOCAB_SIZE; i++)
+        f << TOKENS[i] << "\t" << i << "\n";
+    f.close();
+
+    Vocab v;
+    v.Load(vocabFN);
+    remove(vocabFN.c_str());
+
+    /* hel@@ lo wor@@ ld */
+    const int words[] = { 3, 4, 5, 6 };
+    CHECK(GetText(v, words, 4, true) == "|hello world ");
+    CHECK(GetText(v, words, 4, false) == "|hel@@ lo wor@@ ld ");
+
+    /* a trailing piece is joined with nothing */
+    const int trailing[] = { 4, 7 };
+    CHECK(GetText(v, trailing, 2, true) == "|lo a");
+    CHECK(GetText(v, trailing, 2, false) == "|lo a@@ ");
+
+    /* "@@" alone is an empty piece, and "x@" is not a piece */
+    const int separators[] = { 8, 9, 4 };
+    CHECK(GetText(v, separators, 3, true) == "|x@ lo ");
+    CHECK(GetText(v, separators, 3, false) == "|@@ x@ lo ");
+
+    /* the ids out of the vocabulary are skipped */
+    const int invalid[] = { -1, 4, VOCAB_SIZE, 6 };
+    CHECK(GetText(v, invalid, 4, true) == "|lo ld ");
+
+    /* the text is appended to the buffer */
+    string text;
+    v.AppendTokens(text, words, 2, true);
+    v.AppendTokens(text, words + 2, 2, true);
+    CHECK(text == "hello world ");
+    CHECK(GetText(v, words, 0, true) == "|");
+
+    return FinishTests();
+}
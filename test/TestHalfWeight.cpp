@@ -0,0 +1,133 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the FP16 weights: the conversion between FP32 and FP16, and the
+ * GEMM on several threads, whose pool of workers grows from call to call
+ * and should give the same output as the GEMM on a single thread.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "../source/nmt/submodel/HalfWeight.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/*
+fill an array with random values in [-1, 1)
+>> values - the array
+>> seed - the seed
+*/
+static void FillRandom(vector<float>& values, unsigned int seed)
+{
+    for (size_t i = 0; i < values.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        values[i] = (float)((seed >> 16) % 1000) / 500.0F - 1.0F;
+    }
+}
+
+/* the conversion rounds to the nearest FP16 value and back exactly */
+static void TestConversion()
+{
+    const float values[] = { 0.0F, -0.0F, 1.0F, -2.5F, 65504.0F, 1e6F, 1e-8F, 0.1F, 3.14159F };
+    const int num = sizeof(values) / sizeof(values[0]);
+
+    vector<unsigned short> half(num);
+    vector<float> back(num);
+    FloatToHalf(values, half.data(), num);
+    HalfToFloat(half.data(), back.data(), num);
+
+    CHECK(back[0] == 0.0F && back[1] == 0.0F);
+    CHECK(back[2] == 1.0F && back[3] == -2.5F && back[4] == 65504.0F);
+    CHECK(std::isinf(back[5]));
+    CHECK(back[6] == 0.0F);
+    CHECK(fabs(back[7] - 0.1F) < 1e-4F && fabs(back[8] - 3.14159F) < 2e-3F);
+
+    /* the FP16 values are converted back to FP32 exactly */
+    vector<float> again(num);
+    vector<unsigned short> half2(num);
+    FloatToHalf(back.data(), half2.data(), num);
+    HalfToFloat(half2.data(), again.data(), num);
+    CHECK(half == half2);
+}
+
+/*
+check y = x * w + b on a number of threads against a single thread and
+against the product in double precision
+>> m - number of rows of the output
+>> k - the inner dimension
+>> n - number of columns of the output
+>> threadNums - the numbers of threads of the successive calls
+>> callNum - number of the calls
+*/
+static void TestGemm(int m, int k, int n, const int* threadNums, int callNum)
+{
+    vector<float> x((size_t)m * k);
+    vector<float> wf((size_t)k * n);
+    vector<float> b(n);
+    FillRandom(x, 1);
+    FillRandom(wf, 2);
+    FillRandom(b, 3);
+
+    vector<unsigned short> w(wf.size());
+    FloatToHalf(wf.data(), w.data(), wf.size());
+    HalfToFloat(w.data(), wf.data(), wf.size());
+
+    vector<float> y1((size_t)m * n);
+    MulHalf(x.data(), w.data(), b.data(), y1.data(), m, k, n, 1);
+
+    double maxError = 0;
+    for (int i = 0; i < m; i++) {
+        for (int j = 0; j < n; j++) {
+            double sum = b[j];
+            for (int p = 0; p < k; p++)
+                sum += (double)x[(size_t)i * k + p] * wf[(size_t)p * n + j];
+            double error = fabs(sum - y1[(size_t)i * n + j]);
+            if (error > maxError)
+                maxError = error;
+        }
+    }
+    CHECK(maxError < 1e-3);
+
+    for (int c = 0; c < callNum; c++) {
+        vector<float> y((size_t)m * n, -1.0F);
+        MulHalf(x.data(), w.data(), b.data(), y.data(), m, k, n, threadNums[c]);
+        CHECK(y == y1);
+    }
+}
+
+int main()
+{
+    TestConversion();
+
+    /* the pool grows over the calls (the worker threads added by a call
+       should not run the jobs before it), and shrinking calls reuse it */
+    const int threadNums[] = { 2, 2, 3, 5, 6, 2, 8, 4, 8, 1, 7 };
+    const int callNum = sizeof(threadNums) / sizeof(threadNums[0]);
+    TestGemm(5, 64, 1024, threadNums, callNum);
+    TestGemm(9, 33, 1000, threadNums, callNum);
+
+    /* many small GEMMs on the grown pool */
+    const int repeated[] = { 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8 };
+    for (int i = 0; i < 20; i++)
+        TestGemm(3, 16, 520, repeated, sizeof(repeated) / sizeof(repeated[0]));
+
+    return FinishTests();
+}
@@ -0,0 +1,50 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The harness of the unit tests. A test is a program of its own (one for
+ * each file in this folder) that runs its checks with CHECK, keeps going
+ * after a failed check, and returns FinishTests() from main, which is
+ * nonzero if any check failed, as ctest expects.
+ */
+
+#ifndef __TESTHARNESS_H__
+#define __TESTHARNESS_H__
+
+#include <cstdio>
+
+/* the number of failed checks */
+static int testFailNum = 0;
+
+/* check a condition, and report it (without stopping) if it does not hold */
+#define CHECK(x) { if (!(x)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); testFailNum++; } }
+
+/*
+report the result of the checks
+<< return - the exit code of the test (0 if all checks passed)
+*/
+static inline int FinishTests()
+{
+    if (testFailNum > 0) {
+        fprintf(stderr, "%d checks failed\n", testFailNum);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
+
+#endif /* __TESTHARNESS_H__ */
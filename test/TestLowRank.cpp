@@ -0,0 +1,162 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the low-rank factorization (FactorizeMatrix), which is checked
+ * on matrices of known ranks and singular values, with both the Gram
+ * matrix of the columns (rows >= cols) and that of the rows (rows < cols).
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "../source/nmt/submodel/LowRank.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/*
+make a matrix of a given rank, i.e., the product of two random matrices
+>> rows - number of rows
+>> cols - number of columns
+>> rank - the rank
+<< return - the matrix (rows x cols, row-major)
+*/
+static vector<float> MakeLowRankMatrix(int rows, int cols, int rank)
+{
+    unsigned int seed = 1;
+    vector<float> p((size_t)rows * rank);
+    vector<float> q((size_t)rank * cols);
+    for (size_t i = 0; i < p.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        p[i] = (float)((seed >> 16) % 1000) / 500.0F - 1.0F;
+    }
+    for (size_t i = 0; i < q.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        q[i] = (float)((seed >> 16) % 1000) / 500.0F - 1.0F;
+    }
+
+    vector<float> w((size_t)rows * cols, 0);
+    for (int i = 0; i < rows; i++) {
+        for (int k = 0; k < rank; k++) {
+            for (int j = 0; j < cols; j++)
+                w[(size_t)i * cols + j] += p[(size_t)i * rank + k] * q[(size_t)k * cols + j];
+        }
+    }
+    return w;
+}
+
+/*
+get the relative error of a factorization, i.e., |W - U * V| / |W|
+>> w - the matrix
+>> u - the first factor (rows x r)
+>> v - the second factor (r x cols)
+>> rows - number of rows
+>> cols - number of columns
+>> r - the rank
+<< return - the relative error in the Frobenius norm
+*/
+static double GetError(const vector<float>& w, const vector<float>& u, const vector<float>& v,
+                       int rows, int cols, int r)
+{
+    double diff = 0;
+    double norm = 0;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            double sum = 0;
+            for (int k = 0; k < r; k++)
+                sum += (double)u[(size_t)i * r + k] * v[(size_t)k * cols + j];
+            double x = w[(size_t)i * cols + j];
+            diff += (x - sum) * (x - sum);
+            norm += x * x;
+        }
+    }
+    return sqrt(diff / norm);
+}
+
+/* a matrix of a low rank is recovered with the rank chosen by the energy */
+static void TestReconstruction(int rows, int cols)
+{
+    vector<float> w = MakeLowRankMatrix(rows, cols, 3);
+    vector<float> u;
+    vector<float> v;
+    double kept = 0;
+
+    int r = FactorizeMatrix(w.data(), rows, cols, 0, 0.9999F, u, v, &kept);
+    CHECK(r == 3);
+    CHECK(u.size() == (size_t)rows * r);
+    CHECK(v.size() == (size_t)r * cols);
+    CHECK(kept > 0.9999);
+    CHECK(GetError(w, u, v, rows, cols, r) < 1e-4);
+}
+
+/* the rank is the smallest one that keeps the energy */
+static void TestRankByEnergy(int rows, int cols)
+{
+    /* the singular values are 4, 3, 2 and 1, so the energies
+       (the squares) are 16, 9, 4 and 1 of 30 in total */
+    const float values[] = { 4, 3, 2, 1 };
+    vector<float> w((size_t)rows * cols, 0);
+    for (int i = 0; i < 4; i++)
+        w[(size_t)i * cols + i] = values[i];
+
+    vector<float> u;
+    vector<float> v;
+    double kept = 0;
+
+    CHECK(FactorizeMatrix(w.data(), rows, cols, 0, 0.5F, u, v, &kept) == 1);
+    CHECK(fabs(kept - 16.0 / 30) < 1e-6);
+    CHECK(FactorizeMatrix(w.data(), rows, cols, 0, 0.8F, u, v, &kept) == 2);
+    CHECK(fabs(kept - 25.0 / 30) < 1e-6);
+    CHECK(FactorizeMatrix(w.data(), rows, cols, 0, 0.95F, u, v, &kept) == 3);
+    CHECK(fabs(kept - 29.0 / 30) < 1e-6);
+    CHECK(GetError(w, u, v, rows, cols, 3) < sqrt(1.0 / 30) + 1e-4);
+}
+
+/* a rank given explicitly is used as is, unless it saves no computation */
+static void TestGivenRank(int rows, int cols)
+{
+    vector<float> w = MakeLowRankMatrix(rows, cols, 12);
+    vector<float> u;
+    vector<float> v;
+
+    int r = FactorizeMatrix(w.data(), rows, cols, 5, 0, u, v);
+    CHECK(r == 5);
+    CHECK(u.size() == (size_t)rows * 5);
+    CHECK(v.size() == (size_t)5 * cols);
+
+    /* r * (rows + cols) >= rows * cols */
+    int large = rows * cols / (rows + cols) + 1;
+    u.clear();
+    v.clear();
+    CHECK(FactorizeMatrix(w.data(), rows, cols, large, 0, u, v) == 0);
+    CHECK(u.empty() && v.empty());
+}
+
+int main()
+{
+    /* the Gram matrix of the columns and that of the rows */
+    TestReconstruction(40, 30);
+    TestReconstruction(30, 40);
+    TestRankByEnergy(20, 16);
+    TestRankByEnergy(16, 20);
+    TestGivenRank(40, 30);
+    TestGivenRank(30, 40);
+
+    return FinishTests();
+}
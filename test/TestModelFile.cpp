@@ -0,0 +1,231 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the mapped model format: a file written by ModelFile::Write is
+ * opened with the same configurations, parameters and sections, and a
+ * truncated or corrupted file is rejected.
+ */
+
+#include <cstdio>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../source/nmt/ModelFile.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/* the parameters of the test file */
+static const int PARAM_NUM = 3;
+static const char* NAMES[] = { "encoder.embedding.w", "decoder.layer0.ffn.w1", "output.b" };
+static const int ORDERS[] = { 2, 2, 1 };
+static const int DIMS[][2] = { { 7, 5 }, { 5, 13 }, { 3, 0 } };
+static const int UNIT_SIZES[] = { 4, 2, 4 };
+
+/*
+read a file
+>> fn - path to the file
+<< return - the content
+*/
+static vector<char> ReadFile(const string& fn)
+{
+    ifstream f(fn, ios::in | ios::binary);
+    return vector<char>((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+}
+
+/*
+write a file
+>> fn - path to the file
+>> content - the content
+*/
+static void WriteFile(const string& fn, const vector<char>& content)
+{
+    ofstream f(fn, ios::out | ios::binary);
+    f.write(content.data(), content.size());
+}
+
+/*
+write the test file
+>> fn - path to the file
+>> params - the data of the parameters (the output)
+>> sections - the data of the sections (the output)
+*/
+static void WriteModel(const string& fn, vector<vector<char>>& params, vector<char>* sections)
+{
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    for (int i = 0; i < MODEL_BOOL_NUM; i++)
+        header.bools[i] = i % 3 == 0;
+    for (int i = 0; i < MODEL_INT_NUM; i++)
+        header.ints[i] = i * 7 - 5;
+
+    vector<ModelParamEntry> entries(PARAM_NUM);
+    vector<const char*> data(PARAM_NUM);
+    params.resize(PARAM_NUM);
+    unsigned int seed = 1;
+    for (int i = 0; i < PARAM_NUM; i++) {
+        ModelParamEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+        strcpy(entry.name, NAMES[i]);
+        entry.dataType = i;
+        entry.unitSize = UNIT_SIZES[i];
+        entry.order = ORDERS[i];
+        uint64_t unitNum = 1;
+        for (int d = 0; d < ORDERS[i]; d++) {
+            entry.dims[d] = DIMS[i][d];
+            unitNum *= DIMS[i][d];
+        }
+        entry.size = unitNum * UNIT_SIZES[i];
+
+        params[i].resize(entry.size);
+        for (size_t j = 0; j < params[i].size(); j++) {
+            seed = seed * 1103515245 + 12345;
+            params[i][j] = (char)(seed >> 16);
+        }
+        data[i] = params[i].data();
+    }
+
+    const char vocab[] = "a compact vocabulary";
+    const int32_t heads[] = { 8, 6, 4 };
+    sections[MODEL_SECTION_SRC_VOCAB].assign(vocab, vocab + sizeof(vocab));
+    sections[MODEL_SECTION_HEADS].assign((const char*)heads, (const char*)heads + sizeof(heads));
+
+    CHECK(ModelFile::Write(fn.c_str(), header, entries, data, sections));
+}
+
+/* the file is opened with what is written */
+static void TestRoundTrip(const string& fn)
+{
+    vector<vector<char>> params;
+    vector<char> sections[MODEL_SECTION_NUM];
+    WriteModel(fn, params, sections);
+
+    CHECK(ModelFile::IsModelFile(fn.c_str()));
+
+    ModelFile file;
+    CHECK(file.Open(fn.c_str()));
+    if (file.header == NULL)
+        return;
+
+    CHECK(file.header->version == MODEL_VERSION);
+    CHECK(file.header->paramNum == PARAM_NUM);
+    for (int i = 0; i < MODEL_BOOL_NUM; i++)
+        CHECK(file.header->bools[i] == (i % 3 == 0));
+    for (int i = 0; i < MODEL_INT_NUM; i++)
+        CHECK(file.header->ints[i] == i * 7 - 5);
+
+    /* the parameters are found by their names and aligned */
+    for (int i = PARAM_NUM - 1; i >= 0; i--) {
+        int index = file.Find(NAMES[i]);
+        CHECK(index == i);
+        if (index < 0)
+            continue;
+        const ModelParamEntry& entry = file.entries[index];
+        CHECK(entry.dataType == i && entry.unitSize == UNIT_SIZES[i] && entry.order == ORDERS[i]);
+        for (int d = 0; d < ORDERS[i]; d++)
+            CHECK(entry.dims[d] == DIMS[i][d]);
+        CHECK(entry.size == params[i].size());
+        CHECK(entry.offset % MODEL_ALIGN == 0);
+        CHECK(memcmp(file.GetData(index), params[i].data(), params[i].size()) == 0);
+        CHECK(file.Verify(index));
+    }
+    CHECK(file.Find("decoder.layer0.ffn") == -1);
+
+    for (int i = 0; i < MODEL_SECTION_NUM; i++) {
+        size_t size = 1;
+        const char* data = file.GetSection((ModelSectionType)i, &size);
+        CHECK(size == sections[i].size());
+        CHECK(sections[i].empty() ? data == NULL : memcmp(data, sections[i].data(), size) == 0);
+    }
+}
+
+/* a truncated or corrupted file is rejected */
+static void TestCorrupted(const string& fn)
+{
+    vector<vector<char>> params;
+    vector<char> sections[MODEL_SECTION_NUM];
+    WriteModel(fn, params, sections);
+    const vector<char> content = ReadFile(fn);
+
+    ModelFileHeader header;
+    memcpy(&header, content.data(), sizeof(header));
+    ModelFile file;
+
+    /* truncated */
+    WriteFile(fn, vector<char>(content.begin(), content.end() - 1));
+    CHECK(!file.Open(fn.c_str()));
+    WriteFile(fn, vector<char>(content.begin(), content.begin() + sizeof(ModelFileHeader) - 1));
+    CHECK(!file.Open(fn.c_str()));
+
+    /* a changed header or parameter table */
+    vector<char> broken(content);
+    broken[offsetof(ModelFileHeader, ints)] ^= 1;
+    WriteFile(fn, broken);
+    CHECK(!file.Open(fn.c_str()));
+    broken = content;
+    broken[header.tableOffset + offsetof(ModelParamEntry, dims)] ^= 1;
+    WriteFile(fn, broken);
+    CHECK(!file.Open(fn.c_str()));
+
+    /* a changed section is checked at opening */
+    broken = content;
+    broken[header.sections[MODEL_SECTION_HEADS].offset] ^= 1;
+    WriteFile(fn, broken);
+    CHECK(!file.Open(fn.c_str()));
+
+    /* a changed parameter is found by Verify() */
+    broken = content;
+    ModelParamEntry entry;
+    memcpy(&entry, &content[header.tableOffset + sizeof(ModelParamEntry)], sizeof(entry));
+    broken[entry.offset + entry.size - 1] ^= 1;
+    WriteFile(fn, broken);
+    CHECK(file.Open(fn.c_str()));
+    CHECK(file.Verify(0) && !file.Verify(1) && file.Verify(2));
+    file.Close();
+
+    /* an offset beyond the file, with the checksums updated */
+    broken = content;
+    entry.offset = ~uint64_t(0) / MODEL_ALIGN * MODEL_ALIGN;
+    memcpy(&broken[header.tableOffset + sizeof(ModelParamEntry)], &entry, sizeof(entry));
+    header.tableChecksum = ModelFile::Checksum(&broken[header.tableOffset], sizeof(ModelParamEntry) * PARAM_NUM);
+    header.headerChecksum = ModelFile::Checksum(&header, offsetof(ModelFileHeader, headerChecksum));
+    memcpy(&broken[0], &header, sizeof(header));
+    WriteFile(fn, broken);
+    CHECK(!file.Open(fn.c_str()));
+
+    /* not a model file */
+    broken = content;
+    broken[0] = 'X';
+    WriteFile(fn, broken);
+    CHECK(!ModelFile::IsModelFile(fn.c_str()));
+    CHECK(!file.Open(fn.c_str()));
+}
+
+int main()
+{
+    const string modelFN = "TestModelFile.model";
+
+    TestRoundTrip(modelFN);
+    TestCorrupted(modelFN);
+    remove(modelFN.c_str());
+
+    return FinishTests();
+}
@@ -0,0 +1,141 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the LRU cache of translations: the most recently used entries
+ * are kept, and the least recently used ones are evicted when it is full.
+ */
+
+#include <string>
+#include <vector>
+#include "../source/nmt/translate/TranslationCache.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/*
+make the configuration of the NMT system
+>> options - the options (e.g., "-cachesize 2")
+<< return - the configuration
+*/
+static NMTConfig* MakeConfig(const vector<string>& options)
+{
+    vector<const char*> argv;
+    argv.push_back("TestTranslationCache");
+    for (size_t i = 0; i < options.size(); i++)
+        argv.push_back(options[i].c_str());
+    return new NMTConfig(int(argv.size()), argv.data());
+}
+
+/*
+make a sequence of token ids
+>> first - the first id
+>> len - number of the ids (first, first + 1, ...)
+<< return - the sequence
+*/
+static IntList* MakeIDs(int first, int len)
+{
+    IntList* ids = new IntList(len);
+    for (int i = 0; i < len; i++)
+        ids->Add(first + i);
+    return ids;
+}
+
+/*
+check that a translation is found
+>> cache - the cache
+>> src - the source sequence
+>> tgt - the expected translation
+<< return - whether the translation is found and is the expected one
+*/
+static bool IsFound(TranslationCache& cache, const IntList* src, const IntList* tgt)
+{
+    IntList found(4);
+    if (!cache.Lookup(src, &found) || found.count != tgt->count)
+        return false;
+    for (int i = 0; i < found.count; i++) {
+        if (found.items[i] != tgt->items[i])
+            return false;
+    }
+    return true;
+}
+
+/* the least recently used entries are evicted */
+static void TestLRU()
+{
+    IntList* a = MakeIDs(10, 3);
+    IntList* b = MakeIDs(20, 2);
+    IntList* c = MakeIDs(30, 4);
+    IntList* ta = MakeIDs(100, 5);
+    IntList* tb = MakeIDs(200, 1);
+    IntList* tc = MakeIDs(300, 2);
+
+    NMTConfig* config = MakeConfig({ "-cachesize", "2" });
+    TranslationCache cache;
+    cache.Init(*config);
+    CHECK(cache.IsEnabled());
+
+    IntList found(4);
+    CHECK(!cache.Lookup(a, &found));
+    cache.Add(a, ta);
+    cache.Add(b, tb);
+    CHECK(IsFound(cache, a, ta));
+
+    /* b is the least recently used one */
+    cache.Add(c, tc);
+    CHECK(!cache.Lookup(b, &found));
+    CHECK(found.count == 0);
+    CHECK(IsFound(cache, a, ta));
+    CHECK(IsFound(cache, c, tc));
+
+    /* adding an entry again does not replace it, but marks it as used */
+    cache.Add(a, tb);
+    cache.Add(b, tb);
+    CHECK(IsFound(cache, a, ta));
+    CHECK(!cache.Lookup(c, &found));
+
+    CHECK(cache.GetHitNum() == 4);
+    CHECK(cache.GetMissNum() == 3);
+
+    cache.Clear();
+    CHECK(!cache.Lookup(a, &found));
+
+    /* a cache of size 0 is disabled */
+    NMTConfig* disabled = MakeConfig({});
+    TranslationCache none;
+    none.Init(*disabled);
+    CHECK(!none.IsEnabled());
+    none.Add(a, ta);
+    CHECK(!none.Lookup(a, &found));
+
+    delete config;
+    delete disabled;
+    delete a;
+    delete b;
+    delete c;
+    delete ta;
+    delete tb;
+    delete tc;
+}
+
+int main()
+{
+    TestLRU();
+
+    return FinishTests();
+}
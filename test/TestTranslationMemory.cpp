@@ -0,0 +1,163 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the translation memory: the entries are kept in its file across
+ * instances, and are found for the same model and decoding settings only.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../source/nmt/translate/TranslationMemory.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/*
+make the configuration of the NMT system
+>> options - the options (e.g., "-tm memory.tm")
+<< return - the configuration
+*/
+static NMTConfig* MakeConfig(const vector<string>& options)
+{
+    vector<const char*> argv;
+    argv.push_back("TestTranslationMemory");
+    for (size_t i = 0; i < options.size(); i++)
+        argv.push_back(options[i].c_str());
+    return new NMTConfig(int(argv.size()), argv.data());
+}
+
+/*
+make a sequence of token ids
+>> first - the first id
+>> len - number of the ids (first, first + 1, ...)
+<< return - the sequence
+*/
+static IntList* MakeIDs(int first, int len)
+{
+    IntList* ids = new IntList(len);
+    for (int i = 0; i < len; i++)
+        ids->Add(first + i);
+    return ids;
+}
+
+/*
+check that a translation is found
+>> memory - the translation memory
+>> src - the source sequence
+>> tgt - the expected translation
+<< return - whether the translation is found and is the expected one
+*/
+static bool IsFound(TranslationMemory& memory, const IntList* src, const IntList* tgt)
+{
+    IntList found(4);
+    if (!memory.Lookup(src, &found) || found.count != tgt->count)
+        return false;
+    for (int i = 0; i < found.count; i++) {
+        if (found.items[i] != tgt->items[i])
+            return false;
+    }
+    return true;
+}
+
+#ifndef _WIN32
+
+/* the entries are kept in the file, and found with the same settings only */
+static void TestMemory(const string& tmFN, const string& modelFN)
+{
+    remove(tmFN.c_str());
+    ofstream model(modelFN, ios::out | ios::binary);
+    model << "not a real model, but the translation memory hashes it";
+    model.close();
+
+    IntList* a = MakeIDs(10, 3);
+    IntList* b = MakeIDs(20, 2);
+    IntList* ta = MakeIDs(100, 5);
+    IntList* tb = MakeIDs(200, 1);
+
+    vector<string> options = { "-tm", tmFN, "-model", modelFN, "-tmslots", "8", "-tmsize", "1" };
+    NMTConfig* config = MakeConfig(options);
+
+    {
+        TranslationMemory memory;
+        memory.Init(*config);
+        CHECK(memory.IsEnabled());
+
+        IntList found(4);
+        CHECK(!memory.Lookup(a, &found));
+        memory.Add(a, ta);
+        memory.Add(b, tb);
+        memory.Add(a, tb);
+        CHECK(IsFound(memory, a, ta));
+        CHECK(IsFound(memory, b, tb));
+    }
+
+    /* another instance (e.g., another process) finds the entries in the file */
+    {
+        TranslationMemory memory;
+        memory.Init(*config);
+        CHECK(IsFound(memory, a, ta));
+        CHECK(IsFound(memory, b, tb));
+
+        /* the slots are not filled beyond 3/4 */
+        for (int i = 0; i < 10; i++) {
+            IntList* src = MakeIDs(1000 + i, 2);
+            memory.Add(src, tb);
+            delete src;
+        }
+        IntList* last = MakeIDs(1009, 2);
+        IntList found(4);
+        CHECK(!memory.Lookup(last, &found));
+        CHECK(IsFound(memory, a, ta));
+        delete last;
+    }
+
+    /* the entries of other decoding settings are not used */
+    options.push_back("-beam");
+    options.push_back("4");
+    NMTConfig* beamConfig = MakeConfig(options);
+    {
+        TranslationMemory memory;
+        memory.Init(*beamConfig);
+        IntList found(4);
+        CHECK(!memory.Lookup(a, &found));
+        CHECK(memory.GetMissNum() == 1 && memory.GetHitNum() == 0);
+    }
+
+    delete config;
+    delete beamConfig;
+    delete a;
+    delete b;
+    delete ta;
+    delete tb;
+    remove(tmFN.c_str());
+    remove(modelFN.c_str());
+}
+
+#endif
+
+int main()
+{
+#ifndef _WIN32
+    TestMemory("TestTranslationMemory.tm", "TestTranslationMemory.model");
+#endif
+
+    return FinishTests();
+}
@@ -0,0 +1,238 @@
+/* NiuTrans.NMT - an open-source neural machine translation system.
+ * Copyright (C) 2020 NiuTrans Research. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Tests of the compact vocabulary: the tokens of a vocabulary file are
+ * found by their ids and the ids by their tokens, before and after the
+ * vocabulary is dumped and loaded in the compact form, and broken data of
+ * the compact form is rejected.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "../source/nmt/translate/Vocab.h"
+#include "TestHarness.h"
+
+using namespace std;
+using namespace nmt;
+
+/* the tokens of the test vocabulary, where the ids 0-2 are special ones
+   without tokens */
+static const int SOS_ID = 3;
+static const int VOCAB_SIZE = 8;
+static const char* TOKENS[] = { "", "", "", "the", "hel@@", "lo", "a", "\xe4\xbd\xa0\xe5\xa5\xbd" };
+
+/*
+check that all tokens of a vocabulary are found
+>> v - the vocabulary
+*/
+static void CheckTokens(const Vocab& v)
+{
+    CHECK(v.vocabSize == VOCAB_SIZE);
+    CHECK(v.sosID == SOS_ID);
+
+    for (int i = SOS_ID; i < VOCAB_SIZE; i++) {
+        CHECK(v.HasID(i));
+        CHECK(v.GetID(TOKENS[i]) == i);
+        CHECK(v.GetToken(i) == TOKENS[i]);
+
+        size_t len = 0;
+        const char* token = v.GetToken(i, &len);
+        CHECK(len == strlen(TOKENS[i]) && memcmp(token, TOKENS[i], len) == 0);
+    }
+
+    /* the special ids have no tokens but are in the vocabulary */
+    for (int i = 0; i < SOS_ID; i++)
+        CHECK(v.HasID(i));
+
+    CHECK(v.GetID("") == -1);
+    CHECK(v.GetID("hel") == -1);
+    CHECK(v.GetID("hello") == -1);
+    CHECK(v.GetID("the ") == -1);
+    CHECK(v.GetID(string("lo\0", 3)) == -1);
+    CHECK(!v.HasID(-1));
+    CHECK(!v.HasID(VOCAB_SIZE));
+    CHECK(v.GetToken(-1).empty());
+    CHECK(v.GetToken(VOCAB_SIZE).empty());
+}
+
+/* a vocabulary file is loaded, saved and loaded again */
+static void TestLoad(const string& vocabFN)
+{
+    ofstream f(vocabFN, ios::out);
+    f << VOCAB_SIZE << "\t" << SOS_ID << "\n";
+
+    /* the lines are not necessarily in the order of the ids */
+    for (int i = VOCAB_SIZE - 1; i >= SOS_ID; i--)
+        f << TOKENS[i] << "\t" << i << "\n";
+    f.close();
+
+    Vocab v;
+    v.Load(vocabFN);
+    CheckTokens(v);
+
+    Vocab copy;
+    copy.CopyFrom(v);
+    CheckTokens(copy);
+
+    v.Save(vocabFN);
+    Vocab saved;
+    saved.Load(vocabFN);
+    CheckTokens(saved);
+}
+
+/* a vocabulary is dumped and loaded in the compact form */
+static void TestCompact(const string& vocabFN)
+{
+    Vocab v;
+    v.Load(vocabFN);
+
+    vector<char> compact;
+    v.DumpCompact(compact);
+
+    Vocab loaded;
+    CHECK(loaded.LoadCompact(compact.data(), compact.size()));
+    CheckTokens(loaded);
+
+    /* the data is checked before it is used */
+    Vocab invalid;
+    CHECK(!invalid.LoadCompact(compact.data(), compact.size() - 1));
+    CHECK(!invalid.LoadCompact(compact.data(), sizeof(VocabDataHeader) - 1));
+    vector<char> broken(compact);
+    broken[0] = 'X';
+    CHECK(!invalid.LoadCompact(broken.data(), broken.size()));
+}
+
+/*
+check that a broken copy of the compact form is rejected, and that the
+vocabulary is kept as it was
+>> compact - the data
+>> v - a vocabulary loaded from the data
+*/
+static void CheckRejected(const vector<char>& compact, Vocab& v)
+{
+    CHECK(!v.LoadCompact(compact.data(), compact.size()));
+    CheckTokens(v);
+}
+
+/* the offsets, buckets and sizes of the compact form are checked */
+static void TestInvalid(const string& vocabFN)
+{
+    Vocab v;
+    v.Load(vocabFN);
+    vector<char> compact;
+    v.DumpCompact(compact);
+
+    Vocab loaded;
+    CHECK(loaded.LoadCompact(compact.data(), compact.size()));
+
+    VocabDataHeader header;
+    memcpy(&header, compact.data(), sizeof(header));
+    size_t offsetsPos = sizeof(VocabDataHeader);
+    size_t bucketsPos = offsetsPos + sizeof(uint32_t) * (header.idNum + 1);
+
+    /* the offsets are not monotonic */
+    vector<char> broken(compact);
+    uint32_t offset = header.poolSize;
+    memcpy(&broken[offsetsPos + sizeof(uint32_t) * SOS_ID], &offset, sizeof(offset));
+    CheckRejected(broken, loaded);
+
+    /* an id in a bucket is not in the vocabulary */
+    int32_t largeID = header.idNum;
+    int32_t negativeID = -2;
+    int b = 0;
+    while (true) {
+        int32_t id;
+        memcpy(&id, &compact[bucketsPos + sizeof(int32_t) * b], sizeof(id));
+        if (id >= 0)
+            break;
+        b++;
+    }
+    broken = compact;
+    memcpy(&broken[bucketsPos + sizeof(int32_t) * b], &largeID, sizeof(largeID));
+    CheckRejected(broken, loaded);
+    broken = compact;
+    memcpy(&broken[bucketsPos + sizeof(int32_t) * b], &negativeID, sizeof(negativeID));
+    CheckRejected(broken, loaded);
+
+    /* no empty bucket, so a lookup of an unknown token would never end */
+    broken = compact;
+    int32_t id = SOS_ID;
+    for (int i = 0; i < header.bucketNum; i++)
+        memcpy(&broken[bucketsPos + sizeof(int32_t) * i], &id, sizeof(id));
+    CheckRejected(broken, loaded);
+
+    /* the sizes overflow or do not fit in the data */
+    VocabDataHeader large = header;
+    large.idNum = 0x7fffffff;
+    large.bucketNum = 0x40000000;
+    large.poolSize = 0xffffffff;
+    broken = compact;
+    memcpy(&broken[0], &large, sizeof(large));
+    CheckRejected(broken, loaded);
+    large = header;
+    large.poolSize = header.poolSize + 1;
+    broken = compact;
+    memcpy(&broken[0], &large, sizeof(large));
+    CheckRejected(broken, loaded);
+    large = header;
+    large.bucketNum = header.bucketNum + 1;
+    broken = compact;
+    memcpy(&broken[0], &large, sizeof(large));
+    CheckRejected(broken, loaded);
+}
+
+/* a larger vocabulary, where the tokens share the buckets of the hash index */
+static void TestLarge(const string& vocabFN)
+{
+    const int size = 5000;
+    ofstream f(vocabFN, ios::out);
+    f << size << "\t" << SOS_ID << "\n";
+    for (int i = SOS_ID; i < size; i++)
+        f << "w" << i << "@@\t" << i << "\n";
+    f.close();
+
+    Vocab v;
+    v.Load(vocabFN);
+    CHECK(v.vocabSize == size);
+
+    int wrongNum = 0;
+    for (int i = SOS_ID; i < size; i++) {
+        string token = "w" + to_string(i) + "@@";
+        if (v.GetID(token) != i || v.GetToken(i) != token)
+            wrongNum++;
+    }
+    CHECK(wrongNum == 0);
+    CHECK(v.GetID("w0@@") == -1);
+    CHECK(v.GetID("w" + to_string(size) + "@@") == -1);
+}
+
+int main()
+{
+    const string vocabFN = "TestVocab.vocab";
+
+    TestLoad(vocabFN);
+    TestCompact(vocabFN);
+    TestInvalid(vocabFN);
+    TestLarge(vocabFN);
+    remove(vocabFN.c_str());
+
+    return FinishTests();
+}